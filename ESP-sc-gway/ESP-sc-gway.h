@@ -63,6 +63,12 @@
 // device and also connect enable dio1 to detect this state. 
 #define _CAD 1
 
+// With CAD the SFs are scanned in the order of how often we received
+// messages on them. _CAD_EXPLORE is the percentage of scan cycles that 
+// still use the normal SF7 to SF12 order, so that rarely used SFs keep 
+// a fair chance. Use 100 to always scan SF7 first.
+#define _CAD_EXPLORE 10
+
 // Definitions for the admin webserver.
 // A_SERVER determines whether or not the admin webpage is included in the sketch.
 // Normally, leave it in!
@@ -78,6 +84,16 @@
 // connect with USB.
 #define A_OTA 1
 
+// Firmware update from a web server, started with the UPDATE button or with
+//	http://<gateway>/UPDATE?host=<server>&port=80&path=/fw.bin&sha=<sha256>
+// The image is downloaded in the background while the gateway keeps 
+// forwarding, and a broken download continues where it stopped. Without 
+// the sha argument the SHA-256 is read from <path>.sha256 first. The image
+// is only flashed if its SHA-256 matches, then the gateway restarts.
+#define _OTA_HOST "ota.example.com"
+#define _OTA_PORT 80
+#define _OTA_PATH "/esp-sc-gway.bin"
+
 // We support a few pin-out configurations out-of-the-box: HALLARD, COMPRESULT and TTGO ESP32.
 // If you use one of these two, just set the parameter to the right value.
 // If your pin definitions are different, update the loraModem.h file to reflect these settings.
@@ -89,6 +105,15 @@
 //	6: Other, define your own in loraModem.h
 #define _PIN_OUT 1
 
+// Number of SX127x radios connected (1 to 4). All radios share SCK, MISO and
+// MOSI but have their own select, dio and reset pins, see radioPins in 
+// loraModem.h. Radio n starts listening on the channel n after the one set,
+// so with 3 radios all 3 mandatory channels are received at the same time.
+// _TXRADIO is a radio that is only used for downlink messages. Set to -1 when
+// there is no such radio, downlink messages are then sent by radio 0.
+#define _RADIOS 1
+#define _TXRADIO -1
+
 // Gather statistics on sensor and Wifi status
 // 0= No statistics
 // 1= Keep track of messages statistics, number determined by MAX_STAT
@@ -112,6 +137,13 @@
 // NOTE: In all other cases, value 0 works for most gateways with CAD enabled
 #define _STRICT_1CH	0
 
+// Enforce the duty cycle limits of the region (EU868 and EU433) for downlink.
+// Downlink messages that would exceed the limit of their sub-band are not 
+// sent and reported to the server in the TX_ACK message.
+// The limit is kept per _DC_WINDOW seconds, 3600 is the hour of ETSI.
+#define _DUTY_CYCLE 1
+#define _DC_WINDOW 3600
+
 // Allows configuration through WifiManager AP setup. Must be 0 or 1					
 #define WIFIMANAGER 0
 
@@ -123,7 +155,20 @@
 // This section defines whether we use the gateway as a repeater
 // For his, we use another output channle as the channel (default==0) we are 
 // receiving the messages on.
+// Uplinks received on channel _ICHAN (and with _ISF if not 0) are sent again
+// on channel _OCHAN with _OSF (or the SF received if 0), _REP_DELAY mSec 
+// after reception. The same duty cycle checks as downlinks apply. If 
+// _REP_NODES has addresses, only data messages of those nodes are repeated.
+// Join requests have no address yet: they are repeated unless _REP_EUIS 
+// has DevEUIs, then only those of the listed devices.
 #define REPEATER 0
+#define _ICHAN 0							// Index in freqs[]
+#define _OCHAN 1
+#define _ISF 0
+#define _OSF 0
+#define _REP_DELAY 100
+#define _REP_NODES { 0x00000000 }			// DevAddr list, e.g. { 0x26011234, 0x26015678 }
+#define _REP_EUIS { 0x0000000000000000ULL }	// DevEUI list, e.g. { 0x0004A30B001C0530ULL }
 
 // Will we use Mutex or not?
 // +SPI is input for SPI, SPO is output for SPI
@@ -157,21 +202,37 @@
 //
 #define STAT_LOG 1
 
+// Store-and-forward of uplinks. Messages received while there is no WiFi
+// link are kept in RAM, and when that queue is full they are written to a
+// ring of files in SPIFFS instead of being dropped. If the ring is full
+// the oldest messages are dropped. When the link is back the messages are
+// sent again, one every _UPSTORE_RATE milliseconds, with their original
+// reception time. Messages older than _UPSTORE_AGE seconds are expired.
+#define _UPSTORE 1
+#define _UPSTORE_RATE 200
+#define _UPSTORE_AGE 86400
+
 
 // Name of he configfile in SPIFFs	filesystem
 // In this file we store the configuration and other relevant info that should
-// survive a reboot of the gateway		
-#define CONFIGFILE "/gwayConfig.txt"
+// survive a reboot of the gateway. The configuration is binary and written 
+// alternately to two slots <CONFIGFILE>.a and <CONFIGFILE>.b. 
+// The counters (boots, fcnt etc) are written to COUNTFILE in the same way.
+#define CONFIGFILE "/gwayConfig"
+#define COUNTFILE "/gwayCount"
 
 // Set the Server Settings (IMPORTANT)
 #define _LOCUDPPORT 1700					// UDP port of gateway! Often 1700 or 1701 is used for upstream comms
+#define _LOCNTPPORT 1123					// Local UDP port for NTP, so replies do not arrive on the gateway port
 
 // Timing
 #define _MSG_INTERVAL 15					// Reset timer in seconds
 #define _PULL_INTERVAL 55					// PULL_DATA messages to server to get downstream in milliseconds
 #define _STAT_INTERVAL 120					// Send a 'stat' message to server
 #define _NTP_INTERVAL 3600					// How often do we want time NTP synchronization
+#define _NTP_RETRY 10						// Seconds before retrying a failed NTP request
 #define _WWW_INTERVAL	60					// Number of seconds before we refresh the WWW page
+#define _DNS_TTL 3600						// Seconds before server names are resolved again
 
 // MQTT definitions, these settings should be standard for TTN
 // and need not changing
@@ -187,6 +248,20 @@
 //#define _THINGPORT <port>					// e.g. 1700
 //#define _THINGSERVER "<dns.server.com>"	// Server URL of the LoRa-udp.js handler
 
+// If your own _THINGSERVER understands it, uplinks can be sent to it in a
+// compact binary format instead of JSON (see loraModem.h). Frames received
+// within _BIN_HOLD milliseconds are sent in one datagram.
+#define _THINGBIN 0
+#define _BIN_HOLD 100
+
+// Use the LoRa Basics Station protocol over a websocket instead of the
+// Semtech UDP protocol. _LNSSERVER and _LNSPORT are the router-info endpoint
+// of the LNS, which tells us the websocket to use. Only ws:// (no TLS).
+// Default: Switched off
+#define _BSTATION 0
+#define _LNSSERVER "lns.example.com"
+#define _LNSPORT 3001
+
 // This defines whether or not we would use the gateway as 
 // as sort of backend system which decodes messages (see sensor.h file)
 #define _LOCALSERVER 0						// See server definitions for decodes
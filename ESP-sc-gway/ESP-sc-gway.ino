@@ -108,6 +108,8 @@ extern "C" {
 
 #endif//ESP_ARCH
 
+#include "bStation.h"							// Uses WiFiClient
+
 // ----------- Declaration of vars --------------
 uint8_t debug=1;								// Debug level! 0 is no msgs, 1 normal, 2 extensive
 uint8_t pdebug=0xFF;							// Allow all atterns (departments)
@@ -138,7 +140,11 @@ uint32_t cp_nb_rx_rcv;							// Number of messages received by gateway
 uint32_t cp_nb_rx_ok;							// Number of messages received OK
 uint32_t cp_nb_rx_bad;							// Number of messages received bad
 uint32_t cp_nb_rx_nocrc;						// Number of messages without CRC
-uint32_t cp_up_pkt_fwd;
+uint32_t cp_up_pkt_fwd;							// Number of messages forwarded to server
+uint32_t cp_up_dgram_sent;						// PUSH_DATA sent since last stat message
+uint32_t cp_up_ack_rcv;							// PUSH_ACK received since last stat message
+uint32_t cp_dw_dgram_rcv;						// PULL_RESP received
+uint32_t cp_nb_tx_ok;							// Downlink messages transmitted
 
 uint8_t MAC_array[6];
 
@@ -168,24 +174,68 @@ IPAddress ntpServer;							// IP address of NTP_TIMESERVER
 IPAddress ttnServer;							// IP Address of thethingsnetwork server
 IPAddress thingServer;
 
+// Names of the servers, resolved by dnsStep()
+struct dnsEntry dnsCache[] = {
+	{ NTP_TIMESERVER, &ntpServer },
+#ifdef _TTNSERVER
+	{ _TTNSERVER, &ttnServer },
+#endif
+#ifdef _THINGSERVER
+	{ _THINGSERVER, &thingServer },
+#endif
+#if _BSTATION==1
+	{ _LNSSERVER, &lnsServer },
+#endif
+};
+#define DNS_ENTRIES (sizeof(dnsCache) / sizeof(struct dnsEntry))
+
 WiFiUDP Udp;
+WiFiUDP UdpNtp;									// NTP has its own socket, see ntpStep()
 
 time_t startTime = 0;							// The time in seconds since 1970 that the server started
 												// be aware that UTP time has to succeed for meaningful values.
 												// We use this variable since millis() is reset every 50 days...
-uint32_t eventTime = 0;							// Timing of _event to change value (or not).
-uint32_t sendTime = 0;							// Time that the last message transmitted
-uint32_t doneTime = 0;							// Time to expire when CDDONE takes too long
-uint32_t statTime = 0;							// last time we sent a stat message to server
-uint32_t pulltime = 0;							// last time we sent a pull_data request to server
+uint64_t eventTime = 0;							// Timing of _event to change value (or not).
+uint64_t sendTime = 0;							// Time that the last message transmitted
+uint64_t doneTime = 0;							// Time to expire when CDDONE takes too long
+uint32_t statTime = 0;							// last time we sent a stat message to server (uptime)
+uint32_t pulltime = 0;							// last time we sent a pull_data request to server (uptime)
 //uint32_t lastTmst = 0;							// Last activity Timer
 
 #if A_SERVER==1
 uint32_t wwwtime = 0;
 #endif
-#if NTP_INTR==0
-uint32_t ntptimer = 0;
-#endif
+// NTP client. The time is kept as microseconds since 1970 (UTC) at a 
+// millis() reference and corrected for the drift of the local clock
+// between synchronizations. See ntpStep().
+#define NTP_PACKET_SIZE 48						// Fixed size of NTP record
+#define NTP_TIMEOUT 1500						// millis to wait for the reply
+enum ntp_t { N_IDLE=0, N_WAIT };
+struct ntpStat {
+	uint8_t		state;							// N_IDLE or N_WAIT
+	uint32_t	sent;							// micros() when request was sent
+	uint32_t	sentMs;							// millis() when request was sent
+	uint32_t	next;							// millis() for the next request
+	int64_t		base;							// UTC time in uSec at ref
+	uint32_t	ref;							// millis() of base
+	float		drift;							// ppm, >0 when local clock is slow
+	int32_t		offset;							// uSec, last measured offset
+	uint32_t	jitter;							// uSec, average change of offset
+	uint32_t	rtt;							// uSec, last round trip time
+	uint32_t	syncs;							// Number of successful synchronizations
+	time_t		sec;							// Last second set in the Time library
+} statNtp;
+
+// The receiver is armed first in setup(), the network services are started
+// afterwards from loop() one stage at a time. Messages received before
+// B_DONE are queued in upQueue.
+enum boot_t { B_WIFI=0, B_NET, B_TIME, B_SERV, B_DONE };
+uint8_t bootStage = B_WIFI;
+uint32_t bootTime = 0;							// millis() of last try in current stage
+uint32_t bootArmed = 0;							// millis() when the receiver was armed
+uint32_t bootFirstRx = 0;						// millis() of first received message
+uint32_t bootReady = 0;							// millis() when all services were up
+char hostname[16];								// esp8266-xxxxxx or esp32-xxxxxx
 
 #define TX_BUFF_SIZE  1024						// Upstream buffer to send to MQTT
 #define RX_BUFF_SIZE  1024						// Downstream received from MQTT
@@ -212,7 +262,8 @@ int mutexSPI = 1;
 void ICACHE_RAM_ATTR Interrupt_0();
 void ICACHE_RAM_ATTR Interrupt_1();
 
-int sendPacket(uint8_t *buf, uint8_t length);		// _txRx.ino
+int sendPacket(uint8_t *buf, uint16_t length);		// _txRx.ino
+void rxRecord(struct LoraUp *up, bool internal);	// _txRx.ino
 void setupWWW();									// _wwwServer.ino
 void SerialTime();									// _utils.ino
 static void printIP(IPAddress ipa, const char sep, String& response);	// _wwwServer.ino
@@ -220,10 +271,17 @@ static void printIP(IPAddress ipa, const char sep, String& response);	// _wwwSer
 void init_oLED();									// oLED.ino
 void acti_oLED();
 void addr_oLED();
+void msg_oLED(uint8_t *message, uint8_t len, int rssi, long snr);
+void draw_oLED();
 
 void setupOta(char *hostname);
 void initLoraModem();								// _loraModem.ino
+void radioSelect(uint8_t r);						// _loraModem.ino
+void radioSetup();									// _loraModem.ino
+void radioAttach();									// _loraModem.ino
+bool radioPending();								// _loraModem.ino
 void cadScanner();
+sf_t scanStart();									// _loraModem.ino
 void rxLoraModem();									// _loraModem.ino
 void writeRegister(uint8_t addr, uint8_t value);	// _loraModem.ino
 
@@ -231,6 +289,17 @@ void stateMachine();								// _stateMachine.ino
 
 void SerialStat(uint8_t intr);						// _utils.ino
 
+void initLog();										// _loraFiles.ino
+int flushLog();										// _loraFiles.ino
+
+int sendQueue();									// _txRx.ino
+bool upLink();										// _txRx.ino
+uint8_t upDests();									// _txRx.ino
+void initStore();									// _loraFiles.ino
+int storeUp();										// _loraFiles.ino
+void markStore(uint16_t rec, uint16_t n, uint8_t done);	// _loraFiles.ino
+bool dnsLost(IPAddress *ip);						// _WiFi.ino
+
 #if MUTEX==1
 // Forward declarations
 void ICACHE_FLASH_ATTR CreateMutux(int *mutex);
@@ -347,17 +416,62 @@ void ftoa(float f, char *val, int p) {
 	strcat(val,b);
 }
 
+// ============================================================================
+// TIME functions
+
+
+// ----------------------------------------------------------------------------
+// Monotonic 64-bit microsecond clock.
+// micros() wraps every 71.6 minutes. micros64() counts these wraps so that
+// timers can simply compare and subtract. It must be called at least once
+// per wrap, which loop() does every pass. Do not call from an interrupt.
+// The lower 32 bits are equal to micros(), which is what is used as tmst
+// in the Semtech protocol.
+// ----------------------------------------------------------------------------
+uint64_t micros64() {
+	static uint32_t last = 0;
+	static uint32_t high = 0;
+	uint32_t m = micros();
+	if (m < last) high++;							// micros() wrapped
+	last = m;
+	return( ((uint64_t)high << 32) | m );
+}
+
+
+// ----------------------------------------------------------------------------
+// Expand a 32-bit tmst (as received from the server) to the micros64() value
+// nearest to now, so timestamps just before and after a wrap are both right.
+// ----------------------------------------------------------------------------
+uint64_t tmst64(uint32_t tmst) {
+	uint64_t t = micros64();
+	return( t + (int32_t)(tmst - (uint32_t)t) );
+}
+
+
+// ----------------------------------------------------------------------------
+// Return the uSecs left until deadline t (a micros64() value), 
+// negative when the deadline has passed.
+// ----------------------------------------------------------------------------
+int64_t microsLeft(uint64_t t) {
+	return( (int64_t)(t - micros64()) );
+}
+
+
 // ============================================================================
 // NTP TIME functions
 
 
 
 // ----------------------------------------------------------------------------
-// Send the request packet to the NTP server.
-//
+// Send the request packet to the NTP server on the NTP socket.
+// The micros() value of sending is put in the transmit timestamp, the server
+// returns it as originate timestamp so we know the reply is ours.
+// Parameters:
+//	timeServerIP: Address of the NTP server
+// Returns:
+//	1 when sent, 0 on error
 // ----------------------------------------------------------------------------
 int sendNtpRequest(IPAddress timeServerIP) {
-	const int NTP_PACKET_SIZE = 48;				// Fixed size of NTP record
 	byte packetBuffer[NTP_PACKET_SIZE];
 
 	memset(packetBuffer, 0, NTP_PACKET_SIZE);	// Zeroise the buffer.
@@ -372,10 +486,22 @@ int sendNtpRequest(IPAddress timeServerIP) {
 	packetBuffer[14] = 49;
 	packetBuffer[15] = 52;	
 
+	while (UdpNtp.parsePacket() > 0) {			// Forget about late replies
+		UdpNtp.flush();
+	}
+	
+	statNtp.sent = micros();
+	statNtp.sentMs = millis();
+	packetBuffer[40] = statNtp.sent >> 24;
+	packetBuffer[41] = statNtp.sent >> 16;
+	packetBuffer[42] = statNtp.sent >>  8;
+	packetBuffer[43] = statNtp.sent;
 	
-	if (!sendUdp( (IPAddress) timeServerIP, (int) 123, packetBuffer, NTP_PACKET_SIZE)) {
-		gwayConfig.ntpErr++;
-		gwayConfig.ntpErrTime = now();
+	gwayConfig.ntps++;
+	if ((!UdpNtp.beginPacket(timeServerIP, (int) 123)) ||
+		(UdpNtp.write(packetBuffer, NTP_PACKET_SIZE) != NTP_PACKET_SIZE) ||
+		(!UdpNtp.endPacket())) 
+	{
 		return(0);	
 	}
 	return(1);
@@ -383,68 +509,192 @@ int sendNtpRequest(IPAddress timeServerIP) {
 
 
 // ----------------------------------------------------------------------------
-// Get the NTP time from one of the time servers
-// Note: As this function is called from SyncINterval in the background
-//	make sure we have no blocking calls in this function
+// Convert a 64-bit NTP timestamp (seconds and fraction since 1900) to uSec
+// since 1970.
 // ----------------------------------------------------------------------------
-time_t getNtpTime()
+int64_t ntpMicros(byte *buf) {
+	uint32_t secs = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | 
+					((uint32_t)buf[2] <<  8) |  (uint32_t)buf[3];
+	uint32_t frac = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) | 
+					((uint32_t)buf[6] <<  8) |  (uint32_t)buf[7];
+	return( ((int64_t)secs - 2208988800LL) * 1000000LL + 
+			(int64_t)(((uint64_t)frac * 1000000ULL) >> 32) );
+}
+
+
+// ----------------------------------------------------------------------------
+// Return the local estimate of UTC in uSec since 1970 at millis() value m,
+// based on the last synchronization and the drift estimate.
+// ----------------------------------------------------------------------------
+int64_t ntpLocal(uint32_t m) {
+	int64_t e = (int64_t)(uint32_t)(m - statNtp.ref) * 1000;
+	return( statNtp.base + e + (int64_t)(e * statNtp.drift / 1000000.0) );
+}
+
+
+// ----------------------------------------------------------------------------
+// Return the disciplined local time in seconds, in our timezone.
+// ----------------------------------------------------------------------------
+time_t ntpSeconds() {
+	return( (time_t)(ntpLocal(millis()) / 1000000LL) + NTP_TIMEZONES * SECS_IN_HOUR );
+}
+
+
+// ----------------------------------------------------------------------------
+// Administer a failed NTP request
+// ----------------------------------------------------------------------------
+void ntpFail() {
+	gwayConfig.ntpErr++;
+	gwayConfig.ntpErrTime = now();
+	logCounters(CNT_NTPS | CNT_NTPERR | CNT_NTPETIM);
+	statNtp.state = N_IDLE;
+	statNtp.next = millis() + (statNtp.syncs == 0 ? 2000 : _NTP_RETRY * 1000UL);
+#if DUSB>=1
+	if (( debug>=0 ) && ( pdebug & P_MAIN )) {
+		Serial.println(F("M ntpStep:: read failed"));
+	}
+#endif
+}
+
+
+// ----------------------------------------------------------------------------
+// Process the NTP reply in buf that was received at micros() t4 and millis()
+// m4. The offset is the difference between the server and our local clock
+// at the moment of reception, the round trip excludes the server processing.
+// From the offset accumulated since the last synchronization we estimate the
+// drift of the local clock. The estimate is updated with half of the measured
+// error, which filters out most of the WiFi round trip jitter.
+// Returns:
+//	1 when the reply was used, 0 if not.
+// ----------------------------------------------------------------------------
+int ntpProcess(byte *buf, uint32_t t4, uint32_t m4) {
+
+	uint32_t orig = ((uint32_t)buf[24] << 24) | ((uint32_t)buf[25] << 16) | 
+					((uint32_t)buf[26] <<  8) |  (uint32_t)buf[27];
+	if (orig != statNtp.sent) return(0);		// Not a reply to our request
+	if (((buf[0] & 0x07) != 4) || (buf[1] == 0)) return(0);	// Not a server or Kiss-o-Death
+
+	int64_t t2 = ntpMicros(buf + 32);			// Server receive time
+	int64_t t3 = ntpMicros(buf + 40);			// Server transmit time
+	int64_t rtt = (int64_t)(uint32_t)(t4 - statNtp.sent) - (t3 - t2);
+	if (rtt < 0) rtt = 0;
+	int64_t server = t3 + rtt/2;				// Server time at m4
+
+	if (statNtp.syncs > 0) {
+		int32_t offset = (int32_t)(server - ntpLocal(m4));
+		uint32_t delta = (offset > statNtp.offset ? offset - statNtp.offset : statNtp.offset - offset);
+		statNtp.jitter = (statNtp.jitter * 7 + delta) / 8;
+		statNtp.offset = offset;
+		
+		uint32_t elapsed = m4 - statNtp.ref;	// millis since last sync
+		if (elapsed > 60000) {
+			statNtp.drift += (offset * 1000.0 / elapsed) / 2;
+			if (statNtp.drift > 500) statNtp.drift = 500;
+			if (statNtp.drift < -500) statNtp.drift = -500;
+		}
+	}
+	statNtp.base = server;
+	statNtp.ref = m4;
+	statNtp.rtt = (uint32_t) rtt;
+	statNtp.syncs++;
+	
+	statNtp.sec = ntpSeconds();
+	setTime(statNtp.sec);
+	return(1);
+}
+
+
+// ----------------------------------------------------------------------------
+// NTP state machine, called from loop() and during startup.
+// In state N_IDLE a request is sent when it is time to synchronize, in 
+// N_WAIT we check whether the reply has arrived. The function never waits.
+// In between the Time library is corrected with our drift compensated clock
+// every time this clock passes to a new second.
+// Returns:
+//	1 when synchronized in this call, 0 otherwise, -1 on error
+// ----------------------------------------------------------------------------
+int ntpStep()
 {
-	gwayConfig.ntps++;
+	byte packetBuffer[NTP_PACKET_SIZE];
 	
-    if (!sendNtpRequest(ntpServer))					// Send the request for new time
-	{
-		if (( debug>=0 ) && ( pdebug & P_MAIN ))
-			Serial.println(F("M sendNtpRequest failed"));
-		return(0);
+	if (statNtp.syncs > 0) {
+		time_t s = ntpSeconds();
+		if (s != statNtp.sec) {
+			statNtp.sec = s;
+			if (now() != s) setTime(s);
+		}
 	}
 	
-	const int NTP_PACKET_SIZE = 48;					// Fixed size of NTP record
-	byte packetBuffer[NTP_PACKET_SIZE];
-	memset(packetBuffer, 0, NTP_PACKET_SIZE);		// Set buffer cntents to zero
-
-    uint32_t beginWait = millis();
-	delay(10);
-    while (millis() - beginWait < 1500) 
-	{
-		int size = Udp.parsePacket();
-		if ( size >= NTP_PACKET_SIZE ) {
+	switch (statNtp.state) {
+	
+	case N_IDLE:
+		if ((int32_t)(millis() - statNtp.next) < 0) return(0);
+		if (!sendNtpRequest(ntpServer)) {
+#if DUSB>=1
+			if (( debug>=0 ) && ( pdebug & P_MAIN ))
+				Serial.println(F("M sendNtpRequest failed"));
+#endif
+			ntpFail();
+			return(-1);
+		}
+		statNtp.state = N_WAIT;
+		return(0);
 		
-			if (Udp.read(packetBuffer, NTP_PACKET_SIZE) < NTP_PACKET_SIZE) {
-				break;
-			}
-			else {
-				// Extract seconds portion.
-				unsigned long secs;
-				secs  = packetBuffer[40] << 24;
-				secs |= packetBuffer[41] << 16;
-				secs |= packetBuffer[42] <<  8;
-				secs |= packetBuffer[43];
-				// UTC is 1 TimeZone correction when no daylight saving time
-				return(secs - 2208988800UL + NTP_TIMEZONES * SECS_IN_HOUR);
+	case N_WAIT:
+		if (UdpNtp.parsePacket() >= NTP_PACKET_SIZE) {
+			uint32_t t4 = micros();
+			uint32_t m4 = millis();
+			int len = UdpNtp.read(packetBuffer, NTP_PACKET_SIZE);
+			UdpNtp.flush();
+			if ((len == NTP_PACKET_SIZE) && ntpProcess(packetBuffer, t4, m4)) {
+				logCounters(CNT_NTPS);
+				statNtp.state = N_IDLE;
+				statNtp.next = m4 + _NTP_INTERVAL * 1000UL;
+#if DUSB>=1
+				if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+					Serial.print(F("M ntpStep:: offset="));
+					Serial.print(statNtp.offset);
+					Serial.print(F(", rtt="));
+					Serial.print(statNtp.rtt);
+					Serial.print(F(", drift="));
+					Serial.println(statNtp.drift);
+				}
+#endif
+				return(1);
 			}
-			Udp.flush();	
 		}
-		delay(100);									// Wait 100 millisecs, allow kernel to act when necessary
-    }
+		if ((millis() - statNtp.sentMs) >= NTP_TIMEOUT) {
+			ntpFail();
+			return(-1);
+		}
+		return(0);
+	}
+	return(0);
+}
 
-	Udp.flush();
-	
-	// If we are here, we could not read the time from internet
-	// So increase the counter
-	gwayConfig.ntpErr++;
-	gwayConfig.ntpErrTime = now();
-#if DUSB>=1
-	if (( debug>=0 ) && ( pdebug & P_MAIN )) {
-		Serial.println(F("M getNtpTime:: read failed"));
+
+#if NTP_INTR==1
+// ----------------------------------------------------------------------------
+// Get the NTP time from one of the time servers
+// Note: This function is called by the Time library through setSyncProvider
+//	and has to return the time, so it waits for the reply.
+// ----------------------------------------------------------------------------
+time_t getNtpTime()
+{
+	statNtp.next = millis();
+	if (ntpStep() < 0) return(0);
+	while (statNtp.state == N_WAIT) {
+		delay(10);
+		if (ntpStep() > 0) {
+			return(now());
+		}
 	}
-#endif
 	return(0); 										// return 0 if unable to get the time
 }
 
 // ----------------------------------------------------------------------------
 // Set up regular synchronization of NTP server and the local time.
 // ----------------------------------------------------------------------------
-#if NTP_INTR==1
 void setupTime() {
   setSyncProvider(getNtpTime);
   setSyncInterval(_NTP_INTERVAL);
@@ -457,261 +707,317 @@ void setupTime() {
 
 
 // ----------------------------------------------------------------------------
-// Read DOWN a package from UDP socket, can come from any server
-// Messages are received when server responds to gateway requests from LoRa nodes 
-// (e.g. JOIN requests etc.) or when server has downstream data.
-// We respond only to the server that sent us a message!
-// Note: So normally we can forget here about codes that do upstream
+// Read the datagrams waiting on the UDP socket into udpRing. Called once
+// per loop() when WiFi is connected, the datagrams are handled by readUdp().
+// When the ring is full the rest stays in the socket for the next loop().
 // Parameters:
-//	Packetsize: size of the buffer to read, as read by loop() calling function
-//
+//	<None>
 // Returns:
-//	-1 or false if not read
-//	Or number of characters read is success
-//
+//	Number of datagrams read into the ring
 // ----------------------------------------------------------------------------
-int readUdp(int packetSize)
+int udpIntake()
 {
-	uint8_t protocol;
-	uint16_t token;
-	uint8_t ident; 
-	uint8_t buff[32]; 						// General buffer to use for UDP, set to 64
-	uint8_t buff_down[RX_BUFF_SIZE];		// Buffer for downstream
-
-//	if ((WiFi.status() != WL_CONNECTED) &&& (WlanConnect(10) < 0)) {
-	if (WlanConnect(10) < 0) {
-#if DUSB>=1
-			Serial.print(F("readdUdp: ERROR connecting to WLAN"));
-			if (debug>=2) Serial.flush();
-#endif
-			Udp.flush();
-			yield();
-			return(-1);
-	}
-
-	yield();
+	int packetSize;
+	int n = 0;
 	
-	if (packetSize > RX_BUFF_SIZE) {
+	while (((uint8_t)(udpHead - udpTail) < UDPRING) && 
+		((packetSize = Udp.parsePacket()) > 0))
+	{
+		if (packetSize >= UDP_BUFSIZE) {					// Leave room for a 0
 #if DUSB>=1
-		Serial.print(F("readUDP:: ERROR package of size: "));
-		Serial.println(packetSize);
+			if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+				Serial.print(F("M udpIntake:: ERROR package of size: "));
+				Serial.println(packetSize);
+			}
 #endif
-		Udp.flush();
-		return(-1);
-	}
-  
-	// We assume here that we know the originator of the message
-	// In practice however this can be any sender!
-	if (Udp.read(buff_down, packetSize) < packetSize) {
+			statUdp.oversize++;
+			Udp.flush();
+			continue;
+		}
+		struct udpBuf *u = &udpRing[udpHead & (UDPRING-1)];
+		if (Udp.read(u->data, packetSize) < packetSize) {
 #if DUSB>=1
-		Serial.println(F("A readUsb:: Reading less chars"));
-		return(-1);
+			Serial.println(F("A udpIntake:: Reading less chars"));
 #endif
+			statUdp.dropped++;
+			Udp.flush();
+			continue;
+		}
+		u->size = packetSize;
+		u->ip = Udp.remoteIP();
+		u->port = Udp.remotePort();
+		udpHead++;
+		statUdp.read++;
+		n++;
 	}
+	return(n);
+}
 
-	// Remote Address should be known
-	IPAddress remoteIpNo = Udp.remoteIP();
-
-	// Remote port is either of the remote TTN server or from NTP server (=123)
-	unsigned int remotePortNo = Udp.remotePort();
 
-	if (remotePortNo == 123) {
-		// This is an NTP message arriving
+// ----------------------------------------------------------------------------
+// Print the datagram u with a title, the data in hex or as text
+// ----------------------------------------------------------------------------
 #if DUSB>=1
-		if ( debug>=0 ) {
-			Serial.println(F("A readUdp:: NTP msg rcvd"));
+void udpPrint(const __FlashStringHelper *title, struct udpBuf *u, bool hex)
+{
+	Serial.print(title);
+	Serial.print(F(":: size ")); Serial.print(u->size);
+	Serial.print(F(" From ")); Serial.print(u->ip);
+	Serial.print(F(", port ")); Serial.print(u->port);
+	Serial.print(F(", data: "));
+	if (hex) {
+		for (int i=0; i<u->size; i++) {
+			Serial.print(u->data[i],HEX);
+			Serial.print(':');
 		}
-#endif
-		gwayConfig.ntpErr++;
-		gwayConfig.ntpErrTime = now();
-		return(0);
+		Serial.println();
 	}
-	
-	// If it is not NTP it must be a LoRa message for gateway or node
 	else {
-		uint8_t *data = (uint8_t *) ((uint8_t *)buff_down + 4);
-		protocol = buff_down[0];
-		token = buff_down[2]*256 + buff_down[1];
-		ident = buff_down[3];
+		u->data[u->size] = 0;						// udpIntake() left room
+		Serial.print((char *)(u->data + 4));
+		Serial.println(F("..."));
+	}
+}
+#endif
+
+
+// ----------------------------------------------------------------------------
+// Find the statAck entry of server ip. With add an entry is taken for a
+// server that has none: an unused one or the one of the oldest PUSH_DATA.
+// Returns:
+//	The entry, NULL if there is none
+// ----------------------------------------------------------------------------
+struct ackStat * ackFind(IPAddress ip, bool add)
+{
+	struct ackStat *a = NULL;
+	for (int i=0; i<ACK_DESTS; i++) {
+		if (statAck[i].ip == ip) return(&statAck[i]);
+		if ((add) && ((a == NULL) || (statAck[i].sent < a->sent))) {
+			a = &statAck[i];							// Unused ones have sent 0
+		}
+	}
+	if (a != NULL) {
+		*a = ackStat();
+		a->ip = ip;
+	}
+	return(a);
+}
 
+
+// ----------------------------------------------------------------------------
+// PUSH_ACK: the server acknowledges a PUSH_DATA (or PUSH_BIN) message.
+// Parameters:
+//	u: Datagram in udpRing
+//	token: Token of the PUSH_DATA it acknowledges
+// Returns:
+//	Size of the datagram
+// ----------------------------------------------------------------------------
+int udpPushAck(struct udpBuf *u, uint16_t token)
+{
+	cp_up_ack_rcv++;
+	wlanAps[wlan.ap].acked++;
+	dnsAck(u->ip);
+	struct ackStat *a = ackFind(u->ip, false);
+	if ((a != NULL) && (a->waiting) && (token == a->token)) {
+		a->rtt = (uint32_t) (micros64() - a->sent);
+		a->rttAvg = (a->rttAvg == 0 ? a->rtt : (7 * a->rttAvg + a->rtt) / 8);
+		a->waiting = false;
+	}
 #if DUSB>=1
-	if ((debug>1) && (pdebug & P_MAIN)) {
-		Serial.print(F("M readUdp:: message waiting="));
-		Serial.print(ident);
-		Serial.println();
+	if (( debug>=2) && (pdebug & P_MAIN )) {
+		udpPrint(F("M PKT_PUSH_ACK"), u, true);
 	}
 #endif
-		// now parse the message type from the server (if any)
-		switch (ident) {
+	return(u->size);
+}
 
-		// This message is used by the gateway to send sensor data to the
-		// server. As this function is used for downstream only, this option
-		// will never be selected but is included as a reference only
-		case PKT_PUSH_DATA: // 0x00 UP
+
+// ----------------------------------------------------------------------------
+// PULL_RESP: the server sends a downlink message (e.g. a join accept) for
+// a node. The message is handed to the TX radio, and a TX_ACK goes back to
+// the server that sent it, with the error or warning if there is one.
+// Only our servers may send downlink messages.
+// Parameters:
+//	u: Datagram in udpRing
+// Returns:
+//	Size of the datagram, 0 if not from our server, -1 if not sent
+// ----------------------------------------------------------------------------
+int udpPullResp(struct udpBuf *u)
+{
+	uint8_t buff[64]; 						// TX_ACK message
+	int ackSize;
+	
 #if DUSB>=1
-			if (debug >=1) {
-				Serial.print(F("PKT_PUSH_DATA:: size ")); Serial.print(packetSize);
-				Serial.print(F(" From ")); Serial.print(remoteIpNo);
-				Serial.print(F(", port ")); Serial.print(remotePortNo);
-				Serial.print(F(", data: "));
-				for (int i=0; i<packetSize; i++) {
-					Serial.print(buff_down[i],HEX);
-					Serial.print(':');
-				}
-				Serial.println();
-				if (debug>=2) Serial.flush();
-			}
+	if (( debug>=0 ) && ( pdebug & P_MAIN )) {
+		Serial.println(F("M readUdp:: PKT_PULL_RESP received"));
+	}
 #endif
-		break;
-	
-		// This message is sent by the server to acknoledge receipt of a
-		// (sensor) message sent with the code above.
-		case PKT_PUSH_ACK:	// 0x01 DOWN
+	if ((u->ip != ttnServer) && (u->ip != thingServer)) {
 #if DUSB>=1
-			if (( debug>=2) && (pdebug & P_MAIN )) {
-				Serial.print(F("M PKT_PUSH_ACK:: size ")); 
-				Serial.print(packetSize);
-				Serial.print(F(" From ")); 
-				Serial.print(remoteIpNo);
-				Serial.print(F(", port ")); 
-				Serial.print(remotePortNo);
-				Serial.print(F(", token: "));
-				Serial.println(token, HEX);
-				Serial.println();
-			}
+		if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+			Serial.print(F("M readUdp:: PKT_PULL_RESP from unknown server "));
+			Serial.println(u->ip);
+		}
 #endif
-		break;
+		return(0);
+	}
+	cp_dw_dgram_rcv++;
 	
-		case PKT_PULL_DATA:	// 0x02 UP
+	// Send to the LoRa Node first (timing) and then do reporting to Serial
+	radioSelect(TXRADIO);						// The radio used for downlink
+	if (sendPacket(u->data + 4, u->size - 4) < 0) {
+		radioSelect(0);
 #if DUSB>=1
-			Serial.print(F(" Pull Data"));
-			Serial.println();
+		if ( debug>=0 ) {
+			Serial.println(F("A readUdp:: Error: PKT_PULL_RESP sendPacket failed"));
+		}
 #endif
-		break;
+		return(-1);
+	}
+	radioSelect(0);
+
+	// Now respond with an PKT_TX_ACK; 0x05 UP
+	buff[0]=u->data[0];
+	buff[1]=u->data[1];
+	buff[2]=u->data[2];
+	buff[3]=PKT_TX_ACK;
+	buff[4]=MAC_array[0];
+	buff[5]=MAC_array[1];
+	buff[6]=MAC_array[2];
+	buff[7]=0xFF;
+	buff[8]=0xFF;
+	buff[9]=MAC_array[3];
+	buff[10]=MAC_array[4];
+	buff[11]=MAC_array[5];
+	buff[12]=0;
 	
-		// This message type is used to confirm OTAA message to the node
-		// XXX This message format may also be used for other downstream communucation
-		case PKT_PULL_RESP:	// 0x03 DOWN
+	// If the message is not sent, tell the server why. If it is sent
+	// with another power, tell which. Otherwise there is no JSON.
+	ackSize = 12;
+	if (txErr != TX_NONE) {
+		ackSize += snprintf((char *)(buff+12), sizeof(buff)-12, 
+			"{\"txpk_ack\":{\"error\":\"%s\"}}", txErrStr[txErr]);
+	}
+	else if (txWarn != TX_NONE) {
+		ackSize += snprintf((char *)(buff+12), sizeof(buff)-12, 
+			"{\"txpk_ack\":{\"warn\":\"%s\",\"value\":%u}}", txErrStr[txWarn], LoraDown.powe);
+	}
+	
+	// Only send the PKT_TX_ACK to the UDP socket that just sent the data!!!
+	Udp.beginPacket(u->ip, u->port);
+	if (Udp.write((unsigned char *)buff, ackSize) != (size_t) ackSize) {
 #if DUSB>=1
-			if (( debug>=0 ) && ( pdebug & P_MAIN )) {
-				Serial.println(F("M readUdp:: PKT_PULL_RESP received"));
-			}
+		if (debug>=0)
+			Serial.println("A readUdp:: Error: PKT_TX_ACK UDP write");
 #endif
-//			lastTmst = micros();					// Store the tmst this package was received
-			
-			// Send to the LoRa Node first (timing) and then do reporting to Serial
-			_state=S_TX;
-			sendTime = micros();					// record when we started sending the message
-			
-			if (sendPacket(data, packetSize-4) < 0) {
+	}
+	else {
 #if DUSB>=1
-				if ( debug>=0 ) {
-					Serial.println(F("A readUdp:: Error: PKT_PULL_RESP sendPacket failed"));
-				}
+		if (( debug>=0 ) && ( pdebug & P_TX )) {
+			Serial.print(F("M PKT_TX_ACK:: micros="));
+			Serial.println(micros());
+		}
 #endif
-				return(-1);
-			}
-
-			// Now respond with an PKT_TX_ACK; 0x04 UP
-			buff[0]=buff_down[0];
-			buff[1]=buff_down[1];
-			buff[2]=buff_down[2];
-			//buff[3]=PKT_PULL_ACK;					// Pull request/Change of Mogyi
-			buff[3]=PKT_TX_ACK;
-			buff[4]=MAC_array[0];
-			buff[5]=MAC_array[1];
-			buff[6]=MAC_array[2];
-			buff[7]=0xFF;
-			buff[8]=0xFF;
-			buff[9]=MAC_array[3];
-			buff[10]=MAC_array[4];
-			buff[11]=MAC_array[5];
-			buff[12]=0;
+	}
+	if (!Udp.endPacket()) {
 #if DUSB>=1
-			if (( debug >= 2 ) && ( pdebug & P_MAIN )) {
-				Serial.println(F("M readUdp:: TX buff filled"));
-			}
+		if (( debug>=0 ) && ( pdebug & P_MAIN )) {
+			Serial.println(F("M PKT_TX_ACK Error Udp.endpaket"));
+		}
 #endif
-			// Only send the PKT_PULL_ACK to the UDP socket that just sent the data!!!
-			Udp.beginPacket(remoteIpNo, remotePortNo);
-			if (Udp.write((unsigned char *)buff, 12) != 12) {
+	}
+	yield();
+	
 #if DUSB>=1
-				if (debug>=0)
-					Serial.println("A readUdp:: Error: PKT_PULL_ACK UDP write");
+	if (( debug >=1 ) && (pdebug & P_MAIN )) {
+		udpPrint(F("M PKT_PULL_RESP"), u, false);
+	}
 #endif
-			}
-			else {
+	return(u->size);
+}
+
+
+// ----------------------------------------------------------------------------
+// Handle DOWN a package from the UDP socket, can come from any server
+// Messages are received when server responds to gateway requests from LoRa nodes 
+// (e.g. JOIN requests etc.) or when server has downstream data.
+// Every identifier has its own handler, we respond only to the server that
+// sent us a message!
+// Parameters:
+//	u: Datagram in udpRing, as read by udpIntake()
+//
+// Returns:
+//	-1 or false if not read
+//	Or number of characters read is success
+//
+// ----------------------------------------------------------------------------
+int readUdp(struct udpBuf *u)
+{
+	// Remote port is either of the remote TTN server or from NTP server (=123)
+	if (u->port == 123) {
+		// NTP replies arrive on UdpNtp, so this is a late or stray message.
+		// Just ignore it.
 #if DUSB>=1
-				if (( debug>=0 ) && ( pdebug & P_TX )) {
-					Serial.print(F("M PKT_TX_ACK:: micros="));
-					Serial.println(micros());
-				}
+		if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+			Serial.println(F("A readUdp:: NTP msg rcvd"));
+		}
 #endif
-			}
-
-			if (!Udp.endPacket()) {
+		return(0);
+	}
+	if (u->size < 4) return(0);					// No header
+	
+	// If it is not NTP it must be a LoRa message for gateway or node
+	uint16_t token = u->data[2]*256 + u->data[1];
+	uint8_t ident = u->data[3];
 #if DUSB>=1
-				if (( debug>=0 ) && ( pdebug & P_MAIN )) {
-					Serial.println(F("M PKT_PULL_DATALL Error Udp.endpaket"));
-				}
+	if ((debug>1) && (pdebug & P_MAIN)) {
+		Serial.print(F("M readUdp:: message waiting="));
+		Serial.print(ident);
+		Serial.println();
+	}
 #endif
-			}
-			
-			yield();
+	switch (ident) {
+	
+	// This message is sent by the server to acknoledge receipt of a
+	// (sensor) message sent by sendUdp().
+	case PKT_PUSH_ACK:	// 0x01 DOWN
+		return(udpPushAck(u, token));
+	
+	// This message type is used to confirm OTAA message to the node
+	// XXX This message format may also be used for other downstream communucation
+	case PKT_PULL_RESP:	// 0x03 DOWN
+		return(udpPullResp(u));
+	
+	// The server sends a PULL_ACK to confirm PULL_DATA receipt
+	case PKT_PULL_ACK:	// 0x04 DOWN
 #if DUSB>=1
-			if (( debug >=1 ) && (pdebug & P_MAIN )) {
-				Serial.print(F("M PKT_PULL_RESP:: size ")); 
-				Serial.print(packetSize);
-				Serial.print(F(" From ")); 
-				Serial.print(remoteIpNo);
-				Serial.print(F(", port ")); 
-				Serial.print(remotePortNo);	
-				Serial.print(F(", data: "));
-				data = buff_down + 4;
-				data[packetSize] = 0;
-				Serial.print((char *)data);
-				Serial.println(F("..."));
-			}
-#endif		
-		break;
+		if (( debug >= 2 ) && (pdebug & P_MAIN )) {
+			udpPrint(F("M PKT_PULL_ACK"), u, true);
+		}
+#endif
+		return(u->size);
 	
-		case PKT_PULL_ACK:	// 0x04 DOWN; the server sends a PULL_ACK to confirm PULL_DATA receipt
+	// PUSH_DATA and PULL_DATA go up, from the gateway to the server. We do
+	// not expect them here.
+	case PKT_PUSH_DATA: // 0x00 UP
+	case PKT_PULL_DATA:	// 0x02 UP
 #if DUSB>=1
-			if (( debug >= 2 ) && (pdebug & P_MAIN )) {
-				Serial.print(F("M PKT_PULL_ACK:: size ")); Serial.print(packetSize);
-				Serial.print(F(" From ")); Serial.print(remoteIpNo);
-				Serial.print(F(", port ")); Serial.print(remotePortNo);	
-				Serial.print(F(", data: "));
-				for (int i=0; i<packetSize; i++) {
-					Serial.print(buff_down[i],HEX);
-					Serial.print(':');
-				}
-				Serial.println();
-			}
+		if (debug >=1) {
+			udpPrint(F("M readUdp:: upstream message"), u, true);
+		}
 #endif
-		break;
+		return(u->size);
 	
-		default:
+	default:
 #if GATEWAYMGT==1
-			// For simplicity, we send the first 4 bytes too
-			gateway_mgt(packetSize, buff_down);
-#else
-
+		// For simplicity, we send the first 4 bytes too
+		gateway_mgt(u->size, u->data);
 #endif
 #if DUSB>=1
-			Serial.print(F(", ERROR ident not recognized="));
-			Serial.println(ident);
+		Serial.print(F(", ERROR ident not recognized="));
+		Serial.println(ident);
 #endif
-		break;
-		}
-#if DUSB>=2
-		if (debug>=1) {
-			Serial.print(F("readUdp:: returning=")); 
-			Serial.println(packetSize);
-		}
-#endif
-		// For downstream messages
-		return packetSize;
+		return(u->size);
 	}
 }//readUdp
 
@@ -731,16 +1037,8 @@ int readUdp(int packetSize)
 // ----------------------------------------------------------------------------
 int sendUdp(IPAddress server, int port, uint8_t *msg, int length) {
 
-	// Check whether we are conected to Wifi and the internet
-	if (WlanConnect(3) < 0) {
-#if DUSB>=1
-		if (( debug>=0 ) && ( pdebug & P_MAIN )) {
-			Serial.print(F("M sendUdp: ERROR connecting to WiFi"));
-			Serial.flush();
-		}
-#endif
-		Udp.flush();
-		yield();
+	// Check whether we are conected to Wifi, wlanStep() reconnects
+	if (!wlanUp()) {
 		return(0);
 	}
 
@@ -764,7 +1062,7 @@ int sendUdp(IPAddress server, int port, uint8_t *msg, int length) {
 	yield();
 	
 
-	if (Udp.write((unsigned char *)msg, length) != length) {
+	if (Udp.write((unsigned char *)msg, length) != (size_t) length) {
 #if DUSB>=1
 		if (( debug<=1 ) && ( pdebug & P_MAIN )) {
 			Serial.println(F("M sendUdp:: Error write"));
@@ -785,6 +1083,15 @@ int sendUdp(IPAddress server, int port, uint8_t *msg, int length) {
 #endif
 		return(0);
 	}
+	if ((msg[3] == PKT_PUSH_DATA) || (msg[3] == PKT_PUSH_BIN)) {
+		cp_up_dgram_sent++;								// For ackr in stat message
+		struct ackStat *a = ackFind(server, true);
+		a->token = msg[2]*256 + msg[1];					// Same order as readUdp()
+		a->sent = micros64();
+		a->waiting = true;
+		wlanAps[wlan.ap].sent++;
+		dnsPush(server);
+	}
 	return(1);
 }//sendUDP
 
@@ -806,6 +1113,7 @@ bool UDPconnect() {
 		Serial.println(localPort);
 	}
 #endif	
+	UdpNtp.begin(_LOCNTPPORT);						// Separate socket for NTP replies
 	if (Udp.begin(localPort) == 1) {
 #if DUSB>=1
 		if (debug>=1) Serial.println(F("Connection successful"));
@@ -832,6 +1140,9 @@ bool UDPconnect() {
 // ----------------------------------------------------------------------------
 void pullData() {
 
+#if _BSTATION==1
+	return;													// The websocket needs no PULL_DATA
+#endif
     uint8_t pullDataReq[12]; 								// status report as a JSON object
     int pullIndex=0;
 	int i;
@@ -913,6 +1224,12 @@ void sendstat() {
 	uint8_t token_h   = (uint8_t)rand(); 					// random token
     uint8_t token_l   = (uint8_t)rand();					// random token
 	
+	// Percentage (in 0.1%) of PUSH_DATA acknowledged since last stat message
+	unsigned int ackr = (cp_up_dgram_sent > 0 ? (cp_up_ack_rcv * 1000) / cp_up_dgram_sent : 0);
+	if (ackr > 1000) ackr = 1000;
+	cp_up_dgram_sent = 0;
+	cp_up_ack_rcv = 0;
+	
     // pre-fill the data buffer with fixed fields
     status_report[0]  = PROTOCOL_VERSION;					// 0x01
 	status_report[1]  = token_h;
@@ -944,8 +1261,9 @@ void sendstat() {
 	delay(1);
 	
     int j = snprintf((char *)(status_report + stat_index), STATUS_SIZE-stat_index, 
-		"{\"stat\":{\"time\":\"%s\",\"lati\":%s,\"long\":%s,\"alti\":%i,\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%u.0,\"dwnb\":%u,\"txnb\":%u,\"pfrm\":\"%s\",\"mail\":\"%s\",\"desc\":\"%s\"}}", 
-		stat_timestamp, clat, clon, (int)alt, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 0, 0, 0, platform, email, description);
+		"{\"stat\":{\"time\":\"%s\",\"lati\":%s,\"long\":%s,\"alti\":%i,\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%u.%u,\"dwnb\":%u,\"txnb\":%u,\"pfrm\":\"%s\",\"mail\":\"%s\",\"desc\":\"%s\"}}", 
+		stat_timestamp, clat, clon, (int)alt, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 
+		ackr / 10, ackr % 10, cp_dw_dgram_rcv, cp_nb_tx_ok, platform, email, description);
 		
 	yield();												// Give way to the internal housekeeping of the ESP8266
 
@@ -968,6 +1286,9 @@ void sendstat() {
 	}
 	
     //send the update
+#if _BSTATION==1
+	return;													// Basics Station has no stat message
+#endif
 #ifdef _TTNSERVER
     sendUdp(ttnServer, _TTNPORT, status_report, stat_index);
 	yield();
@@ -1024,15 +1345,15 @@ void setup() {
 
 #if DUSB>=1
 	Serial.flush();
-
-	delay(500);
-
+#endif
 	if (SPIFFS.begin()) {
+#if DUSB>=1
 		Serial.println(F("SPIFFS init success"));
+#endif
 	}
-	else {
-	}
-#endif	
+#if _UPSTORE==1
+	initStore();									// Messages stored before the restart
+#endif
 #if _SPIFF_FORMAT>=1
 #if DUSB>=1
 	if (( debug >= 0 ) && ( pdebug & P_MAIN )) {
@@ -1054,12 +1375,6 @@ void setup() {
 	Serial.println(F("Do Asserts"));
 #endif
 
-#if OLED>=1
-	init_oLED();
-#endif
-
-	delay(500);
-	yield();
 #if DUSB>=1	
 	if (debug>=1) {
 		Serial.print(F("debug=")); 
@@ -1067,10 +1382,10 @@ void setup() {
 		yield();
 	}
 #endif
-
+	
+	WiFi.persistent(false);
 	WiFi.mode(WIFI_STA);
 	WiFi.setAutoConnect(true);
-	//WiFi.begin();
 	
 	WlanReadWpa();								// Read the last Wifi settings from SPIFFS into memory
 
@@ -1083,61 +1398,19 @@ void setup() {
 	Serial.print(F(", len="));
 	Serial.println(strlen(MAC_char));
 
-	// We start by connecting to a WiFi network, set hostname
-	char hostname[12];
-
-	// Setup WiFi UDP connection. Give it some time and retry x times..
-	while (WlanConnect(0) <= 0) {
-		Serial.print(F("Error Wifi network connect "));
-		Serial.println();
-		yield();
-	}	
-	
-	// After there is a WiFi router connection, we can also set the hostname.
+	// The hostname is set once there is a WiFi router connection
 #if ESP32_ARCH==1
 	sprintf(hostname, "%s%02x%02x%02x", "esp32-", MAC_array[3], MAC_array[4], MAC_array[5]);
-	WiFi.setHostname( hostname );
 #else
 	sprintf(hostname, "%s%02x%02x%02x", "esp8266-", MAC_array[3], MAC_array[4], MAC_array[5]);
-	wifi_station_set_hostname( hostname );
-#endif	
-
-	
-	Serial.print(F("Host "));
-#if ESP32_ARCH==1
-	Serial.print(WiFi.getHostname());
-#else
-	Serial.print(wifi_station_get_hostname());
 #endif
-	Serial.print(F(" WiFi Connected to "));
-	Serial.print(WiFi.SSID());
-	Serial.print(F(" on IP="));
-	Serial.print(WiFi.localIP());
-	Serial.println();
-	delay(200);
 	
-	// If we are here we are connected to WLAN
-	// So now test the UDP function
-	if (!UDPconnect()) {
-		Serial.println(F("Error UDPconnect"));
-	}
-	delay(200);
-	
-	// Pins are defined and set in loraModem.h
-    pinMode(pins.ss, OUTPUT);
-	pinMode(pins.rst, OUTPUT);
-    pinMode(pins.dio0, INPUT);								// This pin is interrupt
-	pinMode(pins.dio1, INPUT);								// This pin is interrupt
-	//pinMode(pins.dio2, INPUT);
-
 	// Init the SPI pins
 #if ESP32_ARCH==1
 	SPI.begin(SCK, MISO, MOSI, SS);
 #else
 	SPI.begin();
 #endif
-
-	delay(500);
 	
 	// We choose the Gateway ID to be the Ethernet Address of our Gateway card
     // display results of getting hardware address
@@ -1158,114 +1431,157 @@ void setup() {
 	Serial.print((double)freq/1000000);
 	Serial.println(" Mhz.");
 
-	if (!WiFi.hostByName(NTP_TIMESERVER, ntpServer))		// Get IP address of Timeserver
-	{
-		die("Setup:: ERROR hostByName NTP");
-	};
-	delay(100);
-#ifdef _TTNSERVER
-	if (!WiFi.hostByName(_TTNSERVER, ttnServer))			// Use DNS to get server IP once
-	{
-		die("Setup:: ERROR hostByName TTN");
-	};
-	delay(100);
-#endif
-#ifdef _THINGSERVER
-	if (!WiFi.hostByName(_THINGSERVER, thingServer))
-	{
-		die("Setup:: ERROR hostByName THING");
-	}
-	delay(100);
-#endif
-
-	// The Over the AIr updates are supported when we have a WiFi connection.
-	// The NTP time setting does not have to be precise for this function to work.
-#if A_OTA==1
-	setupOta(hostname);										// Uses wwwServer 
-#endif
-
-	// Set the NTP Time
-	// As long as the time has not been set we try to set the time.
-#if NTP_INTR==1
-	setupTime();											// Set NTP time host and interval
-#else
-	// If not using the standard libraries, do a manual setting
-	// of the time. This meyhod works more reliable than the 
-	// interrupt driven method.
-	
-	//setTime((time_t)getNtpTime());
-	while (timeStatus() == timeNotSet) {
-#if DUSB>=1
-		if (( debug>=0 ) && ( pdebug & P_MAIN )) 
-			Serial.println(F("M setupTime:: Time not set (yet)"));
-#endif
-		delay(500);
-		time_t newTime;
-		newTime = (time_t)getNtpTime();
-		if (newTime != 0) setTime(newTime);
-	}
-	// When we are here we succeeded in getting the time
-	startTime = now();										// Time in seconds
-#if DUSB>=1
-	Serial.print("Time: "); printTime();
-	Serial.println();
-#endif
-	writeGwayCfg(CONFIGFILE );
-#if DUSB>=1
-	Serial.println(F("Gateway configuration saved"));
-#endif
-#endif //NTP_INTR
-
-#if A_SERVER==1	
-	// Setup the webserver
-	setupWWW();
-#endif
-
-	delay(100);												// Wait after setup
-	
 	// Setup ad initialise LoRa state machine of _loramModem.ino
-	_state = S_INIT;
-	initLoraModem();
-	
-	if (_cad) {
-		_state = S_SCAN;
-		sf = SF7;
-		cadScanner();										// Always start at SF7
+	// The receiver is armed before WiFi, DNS and NTP are set up so that
+	// we do not miss messages while starting. Those are queued in upQueue.
+	// Every radio gets its own context, pins are defined in loraModem.h
+	radioSetup();
+	for (uint8_t r=0; r<_RADIOS; r++) {
+		radioSelect(r);
+		pinMode(pins.ss, OUTPUT);
+		digitalWrite(pins.ss, HIGH);						// Unselect, SPI is shared
+		pinMode(pins.rst, OUTPUT);
+		pinMode(pins.dio0, INPUT);							// This pin is interrupt
+		pinMode(pins.dio1, INPUT);							// This pin is interrupt
 	}
-	else { 
-		_state = S_RX;
-		rxLoraModem();
+	for (uint8_t r=0; r<_RADIOS; r++) {
+		radioSelect(r);
+		_state = S_INIT;
+		initLoraModem();
+	
+		if (_cad) {
+			_state = S_SCAN;
+			sf = scanStart();
+			cadScanner();									// Start at the first SF of scan order
+		}
+		else { 
+			_state = S_RX;
+			rxLoraModem();
+		}
+		radioAttach();										// Interrupt handlers of this radio
 	}
+	radioSelect(0);
 	LoraUp.payLoad[0]= 0;
 	LoraUp.payLength = 0;						// Init the length to 0
-
-	// init interrupt handlers, which are shared for GPIO15 / D8, 
-	// we switch on HIGH interrupts
-	if (pins.dio0 == pins.dio1) {
-		//SPI.usingInterrupt(digitalPinToInterrupt(pins.dio0));
-		attachInterrupt(pins.dio0, Interrupt_0, RISING);		// Share interrupts
-	}
-	// Or in the traditional Comresult case
-	else {
-		//SPI.usingInterrupt(digitalPinToInterrupt(pins.dio0));
-		//SPI.usingInterrupt(digitalPinToInterrupt(pins.dio1));
-		attachInterrupt(pins.dio0, Interrupt_0, RISING);	// Separate interrupts
-		attachInterrupt(pins.dio1, Interrupt_1, RISING);	// Separate interrupts		
-	}
-	
-	writeConfig( CONFIGFILE, &gwayConfig);					// Write config
+	bootArmed = millis();
 
 	// activate OLED display
 #if OLED>=1
+	init_oLED();
 	acti_oLED();
-	addr_oLED();
 #endif
 
+	// Start connecting to the last AP we were connected to, but do not wait
+	// for it. bootStep() is called by loop() to do the rest.
+	if (gwayConfig.ssid.length() >0) {
+		WiFi.begin(gwayConfig.ssid.c_str(), gwayConfig.pass.c_str());
+	}
+	bootStage = B_WIFI;
+	bootTime = millis();
+
+	Serial.print(F("Receiver armed after "));
+	Serial.print(bootArmed);
+	Serial.println(F(" ms"));
 	Serial.println(F("--------------------------------------"));
 }//setup
 
 
 
+// ----------------------------------------------------------------------------
+// BOOTSTEP
+// Start the network services after the receiver has been armed in setup().
+// Called by loop() until bootStage is B_DONE. Every call does at most one
+// step so that the state machine can handle received messages in between.
+// Failures do not stop the gateway, the step is retried a few seconds later.
+// Parameters:
+//	<None>
+// Returns:
+//	The current bootStage
+// ----------------------------------------------------------------------------
+int bootStep()
+{
+	switch (bootStage) {
+	
+	// Wait for the connection to the last AP. If that takes too long, 
+	// wlanStep() joins the best AP of the wpa list.
+	case B_WIFI:
+		wlanStep();
+		if (!wlanUp()) break;
+		
+		// After there is a WiFi router connection, we can also set the hostname.
+#if ESP32_ARCH==1
+		WiFi.setHostname( hostname );
+#else
+		wifi_station_set_hostname( hostname );
+#endif
+		Serial.print(F("Host "));
+		Serial.print(hostname);
+		Serial.print(F(" WiFi Connected to "));
+		Serial.print(WiFi.SSID());
+		Serial.print(F(" on IP="));
+		Serial.print(WiFi.localIP());
+		Serial.println();
+
+		// If we are here we are connected to WLAN
+		// So now test the UDP function
+		if (!UDPconnect()) {
+			Serial.println(F("Error UDPconnect"));
+		}
+		bootStage = B_NET;
+		bootTime = 0;
+		break;
+	
+	// Wait until all server names have an address. dnsStep() does not
+	// wait for the DNS answers and retries failed names itself.
+	case B_NET:
+		if (dnsStep() < (int) DNS_ENTRIES) break;
+		bootStage = B_TIME;
+		bootTime = 0;
+		break;
+	
+	// Set the NTP Time
+	// As long as the time has not been set ntpStep() retries every 2 seconds.
+	case B_TIME:
+#if NTP_INTR==1
+		setupTime();										// Set NTP time host and interval
+#else
+		if (ntpStep() <= 0) break;
+		// When we are here we succeeded in getting the time
+		startTime = now();									// Time in seconds
+#if DUSB>=1
+		Serial.print("Time: "); printTime();
+		Serial.println();
+#endif
+#endif //NTP_INTR
+		bootStage = B_SERV;
+		break;
+	
+	// The Over the AIr updates and webserver are supported when we have 
+	// a WiFi connection.
+	case B_SERV:
+#if A_OTA==1
+		setupOta(hostname);									// Uses wwwServer 
+#endif
+#if A_SERVER==1	
+		setupWWW();
+#endif
+		initLog();											// Find the log segment to append to
+#if OLED>=1
+		addr_oLED();
+#endif
+		bootReady = millis();
+		bootStage = B_DONE;
+		Serial.print(F("Gateway ready after "));
+		Serial.print(bootReady);
+		Serial.print(F(" ms, queued="));
+		Serial.println(upCount);
+		break;
+	}
+	return(bootStage);
+}//bootStep
+
+
+
 // ----------------------------------------------------------------------------
 // LOOP
 // This is the main program that is executed time and time again.
@@ -1284,14 +1600,19 @@ void setup() {
 void loop ()
 {
 	uint32_t uSeconds;									// micro seconds
-	int packetSize;
 	uint32_t nowSeconds = now();
 	
 	// check for event value, which means that an interrupt has arrived.
 	// In this case we handle the interrupt ( e.g. message received)
 	// in userspace in loop().
+	// Every radio has its own state machine context. The rest of loop()
+	// works on radio 0.
 	//
-	stateMachine();									// do the state machine
+	for (uint8_t r=0; r<_RADIOS; r++) {
+		radioSelect(r);
+		stateMachine();								// do the state machine
+	}
+	radioSelect(0);
 	
 	// After a quiet period, make sure we reinit the modem and state machine.
 	// The interval is in seconds (about 15 seconds) as this re-init
@@ -1312,20 +1633,39 @@ void loop ()
 #endif
 
 		// startReceiver() ??
-		if ((_cad) || (_hop)) {
-			_state = S_SCAN;
-			sf = SF7;
-			cadScanner();
-		}
-		else {
-			_state = S_RX;
-			rxLoraModem();
+		// Do not disturb a radio that is transmitting.
+		for (uint8_t r=0; r<_RADIOS; r++) {
+			radioSelect(r);
+			if ((_state == S_TX) || (_state == S_TXDONE)) continue;
+			if ((_cad) || (_hop)) {
+				_state = S_SCAN;
+				sf = scanStart();
+				cadScanner();
+			}
+			else {
+				_state = S_RX;
+				rxLoraModem();
+			}
+			writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t) 0x00);
+			writeRegister(REG_IRQ_FLAGS, (uint8_t) 0xFF);		// Reset all interrupt flags
 		}
-		writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t) 0x00);
-		writeRegister(REG_IRQ_FLAGS, (uint8_t) 0xFF);			// Reset all interrupt flags
+		radioSelect(0);
 		msgTime = nowSeconds;
 	}
 
+#if REPEATER==1
+	// Repeat the received messages that are due, with or without WiFi
+	repStep();
+#endif
+
+	// As long as not all network services are up, only do the next step
+	// of starting them. Received messages are queued meanwhile.
+	if (bootStage != B_DONE) {
+		yield();
+		if (!radioPending()) bootStep();
+		return;
+	}
+
 #if A_SERVER==1
 	// Handle the Web server part of this sketch. Mainly used for administration 
 	// and monitoring of the node. This function is important so it is called at the
@@ -1341,6 +1681,7 @@ void loop ()
 	//
 	yield();
 	ArduinoOTA.handle();
+	otaStep();										// Firmware download, if any
 #endif
 
 	// I event is set, we know that we have a (soft) interrupt.
@@ -1348,19 +1689,26 @@ void loop ()
 	// reloop here for timing purposes. 
 	// Do as less yield() as possible.
 	// XXX 180326
-	if (_event == 1) {
+	if (radioPending()) {
 		return;
 	}
 	else yield();
 
-	
-	// If we are not connected, try to connect.
-	// We will not read Udp in this loop cycle then
-	if (WlanConnect(1) < 0) {
-#if DUSB>=1
-		if (( debug >= 0 ) && ( pdebug & P_MAIN ))
-			Serial.println(F("M ERROR reconnect WLAN"));
+#if STAT_LOG==1
+	// Log records are buffered in RAM and written per page. If there is
+	// little traffic, do not keep them in RAM for longer than LOGFLUSH seconds.
+	if ((logBufCnt > 0) && ((nowSeconds - logTime) >= LOGFLUSH)) {
+		flushLog();
+		yield();
+	}
 #endif
+
+	
+	// Keep the WiFi link up, wlanStep() does not wait for a connection.
+	// We will not read Udp in this loop cycle if there is no link, 
+	// received messages are queued meanwhile.
+	wlanStep();
+	if (!wlanUp()) {
 		yield();
 		return;										// Exit loop if no WLAN connected
 	}
@@ -1372,33 +1720,62 @@ void loop ()
 	// As we do not know when the server will respond, we test in every loop.
 	//
 	else {
-		while( (packetSize = Udp.parsePacket()) > 0) {
+		dnsStep();									// Resolve server names when due
+#if _BSTATION==1
+		bsLoop();									// Websocket to the LNS
+#endif
+		udpIntake();								// Into the ring, as far as it goes
+		for (int n=0; (n < UDP_BUDGET) && (udpTail != udpHead); n++) {
 #if DUSB>=2
 			Serial.println(F("loop:: readUdp calling"));
 #endif
 			// DOWNSTREAM
 			// Packet may be PKT_PUSH_ACK (0x01), PKT_PULL_ACK (0x03) or PKT_PULL_RESP (0x04)
 			// This command is found in byte 4 (buffer[3])
-			if (readUdp(packetSize) <= 0) {
+			struct udpBuf *u = &udpRing[udpTail & (UDPRING-1)];
+			udpTail++;
+			statUdp.handled++;
+			if (readUdp(u) <= 0) {
 #if DUSB>=1
 				if (( debug>0 ) && ( pdebug & P_MAIN ))
 					Serial.println(F("M readUDP error"));
 #endif
-				break;
-			}
-			// Now we know we succesfully received message from host
-			else {
-				//_event=1;								// Could be done double if more messages received
 			}
+			if (radioPending()) break;				// Radio first, rest next loop()
 		}
 	}
+
+#if _THINGBIN==1
+	// Send the binary frames that waited long enough for others
+	if ((binLen > 0) && ((millis() - binTime) >= _BIN_HOLD)) {
+		binFlush();
+	}
+#endif
+
+#if OLED>=1
+	draw_oLED();									// Last message, rate limited
+#endif
+
+	// Send the messages that were received while starting up or while 
+	// the link was down
+#if _UPSTORE==1
+	bool upWait = (upCount > 0) || (ups.count > 0);
+#else
+	bool upWait = (upCount > 0);
+#endif
+	if (upWait && upLink()) {
+		sendQueue();
+	}
 	
 	yield();					// XXX 26/12/2017
 
 	// stat PUSH_DATA message (*2, par. 4)
 	//	
 
-    if ((nowSeconds - statTime) >= _STAT_INTERVAL) {	// Wake up every xx seconds
+	// The stat and pull timers use the uptime, as now() jumps when the
+	// time is set by NTP.
+	uint32_t upSeconds = (uint32_t)(micros64() / 1000000);
+    if ((upSeconds - statTime) >= _STAT_INTERVAL) {	// Wake up every xx seconds
 #if DUSB>=1
 		if (( debug>=1 ) && ( pdebug & P_MAIN )) {
 			Serial.print(F("M STAT:: ..."));
@@ -1433,7 +1810,13 @@ void loop ()
 			}
 		}
 #endif
-		statTime = nowSeconds;
+		// Counters that change often, like the page views, are journaled
+		// here and not on every change.
+		if (cntDirty != 0) {
+			logCounters(cntDirty);
+			cntDirty = 0;
+		}
+		statTime = upSeconds;
     }
 	
 	yield();
@@ -1441,8 +1824,7 @@ void loop ()
 	
 	// send PULL_DATA message (*2, par. 4)
 	//
-	nowSeconds = now();
-    if ((nowSeconds - pulltime) >= _PULL_INTERVAL) {	// Wake up every xx seconds
+    if ((upSeconds - pulltime) >= _PULL_INTERVAL) {	// Wake up every xx seconds
 #if DUSB>=1
 		if (( debug>=2) && ( pdebug & P_MAIN )) {
 			Serial.println(F("M PULL"));
@@ -1450,9 +1832,12 @@ void loop ()
 		}
 #endif
         pullData();										// Send PULL_DATA message to server
-		startReceiver();
+		// Not while a downlink is waiting for or using radio 0, as REINIT
+		if ((_state != S_TX) && (_state != S_TXDONE) && (!statTx.pending)) {
+			startReceiver();
+		}
 	
-		pulltime = nowSeconds;
+		pulltime = upSeconds;
     }
 
 	
@@ -1461,16 +1846,10 @@ void loop ()
 	// of the loop() itself which is better for SPI
 #if NTP_INTR==0
 	// Set the time in a manual way. Do not use setSyncProvider
-	// as this function may collide with SPI and other interrupts
+	// as this function may collide with SPI and other interrupts.
+	// ntpStep() does not wait for the reply of the server.
 	yield();											// 26/12/2017
-	nowSeconds = now();
-	if (nowSeconds - ntptimer >= _NTP_INTERVAL) {
-		yield();
-		time_t newTime;
-		newTime = (time_t)getNtpTime();
-		if (newTime != 0) setTime(newTime);
-		ntptimer = nowSeconds;
-	}
+	ntpStep();
 #endif
 	
 
@@ -124,8 +124,8 @@ int WlanStatus() {
 } // WlanStatus
 
 // ----------------------------------------------------------------------------
-// config.txt is a text file that contains lines(!) with WPA configuration items
-// Each line contains an KEY vaue pair describing the gateway configuration
+// Read the gateway configuration (binary CONFIGFILE slots) that contains the
+// WPA configuration items and the other settings of the gateway
 //
 // ----------------------------------------------------------------------------
 int WlanReadWpa() {
@@ -139,6 +139,7 @@ int WlanReadWpa() {
 	_cad = gwayConfig.cad;
 	_hop = gwayConfig.hop;
 	gwayConfig.boots++;							// Every boot of the system we increase the reset
+	logCounters(CNT_BOOTS);
 	
 #if GATEWAYNODE==1
 	if (gwayConfig.fcnt != (uint8_t) 0) frameCount = gwayConfig.fcnt+10;
@@ -163,7 +164,7 @@ int WlanReadWpa() {
 	Serial.print(wpa[0].passw);
 	Serial.println(F(">"));
 #endif
-
+	return(1);
 }
 
 
@@ -205,168 +206,403 @@ int WlanWriteWpa( char* ssid, char *pass) {
 
 
 // ----------------------------------------------------------------------------
-// Function to join the Wifi Network
-//	It is a matter of returning to the main loop() asap and make sure in next loop
-//	the reconnect is done first thing. By default the system will reconnect to the
-// samen SSID as it was connected to before.
-// Parameters:
-//		int maxTry: Number of retries we do:
-//		0: Used during Setup first CONNECT
-//		1: Try once and if unsuccessful return(1);
-//		x: Try x times
-//
-//  Returns:
-//		On failure: Return -1
-//		On connect: return 1
-//		On Disconnect state: return 0
-//
-//  XXX After a few retries, the ESP8266 should be reset. Note: Switching between 
-//	two SSID's does the trick. Rettrying the same SSID does not.
-//	Workaround is found below: Let the ESP8266 forget the SSID
-//
-//  NOTE: The Serial works only on debug setting and not on pdebug. This is 
-//	because WiFi problems would make webserver (which works on WiFI) useless.
+// Return true when the WiFi link is up, as seen by wlanStep().
 // ----------------------------------------------------------------------------
-int WlanConnect(int maxTry) {
-  
-#if WIFIMANAGER==1
-	WiFiManager wifiManager;
-#endif
+bool wlanUp()
+{
+	return(wlan.state == L_UP);
+}
+
+
+// ----------------------------------------------------------------------------
+// Go to a new state of the WiFi link
+// ----------------------------------------------------------------------------
+void wlanState(uint8_t s)
+{
+	wlan.state = s;
+	wlan.since = millis();
+}
 
-	unsigned char agains = 0;
-	unsigned char wpa_index = (WIFIMANAGER >0 ? 0 : 1);		// Skip over first record for WiFiManager
-
-	// The initial setup() call is done with parameter 0
-	// We clear the WiFi memory and start with previous AP.
-	//
-	if (maxTry==0) {
-		Serial.println(F("WlanConnect:: Init para 0"));
-		WiFi.persistent(false);
-		WiFi.mode(WIFI_OFF);   // this is a temporary line, to be removed after SDK update to 1.5.4
-		if (gwayConfig.ssid.length() >0) {
-			WiFi.begin(gwayConfig.ssid.c_str(), gwayConfig.pass.c_str());
-			delay(100);
+
+// ----------------------------------------------------------------------------
+// Choose the AP to join after a scan. Only APs that were seen count, the
+// score is the RSSI plus up to 20 for uplinks that were acknowledged, minus
+// 5 for every failed join in a row. If no AP was seen (hidden SSID or the
+// scan failed) the APs are tried in turn. The first record of wpa is the
+// AP of the WiFiManager, it is only used when WIFIMANAGER==1.
+// Returns:
+//	Index in wpa, or -1 when there is no AP to try
+// ----------------------------------------------------------------------------
+int wlanBest()
+{
+	int best = -1;
+	int32_t bestScore = 0;
+	uint8_t first = (WIFIMANAGER >0 ? 0 : 1);			// Skip over first record for WiFiManager
+	
+	for (uint8_t j=first; j<WPASIZE; j++) {
+		if ((wpa[j].login[0] == 0) || (!wlanAps[j].seen)) continue;
+		int32_t score = wlanAps[j].rssi;
+		score += (wlanAps[j].sent > 0 ? (20 * wlanAps[j].acked) / wlanAps[j].sent : 10);
+		score -= 5 * (wlanAps[j].failRow < 4 ? wlanAps[j].failRow : 4);
+		if ((best < 0) || (score > bestScore)) {
+			best = j;
+			bestScore = score;
 		}
 	}
+	if (best >= 0) return(best);
 	
-	// So try to connect to WLAN as long as we are not connected.
-	// The try parameters tells us how many times we try before giving up
-	// Value 0 is reserved for setup() first time connect
-	int i=0;
-
-	while ( (WiFi.status() != WL_CONNECTED) && ( i<= maxTry ) )
-	{
-
-		// We try every SSID in wpa array until success
-		for (int j=wpa_index; (j< (sizeof(wpa)/sizeof(wpa[0]))) && (WiFi.status() != WL_CONNECTED ); j++)
-		{
-			// Start with well-known access points in the list
-			char *ssid		= wpa[j].login;
-			char *password	= wpa[j].passw;
+	for (uint8_t k=1; k<=WPASIZE-first; k++) {
+		uint8_t j = first + ((wlan.ap + k - first) % (WPASIZE - first));	// Next after the last one
+		if (wpa[j].login[0] != 0) return(j);
+	}
+	return(-1);
+}
+
+
+// ----------------------------------------------------------------------------
+// The link is up. Administer the AP and the time it took.
+// ----------------------------------------------------------------------------
+void wlanConnected()
+{
+	for (uint8_t j=0; j<WPASIZE; j++) {
+		if (WiFi.SSID() == wpa[j].login) {
+			wlan.ap = j;
+			wlanAps[j].failRow = 0;
+			break;
+		}
+	}
+	if (wlan.lost != 0) {
+		wlan.msLast = millis() - wlan.lost;
+		if (wlan.msLast > wlan.msMax) wlan.msMax = wlan.msLast;
+		wlan.downSecs += wlan.msLast / 1000;
+		wlan.lost = 0;
+	}
+	// Only write the configuration when we are on another AP,
+	// the connect counter goes to the counter journal.
+	if (gwayConfig.ssid != WiFi.SSID()) {
+		writeGwayCfg(CONFIGFILE);
+	}
+	logCounters(CNT_WIFIS);
+	wlanState(L_UP);
 #if DUSB>=1
-			if (debug>=0)  {
-				Serial.print(i);
-				Serial.print(':');
-				Serial.print(j); 
-				Serial.print(':');
-				Serial.print(sizeof(wpa)/sizeof(wpa[0]));
-				Serial.print(F(". WiFi connect SSID=")); 
-				Serial.print(ssid);
-				if ( debug>=1 ) {
-					Serial.print(F(", pass="));
-					Serial.print(password);
-				}
-				Serial.println();
-			}
-#endif		
-			// Count the number of times we call WiFi.begin
-			gwayConfig.wifis++;
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M wlanConnected:: "));
+		Serial.print(WiFi.SSID());
+		Serial.print(F(", ms="));
+		Serial.println(wlan.msLast);
+	}
+#endif
+}
 
 
+// ----------------------------------------------------------------------------
+// No AP of the wpa list can be tried: start the access point of the
+// WiFiManager so that the user can give one. autoConnect() only returns
+// when it is connected. The AP is written to the config file and to the
+// first record of wpa, so wlanBest() tries it again after the next loss
+// of the link. wlanConnected() is called by the next wlanStep().
+// ----------------------------------------------------------------------------
+#if WIFIMANAGER==1
+void wlanPortal()
+{
+	WiFiManager wifiManager;
+#if DUSB>=1
+	Serial.println(F("Starting Access Point Mode"));
+	Serial.print(F("Connect Wifi to accesspoint: "));
+	Serial.print(AP_NAME);
+	Serial.print(F(" and connect to IP: 192.168.4.1"));
+	Serial.println();
+#endif
+	wifiManager.autoConnect(AP_NAME, AP_PASSWD );
+	
+	struct station_config sta_conf;
+	wifi_station_get_config(&sta_conf);
+	strncpy(wpa[0].login, (char *)sta_conf.ssid, sizeof(wpa[0].login)-1);
+	strncpy(wpa[0].passw, (char *)sta_conf.password, sizeof(wpa[0].passw)-1);
+	WlanWriteWpa((char *)sta_conf.ssid, (char *)sta_conf.password);
+}
+#endif
 
-			WiFi.mode(WIFI_STA);
-			delay(1000);
-			WiFi.begin(ssid, password);
-			delay(8000);
-			
-			// Check the connection status again, return values
-			// 1 = CONNECTED
-			// 0 = DISCONNECTED (will reconnect)
-			// -1 = No SSID or other cause			
-			int stat = WlanStatus();
-			if ( stat == 1) {
-				writeGwayCfg(CONFIGFILE);					// XXX Write configuration to SPIFFS
-				return(1);
-			}
-		
-			// We increase the time for connect but try the same SSID
-			// We try for 10 times
-			agains=1;
-			while (((WiFi.status()) != WL_CONNECTED) && (agains < 10)) {
-				agains++;
-				delay(agains*500);
+
+// ----------------------------------------------------------------------------
+// Keep the WiFi link up, without waiting. Called by loop() and bootStep().
+// While the link is down, received messages are queued by receivePacket().
+// ----------------------------------------------------------------------------
+void wlanStep()
+{
+	uint32_t ms = millis();
+	bool up = (WiFi.status() == WL_CONNECTED);
+	int n;
+	
+	switch (wlan.state) {
+	case L_UP:
+		if (up) break;
+		wlan.lost = ms;
+		wlan.outages++;
+		wlanState(L_DOWN);
 #if DUSB>=1
-				if ( debug>=0 ) {
-					Serial.print(".");
-				}
+		if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+			Serial.println(F("M wlanStep:: link lost"));
+		}
 #endif
+		break;
+	
+	// Give the SDK time to reconnect to the same AP, or the AP time to
+	// accept us. After that, look for the best AP.
+	case L_DOWN:
+	case L_JOIN:
+	case L_WAIT:
+		if (up) {
+			wlanConnected();
+			break;
+		}
+		if ((ms - wlan.since) < (wlan.state == L_DOWN ? WLAN_AUTO : 
+				(wlan.state == L_JOIN ? WLAN_JOIN : WLAN_WAIT))) {
+			break;
+		}
+		if (wlan.state == L_JOIN) {
+			wlanAps[wlan.ap].fails++;
+			wlanAps[wlan.ap].failRow++;
+		}
+		WiFi.scanNetworks(true);						// Async
+		wlanState(L_SCAN);
+		break;
+	
+	case L_SCAN:
+		n = WiFi.scanComplete();
+		if ((n == WIFI_SCAN_RUNNING) && ((ms - wlan.since) < WLAN_SCAN)) break;
+		for (uint8_t j=0; j<WPASIZE; j++) {
+			wlanAps[j].seen = false;
+			for (int i=0; i<n; i++) {
+				if (WiFi.SSID(i) != wpa[j].login) continue;
+				int16_t rssi = WiFi.RSSI(i);
+				wlanAps[j].rssi = (wlanAps[j].rssi == 0 ? rssi : (3 * wlanAps[j].rssi + rssi) / 4);
+				wlanAps[j].seen = true;
+				break;
 			}
+		}
+		WiFi.scanDelete();
+		if ((n = wlanBest()) < 0) {
+#if WIFIMANAGER==1
+			wlanPortal();
+#endif
+			wlanState(L_WAIT);
+			break;
+		}
+		wlan.ap = n;
+		wlanAps[n].joins++;
+		gwayConfig.wifis++;								// Count the number of times we call WiFi.begin
 #if DUSB>=1
-			Serial.println();
-#endif		
-			//if ( WiFi.status() == WL_DISCONNECTED) return(0);				// XXX 180811 removed
+		if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+			Serial.print(F("M wlanStep:: join "));
+			Serial.print(wpa[n].login);
+			Serial.print(F(", rssi="));
+			Serial.println(wlanAps[n].rssi);
+		}
+#endif
+		WiFi.mode(WIFI_STA);
+		WiFi.begin(wpa[n].login, wpa[n].passw);
+		wlanState(L_JOIN);
+		break;
+	}
+}
 
 
-			// Make sure that we can connect to different AP's than 1
-			// this is a patch. Normally we connect to previous one.
-			WiFi.persistent(false);
-			WiFi.mode(WIFI_OFF);   // this is a temporary line, to be removed after SDK update to 1.5.4
+// ----------------------------------------------------------------------------
+// Callback of dns_gethostbyname(). It runs in the context of the network
+// stack, so only the answer is stored and dnsStep() handles it.
+// ----------------------------------------------------------------------------
+void dnsFound(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+	struct dnsEntry *e = (struct dnsEntry *) arg;
+	e->found = (ipaddr != NULL ? DNS_IP4(ipaddr) : 0);
+	e->done = true;
+}
 
-		} //for next WPA defined AP
-	  
-		i++;			// Number of times we try to connect
-	} //while
 
+// ----------------------------------------------------------------------------
+// Is address i of entry e avoided after a failover?
+// ----------------------------------------------------------------------------
+bool dnsBad(struct dnsEntry *e, uint8_t i)
+{
+	return((e->bad[i] != 0) && ((int32_t) (millis() - e->bad[i]) < 0));
+}
+
+
+// ----------------------------------------------------------------------------
+// Use address a, the answer for entry e. It is put first in the list of
+// addresses of e, the oldest one is dropped if the list is full. The newest
+// address that is not avoided after a failover is used.
+// ----------------------------------------------------------------------------
+void dnsAddr(struct dnsEntry *e, uint32_t a)
+{
+	IPAddress ip(a);
+	uint32_t bad = 0;
+	uint8_t i;
 	
-	// If we are not connected to a well known AP
-	// we can invoike WIFIMANAGER or else return unsuccessful.
-	if (WiFi.status() != WL_CONNECTED) {
-#if WIFIMANAGER==1
+	if (e->start != 0) {								// Not after dnsFail()
+		e->msLast = millis() - e->start;
+		if (e->msLast > e->msMax) e->msMax = e->msLast;
+	}
+	e->start = 0;
+	for (i=0; (i<e->n) && (e->addr[i] != ip); i++) ;
+	if (i == e->n) {									// New address
+		if (e->n < DNS_ADDRS) e->n++;
+		i = e->n - 1;
+	}
+	else {
+		bad = e->bad[i];
+	}
+	for (; i>0; i--) {
+		e->addr[i] = e->addr[i-1];
+		e->bad[i] = e->bad[i-1];
+	}
+	e->addr[0] = ip;
+	e->bad[0] = bad;
+	for (i=0; (i<e->n) && dnsBad(e, i); i++) ;
+	e->cur = (i < e->n ? i : 0);
+	*e->ip = e->addr[e->cur];
+	e->next = millis() + (uint32_t) _DNS_TTL * 1000;
+}
+
+
+// ----------------------------------------------------------------------------
+// No answer for entry e. The address in use is kept.
+// ----------------------------------------------------------------------------
+void dnsFail(struct dnsEntry *e)
+{
+	e->fails++;
+	e->start = 0;
+	e->next = millis() + DNS_RETRY;
 #if DUSB>=1
-		Serial.println(F("Starting Access Point Mode"));
-		Serial.print(F("Connect Wifi to accesspoint: "));
-		Serial.print(AP_NAME);
-		Serial.print(F(" and connect to IP: 192.168.4.1"));
-		Serial.println();
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M dnsFail:: "));
+		Serial.println(e->name);
+	}
 #endif
-		wifiManager.autoConnect(AP_NAME, AP_PASSWD );
-		//wifiManager.startConfigPortal(AP_NAME, AP_PASSWD );
-		// At this point, there IS a Wifi Access Point found and connected
-		// We must connect to the local SPIFFS storage to store the access point
-		//String s = WiFi.SSID();
-		//char ssidBuf[s.length()+1];
-		//s.toCharArray(ssidBuf,s.length()+1);
-		// Now look for the password
-		struct station_config sta_conf;
-		wifi_station_get_config(&sta_conf);
-
-		//WlanWriteWpa(ssidBuf, (char *)sta_conf.password);
-		WlanWriteWpa((char *)sta_conf.ssid, (char *)sta_conf.password);
-#else
-#if DUSB>=1
-		if (debug>=0) {
-			Serial.println(F("WlanConnect:: Not connected after all"));
-			Serial.print(F("WLAN retry="));
-			Serial.print(i);
-			Serial.print(F(" , stat="));
-			Serial.print(WiFi.status() );						// Status. 3 is WL_CONNECTED
-			Serial.println();
+}
+
+
+// ----------------------------------------------------------------------------
+// Resolve the server names that are due, and handle the answers. Called
+// by loop() and bootStep(), it does not wait for the answers.
+// Returns:
+//	Number of names that have an address
+// ----------------------------------------------------------------------------
+int dnsStep()
+{
+	int ok = 0;
+	
+	for (uint8_t i=0; i<DNS_ENTRIES; i++) {
+		struct dnsEntry *e = &dnsCache[i];
+		if (e->done) {
+			e->done = false;
+			if (e->found != 0) dnsAddr(e, e->found);
+			else dnsFail(e);
 		}
-#endif// DUSB
-		return(-1);
+		else if (e->start != 0) {
+			if ((millis() - e->start) > DNS_TIMEOUT) dnsFail(e);
+		}
+		else if ((int32_t) (millis() - e->next) >= 0) {
+			ip_addr_t a;
+			e->lookups++;
+			e->start = millis() | 1;					// Not 0
+			err_t err = dns_gethostbyname(e->name, &a, dnsFound, (void *) e);
+			if (err == ERR_OK) {
+				dnsAddr(e, DNS_IP4(&a));				// Answer was in the lwIP cache
+			}
+			else if (err != ERR_INPROGRESS) {
+				dnsFail(e);
+			}
+		}
+		if (e->n > 0) ok++;
+	}
+	return(ok);
+}
+
+
+// ----------------------------------------------------------------------------
+// Avoid the address in use of entry e for DNS_BAD mSec and use the next
+// one that is not avoided, and resolve its name again now.
+// ----------------------------------------------------------------------------
+void dnsFailover(struct dnsEntry *e)
+{
+	e->miss = 0;
+	e->waiting = false;
+	e->lost = true;
+	if (e->n > 1) {
+		uint8_t c = e->cur;
+		e->bad[c] = (millis() + DNS_BAD) | 1;			// Not 0
+		do {
+			c = (c + 1) % e->n;
+		} while ((c != e->cur) && dnsBad(e, c));
+		if (c == e->cur) c = (c + 1) % e->n;			// All avoided, the next one
+		e->cur = c;
+		*e->ip = e->addr[e->cur];
+		e->failovers++;
+	}
+	if (e->start == 0) e->next = millis();
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M dnsFailover:: "));
+		Serial.print(e->name);
+		Serial.print(F(" -> "));
+		Serial.println(*e->ip);
+	}
 #endif
+}
+
+
+// ----------------------------------------------------------------------------
+// A PUSH_DATA was sent to server. If the previous ones were not 
+// acknowledged within DNS_ACKWAIT the server may have moved.
+// ----------------------------------------------------------------------------
+void dnsPush(IPAddress server)
+{
+	uint32_t ms = millis();
+	
+	for (uint8_t i=0; i<DNS_ENTRIES; i++) {
+		struct dnsEntry *e = &dnsCache[i];
+		if (*e->ip != server) continue;
+		if (e->waiting) {
+			if ((ms - e->pushed) < DNS_ACKWAIT) continue;	// Answer may be on its way
+			e->miss++;
+		}
+		e->waiting = true;
+		e->pushed = ms;
+		if (e->miss >= DNS_ACKLOST) dnsFailover(e);
 	}
+}
 
-	yield();
-	return(1);
+
+// ----------------------------------------------------------------------------
+// A PUSH_ACK was received from server, so it is not avoided any more.
+// ----------------------------------------------------------------------------
+void dnsAck(IPAddress server)
+{
+	for (uint8_t i=0; i<DNS_ENTRIES; i++) {
+		struct dnsEntry *e = &dnsCache[i];
+		for (uint8_t j=0; j<e->n; j++) {
+			if (e->addr[j] == server) e->bad[j] = 0;
+		}
+		if (*e->ip != server) continue;
+		e->waiting = false;
+		e->miss = 0;
+		e->lost = false;
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// Is the server with address ip not acknowledging our PUSH_DATA messages? 
+// Then it gets no uplinks until it answers again, see upDests().
+// Parameters:
+//	ip: Address of the server in dnsCache, e.g. &ttnServer
+// ----------------------------------------------------------------------------
+bool dnsLost(IPAddress *ip)
+{
+	for (uint8_t i=0; i<DNS_ENTRIES; i++) {
+		if (dnsCache[i].ip == ip) return(dnsCache[i].lost);
+	}
+	return(false);
 }
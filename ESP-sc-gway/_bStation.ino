@@ -0,0 +1,818 @@
+// bStation.ino; 1-channel LoRa Gateway for ESP8266
+// Copyright (c) 2016, 2017, 2018 Maarten Westenberg
+// Verison 5.3.3
+// Date: 2018-08-25
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Author: Maarten Westenberg (mw12554@hotmail.com)
+//
+// This file contains the LoRa Basics Station protocol, used instead of the
+// Semtech UDP protocol when _BSTATION==1. The gateway keeps one websocket to
+// the LNS open. Uplinks go up as updf (or jreq, propdf) messages, downlinks
+// come down as dnmsg and are confirmed with dntxed once transmitted.
+// See https://doc.sm.tc/station/tcproto.html
+//
+// Note: As the ESP8266 has little memory, only ws:// is supported and every
+// message must fit in one websocket frame of BS_BUFSIZE bytes.
+// ============================================================================
+
+#if _BSTATION==1
+
+#define BS_OUT (bsMsg + WS_HDR)					// Where messages are composed
+
+// ----------------------------------------------------------------------------
+// Go to a new state of the LNS connection
+// ----------------------------------------------------------------------------
+void bsState(uint8_t s)
+{
+	bs.state = s;
+	bs.since = millis();
+}
+
+
+// ----------------------------------------------------------------------------
+// Close the connection after a failure and try again later. The time
+// between attempts doubles up to BS_RETRY_MAX seconds.
+// ----------------------------------------------------------------------------
+void bsFail(const char *reason)
+{
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M bsFail:: state="));
+		Serial.print(bs.state);
+		Serial.print(F(", "));
+		Serial.println(reason);
+	}
+#endif
+	bsClient.stop();
+	bs.open = false;
+	bs.inLen = 0;
+	if ((bs.state == BS_UP) || (bs.retry == 0)) bs.retry = 1;	// Was working, retry soon
+	bs.next = millis() + (uint32_t) bs.retry * 1000;
+	if (bs.retry < BS_RETRY_MAX) bs.retry *= 2;
+	bsDn.state = BS_DN_NONE;
+	statBs.fails++;
+	bsState(BS_IDLE);
+}
+
+
+// ----------------------------------------------------------------------------
+// Open a websocket, which is a TCP connection with a HTTP upgrade request.
+// The reply is handled by wsUpgrade(). We do not check the accept key as
+// that needs SHA-1. The address is resolved already, connect() blocks at
+// most BS_CONNECT mSec for an LNS that does not answer.
+// Parameters:
+//	ip, port: Where to connect
+//	host: Name of ip, for the Host header
+//	path: Of the websocket
+// Returns:
+//	true when the request is sent
+// ----------------------------------------------------------------------------
+bool wsConnect(IPAddress ip, uint16_t port, const char *host, const char *path)
+{
+	uint8_t key[16];
+	char k64[28];
+
+	bsClient.stop();
+	bs.open = false;
+	bs.inLen = 0;
+	bsClient.setTimeout(BS_CONNECT);
+	if (!bsClient.connect(ip, port)) {
+		return(false);
+	}
+	bsClient.setNoDelay(true);
+	for (int i=0; i<16; i++) key[i] = (uint8_t) rand();
+	base64_encode(k64, (char *) key, 16);
+
+	int n = snprintf(bsMsg, sizeof(bsMsg),
+		"GET %s HTTP/1.1\r\nHost: %s:%u\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n",
+		path, host, port, k64);
+	return(bsClient.write((uint8_t *) bsMsg, n) == (size_t) n);
+}
+
+
+// ----------------------------------------------------------------------------
+// Check the reply to the upgrade request in bs.in. The frames that follow
+// the HTTP header are left in the buffer.
+// Returns:
+//	1 when open, 0 when the header is not complete yet, -1 on error
+// ----------------------------------------------------------------------------
+int wsUpgrade()
+{
+	bs.in[bs.inLen] = 0;
+	char *e = strstr((char *) bs.in, "\r\n\r\n");
+	if (e == NULL) {
+		return(bs.inLen < (BS_BUFSIZE-1) ? 0 : -1);
+	}
+	if (strncmp((char *) bs.in, "HTTP/1.1 101", 12) != 0) {
+		return(-1);
+	}
+	uint16_t h = (e + 4) - (char *) bs.in;
+	memmove(bs.in, bs.in + h, bs.inLen - h);
+	bs.inLen -= h;
+	bs.open = true;
+	return(1);
+}
+
+
+// ----------------------------------------------------------------------------
+// Send a websocket frame with the len bytes at BS_OUT. Frames of a client
+// are masked, which is done in place. The header is put in front of the
+// message so that the frame is written in one TCP segment.
+// ----------------------------------------------------------------------------
+bool wsSend(uint8_t op, uint16_t len)
+{
+	uint8_t *p = (uint8_t *) BS_OUT;
+	uint8_t *mask = p - 4;
+
+	for (int i=0; i<4; i++) mask[i] = (uint8_t) rand();
+	for (uint16_t i=0; i<len; i++) p[i] ^= mask[i & 3];
+	if (len < 126) {
+		p = mask - 2;
+		p[1] = 0x80 | len;								// Masked
+	}
+	else {
+		p = mask - 4;
+		p[1] = 0x80 | 126;
+		p[2] = len >> 8;
+		p[3] = len & 0xFF;
+	}
+	p[0] = 0x80 | op;									// FIN, one frame
+	size_t n = (BS_OUT + len) - (char *) p;
+	if (bsClient.write(p, n) != n) {
+		return(false);
+	}
+	statBs.bytesOut += len;
+	return(true);
+}
+
+
+// ----------------------------------------------------------------------------
+// Handle the first frame in bs.in, if it is complete. Server frames are
+// not masked, but we allow it. Fragmented frames are not supported.
+// Returns:
+//	1 if a frame is handled, 0 if there is none (yet), -1 on error
+// ----------------------------------------------------------------------------
+int wsFrame()
+{
+	if (bs.inLen < 2) return(0);
+
+	uint8_t op = bs.in[0] & 0x0F;
+	bool masked = (bs.in[1] & 0x80);
+	uint16_t len = bs.in[1] & 0x7F;
+	uint16_t h = 2;
+	if (len == 127) {
+		return(-1);										// Far too big for us
+	}
+	if (len == 126) {
+		if (bs.inLen < 4) return(0);
+		len = (bs.in[2] << 8) | bs.in[3];
+		h = 4;
+	}
+	if (masked) h += 4;
+	if ((h + len) >= BS_BUFSIZE) {
+		return(-1);										// Does not fit with its 0
+	}
+	if (bs.inLen < (h + len)) return(0);
+	if (((bs.in[0] & 0x80) == 0) || (op == 0)) {
+		return(-1);										// Fragment
+	}
+
+	uint8_t *p = bs.in + h;
+	if (masked) {
+		for (uint16_t i=0; i<len; i++) p[i] ^= bs.in[h - 4 + (i & 3)];
+	}
+	uint8_t c = p[len];
+	p[len] = 0;
+	bs.lastRx = millis();
+	statBs.bytesIn += len;
+
+	int ret = 1;
+	switch (op) {
+	case WS_TEXT:
+		ret = bsMessage((char *) p);
+		break;
+	case WS_PING:
+		if (len > 125) return(-1);
+		memcpy(BS_OUT, p, len);
+		if (!wsSend(WS_PONG, len)) ret = -1;
+		break;
+	case WS_PONG:
+		break;
+	case WS_CLOSE:
+		ret = -1;
+		break;
+	default:
+		statBs.other++;
+	}
+	if (ret <= 0) {
+		return(ret);									// Buffer reset or error
+	}
+	p[len] = c;
+	memmove(bs.in, bs.in + h + len, bs.inLen - h - len);
+	bs.inLen -= h + len;
+	return(1);
+}
+
+
+// ----------------------------------------------------------------------------
+// Find the value of "key" in a JSON message. As the messages of the LNS
+// are small and flat we do not need a JSON parser for that.
+// Returns:
+//	Pointer to the value, NULL if not found
+// ----------------------------------------------------------------------------
+char * bsKey(char *msg, const char *key)
+{
+	uint8_t n = strlen(key);
+	char *p = msg;
+	while ((p = strstr(p, key)) != NULL) {
+		char *q = p + n;
+		if ((p > msg) && (p[-1] == '"') && (*q == '"')) {
+			q++;
+			while (*q == ' ') q++;
+			if (*q == ':') {
+				q++;
+				while (*q == ' ') q++;
+				return(q);
+			}
+		}
+		p = q;
+	}
+	return(NULL);
+}
+
+
+// ----------------------------------------------------------------------------
+// Copy the string value of key to s.
+// ----------------------------------------------------------------------------
+bool bsStr(char *msg, const char *key, char *s, uint16_t size)
+{
+	char *p = bsKey(msg, key);
+	if ((p == NULL) || (*p != '"')) return(false);
+	p++;
+	uint16_t i = 0;
+	while ((*p != '"') && (*p != 0)) {
+		if (i >= (size - 1)) return(false);
+		s[i++] = *p++;
+	}
+	s[i] = 0;
+	return(*p == '"');
+}
+
+
+// ----------------------------------------------------------------------------
+// Copy the number value of key to s, as text. Used for the values we only
+// return to the LNS, like diid which may need all 64 bits.
+// ----------------------------------------------------------------------------
+bool bsTok(char *msg, const char *key, char *s, uint16_t size)
+{
+	char *p = bsKey(msg, key);
+	if (p == NULL) return(false);
+	uint16_t i = 0;
+	while ((*p == '-') || ((*p >= '0') && (*p <= '9'))) {
+		if (i >= (size - 1)) return(false);
+		s[i++] = *p++;
+	}
+	s[i] = 0;
+	return(i > 0);
+}
+
+
+// ----------------------------------------------------------------------------
+// Return the number value of key, or dflt if there is none
+// ----------------------------------------------------------------------------
+int64_t bsNum(char *msg, const char *key, int64_t dflt)
+{
+	char *p = bsKey(msg, key);
+	if ((p == NULL) || ((*p != '-') && ((*p < '0') || (*p > '9')))) {
+		return(dflt);
+	}
+	return(strtoll(p, NULL, 10));
+}
+
+
+// ----------------------------------------------------------------------------
+// Print a 64-bit number, which printf of the ESP8266 cannot do.
+// ----------------------------------------------------------------------------
+char * bsU64(char *s, uint64_t v)
+{
+	char b[21];
+	int i = 20;
+	b[i] = 0;
+	do {
+		b[--i] = '0' + (v % 10);
+		v /= 10;
+	} while (v > 0);
+	strcpy(s, b + i);
+	return(s);
+}
+
+
+// ----------------------------------------------------------------------------
+// Print len bytes as hex, and an EUI that is sent little endian as
+// "01-02-03-04-05-06-07-08".
+// Returns:
+//	Number of characters
+// ----------------------------------------------------------------------------
+int bsHex(char *s, uint8_t *b, uint8_t len)
+{
+	const char hex[] = "0123456789ABCDEF";
+	for (uint8_t i=0; i<len; i++) {
+		s[2*i] = hex[b[i] >> 4];
+		s[2*i+1] = hex[b[i] & 0x0F];
+	}
+	s[2*len] = 0;
+	return(2*len);
+}
+
+int bsEui(char *s, uint8_t *b)
+{
+	return(sprintf(s, "%02X-%02X-%02X-%02X-%02X-%02X-%02X-%02X",
+		b[7], b[6], b[5], b[4], b[3], b[2], b[1], b[0]));
+}
+
+
+// ----------------------------------------------------------------------------
+// Convert the hex string s to bytes in b, at most BS_PDU.
+// Returns:
+//	Number of bytes, 0 on error or when there are more
+// ----------------------------------------------------------------------------
+uint8_t bsUnhex(uint8_t *b, const char *s)
+{
+	uint8_t n = 0;
+	while ((s[0] != 0) && (s[1] != 0) && (n < BS_PDU)) {
+		char d[3] = { s[0], s[1], 0 };
+		char *e;
+		b[n++] = (uint8_t) strtol(d, &e, 16);
+		if (*e != 0) return(0);
+		s += 2;
+	}
+	return(*s == 0 ? n : 0);
+}
+
+
+// ----------------------------------------------------------------------------
+// Little endian signed 32-bit value, as DevAddr and MIC are reported
+// ----------------------------------------------------------------------------
+int32_t bsLe32(uint8_t *b)
+{
+	return((int32_t) ((uint32_t) b[0] | ((uint32_t) b[1] << 8) |
+		((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24)));
+}
+
+
+// ----------------------------------------------------------------------------
+// The xtime of a micros64() value. The upper bits contain the session, so
+// that the LNS cannot use xtime values of an earlier connection.
+// ----------------------------------------------------------------------------
+uint64_t bsXtime(uint64_t t)
+{
+	return(((uint64_t) bs.session << 48) | (t & 0xFFFFFFFFFFFFULL));
+}
+
+
+// ----------------------------------------------------------------------------
+// Handle the reply of router-info, which contains the uri of the muxs
+// (ws://host:port/path). The router-info connection is closed and the
+// host is resolved, bsLoop() connects when the answer is there.
+// Returns:
+//	0 when resolving the muxs, -1 on error
+// ----------------------------------------------------------------------------
+int bsInfo(char *msg)
+{
+	char uri[112];
+	if (!bsStr(msg, "uri", uri, sizeof(uri))) {
+#if DUSB>=1
+		if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+			Serial.print(F("M bsInfo:: no uri: "));
+			Serial.println(msg);
+		}
+#endif
+		return(-1);
+	}
+	if (strncmp(uri, "ws://", 5) != 0) {
+		return(-1);										// wss:// needs TLS
+	}
+	char *h = uri + 5;
+	char *p = strchr(h, '/');
+	strncpy(bs.path, (p != NULL ? p : "/"), sizeof(bs.path) - 1);
+	if (p != NULL) *p = 0;
+	char *c = strchr(h, ':');
+	bs.port = (c != NULL ? atoi(c + 1) : 80);
+	if (c != NULL) *c = 0;
+	strncpy(bs.host, h, sizeof(bs.host) - 1);
+
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M bsInfo:: muxs="));
+		Serial.print(bs.host);
+		Serial.print(':');
+		Serial.print(bs.port);
+		Serial.println(bs.path);
+	}
+#endif
+	bsClient.stop();
+	bs.open = false;
+	bs.inLen = 0;
+	bsState(BS_RESOLVE);
+	
+	ip_addr_t a;
+	bsDns.done = false;
+	bsDns.lookups++;
+	err_t err = dns_gethostbyname(bs.host, &a, dnsFound, (void *) &bsDns);
+	if (err == ERR_OK) {
+		bsDns.found = DNS_IP4(&a);						// In the lwIP cache
+		bsDns.done = true;
+	}
+	else if (err != ERR_INPROGRESS) {
+		return(-1);
+	}
+	return(0);
+}
+
+
+// ----------------------------------------------------------------------------
+// Wait for the address of the muxs, then connect to it.
+// ----------------------------------------------------------------------------
+void bsResolve()
+{
+	if (!bsDns.done) {
+		if ((millis() - bs.since) > BS_TIMEOUT) {
+			bsDns.fails++;
+			bsFail("dns");
+		}
+		return;
+	}
+	bsDns.done = false;
+	if (bsDns.found == 0) {
+		bsDns.fails++;
+		bsFail("dns");
+		return;
+	}
+	bs.ip = IPAddress(bsDns.found);
+	bsState(BS_MUXS);
+	if (!wsConnect(bs.ip, bs.port, bs.host, bs.path)) {
+		bsFail("connect");
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// Handle router_config. We only use the data rate table, as the channel
+// plan is set in ESP-sc-gway.h. The first one starts a new session.
+// ----------------------------------------------------------------------------
+void bsConfig(char *msg)
+{
+	char *p = bsKey(msg, "DRs");
+	if ((p != NULL) && (*p == '[')) {
+		p++;
+		for (uint8_t i=0; i<BS_DRS; i++) {
+			while ((*p == ' ') || (*p == ',')) p++;
+			if (*p != '[') break;
+			bsDrs[i].sf = (uint8_t) strtol(p + 1, &p, 10);
+			while ((*p == ' ') || (*p == ',')) p++;
+			bsDrs[i].bw = (uint16_t) strtol(p, &p, 10);
+			if ((p = strchr(p, ']')) == NULL) break;	// Skip dnonly
+			p++;
+		}
+	}
+	if (bs.state != BS_UP) {
+		bs.session = (bs.session % 127) + 1;
+		bs.retry = 1;
+		bs.lastPing = millis();
+		statBs.connects++;
+		bsState(BS_UP);
+	}
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M bsConfig:: session="));
+		Serial.println(bs.session);
+	}
+#endif
+}
+
+
+// ----------------------------------------------------------------------------
+// Put the downlink in LoraDown in the arbiter for time tmst, data rate dr
+// and frequency f. setRate() sends at 125 kHz only, so a data rate of 250
+// or 500 kHz is refused like one we do not know.
+// Returns:
+//	TX_NONE or the reason the message is not sent (txerr_t)
+// ----------------------------------------------------------------------------
+uint8_t bsTx(uint32_t tmst, int64_t dr, uint32_t f)
+{
+	if ((dr < 0) || (dr >= BS_DRS) || (bsDrs[dr].sf == 0) || (bsDrs[dr].bw != 125)) {
+		return(TX_FREQ);
+	}
+	LoraDown.tmst = tmst;
+	LoraDown.sfTx = bsDrs[dr].sf;
+#if _STRICT_1CH == 1
+	LoraDown.fff = freq;								// Use the current frequency
+#else
+	LoraDown.fff = f;
+#endif
+	radioSelect(TXRADIO);
+	uint8_t err = txQueue();
+	radioSelect(0);
+	return(err);
+}
+
+
+// ----------------------------------------------------------------------------
+// Handle a dnmsg. Class A downlinks are sent in RX1 and if that is not
+// possible in RX2, relative to the xtime of the uplink. Class C downlinks
+// are sent in RX2 as soon as possible.
+// ----------------------------------------------------------------------------
+void bsDnmsg(char *msg)
+{
+	char pdu[2*128+1];
+	uint8_t err;
+
+	statBs.dnmsg++;
+	cp_dw_dgram_rcv++;
+	
+	// Only one downlink can wait for its time, as it is kept in LoraDown
+	if (statTx.pending) {
+		statTx.err[TX_COLLISION]++;
+		statBs.dnerr++;
+		return;
+	}
+	if (!bsStr(msg, "pdu", pdu, sizeof(pdu)) ||
+		((LoraDown.payLength = bsUnhex(payLoad, pdu)) == 0)) {
+		statBs.dnerr++;
+		return;
+	}
+	if (!bsTok(msg, "diid", bsDn.diid, sizeof(bsDn.diid))) strcpy(bsDn.diid, "0");
+	if (!bsStr(msg, "DevEui", bsDn.devEui, sizeof(bsDn.devEui))) bsDn.devEui[0] = 0;
+	if (!bsTok(msg, "rctx", bsDn.rctx, sizeof(bsDn.rctx))) strcpy(bsDn.rctx, "0");
+	uint64_t xtime = (uint64_t) bsNum(msg, "xtime", 0);
+	uint32_t rxDelay = (uint32_t) bsNum(msg, "RxDelay", 1);
+	if (rxDelay == 0) rxDelay = 1;
+
+	LoraDown.payLoad = payLoad;
+	LoraDown.iiq = 0x40;								// Downlinks have inverted IQ
+	LoraDown.crc = 0x00;
+	LoraDown.powe = 14;
+
+	if (bsNum(msg, "dC", 0) == 2) {
+		err = bsTx((uint32_t) micros64() + 2 * TX_LEAD, bsNum(msg, "RX2DR", -1), bsNum(msg, "RX2Freq", 0));
+	}
+	else if ((xtime >> 48) != bs.session) {
+		err = TX_TOO_LATE;								// Uplink of an earlier session
+		statTx.err[TX_TOO_LATE]++;
+	}
+	else {
+		// The low 32 bits of xtime are the micros() of the uplink
+		uint32_t t = (uint32_t) xtime;
+		err = bsTx(t + rxDelay * 1000000, bsNum(msg, "RX1DR", -1), bsNum(msg, "RX1Freq", 0));
+#if _STRICT_1CH == 0
+		if (err != TX_NONE) {
+			err = bsTx(t + (rxDelay + 1) * 1000000, bsNum(msg, "RX2DR", -1), bsNum(msg, "RX2Freq", 0));
+		}
+#endif
+	}
+
+	if (err != TX_NONE) {
+		statBs.dnerr++;
+		bsDn.state = BS_DN_NONE;
+#if DUSB>=1
+		if (( debug>=1 ) && ( pdebug & P_TX )) {
+			Serial.print(F("T bsDnmsg:: not sent, "));
+			Serial.println(txErrStr[err]);
+		}
+#endif
+		return;
+	}
+	bsDn.state = BS_DN_QUEUED;
+}
+
+
+// ----------------------------------------------------------------------------
+// Called at TXDONE with the time the transmission started, so that loop()
+// can send the dntxed for the dnmsg.
+// ----------------------------------------------------------------------------
+void bsTxed(uint64_t t)
+{
+	if (bsDn.state == BS_DN_QUEUED) {
+		bsDn.state = BS_DN_TXED;
+		bsDn.txTime = t;
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// Send dntxed for the last dnmsg
+// ----------------------------------------------------------------------------
+void bsDntxed()
+{
+	char xt[24];
+	int64_t u = ntpLocal(millis()) - (int64_t) (micros64() - bsDn.txTime);	// UTC uSec
+
+	int n = snprintf(BS_OUT, BS_MSGSIZE,
+		"{\"msgtype\":\"dntxed\",\"diid\":%s,\"DevEui\":\"%s\",\"rctx\":%s,\"xtime\":%s,"
+		"\"txtime\":%lu.%06lu,\"gpstime\":0}",
+		bsDn.diid, bsDn.devEui, bsDn.rctx, bsU64(xt, bsXtime(bsDn.txTime)),
+		(unsigned long) (u / 1000000), (unsigned long) (u % 1000000));
+	bsDn.state = BS_DN_NONE;
+	if (!wsSend(WS_TEXT, n)) {
+		bsFail("send");
+		return;
+	}
+	statBs.dntxed++;
+}
+
+
+// ----------------------------------------------------------------------------
+// Handle a text message of the LNS.
+// Returns:
+//	1 when handled, 0 when the connection is replaced, -1 on error
+// ----------------------------------------------------------------------------
+int bsMessage(char *msg)
+{
+	char mt[16];
+
+#if DUSB>=1
+	if (( debug>=2 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M bsMessage:: "));
+		Serial.println(msg);
+	}
+#endif
+	if (bs.state == BS_INFO) {
+		return(bsInfo(msg));
+	}
+	if (!bsStr(msg, "msgtype", mt, sizeof(mt))) {
+		statBs.other++;
+	}
+	else if (strcmp(mt, "router_config") == 0) {
+		bsConfig(msg);
+	}
+	else if ((strcmp(mt, "dnmsg") == 0) && (bs.state == BS_UP)) {
+		bsDnmsg(msg);
+	}
+	else {
+		statBs.other++;									// timesync, runcmd etc.
+	}
+	return(1);
+}
+
+
+// ----------------------------------------------------------------------------
+// Send the message in LoraUp, received at tmst, to the LNS. Join requests
+// and data frames are sent as jreq and updf with their fields, other
+// frames as propdf.
+// Returns:
+//	Length of the message, -1 when it is not sent
+// ----------------------------------------------------------------------------
+int bsUplink(uint32_t tmst)
+{
+	uint8_t *m = LoraUp.payLoad;
+	uint8_t len = LoraUp.payLength;
+	uint8_t mtype = m[0] >> 5;
+	char *out = BS_OUT;
+	char xt[24];
+	int n;
+	uint8_t dr;
+
+	for (dr=0; dr<BS_DRS; dr++) {
+		if ((bsDrs[dr].sf == LoraUp.sf) && (bsDrs[dr].bw == 125)) break;
+	}
+	if ((bs.state != BS_UP) || (dr == BS_DRS)) {
+		statBs.lost++;
+		return(-1);
+	}
+
+	if ((mtype == 0) && (len == 23)) {					// Join request
+		n = sprintf(out, "{\"msgtype\":\"jreq\",\"MHdr\":%u,\"JoinEui\":\"", m[0]);
+		n += bsEui(out + n, m + 1);
+		n += sprintf(out + n, "\",\"DevEui\":\"");
+		n += bsEui(out + n, m + 9);
+		n += sprintf(out + n, "\",\"DevNonce\":%u,\"MIC\":%ld",
+			m[17] | (m[18] << 8), (long) bsLe32(m + 19));
+	}
+	else if (((mtype == 2) || (mtype == 4)) && (len >= (12 + (m[5] & 0x0F)))) {
+		uint8_t i = 8 + (m[5] & 0x0F);					// After FOpts
+		n = sprintf(out, "{\"msgtype\":\"updf\",\"MHdr\":%u,\"DevAddr\":%ld,\"FCtrl\":%u,\"FCnt\":%u,\"FOpts\":\"",
+			m[0], (long) bsLe32(m + 1), m[5], m[6] | (m[7] << 8));
+		n += bsHex(out + n, m + 8, m[5] & 0x0F);
+		int port = (i < (len - 4) ? m[i++] : -1);
+		n += sprintf(out + n, "\",\"FPort\":%d,\"FRMPayload\":\"", port);
+		n += bsHex(out + n, m + i, len - 4 - i);
+		n += sprintf(out + n, "\",\"MIC\":%ld", (long) bsLe32(m + len - 4));
+	}
+	else {
+		n = sprintf(out, "{\"msgtype\":\"propdf\",\"FRMPayload\":\"");
+		n += bsHex(out + n, m, len);
+		n += sprintf(out + n, "\"");
+	}
+	n += snprintf(out + n, BS_MSGSIZE - n,
+		",\"RefTime\":0.0,\"DR\":%u,\"Freq\":%lu,\"upinfo\":{\"rctx\":%u,\"xtime\":%s,\"gpstime\":0,\"rssi\":%d,\"snr\":%ld}}",
+		dr, (unsigned long) freq, rad, bsU64(xt, bsXtime(tmst64(tmst))),
+		LoraUp.prssi - LoraUp.rssicorr, LoraUp.snr);
+
+	if (!wsSend(WS_TEXT, n)) {
+		bsFail("send");
+		statBs.lost++;
+		return(-1);
+	}
+	statBs.updf++;
+	return(n);
+}
+
+
+// ----------------------------------------------------------------------------
+// Connect to the LNS and handle what it sends. Called by loop() when
+// there is WiFi. Nothing in here waits for DNS, and the TCP connect at
+// most BS_CONNECT mSec.
+// ----------------------------------------------------------------------------
+void bsLoop()
+{
+	int n;
+
+	if (bs.state == BS_IDLE) {
+		if ((int32_t) (millis() - bs.next) < 0) return;
+		bsState(BS_INFO);
+		if (lnsServer == IPAddress(0, 0, 0, 0)) {
+			bsFail("dns");								// dnsStep() did not resolve it yet
+		}
+		else if (!wsConnect(lnsServer, _LNSPORT, _LNSSERVER, "/router-info")) {
+			bsFail("connect");
+		}
+		return;
+	}
+	if (bs.state == BS_RESOLVE) {
+		bsResolve();
+		return;
+	}
+	if ((!bsClient.connected()) && (bsClient.available() == 0)) {
+		bsFail("closed");
+		return;
+	}
+	if ((bs.state != BS_UP) && ((millis() - bs.since) > BS_TIMEOUT)) {
+		bsFail("timeout");
+		return;
+	}
+
+	// Keep one byte free for the 0 at the end of a message
+	n = bsClient.available();
+	if ((n > 0) && (bs.inLen < (BS_BUFSIZE-1))) {
+		if (n > (BS_BUFSIZE-1 - bs.inLen)) n = BS_BUFSIZE-1 - bs.inLen;
+		n = bsClient.read(bs.in + bs.inLen, n);
+		if (n > 0) bs.inLen += n;
+	}
+
+	if (!bs.open) {
+		n = wsUpgrade();
+		if (n < 0) {
+			bsFail("upgrade");
+			return;
+		}
+		if (n == 0) return;
+
+		if (bs.state == BS_INFO) {
+			n = sprintf(BS_OUT, "{\"router\":\"%02X-%02X-%02X-FF-FF-%02X-%02X-%02X\"}",
+				MAC_array[0], MAC_array[1], MAC_array[2], MAC_array[3], MAC_array[4], MAC_array[5]);
+		}
+		else {
+			n = snprintf(BS_OUT, BS_MSGSIZE,
+				"{\"msgtype\":\"version\",\"station\":\"%s\",\"firmware\":null,\"package\":null,"
+				"\"model\":\"%s\",\"protocol\":2,\"features\":\"\"}", VERSION, _PLATFORM);
+			bsState(BS_CONFIG);
+		}
+		if (!wsSend(WS_TEXT, n)) {
+			bsFail("send");
+			return;
+		}
+	}
+
+	while ((n = wsFrame()) > 0) yield();
+	if (n < 0) {
+		bsFail("frame");
+		return;
+	}
+
+	if (bs.state != BS_UP) return;
+	uint32_t ms = millis();
+	if ((ms - bs.lastRx) > (3 * BS_PING)) {
+		bsFail("silent");
+		return;
+	}
+	if ((ms - bs.lastPing) > BS_PING) {
+		bs.lastPing = ms;
+		if (!wsSend(WS_PING, 0)) {
+			bsFail("send");
+			return;
+		}
+	}
+	if (bsDn.state == BS_DN_TXED) {
+		bsDntxed();
+	}
+}
+
+#endif // _BSTATION
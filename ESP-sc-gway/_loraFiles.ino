@@ -24,16 +24,116 @@
 // The LoRa supporting functions are in the section below
 
 // ----------------------------------------------------------------------------
-// Supporting function to readConfig
+// CRC32 (IEEE 802.3, reflected) of a buffer. Bitwise, so no table in RAM
+// is needed. Only used when reading or writing config records.
 // ----------------------------------------------------------------------------
-void id_print (String id, String val) {
+uint32_t calcCrc32(const uint8_t *buf, int len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (int i=0; i<len; i++) {
+		crc ^= buf[i];
+		for (int k=0; k<8; k++) {
+			crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+		}
+	}
+	return(~crc);
+}
+
+// ----------------------------------------------------------------------------
+// Check a config record: magic, version, length and CRC. The CRC is stored 
+// in the last 4 bytes of the record.
+// Parameters:
+//		rec; Pointer to the record (starting with a cfgHdr)
+//		len; Expected length of the record
+// Returns:
+//		true if the record is valid
+// ----------------------------------------------------------------------------
+bool checkSlot(struct cfgHdr *rec, uint16_t len)
+{
+	uint32_t crc;
+	if ((rec->magic != CFGMAGIC) || (rec->version != CFGVERSION) || (rec->len != len)) {
+		return(false);
+	}
+	memcpy(&crc, ((uint8_t *) rec) + len - sizeof(uint32_t), sizeof(uint32_t));
+	return(crc == calcCrc32((uint8_t *) rec, len - sizeof(uint32_t)));
+}
+
+// ----------------------------------------------------------------------------
+// Read the slots <fn>.a and <fn>.b and return the valid record with the 
+// highest sequence number in rec. Each slot is read with one read() call.
+// Parameters:
+//		fn; Base filename of the slots
+//		rec; Record to fill (starting with a cfgHdr)
+//		len; Length of the record, max sizeof(struct cfgRec)
+// Returns:
+//		Slot number read (0 or 1), -1 if no slot is valid
+// ----------------------------------------------------------------------------
+int readSlots(const char *fn, struct cfgHdr *rec, uint16_t len)
+{
+	char sn[32];
+	uint8_t buf[2][sizeof(struct cfgRec)];
+	int slot = -1;
+	
+	if (len > sizeof(struct cfgRec)) return(-1);
+	
+	for (int i=0; i<2; i++) {
+		sprintf(sn, "%s.%c", fn, 'a'+i);
+		File f = SPIFFS.open(sn, "r");
+		if (!f) continue;
+		int n = f.read(buf[i], len);
+		f.close();
+		
+		if ((n != len) || !checkSlot((struct cfgHdr *) buf[i], len)) {
 #if DUSB>=1
-	if (( debug>=0 ) && ( pdebug & P_MAIN )) {
-		Serial.print(id);
-		Serial.print(F("=\t"));
-		Serial.println(val);
+			if (( debug>=0 ) && ( pdebug & P_MAIN )) {
+				Serial.print(F("M readSlots:: invalid slot="));
+				Serial.println(sn);
+			}
+#endif
+			continue;
+		}
+		if ((slot < 0) || (((struct cfgHdr *) buf[i])->seq > ((struct cfgHdr *) buf[slot])->seq)) {
+			slot = i;
+		}
 	}
+	if (slot >= 0) memcpy(rec, buf[slot], len);
+	return(slot);
+}
+
+// ----------------------------------------------------------------------------
+// Write record rec to the next slot of fn. The sequence number is 
+// incremented and the CRC computed before writing.
+// Parameters:
+//		fn; Base filename of the slots
+//		rec; Record to write (starting with a cfgHdr)
+//		len; Length of the record
+// Returns:
+//		1 when successful, -1 on error
+// ----------------------------------------------------------------------------
+int writeSlots(const char *fn, struct cfgHdr *rec, uint16_t len)
+{
+	char sn[32];
+	uint32_t crc;
+	
+	rec->magic = CFGMAGIC;
+	rec->version = CFGVERSION;
+	rec->len = len;
+	rec->seq++;
+	crc = calcCrc32((uint8_t *) rec, len - sizeof(uint32_t));
+	memcpy(((uint8_t *) rec) + len - sizeof(uint32_t), &crc, sizeof(uint32_t));
+	
+	sprintf(sn, "%s.%c", fn, 'a' + (int)(rec->seq % 2));
+	File f = SPIFFS.open(sn, "w");
+	if (!f) {
+#if DUSB>=1
+		Serial.print(F("ERROR:: writeSlots, open file="));
+		Serial.println(sn);
 #endif
+		return(-1);
+	}
+	int n = f.write((uint8_t *) rec, len);
+	f.close();
+	return(n == len ? 1 : -1);
 }
 
 // ----------------------------------------------------------------------------
@@ -50,164 +150,290 @@ int initConfig(struct espGwayConfig *c) {
 	(*c).cad = _CAD;
 	(*c).hop = false;
 	(*c).expert = false;
+	return(1);
 }
 
 
 // ----------------------------------------------------------------------------
-// Read the gateway configuration file
+// Read the gateway configuration from its slots, and the counters from
+// the COUNTFILE slots. When there is no valid configuration we convert the
+// CONFIGTXT file of older versions, or else start with the initConfig() 
+// settings. We do not format SPIFFS anymore since that would also remove 
+// the log and a good counter record.
+// Parameters:
+//		fn; Base filename of the config slots
+//		c; struct config
+// Returns:
+//		1 when successful, -1 when the default config is used
 // ----------------------------------------------------------------------------
 int readConfig(const char *fn, struct espGwayConfig *c) {
 
-	int tries = 0;
 #if DUSB>=1
 	Serial.println(F("readConfig:: Starting "));
 #endif
-	if (!SPIFFS.exists(fn)) {
+	readCounters(COUNTFILE, c);
+	
+	if (readSlots(fn, &cfgRec.hdr, sizeof(struct cfgRec)) < 0) {
 #if DUSB>=1
-		if (( debug>=0 ) && ( pdebug & P_MAIN ))
-		Serial.print(F("M ERR:: readConfig, file="));
-		Serial.print(fn);
-		Serial.println(F(" does not exist .. Formatting"));
+		if (( debug>=0 ) && ( pdebug & P_MAIN )) {
+			Serial.print(F("M ERR:: readConfig, no valid config="));
+			Serial.println(fn);
+		}
 #endif
-		SPIFFS.format();
+		memset(&cfgRec, 0, sizeof(struct cfgRec));
 		initConfig(c);
+		
+		// Convert the text config file of older versions. The counters are
+		// written first; the text file is only removed when both are written,
+		// so a power failure during the conversion just repeats it.
+		if (readConfigTxt(CONFIGTXT, c) > 0) {
+			if ((writeCounters(COUNTFILE, c) > 0) && (writeConfig(fn, c) > 0)) {
+				SPIFFS.remove(CONFIGTXT);
+			}
+			return(1);
+		}
 		return(-1);
 	}
+	if (SPIFFS.exists(CONFIGTXT)) SPIFFS.remove(CONFIGTXT);	// Converted before
+	
+	(*c).ch = cfgRec.ch;
+	(*c).sf = cfgRec.sf;
+	(*c).debug = cfgRec.debug;
+	(*c).pdebug = cfgRec.pdebug;
+	(*c).cad = cfgRec.cad;
+	(*c).hop = cfgRec.hop;
+	(*c).isNode = cfgRec.isNode;
+	(*c).refresh = cfgRec.refresh;
+	(*c).expert = cfgRec.expert;
+	cfgRec.ssid[sizeof(cfgRec.ssid)-1] = 0;
+	cfgRec.pass[sizeof(cfgRec.pass)-1] = 0;
+	(*c).ssid = cfgRec.ssid;
+	(*c).pass = cfgRec.pass;
 
-	File f = SPIFFS.open(fn, "r");
-	if (!f) {
-		Serial.println(F("ERROR:: SPIFFS open failed"));
-		return(-1);
+#if DUSB>=1
+	if (( debug>=0 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M readConfig:: seq="));
+		Serial.print(cfgRec.hdr.seq);
+		Serial.print(F(", SSID="));
+		Serial.print((*c).ssid);
+		Serial.print(F(", CH="));
+		Serial.print((*c).ch);
+		Serial.print(F(", SF="));
+		Serial.print((*c).sf);
+		Serial.print(F(", BOOTS="));
+		Serial.println((*c).boots);
 	}
+#endif
+	return(1);
+}
+
+// ----------------------------------------------------------------------------
+// Read the text configuration file of older versions, one ID=value per 
+// line, into c. Unknown IDs are skipped.
+// Parameters:
+//		fn; Name of the text file
+//		c; struct config
+// Returns:
+//		Number of settings read, -1 when there is no such file
+// ----------------------------------------------------------------------------
+int readConfigTxt(const char *fn, struct espGwayConfig *c) {
 
+	int n = 0;
+	
+	if (!SPIFFS.exists(fn)) return(-1);
+	File f = SPIFFS.open(fn, "r");
+	if (!f) return(-1);
+	
 	while (f.available()) {
+		String id = f.readStringUntil('=');
+		String val = f.readStringUntil('\n');
+		n++;
 		
+		if (id == "SSID") (*c).ssid = val;
+		else if (id == "PASS") (*c).pass = val;
+		else if (id == "CH") (*c).ch = val.toInt();
+		else if (id == "SF") (*c).sf = val.toInt();
+		else if (id == "FCNT") (*c).fcnt = val.toInt();
+		else if (id == "DEBUG") (*c).debug = val.toInt();
+		else if (id == "PDEBUG") (*c).pdebug = val.toInt();
+		else if (id == "CAD") (*c).cad = val.toInt();
+		else if (id == "HOP") (*c).hop = val.toInt();
+		else if (id == "NODE") (*c).isNode = val.toInt();
+		else if (id == "REFR") (*c).refresh = val.toInt();
+		else if (id == "EXPERT") (*c).expert = val.toInt();
+		else if (id == "BOOTS") (*c).boots = val.toInt();
+		else if (id == "RESETS") (*c).resets = val.toInt();
+		else if (id == "WIFIS") (*c).wifis = val.toInt();
+		else if (id == "VIEWS") (*c).views = val.toInt();
+		else if (id == "REENTS") (*c).reents = val.toInt();
+		else if (id == "NTPERR") (*c).ntpErr = val.toInt();
+		else if (id == "NTPETIM") (*c).ntpErrTime = val.toInt();
+		else if (id == "NTPS") (*c).ntps = val.toInt();
+		else if (id == "FILENO") (*c).logFileNo = val.toInt();	// Used by initLog() to
+		else if (id == "FILEREC") (*c).logFileRec = val.toInt();	// remove the old logs
+		else if (id == "FILENUM") (*c).logFileNum = val.toInt();
+		else n--;
+	}
+	f.close();
+	
 #if DUSB>=1
-		if (( debug>=0 ) && ( pdebug & P_MAIN )) {
-			Serial.print('.');
-		}
-#endif
-		// If we wait for more than 10 times, reformat the filesystem
-		// We do this so that the system will be responsive (over OTA for example).
-		//
-		if (tries >= 10) {
-			f.close();
-#if DUSB>=1
-			if (( debug>=0 ) && ( pdebug & P_MAIN ))
-				Serial.println(F("Formatting"));
+	if (( debug>=0 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M readConfigTxt:: converted="));
+		Serial.print(fn);
+		Serial.print(F(", settings="));
+		Serial.println(n);
+	}
 #endif
-			SPIFFS.format();
-			initConfig(c);
-			f = SPIFFS.open(fn, "r");
-			tries = 0;
-		}
-		
-		String id =f.readStringUntil('=');						// C++ thing
-		String val=f.readStringUntil('\n');
-		
-		if (id == "SSID") {										// WiFi SSID
-			id_print(id, val);
-			(*c).ssid = val;									// val contains ssid, we do NO check
-		}
-		else if (id == "PASS") { 								// WiFi Password
-			id_print(id, val); 
-			(*c).pass = val;
-		}
-		else if (id == "CH") { 									// Frequency Channel
-			id_print(id,val); 
-			(*c).ch = (uint32_t) val.toInt();
-		}
-		else if (id == "SF") { 									// Spreading Factor
-			id_print(id, val);
-			(*c).sf = (uint32_t) val.toInt();
-		}
-		else if (id == "FCNT") {								// Frame Counter
-			id_print(id, val);
-			(*c).fcnt = (uint32_t) val.toInt();
-		}
-		else if (id == "DEBUG") {								// Debug Level
-			id_print(id, val);
-			(*c).debug = (uint8_t) val.toInt();
-		}
-		else if (id == "PDEBUG") {								// pDebug Pattern
-			Serial.print(F("PDEBUG=")); Serial.println(val);
-			(*c).pdebug = (uint8_t) val.toInt();
-		}
-		else if (id == "CAD") {									// CAD setting
-			Serial.print(F("CAD=")); Serial.println(val);
-			(*c).cad = (uint8_t) val.toInt();
-		}
-		else if (id == "HOP") {									// HOP setting
-			Serial.print(F("HOP=")); Serial.println(val);
-			(*c).hop = (uint8_t) val.toInt();
-		}
-		else if (id == "BOOTS") {								// BOOTS setting
-			id_print(id, val);
-			(*c).boots = (uint8_t) val.toInt();
-		}
-		else if (id == "RESETS") {								// RESET setting
-			id_print(id, val);
-			(*c).resets = (uint8_t) val.toInt();
-		}
-		else if (id == "WIFIS") {								// WIFIS setting
-			id_print(id, val);
-			(*c).wifis = (uint8_t) val.toInt();
-		}
-		else if (id == "VIEWS") {								// VIEWS setting
-			id_print(id, val);
-			(*c).views = (uint8_t) val.toInt();
-		}
-		else if (id == "NODE") {								// NODE setting
-			id_print(id, val);
-			(*c).isNode = (uint8_t) val.toInt();
-		}
-		else if (id == "REFR") {								// REFR setting
-			id_print(id, val);
-			(*c).refresh = (uint8_t) val.toInt();
-		}
-		else if (id == "REENTS") {								// REENTS setting
-			id_print(id, val);
-			(*c).reents = (uint8_t) val.toInt();
-		}
-		else if (id == "NTPERR") {								// NTPERR setting
-			id_print(id, val);
-			(*c).ntpErr = (uint8_t) val.toInt();
-		}
-		else if (id == "NTPETIM") {								// NTPERR setting
-			id_print(id, val);
-			(*c).ntpErrTime = (uint32_t) val.toInt();
-		}
-		else if (id == "NTPS") {								// NTPS setting
-			id_print(id, val);
-			(*c).ntps = (uint8_t) val.toInt();
-		}
-		else if (id == "FILENO") {								// log FILENO setting
-			id_print(id, val);
-			(*c).logFileNo = (uint8_t) val.toInt();
-		}
-		else if (id == "FILEREC") {								// FILEREC setting
-			id_print(id, val);
-			(*c).logFileRec = (uint16_t) val.toInt();
-		}
-		else if (id == "FILENUM") {								// FILEREC setting
-			id_print(id, val);
-			(*c).logFileNum = (uint16_t) val.toInt();
-		}
-		else if (id == "EXPERT") {								// FILEREC setting
-			id_print(id, val);
-			(*c).expert = (uint8_t) val.toInt();
-		}
-		else {
-			tries++;
+	return(n);
+}
+
+// ----------------------------------------------------------------------------
+// Get and set counter number id of the configuration
+// ----------------------------------------------------------------------------
+uint32_t getCounter(struct espGwayConfig *c, uint8_t id) {
+	switch (id) {
+		case 0: return((*c).fcnt);
+		case 1: return((*c).boots);
+		case 2: return((*c).resets);
+		case 3: return((*c).views);
+		case 4: return((*c).wifis);
+		case 5: return((*c).reents);
+		case 6: return((*c).ntps);
+		case 7: return((*c).ntpErr);
+		case 8: return((*c).ntpErrTime);
+	}
+	return(0);
+}
+
+void setCounter(struct espGwayConfig *c, uint8_t id, uint32_t val) {
+	switch (id) {
+		case 0: (*c).fcnt = val; break;
+		case 1: (*c).boots = val; break;
+		case 2: (*c).resets = val; break;
+		case 3: (*c).views = val; break;
+		case 4: (*c).wifis = val; break;
+		case 5: (*c).reents = val; break;
+		case 6: (*c).ntps = val; break;
+		case 7: (*c).ntpErr = val; break;
+		case 8: (*c).ntpErrTime = val; break;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Read the counters from the COUNTFILE slots and replay the journal.
+// Replay stops at the first entry that is not valid (partial write at
+// power failure). In that case, when the journal ends with a partial entry
+// and when the journal does not belong to the cntRec read, the next 
+// logCounters() call will compact the journal, as appending after a partial
+// entry would misalign all entries that follow.
+// Parameters:
+//		fn; Base filename of the counter slots
+//		c; struct config
+// Returns:
+//		Number of journal entries replayed, -1 when no valid counters found
+// ----------------------------------------------------------------------------
+int readCounters(const char *fn, struct espGwayConfig *c) {
+
+	char jn[32];
+	struct cntHdr h;
+	struct cntEnt e[8];
+	int n;
+	
+	cntEntries = CNTMAXENT;
+	if (readSlots(fn, &cntRec.hdr, sizeof(struct cntRec)) < 0) {
+		memset(&cntRec, 0, sizeof(struct cntRec));
+		return(-1);
+	}
+	(*c).fcnt = cntRec.fcnt;
+	(*c).boots = cntRec.boots;
+	(*c).resets = cntRec.resets;
+	(*c).views = cntRec.views;
+	(*c).wifis = cntRec.wifis;
+	(*c).reents = cntRec.reents;
+	(*c).ntpErr = cntRec.ntpErr;
+	(*c).ntps = cntRec.ntps;
+	(*c).ntpErrTime = cntRec.ntpErrTime;
+	
+	sprintf(jn, "%s.j", fn);
+	File f = SPIFFS.open(jn, "r");
+	if (!f) return(0);
+	if ((f.read((uint8_t *) &h, sizeof(struct cntHdr)) != sizeof(struct cntHdr)) ||
+		(h.magic != CFGMAGIC) || (h.seq != cntRec.hdr.seq)) 
+	{
+		f.close();
+		return(0);
+	}
+	
+	int cnt = 0;
+	bool valid = true;
+	bool whole = ((f.size() - sizeof(struct cntHdr)) % sizeof(struct cntEnt) == 0);
+	while (valid && ((n = f.read((uint8_t *) e, sizeof(e)) / sizeof(struct cntEnt)) > 0)) {
+		for (int i=0; i<n; i++) {
+			if ((e[i].id >= CNT_NUM) || (e[i].inv != (uint8_t) ~e[i].id)) {
+				valid = false;
+				break;
+			}
+			setCounter(c, e[i].id, e[i].val);
+			cnt++;
 		}
 	}
 	f.close();
+	
+	if (valid && whole && (cnt < CNTMAXENT)) cntEntries = cnt;
+	
 #if DUSB>=1
-	if (debug>=0) {
-		Serial.println('#');
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M readCounters:: seq="));
+		Serial.print(cntRec.hdr.seq);
+		Serial.print(F(", journal="));
+		Serial.print(cnt);
+		Serial.println((valid && whole) ? F("") : F(" (damaged)"));
 	}
 #endif
-	Serial.println();
+	return(cnt);
+}
+
+// ----------------------------------------------------------------------------
+// LOGCOUNTERS
+// Make the counters in mask persistent by appending them to the journal. 
+// All counters of the mask are appended with one write() call. When the 
+// journal is full or not valid, all counters are written to a new cntRec 
+// and a new journal is started instead.
+// Parameters:
+//		mask; Counters to write, CNT_xxx values or'ed together
+// Returns:
+//		1 when successful, -1 on error
+// ----------------------------------------------------------------------------
+int logCounters(uint16_t mask) {
+
+	char jn[32];
+	struct cntEnt e[CNT_NUM];
+	int n = 0;
+	
+	for (uint8_t i=0; i<CNT_NUM; i++) {
+		if ((mask & (1 << i)) == 0) continue;
+		e[n].id = i;
+		e[n].inv = ~i;
+		e[n].rsv = 0;
+		e[n].val = getCounter(&gwayConfig, i);
+		n++;
+	}
+	if (n == 0) return(1);
+	
+	if (cntEntries + n > CNTMAXENT) {
+		return(writeCounters(COUNTFILE, &gwayConfig));
+	}
+	
+	sprintf(jn, "%s.j", COUNTFILE);
+	File f = SPIFFS.open(jn, "a");
+	if (!f) {
+		cntEntries = CNTMAXENT;					// Try to compact next time
+		return(-1);
+	}
+	f.write((uint8_t *) e, n * sizeof(struct cntEnt));
+	f.close();
+	cntEntries += n;
+	statCnt.appends++;
 	return(1);
 }
 
@@ -226,9 +452,6 @@ int writeGwayCfg(const char *fn) {
 	gwayConfig.pdebug = pdebug;
 	gwayConfig.cad = _cad;
 	gwayConfig.hop = _hop;
-#if GATEWAYNODE==1
-	gwayConfig.fcnt = frameCount;
-#endif
 	return(writeConfig(fn, &gwayConfig));
 }
 
@@ -236,182 +459,517 @@ int writeGwayCfg(const char *fn) {
 // Write the configuration as found in the espGwayConfig structure
 // to SPIFFS
 // Parameters:
-//		fn; Filename
+//		fn; Base filename of the config slots
 //		c; struct config
 // Returns:
 //		1 when successful, -1 on error
 // ----------------------------------------------------------------------------
 int writeConfig(const char *fn, struct espGwayConfig *c) {
 
-	if (!SPIFFS.exists(fn)) {
-		Serial.print("WARNING:: writeConfig, file not exists, formatting ");
-		SPIFFS.format();
-		initConfig(c);		// XXX make all initial declarations here if config vars need to have a value
-		Serial.println(fn);
-	}
-	File f = SPIFFS.open(fn, "w");
-	if (!f) {
-		Serial.print("ERROR:: writeConfig, open file=");
-		Serial.print(fn);
-		Serial.println();
-		return(-1);
-	}
+	cfgRec.ch = (*c).ch;
+	cfgRec.sf = (*c).sf;
+	cfgRec.debug = (*c).debug;
+	cfgRec.pdebug = (*c).pdebug;
+	cfgRec.cad = (*c).cad;
+	cfgRec.hop = (*c).hop;
+	cfgRec.isNode = (*c).isNode;
+	cfgRec.refresh = (*c).refresh;
+	cfgRec.expert = (*c).expert;
+	memset(cfgRec.ssid, 0, sizeof(cfgRec.ssid));
+	memset(cfgRec.pass, 0, sizeof(cfgRec.pass));
+	(*c).ssid.toCharArray(cfgRec.ssid, sizeof(cfgRec.ssid));
+	(*c).pass.toCharArray(cfgRec.pass, sizeof(cfgRec.pass));
+	
+	return(writeSlots(fn, &cfgRec.hdr, sizeof(struct cfgRec)));
+}
 
-	f.print("SSID"); f.print('='); f.print((*c).ssid); f.print('\n'); 
-	f.print("PASS"); f.print('='); f.print((*c).pass); f.print('\n');
-	f.print("CH"); f.print('='); f.print((*c).ch); f.print('\n');
-	f.print("SF");   f.print('='); f.print((*c).sf);   f.print('\n');
-	f.print("FCNT"); f.print('='); f.print((*c).fcnt); f.print('\n');
-	f.print("DEBUG"); f.print('='); f.print((*c).debug); f.print('\n');
-	f.print("PDEBUG"); f.print('='); f.print((*c).pdebug); f.print('\n');
-	f.print("CAD");  f.print('='); f.print((*c).cad); f.print('\n');
-	f.print("HOP");  f.print('='); f.print((*c).hop); f.print('\n');
-	f.print("NODE");  f.print('='); f.print((*c).isNode); f.print('\n');
-	f.print("BOOTS");  f.print('='); f.print((*c).boots); f.print('\n');
-	f.print("RESETS");  f.print('='); f.print((*c).resets); f.print('\n');
-	f.print("WIFIS");  f.print('='); f.print((*c).wifis); f.print('\n');
-	f.print("VIEWS");  f.print('='); f.print((*c).views); f.print('\n');
-	f.print("REFR");  f.print('='); f.print((*c).refresh); f.print('\n');
-	f.print("REENTS");  f.print('='); f.print((*c).reents); f.print('\n');
-	f.print("NTPETIM");  f.print('='); f.print((*c).ntpErrTime); f.print('\n');
-	f.print("NTPERR");  f.print('='); f.print((*c).ntpErr); f.print('\n');
-	f.print("NTPS");  f.print('='); f.print((*c).ntps); f.print('\n');
-	f.print("FILEREC");  f.print('='); f.print((*c).logFileRec); f.print('\n');
-	f.print("FILENO");  f.print('='); f.print((*c).logFileNo); f.print('\n');
-	f.print("FILENUM");  f.print('='); f.print((*c).logFileNum); f.print('\n');
-	f.print("EXPERT");  f.print('='); f.print((*c).expert); f.print('\n');
+// ----------------------------------------------------------------------------
+// Write the counters as found in the espGwayConfig structure
+// to the COUNTFILE slots and start a new (empty) journal.
+// Normally called by logCounters() when the journal is full. 
+// Parameters:
+//		fn; Base filename of the counter slots
+//		c; struct config
+// Returns:
+//		1 when successful, -1 on error
+// ----------------------------------------------------------------------------
+int writeCounters(const char *fn, struct espGwayConfig *c) {
+
+	cntRec.fcnt = (*c).fcnt;
+	cntRec.boots = (*c).boots;
+	cntRec.resets = (*c).resets;
+	cntRec.views = (*c).views;
+	cntRec.wifis = (*c).wifis;
+	cntRec.reents = (*c).reents;
+	cntRec.ntpErr = (*c).ntpErr;
+	cntRec.ntps = (*c).ntps;
+	cntRec.ntpErrTime = (*c).ntpErrTime;
 	
+	statCnt.compacts++;
+	cntEntries = CNTMAXENT;
+	if (writeSlots(fn, &cntRec.hdr, sizeof(struct cntRec)) < 0) return(-1);
+	
+	char jn[32];
+	struct cntHdr h;
+	h.magic = CFGMAGIC;
+	h.seq = cntRec.hdr.seq;
+	sprintf(jn, "%s.j", fn);
+	File f = SPIFFS.open(jn, "w");
+	if (!f) return(-1);
+	f.write((uint8_t *) &h, sizeof(struct cntHdr));
 	f.close();
+	cntEntries = 0;
 	return(1);
 }
 
 // ----------------------------------------------------------------------------
-// Add a line with statistics to the log.
-//
-// We put the check in the function to protect against calling 
-// the function without STAT_LOG being proper defined
-// ToDo: Store the fileNo and the fileRec in the status file to save for 
-// restarts
+// Open the log segment with sequence number seq. If the segment is new
+// we open it with "w" which truncates the (oldest) file with the same
+// number in the ring and we write the segment header first.
 // Parameters:
-//		line; char array with characters to write to log
-//		cnt;
+//		seq; Sequence number of the segment
+//		mode; "a" for append or "w" for a new segment
 // Returns:
-//		<none>
+//		The opened File (test with if (!f) for errors). A new segment
+//		whose header could not be written is an error too.
 // ----------------------------------------------------------------------------
-void addLog(const unsigned char * line, int cnt) 
-{
 #if STAT_LOG==1
+File openLog(uint32_t seq, const char *mode)
+{
 	char fn[16];
+	sprintf(fn,"/log-%d", (int)(seq % LOGFILEMAX));
 	
-	if (gwayConfig.logFileRec > LOGFILEREC) {		// Have to make define for this
-		gwayConfig.logFileRec = 0;					// INn new logFile start ith record 0
-		gwayConfig.logFileNo++;						// Increase file ID
-		gwayConfig.logFileNum++;					// Increase number of log files
-	}
-	gwayConfig.logFileRec++;
-	
-	// If we have too many logfies, delete the oldest
-	//
-	if (gwayConfig.logFileNum > LOGFILEMAX){
-		sprintf(fn,"/log-%d", gwayConfig.logFileNo - LOGFILEMAX);
+	File f = SPIFFS.open(fn, mode);
+	statLog.opens++;
+	if (!f) {
 #if DUSB>=1
-		if (( debug>=0 ) && ( pdebug & P_GUI )) {
-			Serial.print(F("G addLog:: Too many logfile, deleting="));
+		if (( debug>=1 ) && ( pdebug & P_GUI )) {
+			Serial.print(F("G openLog:: open failed="));
 			Serial.println(fn);
 		}
 #endif
-		SPIFFS.remove(fn);
-		gwayConfig.logFileNum--;
+		return(f);
 	}
 	
-	// Make sure we have the right fileno
-	sprintf(fn,"/log-%d", gwayConfig.logFileNo); 
-	
-	// If there is no SPIFFS, Error
-	// Make sure to write the config record/line also
-	if (!SPIFFS.exists(fn)) {
-#if DUSB>=1
-		if (( debug >= 1 ) && ( pdebug & P_GUI )) {
-			Serial.print(F("G ERROR:: addLog:: file="));
-			Serial.print(fn);
-			Serial.print(F(" does not exist .. rec="));
-			Serial.print(gwayConfig.logFileRec);
-			Serial.println();
+	if (mode[0] == 'w') {
+		struct logHdr h;
+		h.magic = LOGMAGIC;
+		h.seq = seq;
+		h.tmst = now();
+		h.recLen = sizeof(struct logRec);
+		h.recMax = LOGFILEREC;
+		size_t k = f.write((uint8_t *) &h, sizeof(struct logHdr));
+		statLog.writes++;
+		statLog.bytes += k;
+		if (k != sizeof(struct logHdr)) {				// Flash full
+			f.close();
+			return(File());
 		}
+	}
+	return(f);
+}
 #endif
+
+// ----------------------------------------------------------------------------
+// Return bit k (0 or 1) of the bloom filter for DevAddr addr. We use the
+// top bits of two multiplicative hashes so that addresses of the same
+// network (same high bytes) still spread over the filter.
+// ----------------------------------------------------------------------------
+uint8_t logBloomBit(uint32_t addr, uint8_t k)
+{
+	uint32_t h = addr * (k==0 ? 2654435761UL : 2246822519UL);
+	return((uint8_t)(h >> 24) % (LOGBLOOM * 8));
+}
+
+// ----------------------------------------------------------------------------
+// Add log record r to the index of segment file number i
+// ----------------------------------------------------------------------------
+#if STAT_LOG==1
+void addLogIdx(int i, struct logRec *r)
+{
+	struct logIdx *x = &logIdx[i];
+	
+	if ((x->recs == 0) || (r->tmst < x->first)) x->first = r->tmst;
+	if ((x->recs == 0) || (r->tmst > x->last)) x->last = r->tmst;
+	x->recs++;
+	for (uint8_t k=0; k<2; k++) {
+		uint8_t b = logBloomBit(r->addr, k);
+		x->bloom[b/8] |= (1 << (b%8));
 	}
+}
+#endif
+
+// ----------------------------------------------------------------------------
+// Check the index of segment file number i for a query.
+// Parameters:
+//		i; File number in the ring
+//		addr; DevAddr, or 0 for all nodes
+//		from, to; Time range (now() seconds) of the query
+// Returns:
+//		true if the segment may contain matching records
+// ----------------------------------------------------------------------------
+bool matchLogIdx(int i, uint32_t addr, uint32_t from, uint32_t to)
+{
+#if STAT_LOG==1
+	struct logIdx *x = &logIdx[i];
 	
-	File f = SPIFFS.open(fn, "a");
-	if (!f) {
-#if DUSB>=1
-		if (( debug>=1 ) && ( pdebug & P_GUI )) {
-			Serial.println("G file open failed=");
-			Serial.println(fn);
+	if (x->recs == 0) return(false);
+	if ((x->last < from) || (x->first > to)) return(false);
+	if (addr != 0) {
+		for (uint8_t k=0; k<2; k++) {
+			uint8_t b = logBloomBit(addr, k);
+			if ((x->bloom[b/8] & (1 << (b%8))) == 0) return(false);
 		}
+	}
+	return(true);
+#else
+	return(false);
 #endif
-		return;									// If file open failed, return
+}
+
+// ----------------------------------------------------------------------------
+// Read the header of log segment file number i and build the index of
+// the segment in logIdx[i]. Records are read a page at a time in logBuf,
+// so this must not be called while there are records buffered.
+// Parameters:
+//		i; File number in the ring 0 .. LOGFILEMAX-1
+//		h; The header read
+// Returns:
+//		Number of records in the segment, -1 if there is no valid segment
+// ----------------------------------------------------------------------------
+int readLogHdr(int i, struct logHdr *h)
+{
+#if STAT_LOG==1
+	char fn[16];
+	int recs;
+	int n;
+	sprintf(fn,"/log-%d", i);
+	
+	memset(&logIdx[i], 0, sizeof(struct logIdx));
+	File f = SPIFFS.open(fn, "r");
+	if (!f) return(-1);
+	if ((f.read((uint8_t *) h, sizeof(struct logHdr)) != sizeof(struct logHdr)) ||
+		((*h).magic != LOGMAGIC) || 
+		((*h).recLen != sizeof(struct logRec)) )
+	{
+		f.close();
+		return(-1);
+	}
+	recs = (f.size() - sizeof(struct logHdr)) / sizeof(struct logRec);
+	
+	while ((n = f.read((uint8_t *) logBuf, sizeof(logBuf)) / sizeof(struct logRec)) > 0) {
+		for (int j=0; j<n; j++) addLogIdx(i, &logBuf[j]);
+		yield();
+	}
+	
+	if ((f.size() - sizeof(struct logHdr)) % sizeof(struct logRec) != 0) {
+		recs = LOGFILEREC;						// Partial record written, close segment
+	}
+	f.close();
+	return(recs);
+#else
+	return(-1);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// INITLOG
+// Find the segment that we were writing to before the last restart by 
+// looking at the segment headers. We do not trust the logFileNo in the config
+// file as that file is not written on every new segment.
+// Called once from setup()
+// ----------------------------------------------------------------------------
+void initLog()
+{
+#if STAT_LOG==1
+	struct logHdr h;
+	char fn[16];
+	int recs;
+	int found = 0;
+	uint32_t oldNo = gwayConfig.logFileNo;
+	
+	flushLog();									// logBuf is used by readLogHdr()
+	logBufCnt = 0;
+	gwayConfig.logFileNum = 0;
+	for (int i=0; i<LOGFILEMAX; i++) {
+		if ((recs = readLogHdr(i, &h)) < 0) continue;
+		gwayConfig.logFileNum++;
+		if ((found == 0) || (h.seq >= gwayConfig.logFileNo)) {
+			gwayConfig.logFileNo = h.seq;
+			gwayConfig.logFileRec = recs;
+			found = 1;
+		}
+		yield();
+	}
+	
+	// If there is no segment yet, make sure that flushLog() starts a new one.
+	// A segment that is full or that was damaged (partial record write)
+	// is closed by readLogHdr() in the same way.
+	if (found == 0) {
+		// Remove the text logfiles of older versions, which were 
+		// numbered by logFileNo
+		for (int i=0; (i<=LOGFILEMAX) && (i<=oldNo); i++) {
+			sprintf(fn,"/log-%d", (int)(oldNo - i));
+			if (SPIFFS.exists(fn)) SPIFFS.remove(fn);
+		}
+		gwayConfig.logFileNo = 0;
+		gwayConfig.logFileRec = LOGFILEREC;		// Forces a new segment
 	}
 	
-	int i;
 #if DUSB>=1
 	if (( debug>=1 ) && ( pdebug & P_GUI )) {
-		Serial.print(F("G addLog:: fileno="));
+		Serial.print(F("G initLog:: seq="));
 		Serial.print(gwayConfig.logFileNo);
 		Serial.print(F(", rec="));
 		Serial.print(gwayConfig.logFileRec);
+		Serial.print(F(", segments="));
+		Serial.println(gwayConfig.logFileNum);
+	}
+#endif
+#endif //STAT_LOG
+}
 
-		Serial.print(F(": "));
+// ----------------------------------------------------------------------------
+// FLUSHLOG
+// Write the records in logBuf to the current segment, and when the segment
+// is full, continue in the next segment of the ring. A flush normally costs 
+// one open(), one write() and one close() per page of records.
+// The next segment is only used once its header is written, and only the
+// records that were written completely are counted. When the flash is full
+// the other records are lost, a partial record closes the segment just as
+// readLogHdr() does at boot.
+// Parameters:
+//		<none>
+// Returns:
+//		Number of records written
+// ----------------------------------------------------------------------------
+int flushLog()
+{
+#if STAT_LOG==1
+	int i = 0;
+	File f;
+	
+	if (logBufCnt == 0) return(0);
+	statLog.flushes++;
 
-		for (i=0; i< 12; i++) {				// The first 12 bytes contain non printable characters
-			Serial.print(line[i],HEX);
-			Serial.print(' ');
+	while (i < logBufCnt) {
+	
+		if (gwayConfig.logFileRec >= LOGFILEREC) {
+			f = openLog(gwayConfig.logFileNo + 1, "w");	// Next segment, overwrites oldest
+			if (f) {
+				gwayConfig.logFileNo++;
+				gwayConfig.logFileRec = 0;
+				if (gwayConfig.logFileNum < LOGFILEMAX) gwayConfig.logFileNum++;
+				memset(&logIdx[gwayConfig.logFileNo % LOGFILEMAX], 0, sizeof(struct logIdx));
+			}
+		}
+		else {
+			f = openLog(gwayConfig.logFileNo, "a");
+		}
+		
+		if (!f) {
+			statLog.lost += logBufCnt - i;
+			break;
+		}
+		
+		int n = logBufCnt - i;
+		if (n > LOGFILEREC - gwayConfig.logFileRec) n = LOGFILEREC - gwayConfig.logFileRec;
+		size_t k = f.write((uint8_t *) &logBuf[i], n * sizeof(struct logRec));
+		f.close();
+		int w = k / sizeof(struct logRec);				// Records written completely
+		for (int j=i; j<i+w; j++) addLogIdx(gwayConfig.logFileNo % LOGFILEMAX, &logBuf[j]);
+		
+		statLog.writes++;
+		statLog.bytes += k;
+		gwayConfig.logFileRec += w;
+		i += w;
+		
+		if (w < n) {									// Flash full
+			if ((k % sizeof(struct logRec)) != 0) gwayConfig.logFileRec = LOGFILEREC;
+			statLog.lost += logBufCnt - i;
+			break;
 		}
-		Serial.print((char *) &line[i]);	// The rest if the buffer contains ascii
-
-		Serial.println();
 	}
-#endif //DUSB
 
-
-	for (i=0; i< 12; i++) {					// The first 12 bytes contain non printable characters
-	//	f.print(line[i],HEX);
-		f.print('*');
+#if DUSB>=1
+	if (( debug>=2 ) && ( pdebug & P_GUI )) {
+		Serial.print(F("G flushLog:: seq="));
+		Serial.print(gwayConfig.logFileNo);
+		Serial.print(F(", rec="));
+		Serial.print(gwayConfig.logFileRec);
+		Serial.print(F(", written="));
+		Serial.println(i);
 	}
-	f.write(&(line[i]), cnt-12);				// write/append the line to the file
-	f.print('\n');
-	f.close();								// Close the file after appending to it
-
+#endif
+	logBufCnt = 0;
+	return(i);
+#else
+	return(0);
 #endif //STAT_LOG
 }
 
 // ----------------------------------------------------------------------------
-// Print (all) logfiles
+// Add a record with statistics to the log.
+// The record is only added to the RAM buffer, and the buffer is written 
+// to SPIFFS when it holds a full page of records. So this function is 
+// cheap enough to be called from the receive path in buildPacket().
 //
+// We put the check in the function to protect against calling 
+// the function without STAT_LOG being proper defined
+// Parameters:
+//		message; The LoRa message as received
+//		len; Length of the message
+//		sf; Spreading factor
+//		prssi; Packet RSSI (corrected)
+//		snr; SNR of the message
+// Returns:
+//		<none>
 // ----------------------------------------------------------------------------
-void printLog()
+void addLog(const uint8_t *message, uint8_t len, uint8_t sf, int16_t prssi, int8_t snr) 
 {
-	char fn[16];
-	int i=0;
-#if DUSB>=1
-	while (i< LOGFILEMAX ) {
-		sprintf(fn,"/log-%d", gwayConfig.logFileNo - i);
-		if (!SPIFFS.exists(fn)) break;		// break the loop
+#if STAT_LOG==1
+	if (logBufCnt >= LOGBUFREC) flushLog();
+	
+	struct logRec *r = &logBuf[logBufCnt];
+	
+	r->tmst = now();
+	if (len >= 8) {
+		r->addr = ((uint32_t)message[4]<<24) | ((uint32_t)message[3]<<16) | 
+				((uint32_t)message[2]<<8) | message[1];
+		r->fcnt = (message[7]<<8) | message[6];
+	}
+	else {
+		r->addr = 0;
+		r->fcnt = 0;
+	}
+	r->ch = ifreq;
+	r->sf = sf;
+	r->prssi = prssi;
+	r->snr = snr;
+	r->len = len;
+#if LOGPAYLOAD == 1
+	memset(r->data, 0, LOGPAYLEN);
+	memcpy(r->data, message, (len < LOGPAYLEN ? len : LOGPAYLEN));
+#endif
+	if (logBufCnt == 0) logTime = r->tmst;
+	logBufCnt++;
+	statLog.recs++;
+	
+	if (logBufCnt >= LOGBUFREC) flushLog();
+#endif //STAT_LOG
+}
 
-		// Open the file for reading
-		File f = SPIFFS.open(fn, "r");
-		
-		int j;
-		for (j=0; j<LOGFILEREC; j++) {
-			
-			String s=f.readStringUntil('\n');
-			if (s.length() == 0) break;
+// ----------------------------------------------------------------------------
+// Format a log record as one line of text in buf.
+// Parameters:
+//		r; The record
+//		buf; Character buffer
+//		len; Length of the buffer
+// Returns:
+//		Number of characters in buf
+// ----------------------------------------------------------------------------
+#if STAT_LOG==1
+int sprintLogRec(struct logRec *r, char *buf, int len)
+{
+	time_t t = r->tmst;
+	int j = snprintf(buf, len, 
+		"%04d-%02d-%02d %02d:%02d:%02d addr=%08lX fcnt=%u ch=%u sf=%u rssi=%d snr=%d len=%u",
+		year(t), month(t), day(t), hour(t), minute(t), second(t),
+		(unsigned long) r->addr, r->fcnt, r->ch, r->sf, r->prssi, r->snr, r->len);
+#if LOGPAYLOAD == 1
+	if (j < len) j += snprintf(buf+j, len-j, " data=");
+	for (int i=0; (i<r->len) && (i<LOGPAYLEN) && (j<len); i++) {
+		j += snprintf(buf+j, len-j, "%02X", r->data[i]);
+	}
+#endif
+	return(j);
+}
+#endif
 
-			Serial.println(s.substring(12));			// Skip the first 12 Gateway specific binary characters
+// ----------------------------------------------------------------------------
+// QUERYLOG
+// Find the log records of node addr that were received between from and to,
+// and output them one line per record. Segments are read oldest first, and
+// only when their index says that they may contain matching records.
+// The records are read in pages into logBuf, so no String is allocated
+// per record.
+// Parameters:
+//		addr; DevAddr of the node, 0 for all nodes
+//		from, to; Time range in now() seconds
+//		out; LOG_SERIAL or LOG_WWW (server.sendContent())
+// Returns:
+//		Number of records found
+// ----------------------------------------------------------------------------
+int queryLog(uint32_t addr, uint32_t from, uint32_t to, uint8_t out)
+{
+	int found = 0;
+#if STAT_LOG==1
+	char fn[16];
+	char line[128];
+	int n;
+	
+	flushLog();									// Also query the records in RAM
+	
+	for (uint32_t i=gwayConfig.logFileNum; i>0; i--) {
+		int seg = (gwayConfig.logFileNo - i + 1) % LOGFILEMAX;
+		
+		if (!matchLogIdx(seg, addr, from, to)) {
+			statLog.segSkip++;
+			continue;
+		}
+		statLog.segRead++;
+		
+		sprintf(fn,"/log-%d", seg);
+		File f = SPIFFS.open(fn, "r");			// Open the file for reading
+		if (!f) continue;
+		f.seek(sizeof(struct logHdr), SeekSet);
+		
+		while ((n = f.read((uint8_t *) logBuf, sizeof(logBuf)) / sizeof(struct logRec)) > 0) {
+			for (int j=0; j<n; j++) {
+				struct logRec *r = &logBuf[j];
+				if ((r->tmst < from) || (r->tmst > to)) continue;
+				if ((addr != 0) && (r->addr != addr)) continue;
+				
+				int k = sprintLogRec(r, line, sizeof(line)-1);
+				found++;
+				if (out == LOG_SERIAL) {
+					Serial.println(line);
+				}
+#if A_SERVER==1
+				else {
+					line[k++] = '\n';
+					line[k] = 0;
+					server.sendContent(line);
+				}
+#endif
+			}
 			yield();
 		}
-		i++;
+		f.close();
+	}
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_GUI )) {
+		Serial.print(F("G queryLog:: found="));
+		Serial.print(found);
+		Serial.print(F(", segRead="));
+		Serial.print(statLog.segRead);
+		Serial.print(F(", segSkip="));
+		Serial.println(statLog.segSkip);
 	}
 #endif
+#endif //STAT_LOG
+	return(found);
+}
+
+// ----------------------------------------------------------------------------
+// Print (all) logfiles, oldest segment first
+//
+// ----------------------------------------------------------------------------
+void printLog()
+{
+#if DUSB>=1
+	queryLog(0, 0, 0xFFFFFFFF, LOG_SERIAL);
+#endif
 } //printLog
 
 
@@ -426,3 +984,288 @@ void listDir(char * dir)
 #endif
 }
 
+
+#if _UPSTORE==1
+// ----------------------------------------------------------------------------
+// Open segment seq of the upstream flash store. If mode is "w" the segment
+// file is (re)created and the header is written.
+// Parameters:
+//		seq; Sequence number of the segment
+//		mode; "r", "a" or "w"
+// Returns:
+//		The opened File (test with if (!f) for errors)
+// ----------------------------------------------------------------------------
+File openStore(uint32_t seq, const char *mode)
+{
+	char fn[16];
+	sprintf(fn,"/up-%d", (int)(seq % UPSFILEMAX));
+	
+	File f = SPIFFS.open(fn, mode);
+	if ((f) && (mode[0] == 'w')) {
+		struct upsHdr h;
+		h.magic = UPSMAGIC;
+		h.seq = seq;
+		h.recLen = sizeof(struct upFrame);
+		h.recMax = UPSFILEREC;
+		if (f.write((uint8_t *) &h, sizeof(struct upsHdr)) != sizeof(struct upsHdr)) {
+			f.close();
+			return(File());
+		}
+	}
+	return(f);
+}
+
+
+// ----------------------------------------------------------------------------
+// Remove segment seq of the upstream flash store
+// ----------------------------------------------------------------------------
+void removeStore(uint32_t seq)
+{
+	char fn[16];
+	sprintf(fn,"/up-%d", (int)(seq % UPSFILEMAX));
+	SPIFFS.remove(fn);
+	ups.recs[seq % UPSFILEMAX] = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// INITSTORE
+// Find the messages that were stored but not replayed before the last 
+// restart, by reading the segment headers. Segments are removed when they 
+// have been replayed, and popStore() marks the records of the oldest 
+// segment as UP_DONE, so replay continues after the last one that was sent.
+// Called once from setup()
+// ----------------------------------------------------------------------------
+void initStore()
+{
+	struct upsHdr h;
+	char fn[16];
+	bool found = false;
+	uint32_t minSeq = 0;
+	
+	memset(&ups, 0, sizeof(struct upStore));
+	for (int i=0; i<UPSFILEMAX; i++) {
+		sprintf(fn,"/up-%d", i);
+		File f = SPIFFS.open(fn, "r");
+		if (!f) continue;
+		if ((f.read((uint8_t *) &h, sizeof(struct upsHdr)) != sizeof(struct upsHdr)) ||
+			(h.magic != UPSMAGIC) || (h.recLen != sizeof(struct upFrame)) ||
+			((h.seq % UPSFILEMAX) != (uint32_t) i))
+		{
+			f.close();
+			SPIFFS.remove(fn);
+			continue;
+		}
+		uint32_t n = (f.size() - sizeof(struct upsHdr)) / sizeof(struct upFrame);
+		ups.recs[i] = (n < UPSFILEREC ? n : UPSFILEREC);
+		if (!found || (h.seq > ups.wrSeq)) {
+			ups.wrSeq = h.seq;
+			ups.wrRec = ups.recs[i];
+		}
+		if (!found || (h.seq < minSeq)) minSeq = h.seq;
+		found = true;
+		f.close();
+		yield();
+	}
+	
+	if (!found) {
+		ups.wrRec = UPSFILEREC;						// Forces a new segment
+		ups.rdSeq = ups.wrSeq + 1;
+		return;
+	}
+	ups.rdSeq = minSeq;
+	if ((ups.wrSeq - ups.rdSeq) >= UPSFILEMAX) ups.rdSeq = ups.wrSeq - UPSFILEMAX + 1;
+	ups.wrRec = UPSFILEREC;							// Never append to an old segment
+	
+	// Skip the records that were replayed before the restart
+	while (ups.rdSeq <= ups.wrSeq) {
+		uint8_t done = 0;
+		File f = openStore(ups.rdSeq, "r");
+		while ((f) && (ups.rdRec < ups.recs[ups.rdSeq % UPSFILEMAX]) &&
+			(f.seek(sizeof(struct upsHdr) + ups.rdRec * sizeof(struct upFrame) +
+				offsetof(struct upFrame, done), SeekSet)) &&
+			(f.read(&done, 1) == 1) && (done == UP_DONE))
+		{
+			ups.rdRec++;
+		}
+		if (f) f.close();
+		if (ups.rdRec < ups.recs[ups.rdSeq % UPSFILEMAX]) break;
+		removeStore(ups.rdSeq);
+		ups.rdSeq++;
+		ups.rdRec = 0;
+	}
+	for (uint32_t s=ups.rdSeq; s<=ups.wrSeq; s++) ups.count += ups.recs[s % UPSFILEMAX];
+	ups.count -= ups.rdRec;
+
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M initStore:: seq="));
+		Serial.print(ups.rdSeq);
+		Serial.print(F(".."));
+		Serial.print(ups.wrSeq);
+		Serial.print(F(", stored="));
+		Serial.println(ups.count);
+	}
+#endif
+}
+
+
+// ----------------------------------------------------------------------------
+// STOREUP
+// Move the messages in upQueue to the flash store. All messages are written
+// with one open() and close() per segment. If a new segment overwrites the
+// oldest one, the messages in that segment that were not replayed are 
+// dropped.
+// Returns:
+//		Number of messages stored, -1 if the store could not be opened and
+//		the messages are still in upQueue.
+// ----------------------------------------------------------------------------
+int storeUp()
+{
+	File f;
+	int n = 0;
+	
+	while (upCount > 0) {
+		if (ups.wrRec >= UPSFILEREC) {
+			if (f) f.close();
+			f = openStore(ups.wrSeq + 1, "w");
+			if (!f) break;
+			ups.wrSeq++;
+			ups.wrRec = 0;
+			if (ups.count == 0) {
+				ups.rdSeq = ups.wrSeq;
+				ups.rdRec = 0;
+			}
+			else if ((ups.wrSeq - ups.rdSeq) >= UPSFILEMAX) {
+				uint16_t d = ups.recs[ups.rdSeq % UPSFILEMAX] - ups.rdRec;
+				ups.count -= d;
+				statUp.dropped += d;						// Oldest segment overwritten
+				ups.rdSeq++;
+				ups.rdRec = 0;
+			}
+			ups.recs[ups.wrSeq % UPSFILEMAX] = 0;
+		}
+		else if (!f) {
+			f = openStore(ups.wrSeq, "a");
+			if (!f) break;
+		}
+		
+		if (f.write((uint8_t *) &upQueue[upHead], sizeof(struct upFrame)) != sizeof(struct upFrame)) {
+			statUp.lost++;									// And close the segment, a
+			ups.wrRec = UPSFILEREC;							// partial record is not read
+		}
+		else {
+			ups.wrRec++;
+			ups.recs[ups.wrSeq % UPSFILEMAX]++;
+			ups.count++;
+			statUp.stored++;
+			n++;
+		}
+		upHead = (upHead + 1) % UPQUEUE;
+		upCount--;
+	}
+	if (f) f.close();
+	
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_RX )) {
+		Serial.print(F("R storeUp:: stored="));
+		Serial.print(n);
+		Serial.print(F(", waiting="));
+		Serial.println(ups.count);
+	}
+#endif
+	return(upCount > 0 ? -1 : n);
+}
+
+
+// ----------------------------------------------------------------------------
+// READSTORE
+// Read the oldest message in the flash store into q. It stays in the store
+// until popStore() is called, so a message that could not be sent is read
+// again.
+// Parameters:
+//		q; Message read
+// Returns:
+//		1 when a message was read, -1 when the store is empty or there was
+//		a read error (the rest of that segment is lost).
+// ----------------------------------------------------------------------------
+int readStore(struct upFrame *q)
+{
+	if (ups.count == 0) return(-1);
+	
+	File f = openStore(ups.rdSeq, "r");
+	if ((!f) ||
+		(!f.seek(sizeof(struct upsHdr) + ups.rdRec * sizeof(struct upFrame), SeekSet)) ||
+		(f.read((uint8_t *) q, sizeof(struct upFrame)) != sizeof(struct upFrame)) ||
+		(q->up.payLength > sizeof(q->up.payLoad)))
+	{
+		if (f) f.close();
+		uint8_t i = ups.rdSeq % UPSFILEMAX;
+		uint16_t d = ups.recs[i] - ups.rdRec;
+		statUp.lost += d;
+		popStore(d);
+		return(-1);
+	}
+	f.close();
+	return(1);
+}
+
+
+// ----------------------------------------------------------------------------
+// POPSTORE
+// Remove the n oldest messages from the flash store, n is at most what is
+// left in the segment being read. A segment that has been read completely
+// is removed, else the messages are marked UP_DONE in flash so that 
+// initStore() skips them after a restart.
+// ----------------------------------------------------------------------------
+void popStore(uint16_t n)
+{
+	uint8_t i = ups.rdSeq % UPSFILEMAX;
+	
+	ups.rdRec += n;
+	ups.count -= n;
+	
+	// Remove the segment when it has been read. If the store is empty
+	// the next message starts a new segment.
+	if (ups.count == 0) {
+		removeStore(ups.rdSeq);
+		ups.wrRec = UPSFILEREC;
+		ups.rdSeq = ups.wrSeq + 1;
+		ups.rdRec = 0;
+	}
+	else if ((ups.rdSeq < ups.wrSeq) && (ups.rdRec >= ups.recs[i])) {
+		removeStore(ups.rdSeq);
+		ups.rdSeq++;
+		ups.rdRec = 0;
+	}
+	else {
+		markStore(ups.rdRec - n, n, UP_DONE);
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// MARKSTORE
+// Write the destinations that have n messages of the segment being read
+// in their records, so that after a restart they are not sent to them 
+// again.
+// Parameters:
+//		rec; Index of the first message in the segment
+//		n; Number of messages
+//		done; UP_TTN, UP_THING bits, or UP_DONE when it was popped
+// ----------------------------------------------------------------------------
+void markStore(uint16_t rec, uint16_t n, uint8_t done)
+{
+	File f = openStore(ups.rdSeq, "r+");
+	if (!f) return;
+	for (uint16_t r=rec; r<rec+n; r++) {
+		if (f.seek(sizeof(struct upsHdr) + r * sizeof(struct upFrame) + 
+			offsetof(struct upFrame, done), SeekSet)) 
+		{
+			f.write(&done, 1);
+		}
+	}
+	f.close();
+}
+
+#endif //_UPSTORE
@@ -91,6 +91,7 @@
 // The SS (Chip select) pin is used to make sure the RFM95 is selected
 // The variable is for obvious reasons valid for read and write traffic at the
 // same time. Since both read and write mean that we write to the SPI interface.
+// Registers in regCache are read from regShadow once their value is known.
 // Parameters:
 //	Address: SPI address to read from. Type uint8_t
 // Return:
@@ -102,13 +103,25 @@ SPISettings readSettings(SPISPEED, MSBFIRST, SPI_MODE0);
 
 uint8_t readRegister(uint8_t addr)
 {
-
+	addr &= 0x7F;
+	bool cache = regCache[addr >> 3] & (1 << (addr & 0x07));
+	if (cache && (regValid[rad][addr >> 3] & (1 << (addr & 0x07)))) {
+		statSpi[rad].cached++;
+		return(regShadow[rad][addr]);
+	}
+	
 	SPI.beginTransaction(readSettings);				
     digitalWrite(pins.ss, LOW);					// Select Receiver
 	SPI.transfer(addr & 0x7F);
 	uint8_t res = (uint8_t) SPI.transfer(0x00);
     digitalWrite(pins.ss, HIGH);				// Unselect Receiver
 	SPI.endTransaction();
+	statSpi[rad].reads++;
+	
+	if (cache) {
+		regShadow[rad][addr] = res;
+		regValid[rad][addr >> 3] |= (1 << (addr & 0x07));
+	}
     return((uint8_t) res);
 }
 
@@ -116,6 +129,8 @@ uint8_t readRegister(uint8_t addr)
 // ----------------------------------------------------------------------------
 // Write value to a register with address addr. 
 // Function writes one byte at a time.
+// If the register is in regCache and already has this value nothing is
+// written.
 // Parameters:
 //	addr: SPI address to write to
 //	value: The value to write to address
@@ -128,6 +143,16 @@ SPISettings writeSettings(SPISPEED, MSBFIRST, SPI_MODE0);
 
 void writeRegister(uint8_t addr, uint8_t value)
 {
+	addr &= 0x7F;
+	if (regCache[addr >> 3] & (1 << (addr & 0x07))) {
+		if ((regValid[rad][addr >> 3] & (1 << (addr & 0x07))) && (regShadow[rad][addr] == value)) {
+			statSpi[rad].skipped++;
+			return;
+		}
+		regShadow[rad][addr] = value;
+		regValid[rad][addr >> 3] |= (1 << (addr & 0x07));
+	}
+	
 	SPI.beginTransaction(writeSettings);
 	digitalWrite(pins.ss, LOW);					// Select Receiver
 	
@@ -138,6 +163,7 @@ void writeRegister(uint8_t addr, uint8_t value)
     digitalWrite(pins.ss, HIGH);				// Unselect Receiver
 	
 	SPI.endTransaction();
+	statSpi[rad].writes++;
 }
 
 
@@ -165,36 +191,31 @@ void writeBuffer(uint8_t addr, uint8_t *buf, uint8_t len)
     digitalWrite(pins.ss, HIGH);				// Unselect Receiver
 	
 	SPI.endTransaction();
+	statSpi[rad].writes++;
 }
 
 // ----------------------------------------------------------------------------
-//  setRate is setting rate and spreading factor and CRC etc. for transmission
+//  rateConfig gives the modem config registers setRate() writes for the
+//  spreading factor and CRC etc. in mc[0..2]
 //		Modem Config 1 (MC1) == 0x72 for sx1276
 //		Modem Config 2 (MC2) == (CRC_ON) | (sf<<4)
 //		Modem Config 3 (MC3) == 0x04 | (optional SF11/12 LOW DATA OPTIMIZE 0x08)
+//		Modem Config 1 (MC1) == 0x0A for sx1272 (bw 125, cr 4/5, CRC on)
 //		sf == SF7 default 0x07, (SF7<<4) == SX72_MC2_SF7
 //		bw == 125 == 0x70
 //		cr == CR4/5 == 0x02
 //		CRC_ON == 0x04
 // ----------------------------------------------------------------------------
 
-void setRate(uint8_t sf, uint8_t crc) 
+void rateConfig(uint8_t sf, uint8_t crc, uint8_t *mc) 
 {
 	uint8_t mc1=0, mc2=0, mc3=0;
-#if DUSB>=2
-	if ((sf<SF7) || (sf>SF12)) {
-		if (( debug>=1 ) && ( pdebug & P_RADIO )) {
-			Serial.print(F("setRate:: SF="));
-			Serial.println(sf);
-		}
-		return;
-	}
-#endif
+
 	// Set rate based on Spreading Factor etc
     if (sx1272) {
-		mc1= 0x0A;				// SX1276_MC1_BW_250 0x80 | SX1276_MC1_CR_4_5 0x02
+		mc1= 0x0A;				// SX1272_MC1_BW_125 0x00 | SX1272_MC1_CR_4_5 0x08 | SX1272_MC1_CRC_ON 0x02
 		mc2= ((sf<<4) | crc) % 0xFF;
-		// SX1276_MC1_BW_250 0x80 | SX1276_MC1_CR_4_5 0x02 | SX1276_MC1_IMPLICIT_HEADER_MODE_ON 0x01
+		// SX1272_MC1_LOW_DATA_RATE_OPTIMIZE 0x01
         if (sf == SF11 || sf == SF12) { mc1= 0x0B; }			        
     }
 	
@@ -217,9 +238,52 @@ void setRate(uint8_t sf, uint8_t crc)
     //    writeRegister(REG_PAYLOAD_LENGTH, getIh(LMIC.rps)); // required length
     //}
 	
-	writeRegister(REG_MODEM_CONFIG1, (uint8_t) mc1);
-	writeRegister(REG_MODEM_CONFIG2, (uint8_t) mc2);
-	writeRegister(REG_MODEM_CONFIG3, (uint8_t) mc3);
+	mc[0] = mc1;
+	mc[1] = mc2;
+	mc[2] = mc3;
+}
+
+
+// ----------------------------------------------------------------------------
+// Time-on-air in uSec of a message of pl bytes sent after setRate(sf, crc).
+// The bandwidth, coding rate and CRC are those of the modem config 
+// registers, which have a different layout for the sx1272:
+//		sx1272 MC1: bw 7-6 (0 = 125 kHz), cr 5-3, crc on 1
+//		sx1276 MC1: bw 7-4 (7 = 125 kHz), cr 3-1; MC2: crc on 2
+// ----------------------------------------------------------------------------
+uint32_t rateAirTime(uint8_t sf, uint8_t crc, uint8_t pl)
+{
+	uint8_t mc[3];
+	uint8_t b;
+	rateConfig(sf, crc, mc);
+	if (sx1272) {
+		b = (mc[0] >> 6) & 0x03;
+		return(airTime(sf, 125 << b, (mc[0] >> 3) & 0x07, pl, (mc[0] & 0x02) != 0));
+	}
+	b = (mc[0] >> 4) & 0x0F;
+	return(airTime(sf, (b >= 7 ? 125 << (b - 7) : 125), (mc[0] >> 1) & 0x07, pl, (mc[1] & 0x04) != 0));
+}
+
+
+// ----------------------------------------------------------------------------
+// Set the modem config registers for sf and crc, see rateConfig()
+// ----------------------------------------------------------------------------
+void setRate(uint8_t sf, uint8_t crc)
+{
+	uint8_t mc[3];
+#if DUSB>=2
+	if ((sf<SF7) || (sf>SF12)) {
+		if (( debug>=1 ) && ( pdebug & P_RADIO )) {
+			Serial.print(F("setRate:: SF="));
+			Serial.println(sf);
+		}
+		return;
+	}
+#endif
+	rateConfig(sf, crc, mc);
+	writeRegister(REG_MODEM_CONFIG1, mc[0]);
+	writeRegister(REG_MODEM_CONFIG2, mc[1]);
+	writeRegister(REG_MODEM_CONFIG3, mc[2]);
 	
 	// Symbol timeout settings
     if (sf == SF10 || sf == SF11 || sf == SF12) {
@@ -231,16 +295,57 @@ void setRate(uint8_t sf, uint8_t crc)
 }
 
 
+// ----------------------------------------------------------------------------
+// Compute the FRF register value for a frequency in Hz.
+// freq * 256 / 15625 is split in a quotient and a remainder part so that
+// we only need 32-bit divisions (the remainder * 256 stays below 2^22).
+// The result is the same as ((uint64_t)freq << 19) / 32000000.
+// ----------------------------------------------------------------------------
+uint32_t frfOf(uint32_t freq)
+{
+	uint32_t q = freq / 15625;
+	uint32_t r = freq - (q * 15625);
+	return((q << 8) + ((r << 8) / 15625));
+}
+
+
+// ----------------------------------------------------------------------------
+// Fill the frfs[] table for all channels in freqs[].
+// Only done once at startup since freqs[] does not change.
+// ----------------------------------------------------------------------------
+void initFrf()
+{
+	for (uint8_t i=0; i< NUM_FREQS; i++) {
+		frfs[i] = frfOf(freqs[i]);
+#if DUSB>=1
+		if ((debug>=2) && (frfs[i] != FRF(freqs[i]))) {
+			Serial.print(F("initFrf:: ERROR ch="));
+			Serial.println(i);
+		}
+#endif
+	}
+}
+
+
 // ----------------------------------------------------------------------------
 // Set the frequency for our gateway
-// The function has no parameter other than the freq setting used in init.
-// Since we are usin a 1ch gateway this value is set fixed.
+// For our own channels and RX2 the FRF value comes from a table, other
+// (downlink) frequencies are computed by frfOf().
 // ----------------------------------------------------------------------------
 
 void  setFreq(uint32_t freq)
 {
-    // set frequency
-    uint64_t frf = ((uint64_t)freq << 19) / 32000000;
+	uint32_t frf;
+	if ((ifreq < NUM_FREQS) && (freq == (uint32_t) freqs[ifreq])) {
+		frf = frfs[ifreq];										// Normal case, rx on our channel
+	}
+	else if (freq == _RX2FREQ) {
+		frf = frfRx2;
+	}
+	else {
+		frf = frfOf(freq);
+	}
+	
     writeRegister(REG_FRF_MSB, (uint8_t)(frf>>16) );
     writeRegister(REG_FRF_MID, (uint8_t)(frf>> 8) );
     writeRegister(REG_FRF_LSB, (uint8_t)(frf>> 0) );
@@ -254,11 +359,11 @@ void  setFreq(uint32_t freq)
 // ----------------------------------------------------------------------------
 void setPow(uint8_t powe)
 {
-	if (powe >= 16) powe = 15;
+	if (powe > TX_POWE_MAX) powe = TX_POWE_MAX;
 	//if (powe >= 15) powe = 14;
-	else if (powe < 2) powe =2;
+	else if (powe < TX_POWE_MIN) powe = TX_POWE_MIN;
 	
-	ASSERT((powe>=2)&&(powe<=15));
+	ASSERT((powe>=TX_POWE_MIN)&&(powe<=TX_POWE_MAX));
 	
 	uint8_t pac = (0x80 | (powe & 0xF)) & 0xFF;
 	writeRegister(REG_PAC, (uint8_t)pac);								// set 0x09 to pac
@@ -302,23 +407,85 @@ void  opmode(uint8_t mode)
 }
 
 // ----------------------------------------------------------------------------
-// Hop to next frequency as defined by NUM_HOPS
+// Register activity on channel ch for the hop planner. 
+// Parameters:
+//	ch: channel index (ifreq)
+//	w: HOPDET for a detected preamble, HOPRCV for a received message
+// ----------------------------------------------------------------------------
+void hopActivity(uint8_t ch, uint8_t w)
+{
+	struct radio *p = &radios[rad];
+	if (ch >= NUM_HOPS) return;
+	if (w == HOPRCV) p->statHop.rcv[ch]++; else p->statHop.det[ch]++;
+	p->hopAct[ch] = (p->hopAct[ch] + w > HOPACTMAX ? HOPACTMAX : p->hopAct[ch] + w);
+}
+
+
+// ----------------------------------------------------------------------------
+// Return the number of EVENT_WAIT periods to stay on the current channel
+// before we hop. Busy channels get up to 4 times as long.
+// ----------------------------------------------------------------------------
+uint8_t hopDwell()
+{
+	uint8_t d = 1 + radios[rad].hopAct[ifreq] / (2*HOPRCV);
+	return( d > 4 ? 4 : d );
+}
+
+
+// ----------------------------------------------------------------------------
+// Choose the next channel to listen on.
+// We take the next channel with recent activity. Idle channels are skipped,
+// but not more than HOPSKIP times in a row so we notice new traffic. If no
+// channel has activity we use round robin. If only the current channel
+// has activity we stay there.
+// ----------------------------------------------------------------------------
+uint8_t hopNext()
+{
+	struct radio *p = &radios[rad];
+	bool any = false;
+	
+	if ((micros64() - p->hopDecay) > (HOPDECAY * 1000000ULL)) {
+		for (int i=0; i<NUM_HOPS; i++) p->hopAct[i] /= 2;
+		p->hopDecay = micros64();
+	}
+	for (int i=0; i<NUM_HOPS; i++) {
+		if (p->hopAct[i] > 0) any = true;
+	}
+	for (int i=1; i<=NUM_HOPS; i++) {
+		uint8_t c = (ifreq + i) % NUM_HOPS;
+		if ((!any) || (p->hopAct[c] > 0) || (p->hopSkip[c] >= HOPSKIP)) {
+			p->hopSkip[c] = 0;
+			return(c);
+		}
+		p->hopSkip[c]++;
+		p->statHop.skips++;
+	}
+	return((ifreq + 1) % NUM_HOPS);
+}
+
+
+// ----------------------------------------------------------------------------
+// Hop to next frequency as chosen by hopNext() out of NUM_HOPS channels.
 // This function should only be used for receiver operation. The current
 // receiver frequency is determined by ifreq index like so: freqs[ifreq] 
+// Registers that do not change are not written again, see writeRegister().
 // ----------------------------------------------------------------------------
 void hop() {
 
 	// 1. Set radio to standby
 	opmode(OPMODE_STANDBY);
-		
+	
+	radios[rad].statHop.dwell[ifreq] += (uint32_t)((micros64() - hopTime) / 1000);
+	
 	// 3. Set frequency based on value in freq		
-	ifreq = (ifreq + 1) % NUM_HOPS ;							// Increment the freq round robin
+	ifreq = hopNext();
+	radios[rad].statHop.hops[ifreq]++;
 	freq = freqs[ifreq];
 	setFreq(freqs[ifreq]);
 
 	// 4. Set spreading Factor
-	sf = SF7;													// Starting the new frequency 
-	setRate(sf, 0x40);											// set the sf to SF7 
+	sf = scanStart();											// Starting the new frequency 
+	setRate(sf, 0x40);											// set the first sf
 		
 	// Low Noise Amplifier used in receiver
 	writeRegister(REG_LNA, (uint8_t) LNA_MAX_GAIN);  			// 0x0C, 0x23
@@ -335,7 +502,7 @@ void hop() {
 	writeRegister(REG_PAYLOAD_LENGTH,PAYLOAD_LENGTH);			// 0x22, 0x40==64Byte long
 	
 	writeRegister(REG_FIFO_ADDR_PTR, (uint8_t) readRegister(REG_FIFO_RX_BASE_AD));	// set reg 0x0D to 0x0F
-	writeRegister(REG_HOP_PERIOD,0x00);							// reg 0x24, set to 0x00
+	writeRegister(REG_HOP_PERIOD,0x00);						// reg 0x24, set to 0x00
 
 	// 5. Config PA Ramp up time								// set reg 0x0A  
 	writeRegister(REG_PARAMP, (readRegister(REG_PARAMP) & 0xF0) | 0x08); // set PA ramp-up time 50 uSec
@@ -356,13 +523,13 @@ void hop() {
 #if DUSB>=1
 	if (( debug>=2 ) && ( pdebug & P_RADIO )){
 			Serial.print(F("hop:: hopTime:: "));
-			Serial.print(micros() - hopTime);
+			Serial.print((uint32_t)(micros64() - hopTime));
 			Serial.print(F(", "));
 			SerialStat(0);
 	}
 #endif
 	// Remember the last time we hop
-	hopTime = micros();									// At what time did we hop
+	hopTime = micros64();									// At what time did we hop
 }
 	
 
@@ -605,6 +772,194 @@ bool sendPkt(uint8_t *payLoad, uint8_t payLength)
 	return true;
 }
 
+// ----------------------------------------------------------------------------
+// Time-on-air of a LoRa message in uSec, integer only. This is the formula
+// of the Semtech SX1276 datasheet (4.1.1.7) with explicit header and a
+// preamble of 8 symbols:
+//	Tsym = 2^sf / bw
+//	Tpreamble = (8 + 4.25) * Tsym
+//	nPayload = 8 + max(ceil((8*pl - 4*sf + 28 + 16*crc) / (4*(sf - 2*de))) * (cr + 4), 0)
+// where de (low data rate optimize) is set when a symbol takes more than
+// 16 ms: sf 11 and 12 at 125 kHz, sf 12 at 250 kHz.
+// Parameters:
+//	sf: Spreading factor 6 to 12
+//	bw: Bandwidth in kHz, 125, 250 or 500
+//	cr: Coding rate, 1 (4/5) to 4 (4/8)
+//	pl: Payload length in bytes
+//	crc: Payload CRC on
+// Returns:
+//	Time on air in uSec
+// ----------------------------------------------------------------------------
+uint32_t airTime(uint8_t sf, uint16_t bw, uint8_t cr, uint8_t pl, bool crc)
+{
+	uint32_t tsym = ((uint32_t) 1000 << sf) / bw;		// Exact for 125, 250 and 500 kHz
+	uint8_t de = (tsym > 16000) ? 1 : 0;
+	
+	int32_t num = (8 * (int32_t) pl) - (4 * sf) + 28 + (crc ? 16 : 0);
+	int32_t den = 4 * (sf - (2 * de));
+	uint32_t nsym = 8;
+	if (num > 0) nsym += ((num + den - 1) / den) * (cr + 4);
+	
+	return((((8 * 4) + 17) * tsym) / 4 + (nsym * tsym));
+}
+
+
+// ----------------------------------------------------------------------------
+// Extra wait time before transmission, per spreading factor.
+// Used by loraWait() and by the arbiter which must start in time.
+// ----------------------------------------------------------------------------
+int32_t txAdjust(uint8_t sfTx)
+{
+	switch (sfTx) {
+		case 7: return(60000);							// Make time for SF7 longer 
+		default: return(0);								// Around 60ms
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// Add uSec the radio did not receive to the statistics of this hour.
+// Uses the time on air of LoraDown too.
+// ----------------------------------------------------------------------------
+void txDeaf(uint32_t us)
+{
+	uint32_t h = (uint32_t) (micros64() / 3600000000ULL);	// Hour of uptime
+	if (h != statTx.hour) {
+		statTx.airLast = (h == statTx.hour + 1) ? statTx.airHour : 0;
+		statTx.deafLast = (h == statTx.hour + 1) ? statTx.deafHour : 0;
+		statTx.airHour = 0;
+		statTx.deafHour = 0;
+		statTx.hour = h;
+	}
+	statTx.deafHour += us / 1000;
+	statTx.airHour += statTx.air / 1000;
+}
+
+
+// ----------------------------------------------------------------------------
+// Check the duty cycle of the sub-band of freq for a message of air uSec 
+// that is sent at txTime, and take its air time from the bucket if it fits.
+// The bucket is filled up to txTime, as the message is sent then.
+// Parameters:
+//	freq: Frequency in Hz
+//	air: Time-on-air in uSec
+//	txTime: micros64() of transmission
+// Returns:
+//	TX_NONE when the message may be sent, TX_FREQ or TX_DUTY otherwise
+// ----------------------------------------------------------------------------
+uint8_t dcCheck(uint32_t freq, uint32_t air, uint64_t txTime)
+{
+#if (_DUTY_CYCLE==1) && (DC_BANDS > 0)
+	uint32_t khz = freq / 1000;
+	uint8_t i;
+	for (i=0; i<DC_BANDS; i++) {
+		if ((khz >= dcBands[i].lo) && (khz < dcBands[i].hi)) break;
+	}
+	if (i == DC_BANDS) return(TX_FREQ);					// Not in any band
+	
+	uint32_t cap = (uint32_t) _DC_WINDOW * 1000 * dcBands[i].permille;
+	if (statDc[i].last == 0) {
+		statDc[i].tokens = cap;							// First use, full bucket
+	}
+	else if (txTime > statDc[i].last) {
+		uint64_t t = statDc[i].tokens + ((txTime - statDc[i].last) * dcBands[i].permille) / 1000;
+		statDc[i].tokens = (t > cap ? cap : (uint32_t) t);
+	}
+	if (txTime > statDc[i].last) statDc[i].last = txTime;
+	
+	if (statDc[i].tokens < air) {
+		statDc[i].rejected++;
+		return(TX_DUTY);
+	}
+	statDc[i].tokens -= air;
+	statDc[i].sent++;
+#endif
+	return(TX_NONE);
+}
+
+
+// ----------------------------------------------------------------------------
+// Hand the downlink message in LoraDown to the arbiter. Its time-on-air is
+// computed with the settings setRate() will use. The radio keeps on
+// receiving until txArbiter() starts the transmission.
+// Messages that are too late or too early, overlap the one being sent,
+// have a frequency outside the band or exceed the duty cycle are not sent.
+// A power we cannot do is changed to the nearest one, with txWarn set.
+// Must be called with the TX radio selected.
+// Returns:
+//	TX_NONE or the reason the message is not sent (txerr_t)
+// ----------------------------------------------------------------------------
+uint8_t txQueue()
+{
+	uint64_t txTime = tmst64(LoraDown.tmst + txDelay + txAdjust(LoraDown.sfTx));
+	uint32_t air = rateAirTime(LoraDown.sfTx, LoraDown.crc, LoraDown.payLength);
+	int64_t left = microsLeft(txTime);
+	uint8_t err = TX_NONE;
+	
+	txWarn = TX_NONE;
+	if (left < 0) {
+		err = TX_TOO_LATE;
+	}
+	else if (left > TX_EARLY) {
+		err = TX_TOO_EARLY;
+	}
+	else if (((_state == S_TX) || (_state == S_TXDONE)) &&
+		(txTime < (statTx.due + TX_LEAD + statTx.air))) {
+		err = TX_COLLISION;										// Still sending the previous one
+	}
+#if _LFREQ==915
+	else if ((LoraDown.fff < 902000000) || (LoraDown.fff > 928000000)) {
+		err = TX_FREQ;
+	}
+#endif
+	else {
+		if ((LoraDown.powe > TX_POWE_MAX) || (LoraDown.powe < TX_POWE_MIN)) {
+			LoraDown.powe = (LoraDown.powe > TX_POWE_MAX ? TX_POWE_MAX : TX_POWE_MIN);
+			txWarn = TX_POWER;
+			statTx.err[TX_POWER]++;
+		}
+		err = dcCheck(LoraDown.fff, air, txTime);
+	}
+	
+	if (err != TX_NONE) {
+		statTx.err[err]++;
+#if DUSB>=1
+		if (( debug>=1 ) && ( pdebug & P_TX )) {
+			Serial.print(F("T txQueue:: not sent, "));
+			Serial.println(txErrStr[err]);
+		}
+#endif
+		return(err);
+	}
+	statTx.air = air;
+	statTx.due = txTime - TX_LEAD;
+	statTx.pending = true;
+	return(TX_NONE);
+}
+
+
+// ----------------------------------------------------------------------------
+// Start the transmission of a pending downlink when it is due.
+// Called by stateMachine() of the radio that transmits. If the radio is
+// receiving a message at that time, the reception is aborted as the
+// downlink cannot wait.
+// ----------------------------------------------------------------------------
+void txArbiter()
+{
+	if (micros64() < statTx.due) return;
+	if ((_state == S_TX) || (_state == S_TXDONE)) return;	// Previous one not done yet
+	
+	if ((_state == S_RX) && ((_cad) || (_hop))) {		// Preamble detected, receiving
+		statTx.preempt++;
+	}
+	statTx.pending = false;
+	_state = S_TX;
+	_event = 1;
+	sendTime = micros64();								// record when we started sending
+	statTx.start = sendTime;
+}
+
+
 // ----------------------------------------------------------------------------
 // loraWait()
 // This function implements the wait protocol needed for downstream transmissions.
@@ -628,28 +983,19 @@ void loraWait(const uint32_t timestamp)
 {
 	uint32_t startMics = micros();						// Start of the loraWait function
 	uint32_t tmst = timestamp;
-// XXX
-	int32_t adjust=0;
-	switch (LoraDown.sfTx) {
-		case 7: adjust= 60000; break;					// Make time for SF7 longer 
-		case 8: break;									// Around 60ms
-		case 9: break;
-		case 10: break;
-		case 11: break;
-		case 12: break;
-		default:
 #if DUSB>=1
-		if (( debug>=1 ) && ( pdebug & P_TX )) {
-			Serial.print(F("T loraWait:: unknown SF="));
-			Serial.print(LoraDown.sfTx);
-		}
-#endif
-		break; // to avoid compiler error when DUSB==0
+	if (((LoraDown.sfTx < 7) || (LoraDown.sfTx > 12)) && ( debug>=1 ) && ( pdebug & P_TX )) {
+		Serial.print(F("T loraWait:: unknown SF="));
+		Serial.print(LoraDown.sfTx);
 	}
-	tmst = tmst + txDelay + adjust;						// tmst based on txDelay and spreading factor
-	uint32_t waitTime = tmst - micros();
-//	if (waitTime<0) { //uint32_t is never negative! If micros() is > tmst, waitTime assume a very big value and the app hangs
-	if (micros()>tmst) { // test if the tmst is in the past to avoid hangs
+#endif
+	tmst = tmst + txDelay + txAdjust(LoraDown.sfTx);	// tmst based on txDelay and spreading factor
+	
+	// tmst is a 32-bit micros() value that may be on the other side of a 
+	// micros() wrap, so compare on the 64-bit clock.
+	uint64_t txTime = tmst64(tmst);
+	int32_t waitTime = (int32_t) microsLeft(txTime);
+	if (waitTime < 0) {									// test if the tmst is in the past to avoid hangs
 		Serial.println(F("loraWait:: Error wait time < 0"));
 		return;
 	}
@@ -658,7 +1004,7 @@ void loraWait(const uint32_t timestamp)
 	// This is the most efficient way
 	while (waitTime > 16000) {
 		delay(15);										// ms delay including yield, slightly shorter
-		waitTime= tmst - micros();
+		waitTime = (int32_t) microsLeft(txTime);
 	}
 	// The remaining wait time is less tan 15000 uSecs
 	// And we use delayMicroseconds() to wait
@@ -815,6 +1161,13 @@ void txLoraModem(uint8_t *payLoad, uint8_t payLength, uint32_t tmst, uint8_t sfT
 
 void rxLoraModem()
 {
+#if _TXRADIO >= 0
+	// A radio only used for downlink does not listen
+	if (rad == _TXRADIO) {
+		opmode(OPMODE_STANDBY);
+		return;
+	}
+#endif
 	// 1. Put system in LoRa mode
 	//opmode(OPMODE_LORA);										// Is already so
 	
@@ -900,6 +1253,13 @@ void rxLoraModem()
 // ----------------------------------------------------------------------------
 void cadScanner()
 {
+#if _TXRADIO >= 0
+	// A radio only used for downlink does not listen
+	if (rad == _TXRADIO) {
+		opmode(OPMODE_STANDBY);
+		return;
+	}
+#endif
 	// 1. Put system in LoRa mode (which destroys all other nodes(
 	//opmode(OPMODE_LORA);
 	
@@ -945,6 +1305,60 @@ void cadScanner()
 }// cadScanner
 
 
+// ----------------------------------------------------------------------------
+// Start a new CAD scan cycle and return the first SF to scan.
+// Normally this is the SF we received most messages on, but in _CAD_EXPLORE
+// percent of the cycles we use SF7 to SF12 so other SFs are seen as well.
+// ----------------------------------------------------------------------------
+sf_t scanStart()
+{
+	struct radio *p = &radios[rad];
+	p->statCad.cycles++;
+	sfIdx = 0;
+	sfExplore = ((_CAD_EXPLORE >= 100) || 
+		((_CAD_EXPLORE > 0) && ((p->statCad.cycles % (100 / _CAD_EXPLORE)) == 0)));
+	return( sfExplore ? SF7 : (sf_t) p->sfOrder[0] );
+}
+
+
+// ----------------------------------------------------------------------------
+// Return the next SF to scan in this cycle.
+// Caller makes sure that sfIdx < 5
+// ----------------------------------------------------------------------------
+sf_t scanNext()
+{
+	sfIdx++;
+	return( sfExplore ? (sf_t)(SF7 + sfIdx) : (sf_t) radios[rad].sfOrder[sfIdx] );
+}
+
+
+// ----------------------------------------------------------------------------
+// Count a received message on SF s and sort the scan order on the weights.
+// The weights are halved when one gets too large so that the order follows
+// changes in the nodes around the gateway.
+// ----------------------------------------------------------------------------
+void scanOrder(uint8_t s)
+{
+	struct radio *p = &radios[rad];
+	if ((s < SF7) || (s > SF12)) return;
+	p->statCad.rcv[s - SF7]++;
+	if (++p->sfWeight[s - SF7] > SFWEIGHTMAX) {
+		for (int i=0; i<6; i++) p->sfWeight[i] /= 2;
+	}
+	// Insertion sort, 6 elements. Equal weights keep the lower SF first.
+	for (int i=0; i<6; i++) p->sfOrder[i] = SF7 + i;
+	for (int i=1; i<6; i++) {
+		uint8_t o = p->sfOrder[i];
+		int j = i-1;
+		while ((j >= 0) && (p->sfWeight[p->sfOrder[j] - SF7] < p->sfWeight[o - SF7])) {
+			p->sfOrder[j+1] = p->sfOrder[j];
+			j--;
+		}
+		p->sfOrder[j+1] = o;
+	}
+}
+
+
 // ----------------------------------------------------------------------------
 // First time initialisation of the LoRa modem
 // Subsequent changes to the modem state etc. done by txLoraModem or rxLoraModem
@@ -970,6 +1384,10 @@ void initLoraModem()
     digitalWrite(pins.rst, LOW);
 	delayMicroseconds(10000);
 #endif
+	// After a reset the registers have their default values again
+	memset(regValid[rad], 0, sizeof(regValid[rad]));
+	initFrf();
+	
 	// 2. Set radio to sleep
 	opmode(OPMODE_SLEEP);										// set register 0x01 to 0x00
 
@@ -1072,7 +1490,7 @@ void startReceiver() {
 		}
 #endif
 		_state = S_SCAN;
-		sf = SF7;
+		sf = scanStart();
 		cadScanner();
 	}
 	else {
@@ -1084,6 +1502,131 @@ void startReceiver() {
 }
 
 
+// ----------------------------------------------------------------------------
+// Select radio r: save the context of the current radio in radios[] and load
+// the one of radio r. With one radio there is nothing to do.
+// ----------------------------------------------------------------------------
+void radioSelect(uint8_t r)
+{
+#if _RADIOS > 1
+	if (r == rad) return;
+	
+	struct radio *p = &radios[rad];
+	p->state = _state;
+	p->event = _event;
+	p->ifreq = ifreq;
+	p->freq = freq;
+	p->sf = sf;
+	p->sfIdx = sfIdx;
+	p->sfExplore = sfExplore;
+	p->rssi = _rssi;
+	p->eventTime = eventTime;
+	p->doneTime = doneTime;
+	p->sendTime = sendTime;
+	p->hopTime = hopTime;
+	p->detTime = detTime;
+	p->pollTime = pollTime;
+	
+	rad = r;
+	p = &radios[rad];
+	pins.ss = p->ss;
+	pins.dio0 = p->dio0;
+	pins.dio1 = p->dio1;
+	pins.dio2 = p->dio2;
+	pins.rst = p->rst;
+	_state = p->state;
+	_event = p->event;
+	ifreq = p->ifreq;
+	freq = p->freq;
+	sf = p->sf;
+	sfIdx = p->sfIdx;
+	sfExplore = p->sfExplore;
+	_rssi = p->rssi;
+	eventTime = p->eventTime;
+	doneTime = p->doneTime;
+	sendTime = p->sendTime;
+	hopTime = p->hopTime;
+	detTime = p->detTime;
+	pollTime = p->pollTime;
+#endif
+}
+
+
+// ----------------------------------------------------------------------------
+// Fill the context of every radio. Radio 0 uses the pins of loraModem.h
+// and the current ifreq and sf. Radio n uses channel ifreq+n.
+// Radio 0 is selected afterwards.
+// ----------------------------------------------------------------------------
+void radioSetup()
+{
+	for (uint8_t r=0; r<_RADIOS; r++) {
+		struct radio *p = &radios[r];
+		if (r == 0) {
+			p->ss = pins.ss; p->dio0 = pins.dio0; p->dio1 = pins.dio1;
+			p->dio2 = pins.dio2; p->rst = pins.rst;
+		}
+#if _RADIOS > 1
+		else {
+			p->ss = radioPins[r-1][0]; p->dio0 = radioPins[r-1][1]; p->dio1 = radioPins[r-1][2];
+			p->dio2 = radioPins[r-1][3]; p->rst = radioPins[r-1][4];
+		}
+#endif
+		p->state = S_INIT;
+		p->event = 0;
+		p->ifreq = (ifreq + r) % NUM_HOPS;
+		p->freq = freqs[p->ifreq];
+		p->sf = sf;
+		p->sfIdx = 0;
+		p->sfExplore = false;
+		p->rssi = 0;
+		p->eventTime = p->doneTime = p->sendTime = 0;
+		p->hopTime = p->detTime = p->pollTime = 0;
+		p->rcvd = 0;
+		p->sent = 0;
+		for (int i=0; i<6; i++) p->sfOrder[i] = SF7 + i;
+	}
+	rad = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// Put an event in evtRing of radio r. Called by the interrupt handlers only.
+// _event is not touched: it belongs to the selected radio, which need not
+// be radio r. If the ring is full the event is lost, but the ring is not 
+// empty so stateMachine() of radio r still reads the flags.
+// ----------------------------------------------------------------------------
+void ICACHE_RAM_ATTR pushEvent(uint8_t r, uint8_t src)
+{
+	uint8_t h = evtHead[r];
+	if ((uint8_t)(h - evtTail[r]) >= EVTRING) {
+		evtLost[r]++;
+	}
+	else {
+		evtRing[r][h & (EVTRING-1)].tmst = micros();
+		evtRing[r][h & (EVTRING-1)].src = src;
+		evtHead[r] = h + 1;								// Publish after filling the entry
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// Return true when a radio needs its state machine: there are events in 
+// its ring, or it has a soft event (_event of the selected radio, the saved
+// event of the others). loop() handles the radios first when this is set.
+// ----------------------------------------------------------------------------
+bool radioPending()
+{
+	if (_event) return(true);
+	for (uint8_t r=0; r<_RADIOS; r++) {
+		if (evtHead[r] != evtTail[r]) return(true);
+#if _RADIOS > 1
+		if ((r != rad) && (radios[r].event)) return(true);
+#endif
+	}
+	return(false);
+}
+
+
 // ----------------------------------------------------------------------------
 // Interrupt_0 Handler.
 // Both interrupts DIO0 and DIO1 are mapped on GPIO15. Se we have to look at 
@@ -1094,7 +1637,7 @@ void startReceiver() {
 // ----------------------------------------------------------------------------
 void ICACHE_RAM_ATTR Interrupt_0()
 {
-	_event=1;
+	pushEvent(0, EVT_DIO0);
 }
 
 
@@ -1111,7 +1654,7 @@ void ICACHE_RAM_ATTR Interrupt_0()
 // ----------------------------------------------------------------------------
 void ICACHE_RAM_ATTR Interrupt_1()
 {
-	_event=1;
+	pushEvent(0, EVT_DIO1);
 }
 
 // ----------------------------------------------------------------------------
@@ -1119,7 +1662,62 @@ void ICACHE_RAM_ATTR Interrupt_1()
 // ----------------------------------------------------------------------------
 void ICACHE_RAM_ATTR Interrupt_2() 
 {
-	_event=1;
+	pushEvent(0, EVT_DIO2);
 }
 
 
+// ----------------------------------------------------------------------------
+// Interrupt handlers of radio 1 and up. dio0 and dio1 both use these, the
+// flags tell what happened.
+// ----------------------------------------------------------------------------
+#if _RADIOS > 1
+void ICACHE_RAM_ATTR Interrupt_R1()
+{
+	pushEvent(1, EVT_DIO0);
+}
+#endif
+#if _RADIOS > 2
+void ICACHE_RAM_ATTR Interrupt_R2()
+{
+	pushEvent(2, EVT_DIO0);
+}
+#endif
+#if _RADIOS > 3
+void ICACHE_RAM_ATTR Interrupt_R3()
+{
+	pushEvent(3, EVT_DIO0);
+}
+#endif
+
+
+// ----------------------------------------------------------------------------
+// Attach the interrupt handlers of the selected radio to its dio pins.
+// For radio 0 dio0 and dio1 may be separate pins (Comresult) or
+// shared (GPIO15 / D8 for Hallard). We switch on RISING interrupts.
+// ----------------------------------------------------------------------------
+void radioAttach()
+{
+	if (rad == 0) {
+		if (pins.dio0 == pins.dio1) {
+			attachInterrupt(pins.dio0, Interrupt_0, RISING);	// Share interrupts
+		}
+		else {
+			attachInterrupt(pins.dio0, Interrupt_0, RISING);	// Separate interrupts
+			attachInterrupt(pins.dio1, Interrupt_1, RISING);	// Separate interrupts		
+		}
+		return;
+	}
+#if _RADIOS > 1
+	void (*isr)() = Interrupt_R1;
+#if _RADIOS > 2
+	if (rad == 2) isr = Interrupt_R2;
+#endif
+#if _RADIOS > 3
+	if (rad == 3) isr = Interrupt_R3;
+#endif
+	attachInterrupt(pins.dio0, isr, RISING);
+	if (pins.dio1 != pins.dio0) {
+		attachInterrupt(pins.dio1, isr, RISING);
+	}
+#endif
+}
@@ -69,19 +69,67 @@ void acti_oLED()
 }
 
 // ----------------------------------------------------------------
-// Print a message on the OLED.
-// Note: The whole message must fit in the buffer
+// Store a received message for the OLED. Called from the receive 
+// path, so nothing is drawn here; see draw_oLED()
 //
 // ----------------------------------------------------------------
-void msg_oLED(String tim, String sf) {
-    display.clear();
-    display.setFont(ArialMT_Plain_16);
-    display.setTextAlignment(TEXT_ALIGN_LEFT);
+void msg_oLED(uint8_t *message, uint8_t len, int rssi, long snr) 
+{
+	oledPkt.tmst = now();
+	oledPkt.rssi = rssi;
+	oledPkt.snr = snr;
+	oledPkt.len = len;
+	for (int i=0; i<4; i++) {
+		oledPkt.addr[i] = (len > 4 ? message[4-i] : 0);
+	}
+	oledPkt.dirty = true;
+	statOled.pkts++;
+}
+
+// ----------------------------------------------------------------
+// Show the last received message on the OLED. Called by loop(), 
+// the screen is updated at most every OLED_INTERVAL mSec and only
+// when there is no radio event waiting. A burst of messages costs
+// one update.
+//
+// ----------------------------------------------------------------
+void draw_oLED() 
+{
+	if ((!oledPkt.dirty) || (radioPending())) return;
+	if ((millis() - oledTime) < OLED_INTERVAL) return;
+	
+	uint32_t start = micros();
+	uint32_t bytes = display.i2cBytes;
+	char buf[20];
+	
+	display.clear();
+	display.setFont(ArialMT_Plain_16);
+	display.setTextAlignment(TEXT_ALIGN_LEFT);
+	
+	sprintf(buf, "%02i:%02i:%02i", hour(oledPkt.tmst), minute(oledPkt.tmst), second(oledPkt.tmst));
+	display.drawString(0, 0, "Time: " );
+	display.drawString(40, 0, buf);
+	
+	display.drawString(0, 16, "RSSI: " );
+	display.drawString(40, 16, String(oledPkt.rssi));
+	display.drawString(70, 16, ",SNR: " );
+	display.drawString(110, 16, String(oledPkt.snr));
+	
+	sprintf(buf, "%02x %02x %02x %02x", oledPkt.addr[0], oledPkt.addr[1], oledPkt.addr[2], oledPkt.addr[3]);
+	display.drawString(0, 32, "Addr: " );
+	display.drawString(40, 32, buf);
 	
 	display.drawString(0, 48, "LEN: " );
-//    display.drawString(40, 48, String((int)messageLength) );
-    display.display();
-	yield();
+	display.drawString(40, 48, String((int)oledPkt.len));
+	display.display();
+	
+	uint32_t us = micros() - start;
+	statOled.draws++;
+	statOled.bytes += display.i2cBytes - bytes;
+	statOled.us += us;
+	if (us > statOled.usMax) statOled.usMax = us;
+	oledPkt.dirty = false;
+	oledTime = millis();
 }
 
 // ----------------------------------------------------------------
@@ -25,6 +25,8 @@
 
 // Make sure that webserver is running before continuing
 
+WiFiClient otaClient;							// Firmware download, see otaStep()
+
 // ----------------------------------------------------------------------------
 // setupOta
 // Function to run in the setup() function to initialise the update function
@@ -105,16 +107,445 @@ void setupOta(char *hostname) {
 
 
 // ----------------------------------------------------------------------------
-//
-//
+// Start the download of the default image _OTA_PATH from _OTA_HOST.
+// Called by the UPDATE button of the webserver.
 // ----------------------------------------------------------------------------
 void updateOtaa() {
+	otaStart(_OTA_HOST, _OTA_PORT, _OTA_PATH, "");
+}
+
+
+// ----------------------------------------------------------------------------
+// SHA-256 (FIPS 180-4) of the image, computed while it is downloaded.
+// The Updater only checks MD5, and not every core has a SHA-256.
+// ----------------------------------------------------------------------------
+static const uint32_t shaK[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3, 
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+#define SHA_ROR(x,n) (((x) >> (n)) | ((x) << (32-(n))))
+
+void sha256Init(struct sha256Ctx *c)
+{
+	static const uint32_t h0[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 
+									0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memcpy(c->h, h0, sizeof(h0));
+	c->len = 0;
+}
+
+void sha256Block(struct sha256Ctx *c, const uint8_t *p)
+{
+	uint32_t w[64];
+	uint32_t v[8];
+	
+	for (int i=0; i<16; i++) {
+		w[i] = ((uint32_t)p[4*i]<<24) | ((uint32_t)p[4*i+1]<<16) | ((uint32_t)p[4*i+2]<<8) | p[4*i+3];
+	}
+	for (int i=16; i<64; i++) {
+		uint32_t s0 = SHA_ROR(w[i-15],7) ^ SHA_ROR(w[i-15],18) ^ (w[i-15] >> 3);
+		uint32_t s1 = SHA_ROR(w[i-2],17) ^ SHA_ROR(w[i-2],19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+	memcpy(v, c->h, sizeof(v));
+	for (int i=0; i<64; i++) {
+		uint32_t t1 = v[7] + (SHA_ROR(v[4],6) ^ SHA_ROR(v[4],11) ^ SHA_ROR(v[4],25)) + 
+					((v[4] & v[5]) ^ (~v[4] & v[6])) + shaK[i] + w[i];
+		uint32_t t2 = (SHA_ROR(v[0],2) ^ SHA_ROR(v[0],13) ^ SHA_ROR(v[0],22)) + 
+					((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+		memmove(&v[1], &v[0], 7 * sizeof(uint32_t));
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+	for (int i=0; i<8; i++) c->h[i] += v[i];
+}
+
+void sha256Update(struct sha256Ctx *c, const uint8_t *p, uint32_t n)
+{
+	while (n > 0) {
+		uint8_t i = c->len % 64;
+		uint32_t k = (n < (uint32_t)(64 - i) ? n : 64 - i);
+		memcpy(c->buf + i, p, k);
+		c->len += k;
+		p += k;
+		n -= k;
+		if ((c->len % 64) == 0) sha256Block(c, c->buf);
+	}
+}
+
+// Finish the hash, hex gets the 64 character lowercase digest
+void sha256Hex(struct sha256Ctx *c, char *hex)
+{
+	uint64_t bits = (uint64_t) c->len * 8;
+	uint8_t i = c->len % 64;
+	c->buf[i++] = 0x80;
+	if (i > 56) {
+		memset(c->buf + i, 0, 64 - i);
+		sha256Block(c, c->buf);
+		i = 0;
+	}
+	memset(c->buf + i, 0, 56 - i);
+	for (int j=0; j<8; j++) c->buf[63-j] = (uint8_t)(bits >> (8*j));
+	sha256Block(c, c->buf);
+	for (int j=0; j<32; j++) {
+		sprintf(hex + 2*j, "%02x", (uint8_t)(c->h[j/4] >> (24 - 8*(j%4))));
+	}
+}
+
 
-	String response="";
-	printIP((IPAddress)WiFi.localIP(),'.',response);
+// ----------------------------------------------------------------------------
+// Start a firmware download. Ignored when a download is running.
+// Parameters:
+//	host, port, path: Of the image on a web server (http only)
+//	sha: SHA-256 of the image in hex, or "" to read it from <path>.sha256
+// Returns:
+//	0 when started, -1 if not
+// ----------------------------------------------------------------------------
+int otaStart(const char *host, uint16_t port, const char *path, const char *sha)
+{
+	if ((ota.state != OTA_IDLE) && (ota.state != OTA_FAIL)) return(-1);
 	
-	ESPhttpUpdate.update(response, 80, "/arduino.bin");
+	strncpy(ota.host, host, sizeof(ota.host)-1);
+	ota.host[sizeof(ota.host)-1] = 0;
+	strncpy(ota.path, path, sizeof(ota.path)-8);		// Room for ".sha256"
+	ota.path[sizeof(ota.path)-8] = 0;
+	ota.ip = IPAddress(0, 0, 0, 0);
+	otaDns.start = 0;
+	ota.port = port;
+	ota.sha[0] = 0;
+	if (strlen(sha) == 64) strcpy(ota.sha, sha);
+	ota.file = (ota.sha[0] == 0 ? OTA_F_SHA : OTA_F_BIN);
+	ota.off = 0;
+	ota.size = 0;
+	ota.retries = 0;
+	ota.state = OTA_RESOLVE;
+	ota.since = millis();
+	statOta.starts++;
+	statOta.start = millis();
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M otaStart:: "));
+		Serial.print(ota.host);
+		Serial.println(ota.path);
+	}
+#endif
+	return(0);
+}
+
+
+// ----------------------------------------------------------------------------
+// The download failed and cannot continue. A partially written image is 
+// abandoned, Update.end() does not activate an image that is not complete.
+// ----------------------------------------------------------------------------
+void otaFail(const char *why)
+{
+	otaClient.stop();
+	if ((ota.file == OTA_F_BIN) && (ota.size > 0)) {
+		Update.end();
+	}
+	ota.state = OTA_FAIL;
+	statOta.fails++;
+#if DUSB>=1
+	if (( debug>=0 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M otaFail:: "));
+		Serial.print(why);
+		Serial.print(F(", off="));
+		Serial.println(ota.off);
+	}
+#endif
+}
 
+
+// ----------------------------------------------------------------------------
+// The connection broke or timed out. Wait a while and continue the 
+// download where it stopped.
+// ----------------------------------------------------------------------------
+void otaRetry(const char *why)
+{
+	otaClient.stop();
+	if (++ota.retries > OTA_RETRIES) {
+		otaFail(why);
+		return;
+	}
+	ota.state = OTA_WAIT;
+	ota.since = millis();
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_MAIN )) {
+		Serial.print(F("M otaRetry:: "));
+		Serial.print(why);
+		Serial.print(F(", off="));
+		Serial.println(ota.off);
+	}
+#endif
+}
+
+
+// ----------------------------------------------------------------------------
+// Handle a line of the HTTP response header in ota.line.
+// At the empty line that ends the header, the body starts. For the image
+// the Updater is started on the first response, for a continued download 
+// the server should answer 206 with the rest of the image.
+// ----------------------------------------------------------------------------
+void otaHeader()
+{
+	if (ota.status == 0) {
+		if (sscanf(ota.line, "HTTP/%*d.%*d %d", &ota.status) != 1) ota.status = -1;
+		return;
+	}
+	if (strncasecmp(ota.line, "Content-Length:", 15) == 0) {
+		ota.length = strtoul(ota.line + 15, NULL, 10);
+		return;
+	}
+	if (strncasecmp(ota.line, "Content-Range:", 14) == 0) {
+		char *p = strstr(ota.line + 14, "bytes");		// bytes <first>-<last>/<size>
+		if (p != NULL) ota.range = strtoul(p + 5, NULL, 10);
+		return;
+	}
+	if (ota.lineLen > 0) return;
+	
+	// End of the header
+	if ((ota.status != 200) && (ota.status != 206)) {
+		char why[16];
+		sprintf(why, "HTTP %d", ota.status);
+		otaFail(why);
+		return;
+	}
+	ota.skip = 0;
+	if (ota.file == OTA_F_BIN) {
+		if (ota.off == 0) {
+			ota.size = ota.length;
+			if ((ota.size == 0) || (!Update.begin(ota.size))) {
+				ota.size = 0;
+				otaFail("no room");
+				return;
+			}
+			sha256Init(&ota.ctx);
+		}
+		else if (ota.status == 200) {
+			ota.skip = ota.off;							// Range was ignored
+		}
+		else if (ota.range != ota.off) {
+			otaRetry("range");							// Not where we are
+			return;
+		}
+		else {
+			statOta.resumes++;
+		}
+	}
+	else {
+		ota.off = 0;
+	}
+	ota.state = OTA_BODY;
+}
+
+
+// ----------------------------------------------------------------------------
+// Handle the data of the image in otaBuf. The last part is only written
+// after the SHA-256 has been checked, so a wrong image is never activated.
+// ----------------------------------------------------------------------------
+void otaData(uint8_t *buf, uint32_t n)
+{
+	char hex[65];
+	
+	if (ota.skip > 0) {
+		uint32_t k = (n < ota.skip ? n : ota.skip);
+		ota.skip -= k;
+		buf += k;
+		n -= k;
+	}
+	if (n == 0) return;
+	if (n > (ota.size - ota.off)) n = ota.size - ota.off;
+	
+	sha256Update(&ota.ctx, buf, n);
+	if ((ota.off + n) >= ota.size) {
+		sha256Hex(&ota.ctx, hex);
+		if (strcasecmp(hex, ota.sha) != 0) {
+			otaFail("sha256");
+			return;
+		}
+	}
+	if (Update.write(buf, n) != n) {
+		otaFail("write");
+		return;
+	}
+	ota.off += n;
+	ota.retries = 0;
+	
+	if (ota.off >= ota.size) {
+		otaClient.stop();
+		if (!Update.end()) {
+			ota.size = 0;
+			otaFail("end");
+			return;
+		}
+		statOta.msLast = millis() - statOta.start;
+		ota.state = OTA_DONE;
+		ota.since = millis();
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// Resolve ota.host without waiting for the answer, which dnsFound() puts 
+// in otaDns. An address in the lwIP cache is used at once.
+// Returns:
+//	1 when ota.ip is set, 0 when waiting, -1 when the host is not found
+// ----------------------------------------------------------------------------
+int otaResolve()
+{
+	ip_addr_t a;
+	
+	if (otaDns.start == 0) {
+		otaDns.done = false;
+		otaDns.lookups++;
+		otaDns.start = millis() | 1;					// Not 0
+		err_t err = dns_gethostbyname(ota.host, &a, dnsFound, (void *) &otaDns);
+		if (err == ERR_OK) {
+			otaDns.found = DNS_IP4(&a);					// In the lwIP cache
+			otaDns.done = true;
+		}
+		else if (err != ERR_INPROGRESS) {
+			otaDns.found = 0;
+			otaDns.done = true;
+		}
+	}
+	if (!otaDns.done) return(0);
+	otaDns.done = false;
+	otaDns.start = 0;
+	if (otaDns.found == 0) {
+		otaDns.fails++;
+		return(-1);
+	}
+	ota.ip = IPAddress(otaDns.found);
+	return(1);
+}
+
+
+// ----------------------------------------------------------------------------
+// OTASTEP
+// Run the firmware download, called by loop(). Never waits for data or
+// DNS: at most OTA_READ bytes are handled per call, so the radio and the
+// servers are handled in between. The TCP connect blocks at most
+// OTA_CONNECT_MS mSec.
+// ----------------------------------------------------------------------------
+void otaStep()
+{
+	uint32_t ms = millis();
+	int n;
+	
+	switch (ota.state) {
+	case OTA_IDLE:
+	case OTA_FAIL:
+		return;
+	
+	case OTA_WAIT:
+		if ((ms - ota.since) < (uint32_t) (ota.retries * OTA_BACKOFF)) return;
+		ota.since = ms;
+		ota.state = (ota.ip == IPAddress(0, 0, 0, 0) ? OTA_RESOLVE : OTA_CONNECT);
+		return;
+	
+	case OTA_RESOLVE:
+		if (!wlanUp()) return;
+		n = otaResolve();
+		if (n < 0) {
+			otaRetry("dns");
+			return;
+		}
+		if (n > 0) ota.state = OTA_CONNECT;
+		break;											// Timeout below
+	
+	case OTA_CONNECT:
+		if (!wlanUp()) return;
+		otaClient.setTimeout(OTA_CONNECT_MS);
+		if (!otaClient.connect(ota.ip, ota.port)) {
+			otaRetry("connect");
+			return;
+		}
+		otaClient.print(String("GET ") + ota.path + (ota.file == OTA_F_SHA ? ".sha256" : "") +
+			" HTTP/1.1\r\nHost: " + ota.host + "\r\nConnection: close\r\n");
+		if ((ota.file == OTA_F_BIN) && (ota.off > 0)) {
+			otaClient.print(String("Range: bytes=") + ota.off + "-\r\n");
+		}
+		otaClient.print("\r\n");
+		ota.status = 0;
+		ota.length = 0;
+		ota.range = 0;
+		ota.lineLen = 0;
+		ota.since = ms;
+		ota.state = OTA_HEAD;
+		return;
+	
+	case OTA_HEAD:
+		while ((ota.state == OTA_HEAD) && (otaClient.available() > 0)) {
+			char c = otaClient.read();
+			ota.since = ms;
+			if (c == '\r') continue;
+			if (c != '\n') {
+				if (ota.lineLen < sizeof(ota.line)-1) ota.line[ota.lineLen++] = c;
+				continue;
+			}
+			ota.line[ota.lineLen] = 0;
+			otaHeader();
+			ota.lineLen = 0;
+		}
+		break;
+	
+	case OTA_BODY:
+		n = otaClient.available();
+		if (n > OTA_READ) n = OTA_READ;
+		if (n > 0) n = otaClient.read(otaBuf, n);
+		if (n > 0) {
+			ota.since = ms;
+			if (ota.file == OTA_F_BIN) {
+				otaData(otaBuf, n);
+			}
+			else {
+				for (int i=0; (i<n) && (ota.off<64) && isxdigit(otaBuf[i]); i++) {
+					ota.sha[ota.off++] = otaBuf[i];
+				}
+				ota.sha[ota.off] = 0;
+			}
+			return;
+		}
+		if (otaClient.connected()) break;
+		
+		// Connection closed by the server
+		if (ota.file == OTA_F_SHA) {
+			if (ota.off != 64) {
+				otaFail("sha256 file");
+				return;
+			}
+			ota.file = OTA_F_BIN;
+			ota.off = 0;
+			ota.state = OTA_CONNECT;
+			return;
+		}
+		otaRetry("closed");
+		return;
+	
+	// Give the web server time to show the result, then start the new image
+	case OTA_DONE:
+		if ((ms - ota.since) < 2000) return;
+#if DUSB>=1
+		Serial.println(F("M otaStep:: restart with new image"));
+		Serial.flush();
+#endif
+#if STAT_LOG==1
+		flushLog();
+#endif
+		ESP.restart();
+		return;
+	}
+	
+	if ((ms - ota.since) > OTA_TIMEOUT) {
+		otaDns.start = 0;								// Ask again at the retry
+		otaRetry("timeout");
+	}
 }
 
 
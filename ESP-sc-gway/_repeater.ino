@@ -12,35 +12,175 @@
 //
 // Author: Maarten Westenberg (mw12554@hotmail.com)
 //
-// This file contains code for using the single channel gateway also as a sensor node. 
-// Please specify the DevAddr and the AppSKey below (and on your LoRa backend).
-// Also you will have to choose what sensors to forward to your application.
+// This file contains code for using the single channel gateway also as a repeater.
+// Uplinks received on _ICHAN are sent again on _OCHAN, for nodes that the 
+// other gateways cannot hear (e.g. in a basement). See ESP-sc-gway.h for the settings.
 //
 // ============================================================================
 		
 #if REPEATER==1
 
-#define _ICHAN 0
-#define _OCHAN 1
+// ----------------------------------------------------------------------------
+// Check the allow lists for the message in msg. A data message is checked
+// against the DevAddr in _REP_NODES, a join request against the DevEUI
+// (bytes 9-16, LSB first) in _REP_EUIS. An empty list allows all.
+// Returns:
+//	true when the message may be repeated
+// ----------------------------------------------------------------------------
+bool repAllowed(uint8_t *msg, uint8_t len)
+{
+	bool list = false;
+	
+	if ((msg[0] >> 5) == 0) {							// Join request
+		uint64_t eui = 0;
+		if (len < 23) return(false);
+		for (uint8_t i=16; i>=9; i--) eui = (eui << 8) | msg[i];
+		for (uint8_t i=0; i<(sizeof(repEuis)/sizeof(repEuis[0])); i++) {
+			if (repEuis[i] == 0) continue;
+			if (repEuis[i] == eui) return(true);
+			list = true;
+		}
+		return(!list);
+	}
+	
+	uint32_t addr = ((uint32_t)msg[4]<<24) | ((uint32_t)msg[3]<<16) | ((uint32_t)msg[2]<<8) | msg[1];
+	for (uint8_t i=0; i<(sizeof(repNodes)/sizeof(repNodes[0])); i++) {
+		if (repNodes[i] == 0) continue;
+		if (repNodes[i] == addr) return(true);
+		list = true;
+	}
+	return(!list);
+}
+
 
-#ifdef _TTNSERVER
-#error "Please undefined _THINGSERVER, for REAPETR shutdown WiFi"
+// ----------------------------------------------------------------------------
+// Take a received uplink in LoraUp for repeating. Called by receivePacket()
+// before the message is forwarded or queued, so that the repeater also 
+// works when there is no WiFi.
+// Returns:
+//	1 when the message is queued, 0 if not
+// ----------------------------------------------------------------------------
+int repeatUp()
+{
+	uint8_t *msg = LoraUp.payLoad;
+	uint8_t len = LoraUp.payLength;
+	uint8_t mtype = msg[0] >> 5;
+	
+	if (ifreq != _ICHAN) return(0);
+	statRep.rcvd++;
+	
+	// Only join requests and data uplinks with at least a header and MIC
+	if (((_ISF != 0) && (LoraUp.sf != _ISF)) || (len < 12) || 
+		((mtype != 0) && (mtype != 2) && (mtype != 4))) 
+	{
+		statRep.skipped++;
+		return(0);
+	}
+	if (!repAllowed(msg, len)) {
+		statRep.denied++;
+		return(0);
+	}
+	
+	uint32_t crc = calcCrc32(msg, len);
+	uint32_t ms = millis();
+	for (uint8_t i=0; i<REP_DEDUP; i++) {
+		if ((repSeen[i].crc == crc) && (repSeen[i].ms != 0) && ((ms - repSeen[i].ms) < REP_WINDOW)) {
+			statRep.dups++;
+			return(0);
+		}
+	}
+	repSeen[repSeenIdx].crc = crc;
+	repSeen[repSeenIdx].ms = (ms == 0 ? 1 : ms);
+	repSeenIdx = (repSeenIdx + 1) % REP_DEDUP;
+	
+	if (repCount >= REPQUEUE) {
+		statRep.dropped++;
+		return(0);
+	}
+	struct repFrame *r = &repQueue[(repHead + repCount) % REPQUEUE];
+	r->due = micros64() + (uint64_t) _REP_DELAY * 1000;
+	r->sf = (_OSF != 0 ? _OSF : LoraUp.sf);
+	r->len = len;
+	memcpy(r->data, msg, len);
+	repCount++;
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_TX )) {
+		Serial.print(F("T repeatUp:: len="));
+		Serial.print(len);
+		Serial.print(F(", SF"));
+		Serial.print(LoraUp.sf);
+		Serial.print(F(" > SF"));
+		Serial.println(r->sf);
+	}
 #endif
+	return(1);
+}
 
-// Send a LoRa message out from the gateway transmitter
-// XXX Maybe we should block the received ontul the message is transmitter
 
-int sendLora(char *msg, int len) {
-	// Check whete len is not exceeding maximum length
-	Serial.print("sendLora:: ");
+// ----------------------------------------------------------------------------
+// Hand the oldest repeated message to the arbiter when it is due. It waits 
+// while a downlink is pending, as there is only one LoraDown. The message
+// is sent as an uplink: payload CRC on and IQ not inverted.
+// Called by loop(), also when there is no WiFi.
+// ----------------------------------------------------------------------------
+void repStep()
+{
+	if (repCount == 0) return;
+	struct repFrame *r = &repQueue[repHead];
+	uint64_t now64 = micros64();
 	
-	for (int i=0; i< len; i++) {
-		Serial.print(msg[1],HEX);
-		Serial.print('.');
+	if (now64 < r->due) return;
+	if (now64 > (r->due + REP_LATE)) {
+		statRep.dropped++;								// Transmitter busy too long
+		repHead = (repHead + 1) % REPQUEUE;
+		repCount--;
+		return;
 	}
+	if (statTx.pending) return;
 	
-	if (debug>=2) Serial.flush();
-	return(1);
+	memcpy(payLoad, r->data, r->len);
+	LoraDown.payLoad = payLoad;
+	LoraDown.payLength = r->len;
+	LoraDown.sfTx = r->sf;
+	LoraDown.powe = 14;
+	LoraDown.fff = freqs[_OCHAN];
+	LoraDown.crc = 0x04;
+	LoraDown.iiq = 0x27;
+	LoraDown.tmst = (uint32_t) (now64 + REP_LEAD) - txDelay - txAdjust(r->sf);
+	
+	radioSelect(TXRADIO);
+	uint8_t err = txQueue();
+	radioSelect(0);
+	
+	repHead = (repHead + 1) % REPQUEUE;
+	repCount--;
+	if (err == TX_NONE) statRep.sent++;
+	else if (err == TX_DUTY) statRep.duty++;
+	else statRep.err++;
+}
+
+
+// ----------------------------------------------------------------------------
+// Maximum number of messages of REP_PL bytes per hour the repeater can
+// handle when they are received with sfIn. The radio cannot receive while
+// it transmits, and the duty cycle of the band of _OCHAN limits the time
+// we may transmit.
+// ----------------------------------------------------------------------------
+uint32_t repRate(uint8_t sfIn)
+{
+	uint8_t sfOut = (_OSF != 0 ? _OSF : sfIn);
+	uint32_t airIn = airTime(sfIn, 125, 1, REP_PL, true);
+	uint32_t airOut = rateAirTime(sfOut, 0x04, REP_PL);		// As txQueue() will send it
+	uint32_t rate = 3600000000UL / (airIn + airOut);
+#if (_DUTY_CYCLE==1) && (DC_BANDS > 0)
+	uint32_t khz = freqs[_OCHAN] / 1000;
+	for (uint8_t i=0; i<DC_BANDS; i++) {
+		if ((khz < dcBands[i].lo) || (khz >= dcBands[i].hi)) continue;
+		uint32_t dc = (uint32_t) (3600000000ULL * dcBands[i].permille / 1000 / airOut);
+		if (dc < rate) rate = dc;
+	}
+#endif
+	return(rate);
 }
 
-#endif //REPEATER==1
\ No newline at end of file
+#endif //REPEATER==1
@@ -422,7 +422,7 @@ int sensorPacket() {
 	uint8_t buff_up[512];								// Declare buffer here to avoid exceptions
 	uint8_t message[64]={ 0 };							// Payload, init to 0
 	uint8_t mlength = 0;
-	uint32_t tmst = micros();
+	uint32_t tmst = (uint32_t) micros64();
 	struct LoraUp LUP;
 	uint8_t NwkSKey[16] = _NWKSKEY;
 	uint8_t AppSKey[16] = _APPSKEY;
@@ -520,16 +520,20 @@ int sensorPacket() {
 	// Note Be aware that the sensor message (which is bytes) in message will be
 	// be expanded if the server expects JSON messages.
 	//
+	rxRecord(&LUP, true);
 	int buff_index = buildPacket(tmst, buff_up, LUP, true);
 	
 	frameCount++;
     cp_nb_rx_rcv++;	
 	
 	// In order to save the memory, we only write the framecounter
-	// to EEPROM every 10 values. It also means that we will invalidate
+	// to the counter journal every 10 values. It also means that we will invalidate
 	// 10 value when restarting the gateway.
 	//
-	if (( frameCount % 10)==0) writeGwayCfg(CONFIGFILE);
+	if (( frameCount % 10)==0) {
+		gwayConfig.fcnt = frameCount;
+		logCounters(CNT_FCNT);
+	}
 	
 	if (buff_index > 512) {
 		if (debug>0) Serial.println(F("sensorPacket:: ERROR buffer size too large"));
@@ -569,7 +573,7 @@ int sensorPacket() {
 	if (_cad) {
 		// Set the state to CAD scanning after sending a packet
 		_state = S_SCAN;						// Inititialise scanner
-		sf = SF7;
+		sf = scanStart();
 		cadScanner();
 	}
 	else {
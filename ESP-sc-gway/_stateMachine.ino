@@ -72,12 +72,48 @@
 
 void stateMachine()
 {
-	// Determine what interrupt flags are set
-	//
-	uint8_t flags = readRegister(REG_IRQ_FLAGS);
-	uint8_t mask  = readRegister(REG_IRQ_FLAGS_MASK);
-	uint8_t intr  = flags & ( ~ mask );				// Only react on non masked interrupts
+	uint8_t flags = 0;
+	uint8_t mask  = 0;
+	uint8_t intr  = 0;
 	uint8_t rssi;
+	bool hard = false;
+	uint32_t spiOps = statSpi[rad].reads + statSpi[rad].writes;	// SPI accesses so far
+	uint32_t spiStart = micros();
+	uint8_t spiState = _state;						// State the interrupt arrived in
+	
+	// Take all events the interrupt handlers put in the ring of this radio.
+	// The edge time of the last one is used as the reception time of a message.
+	//
+	statEvt[rad].loops++;
+	evtTmst = 0;
+	while (evtTail[rad] != evtHead[rad]) {
+		uint8_t t = evtTail[rad];
+		evtTmst = evtRing[rad][t & (EVTRING-1)].tmst;
+		evtTail[rad] = t + 1;
+		uint32_t lat = (uint32_t) micros() - evtTmst;
+		statEvt[rad].events++;
+		statEvt[rad].latSum += lat;
+		if (lat > statEvt[rad].latMax) statEvt[rad].latMax = lat;
+		hard = true;
+	}
+	
+	// A downlink waiting for its time keeps the radio receiving until then
+	if ((statTx.pending) && (rad == TXRADIO)) {
+		txArbiter();
+	}
+	
+	// Determine what interrupt flags are set, but only if there is a reason
+	// to. Without (soft) event we have nothing to read in most states.
+	//
+	if ((hard) || (_event) || (_state == S_INIT) || (_state == S_TX) || (_state == S_TXDONE) ||
+		((micros64() - pollTime) > EVENT_POLL))
+	{
+		flags = readRegister(REG_IRQ_FLAGS);
+		mask  = readRegister(REG_IRQ_FLAGS_MASK);
+		intr  = flags & ( ~ mask );					// Only react on non masked interrupts
+		statEvt[rad].reads++;
+		pollTime = micros64();
+	}
 	_event=0;										// Reset the interrupt detector	
 	
 #if DUSB>=1
@@ -105,8 +141,8 @@ void stateMachine()
 			switch (_state) {
 				case S_INIT:	eventWait = 0; break;
 				// Next two are most important
-				case S_SCAN:	eventWait = EVENT_WAIT * 1; break;
-				case S_CAD:		eventWait = EVENT_WAIT * 1; break;
+				case S_SCAN:	eventWait = EVENT_WAIT * hopDwell(); break;
+				case S_CAD:		eventWait = EVENT_WAIT * hopDwell(); break;
 				
 				case S_RX:		eventWait = EVENT_WAIT * 8; break;
 				case S_TX:		eventWait = EVENT_WAIT * 1; break;
@@ -143,17 +179,11 @@ void stateMachine()
 					break;
 			}
 
-			// If micros is starting over again after 51 minutes 
-			// it's value is smaller than an earlier value of eventTime/doneTime
-			//
-			if (eventTime > micros())	eventTime=micros();
-			if (doneTime > micros())	doneTime=micros();
-
-			if (((micros() - doneTime) > doneWait ) &&
+			if (((micros64() - doneTime) > doneWait ) &&
 				(( _state == S_SCAN ) || ( _state == S_CAD )))
 			{
 				_state = S_SCAN;
-				hop();								// increment ifreq = (ifreq + 1) % NUM_HOPS ;
+				hop();								// next channel, see hopNext()
 				cadScanner();						// Reset to initial SF, leave frequency "freqs[ifreq]"
 #if DUSB>=1
 				if (( debug >= 1 ) && ( pdebug & P_PRE )) {
@@ -161,17 +191,17 @@ void stateMachine()
 					SerialStat(intr);
 				}
 #endif
-				eventTime=micros();					// reset the timer on timeout
-				doneTime=micros();					// reset the timer on timeout
+				eventTime=micros64();					// reset the timer on timeout
+				doneTime=micros64();					// reset the timer on timeout
 				return;
 			}
 			// If timeout occurs and still no _event, then hop
 			// and start scanning again
 			//
-			if ((micros() - eventTime) > eventWait ) 
+			if ((micros64() - eventTime) > eventWait ) 
 			{
 				_state = S_SCAN;
-				hop();								// increment ifreq = (ifreq + 1) % NUM_HOPS ;
+				hop();								// next channel, see hopNext()
 				cadScanner();						// Reset to initial SF, leave frequency "freqs[ifreq]"
 #if DUSB>=1
 				if (( debug >= 2 ) && ( pdebug & P_PRE )) {
@@ -179,8 +209,8 @@ void stateMachine()
 					SerialStat(intr);
 				}
 #endif
-				eventTime=micros();					// reset the timer on timeout
-				doneTime=micros();					// reset the timer on timeout
+				eventTime=micros64();					// reset the timer on timeout
+				doneTime=micros64();					// reset the timer on timeout
 				return;
 			}
 			
@@ -191,7 +221,7 @@ void stateMachine()
 #if DUSB>=1
 			if (( debug>=3 ) && ( pdebug & P_PRE )) {
 				Serial.print(F("PRE:: eventTime="));
-				Serial.print(eventTime);
+				Serial.print((uint32_t)eventTime);
 				Serial.print(F(", micros="));
 				Serial.print(micros());
 				Serial.print(F(": "));
@@ -276,7 +306,9 @@ void stateMachine()
 			_rssi = rssi;								// Read the RSSI in the state variable
 
 			_event = 0;									// Make 0, as soon as we have an interrupt
-			detTime = micros();							// mark time that preamble detected
+			detTime = micros64();							// mark time that preamble detected
+			radios[rad].statCad.det[sf - SF7]++;
+			hopActivity(ifreq, HOPDET);
 			
 #if DUSB>=1
 			if (( debug>=1 ) && ( pdebug & P_SCAN )) {
@@ -343,7 +375,7 @@ void stateMachine()
 			// Clear the CADDONE flag
 			writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t) 0x00);
 			writeRegister(REG_IRQ_FLAGS, (uint8_t) 0xFF);
-			doneTime = micros();						// We need CDDONE or other intr to reset timeout			
+			doneTime = micros64();						// We need CDDONE or other intr to reset timeout			
 
 		}//SCAN CDDONE 
 		
@@ -436,7 +468,10 @@ void stateMachine()
 			rssi = readRegister(REG_RSSI);				// Read the RSSI
 			_rssi = rssi;								// Read the RSSI in the state variable
 
-			detTime = micros();
+			detTime = micros64();
+			radios[rad].statCad.det[sf - SF7]++;
+			hopActivity(ifreq, HOPDET);
+			radios[rad].statCad.steps += sfIdx;
 #if DUSB>=1
 			if (( debug>=1 ) && ( pdebug & P_CAD )) {
 				Serial.print(F("CAD:: "));
@@ -451,12 +486,12 @@ void stateMachine()
 		// So we scan this SF and if not high enough ... next
 		//
 		else if (intr & IRQ_LORA_CDDONE_MASK) {
-			// If this is not SF12, increment the SF and try again
+			// If this is not the last SF in scan order, take the next and try again
 			// We expect on other SF get CDDETD
 			//
-			if (((uint8_t)sf) < SF12) {
+			if (sfIdx < 5) {
 			
-				sf = (sf_t)((uint8_t)sf+1);				// Increment sf
+				sf = scanNext();						// Next sf in scan order
 				setRate(sf, 0x04);						// Set SF with CRC==on
 				
 				// reset interrupt flags for CAD Done
@@ -478,7 +513,7 @@ void stateMachine()
 #endif
 			}
 
-			// If we reach SF12, we should go back to SCAN state
+			// If we reach the last SF, we should go back to SCAN state
 			//
 			else {
 
@@ -487,9 +522,9 @@ void stateMachine()
 				writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t) 0x00);	// Reset the interrupt mask
 				writeRegister(REG_IRQ_FLAGS, (uint8_t) 0xFF );	// or IRQ_LORA_CDDONE_MASK
 				
-				_state = S_SCAN;						// As soon as we reach SF12 do something
-				sf = SF7;
-				cadScanner();							// Which will reset SF to SF7
+				_state = S_SCAN;						// As soon as we reach the last SF do something
+				sf = scanStart();
+				cadScanner();							// Which will start at the first SF
 
 #if DUSB>=1		
 				if (( debug>=2 ) && ( pdebug & P_CAD )) {
@@ -498,7 +533,7 @@ void stateMachine()
 				}
 #endif
 			}
-			doneTime = micros();						// We need CDDONE or other intr to reset timeout
+			doneTime = micros64();						// We need CDDONE or other intr to reset timeout
 			
 		} //CAD CDDONE
 
@@ -528,7 +563,7 @@ void stateMachine()
 			}
 #endif
 			_state = S_SCAN;
-			sf = SF7;
+			sf = scanStart();
 			cadScanner();										// Scan and set SF7
 			
 			// Reset Interrupts
@@ -565,7 +600,7 @@ void stateMachine()
 				}
 #endif
 				if (_cad) {
-					sf = SF7;
+					sf = scanStart();
 					_state = S_SCAN;
 					cadScanner();
 				}
@@ -589,7 +624,7 @@ void stateMachine()
 			
 			// If we are here, no CRC error occurred, start timer
 #if DUSB>=1
-			unsigned long ffTime = micros();	
+			uint64_t ffTime = micros64();	
 #endif			
 			// There should not be an error in the message
 			LoraUp.payLoad[0]= 0x00;								// Empty the message
@@ -624,7 +659,7 @@ void stateMachine()
 #if DUSB>=1
 			if (( debug>=1 ) && ( pdebug & P_RX )) {
 				Serial.print(F("RXDONE in dT="));
-				Serial.print(ffTime - detTime);
+				Serial.print((uint32_t)(ffTime - detTime));
 				Serial.print(F(": "));
 				SerialStat(intr);
 			}
@@ -668,7 +703,7 @@ void stateMachine()
 			// 
 			if ((_cad) || (_hop)) {
 				_state = S_SCAN;
-				sf = SF7;
+				sf = scanStart();
 				cadScanner();
 			}
 			else {
@@ -678,7 +713,7 @@ void stateMachine()
 			
 			writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t) 0x00);
 			writeRegister(REG_IRQ_FLAGS, (uint8_t) 0xFF);		// Reset the interrupt mask
-			eventTime=micros();				//There was an event for receive
+			eventTime=micros64();				//There was an event for receive
 			_event=0;
 		}// RXDONE
 		
@@ -708,7 +743,7 @@ void stateMachine()
 					SerialStat(intr);
 				}
 #endif
-				sf = SF7;
+				sf = scanStart();
 				cadScanner();								// Start the scanner after RXTOUT
 				_state = S_SCAN;							// New state is scan
 
@@ -721,8 +756,8 @@ void stateMachine()
 				rxLoraModem();
 			}
 			
-			eventTime=micros();								//There was an event for receive
-			doneTime = micros();							// We need CDDONE or other intr to reset timeout
+			eventTime=micros64();								//There was an event for receive
+			doneTime = micros64();							// We need CDDONE or other intr to reset timeout
 			
 		}// RXTOUT
 		
@@ -845,11 +880,18 @@ void stateMachine()
 				if (debug>=2) Serial.flush();
 			}
 #endif
+			radios[rad].sent++;
+			cp_nb_tx_ok++;
+#if _BSTATION==1
+			bsTxed(statTx.start);									// dntxed in loop()
+#endif
+			txDeaf((uint32_t) (micros64() - statTx.start));		// Receiving again below
+			
 			// After transmission reset to receiver
 			if ((_cad) || (_hop)) {									// XXX 26/02
 				// Set the state to CAD scanning
 				_state = S_SCAN;
-				sf = SF7;
+				sf = scanStart();
 				cadScanner();										// Start the scanner after TX cycle
 			}
 			else {
@@ -884,17 +926,21 @@ void stateMachine()
 		// intr == 0
 		else {
 
-			// Increase timer. If timer exceeds certain value (7 seconds!), reset
 			// After sending a message with S_TX, we have to receive a TXDONE interrupt
-			// within 7 seconds according to spec, of here is a problem.
-			if ( sendTime > micros() ) sendTime = 0;					// This could be omitted for usigned ints
-			if (( _state == S_TXDONE ) && (( micros() - sendTime) > 7000000 )) {
+			// when the time-on-air of the message has passed. If it does not
+			// come within TX_MARGIN there is a problem and we reset.
+			uint64_t txEnd = statTx.due + TX_LEAD;				// Planned tx time
+			if (sendTime > txEnd) txEnd = sendTime;				// or later if it was late
+			txEnd += statTx.air + TX_MARGIN;
+			if (( _state == S_TXDONE ) && ( micros64() > txEnd )) {
 #if DUSB>=1
 				if (( debug>=1 ) && ( pdebug & P_TX )) {
 					Serial.println(F("T TXDONE:: reset TX"));
 					Serial.flush();
 				}
 #endif
+				statTx.tout++;
+				txDeaf((uint32_t) (micros64() - statTx.start));
 				startReceiver();
 			}
 #if DUSB>=1
@@ -927,7 +973,7 @@ void stateMachine()
 			}
 #endif
 			_state = S_SCAN;
-			sf = SF7;
+			sf = scanStart();
 			cadScanner();								// Restart the state machine
 			_event=0;									
 		}
@@ -939,10 +985,19 @@ void stateMachine()
 		}
 		writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t) 0x00);
 		writeRegister(REG_IRQ_FLAGS, (uint8_t) 0xFF);	// Reset all interrupts
-		eventTime=micros();							// Reset event for unkonwn state
+		eventTime=micros64();							// Reset event for unkonwn state
 		
 	  break;// default
 	}// switch(_state)
 	
+	// Cost of handling this interrupt, and of arming the radio again,
+	// per state. The returns above are for intr==0 only.
+	//
+	if ((intr != 0) && (spiState <= S_TXDONE)) {
+		statSpi[rad].trans[spiState]++;
+		statSpi[rad].ops[spiState] += (statSpi[rad].reads + statSpi[rad].writes - spiOps);
+		statSpi[rad].usec[spiState] += ((uint32_t) micros() - spiStart);
+	}
+	
 	return;
 }
@@ -29,11 +29,13 @@
 // This function is used for regular downstream messages and for JOIN_ACCEPT
 // messages.
 // NOTE: This is not an interrupt function, but is started by loop().
-// The _status is set an the end of the function to TX and in _stateMachine
-// function the actual transmission function is executed.
+// The message is handed to the arbiter with txQueue() at the end of the 
+// function and in _stateMachine the actual transmission is executed.
 // The LoraDown.tmst contains the timestamp that the tranmission should finish.
+// Returns -1 if the message cannot be decoded, else 1 with txErr set to the
+// result for the TX_ACK message.
 // ----------------------------------------------------------------------------
-int sendPacket(uint8_t *buf, uint8_t length) 
+int sendPacket(uint8_t *buf, uint16_t length) 
 {
 	// Received package with Meta Data (for example):
 	// codr	: "4/5"
@@ -94,7 +96,14 @@ int sendPacket(uint8_t *buf, uint8_t length)
 	// {"txpk":{"codr":"4/5","data":"YCkEAgIABQABGmIwYX/kSn4Y","freq":868.1,"ipol":true,"modu":"LORA","powe":14,"rfch":0,"size":18,"tmst":1890991792,"datr":"SF7BW125"}}
 
 	// Used in the protocol of Gateway:
-  JsonObject root = jsonBuffer.to<JsonObject>();
+  JsonObject root = jsonBuffer.as<JsonObject>();
+  
+	// Only one downlink can wait for its time, as it is kept in LoraDown
+	if (statTx.pending) {
+		txErr = TX_COLLISION;
+		statTx.err[TX_COLLISION]++;
+		return(1);
+	}
 	const char * data	= root["txpk"]["data"];			// Downstream Payload
 	uint8_t psize		= root["txpk"]["size"];
 	bool ipol			= root["txpk"]["ipol"];
@@ -136,7 +145,7 @@ int sendPacket(uint8_t *buf, uint8_t length)
 	base64_decode((char *) payLoad, (char *) data, strlen(data));	// Fill payload w decoded message
 
 	// Compute wait time in microseconds
-	uint32_t w = (uint32_t) (LoraDown.tmst - micros());	// Wait Time compute
+	int32_t w = (int32_t) microsLeft(tmst64(LoraDown.tmst));	// Wait Time compute, wrap safe
 
 // _STRICT_1CH determines ho we will react on downstream messages.
 // If STRICT==0, we will receive messags from the TTN gateway presumably on SF12/869.5MHz
@@ -213,8 +222,6 @@ int sendPacket(uint8_t *buf, uint8_t length)
 		if (debug>=2) Serial.flush();
 	}
 #endif
-	cp_up_pkt_fwd++;
-
 #if DUSB>=1
 	if (( debug>=2 ) && ( pdebug & P_TX )) {
 		Serial.println(F("T sendPacket:: fini OK"));
@@ -222,8 +229,9 @@ int sendPacket(uint8_t *buf, uint8_t length)
 #endif // DUSB
 
 	// All data is in Payload and parameters and need to be transmitted.
-	// The function is called in user-space
-	_state = S_TX;										// _state set to transmit
+	// The function is called in user-space, the arbiter starts the 
+	// transmission when it is time. txErr is reported in TX_ACK.
+	txErr = txQueue();
 	
 	return 1;
 }//sendPacket
@@ -232,40 +240,23 @@ int sendPacket(uint8_t *buf, uint8_t length)
 
 
 // ----------------------------------------------------------------------------
-// UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP
-// Based on the information read from the LoRa transceiver (or fake message)
-// build a gateway message to send upstream (to the user somewhere on the web).
-//
+// Bookkeeping of a message that is received: the statistics, the CAD scan
+// order, the hop planner, the OLED and the log. It is done once, at 
+// reception, as a message may be forwarded much later (queued or stored 
+// while the backend is down), or more than once when a destination 
+// missed it. ifreq, rad and now() are those of the reception.
 // parameters:
-// 	tmst: Timestamp to include in the upstream message
-// 	buff_up: The buffer that is generated for upstream
-// 	message: The payload message to include in the the buff_up
-//	messageLength: The number of bytes received by the LoRa transceiver
+//	up: The message
 // 	internal: Boolean value to indicate whether the local sensor is processed
-//
-// returns:
-//	buff_index
 // ----------------------------------------------------------------------------
-int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool internal) 
+void rxRecord(struct LoraUp *up, bool internal)
 {
 	long SNR;
     int rssicorr;
 	int prssi;											// packet rssi
-	
-	char cfreq[12] = {0};								// Character array to hold freq in MHz
-	//lastTmst = tmst;									// Following/according to spec
-	int buff_index=0;
-	char b64[256];
-	
-	uint8_t *message = LoraUp.payLoad;
-	char messageLength = LoraUp.payLength;
-		
-#if _CHECK_MIC==1
-	unsigned char NwkSKey[16] = _NWKSKEY;
-	checkMic(message, messageLength, NwkSKey);
-#endif // _CHECK_MIC
+	uint8_t *message = up->payLoad;
+	char messageLength = up->payLength;
 
-	// Read SNR and RSSI from the register. Note: Not for internal sensors!
 	// For internal sensor we fake these values as we cannot read a register
 	if (internal) {
 		SNR = 12;
@@ -273,9 +264,9 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 		rssicorr = 157;
 	}
 	else {
-		SNR = LoraUp.snr;
-		prssi = LoraUp.prssi;								// read register 0x1A, packet rssi
-		rssicorr = LoraUp.rssicorr;
+		SNR = up->snr;
+		prssi = up->prssi;
+		rssicorr = up->rssicorr;
 	}
 
 #if STATISTICS >= 1
@@ -289,25 +280,25 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 #if _LOCALSERVER==1
 	statr[0].datal=0;
 	int index;
-	if ((index = inDecodes((char *)(LoraUp.payLoad+1))) >=0 ) {
+	if ((index = inDecodes((char *)(up->payLoad+1))) >=0 ) {
 
-		uint16_t frameCount=LoraUp.payLoad[7]*256 + LoraUp.payLoad[6];
+		uint16_t frameCount=up->payLoad[7]*256 + up->payLoad[6];
 		
-		for (int k=0; (k<LoraUp.payLength) && (k<23); k++) {
-			statr[0].data[k] = LoraUp.payLoad[k+9];
+		for (int k=0; (k<up->payLength) && (k<23); k++) {
+			statr[0].data[k] = up->payLoad[k+9];
 		};
 		
 		// XXX Check that k<23 when leaving the for loop
 		// XXX or we can not display in statr
 		
 		uint8_t DevAddr[4]; 
-		DevAddr[0]= LoraUp.payLoad[4];
-		DevAddr[1]= LoraUp.payLoad[3];
-		DevAddr[2]= LoraUp.payLoad[2];
-		DevAddr[3]= LoraUp.payLoad[1];
+		DevAddr[0]= up->payLoad[4];
+		DevAddr[1]= up->payLoad[3];
+		DevAddr[2]= up->payLoad[2];
+		DevAddr[3]= up->payLoad[1];
 
 		statr[0].datal = encodePacket((uint8_t *)(statr[0].data), 
-								LoraUp.payLength-9-4, 
+								up->payLength-9-4, 
 								(uint16_t)frameCount, 
 								DevAddr, 
 								decodes[index].appKey, 
@@ -320,7 +311,7 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 #if RSSI==1
 	statr[0].rssi = _rssi - rssicorr;
 #endif // RSII
-	statr[0].sf = LoraUp.sf;
+	statr[0].sf = up->sf;
 #if DUSB>=2
 	if (debug>=0) {
 		if ((message[4] != 0x26) || (message[1]==0x99)) {
@@ -336,6 +327,11 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 #endif //DUSB
 	statr[0].node = ( message[1]<<24 | message[2]<<16 | message[3]<<8 | message[4] );
 
+	if (!internal) {
+		scanOrder(statr[0].sf);							// Adapt the CAD scan order
+		hopActivity(statr[0].ch, HOPRCV);				// and the hop planner
+	}
+
 #if STATISTICS >= 2
 	// Fill in the statistics that we will also need for the GUI.
 	// So 
@@ -382,7 +378,7 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 
 #if DUSB>=1	
 	if (( debug>=2 ) && ( pdebug & P_RADIO )){
-		Serial.print(F("R buildPacket:: pRSSI="));
+		Serial.print(F("R rxRecord:: pRSSI="));
 		Serial.print(prssi-rssicorr);
 		Serial.print(F(" RSSI: "));
 		Serial.print(_rssi - rssicorr);
@@ -401,39 +397,69 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 	}
 #endif // DUSB
 
-// Show received message status on OLED display
+// Show received message status on OLED display. Only the data is stored 
+// here, loop() draws it with draw_oLED().
 #if OLED>=1
-    char timBuff[20];
-    sprintf(timBuff, "%02i:%02i:%02i", hour(), minute(), second());
-	
-    display.clear();
-    display.setFont(ArialMT_Plain_16);
-    display.setTextAlignment(TEXT_ALIGN_LEFT);
+	msg_oLED(message, messageLength, prssi-rssicorr, SNR);
+#endif //OLED>=1
 
-//	msg_oLED(timBuff, prssi-rssicorr, SNR, message)
-	
-    display.drawString(0, 0, "Time: " );
-    display.drawString(40, 0, timBuff);
+#if STAT_LOG == 1	
+	// Do statistics logging. The record is buffered in RAM and 
+	// written to SPIFFS per page of records by flushLog()
+
+	addLog( message, messageLength, up->sf, prssi-rssicorr, SNR );
+#endif	
+}
+
+
+// ----------------------------------------------------------------------------
+// UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP
+// Based on the information read from the LoRa transceiver (or fake message)
+// build a gateway message to send upstream (to the user somewhere on the web).
+// Only the rxpk is made here, rxRecord() did the bookkeeping of the message
+// when it was received.
+//
+// parameters:
+// 	tmst: Timestamp to include in the upstream message
+// 	buff_up: The buffer that is generated for upstream
+// 	message: The payload message to include in the the buff_up
+//	messageLength: The number of bytes received by the LoRa transceiver
+// 	internal: Boolean value to indicate whether the local sensor is processed
+//
+// returns:
+//	buff_index
+// ----------------------------------------------------------------------------
+int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool internal) 
+{
+	long SNR;
+    int rssicorr;
+	int prssi;											// packet rssi
 	
-    display.drawString(0, 16, "RSSI: " );
-    display.drawString(40, 16, String(prssi-rssicorr));
+	char cfreq[12] = {0};								// Character array to hold freq in MHz
+	//lastTmst = tmst;									// Following/according to spec
+	int buff_index=0;
+	char b64[256];
 	
-    display.drawString(70, 16, ",SNR: " );
-    display.drawString(110, 16, String(SNR) );
-	  
-	display.drawString(0, 32, "Addr: " );
-	  
-    if (message[4] < 0x10) display.drawString( 40, 32, "0"+String(message[4], HEX)); else display.drawString( 40, 32, String(message[4], HEX));
-	if (message[3] < 0x10) display.drawString( 61, 32, "0"+String(message[3], HEX)); else display.drawString( 61, 32, String(message[3], HEX));
-	if (message[2] < 0x10) display.drawString( 82, 32, "0"+String(message[2], HEX)); else display.drawString( 82, 32, String(message[2], HEX));
-	if (message[1] < 0x10) display.drawString(103, 32, "0"+String(message[1], HEX)); else display.drawString(103, 32, String(message[1], HEX));
-	  
-    display.drawString(0, 48, "LEN: " );
-    display.drawString(40, 48, String((int)messageLength) );
-    display.display();
-	//yield();
+	uint8_t *message = LoraUp.payLoad;
+	char messageLength = LoraUp.payLength;
+		
+#if _CHECK_MIC==1
+	unsigned char NwkSKey[16] = _NWKSKEY;
+	checkMic(message, messageLength, NwkSKey);
+#endif // _CHECK_MIC
 
-#endif //OLED>=1
+	// Read SNR and RSSI from the register. Note: Not for internal sensors!
+	// For internal sensor we fake these values as we cannot read a register
+	if (internal) {
+		SNR = 12;
+		prssi = 50;
+		rssicorr = 157;
+	}
+	else {
+		SNR = LoraUp.snr;
+		prssi = LoraUp.prssi;								// read register 0x1A, packet rssi
+		rssicorr = LoraUp.rssicorr;
+	}
 			
 	int j;
 	
@@ -488,6 +514,14 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 	}
 #endif
 	buff_index += j;
+	// A message that was queued carries the time it was received, in UTC
+	if (upTime >= UPTIME_VALID) {
+		time_t t = upTime - NTP_TIMEZONES * SECS_IN_HOUR;
+		j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, 
+			",\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.000000Z\"",
+			year(t), month(t), day(t), hour(t), minute(t), second(t));
+		buff_index += j;
+	}
 	ftoa((double)freq/1000000,cfreq,6);					// XXX This can be done better
 	j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE-buff_index, ",\"chan\":%1u,\"rfch\":%1u,\"freq\":%s", 0, 0, cfreq);
 	buff_index += j;
@@ -560,13 +594,6 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 	++buff_index;
 	buff_up[buff_index] = 0; 							// add string terminator, for safety
 
-#if STAT_LOG == 1	
-	// Do statistics logging. In first version we might only
-	// write part of the record to files, later more
-
-	addLog( (unsigned char *)(buff_up), buff_index );
-#endif	
-	
 #if DUSB>=1
 	if (( debug>=2 ) && ( pdebug & P_RX )) {
 		Serial.print(F("R RXPK:: "));
@@ -582,18 +609,319 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 
 
 
+// ----------------------------------------------------------------------------
+// Put the message in LoraUp in the upstream queue, together with its
+// reception time. Used as long as the network is not available.
+// If the queue is full it is moved to the flash store, and if that is not
+// possible the oldest message is dropped.
+// Parameters:
+//	tmst: micros() value at reception
+//	done: Destinations that already have it (UP_TTN, UP_THING)
+// Returns:
+//	Number of messages in queue
+// ----------------------------------------------------------------------------
+int queueUp(uint32_t tmst, uint8_t done)
+{
+#if _UPSTORE==1
+	if (upCount >= UPQUEUE) {
+		storeUp();										// Empties the queue
+	}
+#endif
+	if (upCount >= UPQUEUE) {
+		upHead = (upHead + 1) % UPQUEUE;				// Drop the oldest
+		upCount--;
+		statUp.dropped++;
+	}
+	uint8_t i = (upHead + upCount) % UPQUEUE;
+	upQueue[i].tmst = tmst;
+	upQueue[i].time = now();
+	upQueue[i].freq = freq;
+	upQueue[i].ifreq = ifreq;
+	upQueue[i].rad = rad;
+	upQueue[i].done = done;
+	memcpy(&upQueue[i].up, &LoraUp, sizeof(struct LoraUp));
+	upCount++;
+	statUp.queued++;
+#if DUSB>=1
+	if (( debug>=1 ) && ( pdebug & P_RX )) {
+		Serial.print(F("R queueUp:: len="));
+		Serial.print(LoraUp.payLength);
+		Serial.print(F(", queued="));
+		Serial.println(upCount);
+	}
+#endif
+	return(upCount);
+}
+
+
+// ----------------------------------------------------------------------------
+// Forward a queued message to the server(s). LoraUp is not in use by the
+// state machine when this is called from loop(), so it is used to forward
+// the message. The radio, frequency and channel that received the message
+// are selected while forwarding it, so that its channel is reported.
+// Only the destinations that are up and do not have the message yet get
+// it, q->done gets the ones it was sent to.
+// Parameters:
+//	q: The message from upQueue or the flash store
+// Returns:
+//	Value of forwardPacket(), >0 when sent to all destinations that are up
+// ----------------------------------------------------------------------------
+int sendUp(struct upFrame *q)
+{
+	if (!upLink()) return(-1);							// Not while the primary is down
+	uint8_t want = upDests() & ~q->done;
+	if (want == 0) return(1);
+	
+	memcpy(&LoraUp, &q->up, sizeof(struct LoraUp));
+	radioSelect(q->rad);
+	uint32_t f = freq;
+	uint8_t ch = ifreq;
+	freq = q->freq;
+	ifreq = q->ifreq;
+	upTime = q->time;
+	upSkip = ~want;
+	int ret = forwardPacket(q->tmst);
+	q->done |= upSent;
+	upSkip = 0;
+	upTime = 0;
+	freq = f;
+	ifreq = ch;
+	radioSelect(0);
+	return(ret);
+}
+
+
+// ----------------------------------------------------------------------------
+// The destinations that can take uplinks: the WiFi link is up, the address
+// is known and the server acknowledges our PUSH_DATA messages (not 
+// DNS_ACKLOST in a row unanswered).
+// Returns:
+//	UP_TTN and UP_THING bits
+// ----------------------------------------------------------------------------
+uint8_t upDests()
+{
+	uint8_t d = 0;
+	
+	if (!wlanUp()) return(0);
+#if _BSTATION==1
+	if (bs.state == BS_UP) d |= UP_TTN;
+#else
+#ifdef _TTNSERVER
+	if (!dnsLost(&ttnServer)) d |= UP_TTN;
+#endif
+#ifdef _THINGSERVER
+	if ((thingServer != IPAddress(0, 0, 0, 0)) && (!dnsLost(&thingServer))) d |= UP_THING;
+#endif
+#endif // _BSTATION
+	return(d);
+}
+
+
+// ----------------------------------------------------------------------------
+// Can messages be sent upstream? Only the primary server decides: not while
+// the WiFi link is down or while it does not acknowledge them, then they
+// are queued and stored. The stat messages that are still sent tell when
+// it is back. An optional _THINGSERVER that does not answer does not hold
+// up the uplinks, see sendUp().
+// ----------------------------------------------------------------------------
+bool upLink()
+{
+#if (_BSTATION==1) || defined(_TTNSERVER)
+	return((upDests() & UP_TTN) != 0);
+#else
+	return((upDests() & UP_THING) != 0);
+#endif
+}
+
+
+// ----------------------------------------------------------------------------
+// Send the messages in the upstream queue to the server(s).
+// Called from loop() once the network is available. The messages in the 
+// flash store are older than the ones in the RAM queue, so they go first,
+// one every _UPSTORE_RATE mSec so that the server and our own receive path
+// are not flooded.
+// A message is only removed when every destination that is up has it, so
+// if sending fails it is sent again at the next call, only to the ones 
+// that do not have it yet.
+// Parameters:
+//	<None>
+// Returns:
+//	Number of messages sent
+// ----------------------------------------------------------------------------
+int sendQueue()
+{
+	int sent = 0;
+#if _UPSTORE==1
+	struct upFrame q;
+	while ((ups.count > 0) && (!radioPending()) && ((int32_t)(millis() - ups.next) >= 0)) {
+		if (readStore(&q) < 0) break;
+		if ((q.time >= UPTIME_VALID) && ((now() - q.time) > _UPSTORE_AGE)) {
+			popStore(1);
+			statUp.expired++;							// Next one without waiting
+			continue;
+		}
+		ups.next = millis() + _UPSTORE_RATE;
+		uint8_t done = q.done;
+		if (sendUp(&q) <= 0) {
+			if (q.done != done) markStore(ups.rdRec, 1, q.done);
+			break;
+		}
+		popStore(1);
+		statUp.replayed++;
+		sent++;
+	}
+	if (ups.count > 0) return(sent);
+#endif
+	while ((upCount > 0) && (!radioPending())) {		// Radio events go first
+		if (sendUp(&upQueue[upHead]) <= 0) {
+			return(sent);
+		}
+		upHead = (upHead + 1) % UPQUEUE;
+		upCount--;
+		statUp.sent++;
+		sent++;
+		yield();
+	}
+	return(sent);
+}
+
+
 // ----------------------------------------------------------------------------
 // UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP 
 // Receive a LoRa package over the air, LoRa and deliver to server(s)
 //
-// Receive a LoRa message and fill the buff_up char buffer.
+// If the gateway is still starting up (no WiFi, DNS or time yet), the
+// WiFi link is down or the backend does not answer (see upLink()), the
+// message is queued and sent later by sendQueue().
 // returns values:
-// - returns the length of string returned in buff_up
+// - returns the length of string returned in buff_up or the queue length
 // - returns -1 or -2 when no message arrived, depending connection.
 //
 // This is the "highlevel" function called by loop()
 // ----------------------------------------------------------------------------
 int receivePacket()
+{
+	// Use the time of the RXDONE interrupt edge, or if that is not known
+	// take the timestamp as soon as possible.
+	// The tmst in the protocol is 32 bits and wraps with micros(), the server
+	// handles that. Internally we use micros64() for timers.
+	uint32_t tmst = (evtTmst != 0 ? evtTmst : (uint32_t) micros64());
+
+	if (LoraUp.payLength == 0) {
+		return(0);
+	}
+	radios[rad].rcvd++;
+	rxRecord(&LoraUp, false);
+	if (bootFirstRx == 0) {
+		bootFirstRx = millis();							// Time to first message
+	}
+#if REPEATER==1
+	// REPEATER is a special function where we retransmit received 
+	// message on _ICHAN to _OCHAN, see _repeater.ino
+	repeatUp();
+#endif
+	if ((bootStage != B_DONE) || (!upLink())) {
+		int ret = queueUp(tmst, 0);
+		LoraUp.payLength = 0;
+		LoraUp.payLoad[0] = 0x00;
+		return(ret);
+	}
+	int ret = forwardPacket(tmst);
+	if (ret == -1) {
+		queueUp(tmst, upSent);						// Link lost before wlanStep() saw it
+		LoraUp.payLength = 0;
+		LoraUp.payLoad[0] = 0x00;
+	}
+	return(ret);
+}
+
+
+#if _THINGBIN==1
+// ----------------------------------------------------------------------------
+// Send the binary frames in binBuf to _THINGSERVER
+// Returns:
+//	1 when sent, 0 on error
+// ----------------------------------------------------------------------------
+int binFlush()
+{
+	int ret = sendUdp(thingServer, _THINGPORT, binBuf, binLen);
+	if (ret) {
+		statBin.dgrams++;
+		statBin.bytes += binLen;
+	}
+	binLen = 0;
+	return(ret);
+}
+
+
+// ----------------------------------------------------------------------------
+// Add the message in LoraUp to binBuf as a binary frame (see loraModem.h).
+// The datagram is sent when it is full, or by loop() after _BIN_HOLD.
+// Parameters:
+//	tmst: micros() value at reception
+//	json: Length of the JSON message of the frame, for the statistics
+// Returns:
+//	1 when added, 0 when sending the full datagram failed
+// ----------------------------------------------------------------------------
+int binFrame(uint32_t tmst, int json)
+{
+	int ret = 1;
+	uint8_t len = LoraUp.payLength;
+	
+	if ((binLen + BIN_HDR + len) > BIN_SIZE) {
+		ret = binFlush();
+	}
+	if (binLen == 0) {
+		binBuf[0] = PROTOCOL_VERSION;
+		binBuf[1] = (uint8_t) rand();					// random token
+		binBuf[2] = (uint8_t) rand();
+		binBuf[3] = PKT_PUSH_BIN;
+		binBuf[4]  = MAC_array[0];
+		binBuf[5]  = MAC_array[1];
+		binBuf[6]  = MAC_array[2];
+		binBuf[7]  = 0xFF;
+		binBuf[8]  = 0xFF;
+		binBuf[9]  = MAC_array[3];
+		binBuf[10] = MAC_array[4];
+		binBuf[11] = MAC_array[5];
+		binLen = 12;
+		binTime = millis();
+	}
+	
+	uint8_t *b = binBuf + binLen;
+	int16_t rssi = LoraUp.prssi - LoraUp.rssicorr;
+	for (int i=0; i<4; i++) {
+		b[i] = (uint8_t) (tmst >> (8*i));
+		b[4+i] = (uint8_t) (freq >> (8*i));
+	}
+	b[8] = (LoraUp.sf & 0x0F) | (rad << 4);
+	b[9] = (uint8_t) rssi;
+	b[10] = (uint8_t) (rssi >> 8);
+	b[11] = (uint8_t) (int8_t) LoraUp.snr;
+	b[12] = len;
+	memcpy(b + BIN_HDR, LoraUp.payLoad, len);
+	binLen += BIN_HDR + len;
+	statBin.frames++;
+	statBin.json += json;
+	
+#if _BIN_HOLD==0
+	ret = binFlush();
+#endif
+	return(ret);
+}
+#endif // _THINGBIN
+
+
+// ----------------------------------------------------------------------------
+// Build the upstream message for the message in LoraUp and deliver it to the
+// server(s).
+// Parameters:
+//	tmst: micros() value at reception
+// returns values:
+// - returns the length of string returned in buff_up
+// - returns -1 or -2 when no message arrived, depending connection.
+// ----------------------------------------------------------------------------
+int forwardPacket(uint32_t tmst)
 {
 	uint8_t buff_up[TX_BUFF_SIZE]; 						// buffer to compose the upstream packet to backend server
 	long SNR;
@@ -605,41 +933,48 @@ int receivePacket()
 	// in one UDP message as the Semtech Gateway spec does allow this.
 	// XXX Not yet supported
 
-		// Take the timestamp as soon as possible, to have accurate reception timestamp
-		// TODO: tmst can jump if micros() overflow.
-		uint32_t tmst = (uint32_t) micros();			// Only microseconds, rollover in 5X minutes
-		//lastTmst = tmst;								// Following/according to spec
-		
 		// Handle the physical data read from LoraUp
 		if (LoraUp.payLength > 0) {
 
 			// externally received packet, so last parameter is false (==LoRa external)
             int build_index = buildPacket(tmst, buff_up, LoraUp, false);
 
-			// REPEATER is a special function where we retransmit received 
-			// message on _ICHANN to _OCHANN.
-			// Note:: For the moment _OCHANN is not allowed to be same as _ICHANN
-#if REPEATER==1
-			if (!sendLora(LoraUp.payLoad, LoraUp.payLength)) {
-				return(-3);
-			}
-#endif
-			
 			// This is one of the potential problem areas.
 			// If possible, USB traffic should be left out of interrupt routines
 			// rxpk PUSH_DATA received from node is rxpk (*2, par. 3.2)
+			upSent = 0;
+#if _BSTATION==1
+			if (bsUplink(tmst) < 0) {
+				return(-1);
+			}
+			upSent |= UP_TTN;
+#else
 #ifdef _TTNSERVER
-			if (!sendUdp(ttnServer, _TTNPORT, buff_up, build_index)) {
-				return(-1); 							// received a message
+			if (!(upSkip & UP_TTN)) {
+				if (!sendUdp(ttnServer, _TTNPORT, buff_up, build_index)) {
+					return(-1); 						// received a message
+				}
+				upSent |= UP_TTN;
+				yield();
 			}
-			yield();
 #endif
 			// Use our own defined server or a second well kon server
 #ifdef _THINGSERVER
-			if (!sendUdp(thingServer, _THINGPORT, buff_up, build_index)) {
-				return(-2); 							// received a message
+			if (!(upSkip & UP_THING)) {
+#if _THINGBIN==1
+				if (!binFrame(tmst, build_index)) {
+					return(-2);
+				}
+#else
+				if (!sendUdp(thingServer, _THINGPORT, buff_up, build_index)) {
+					return(-2); 						// received a message
+				}
+#endif
+				upSent |= UP_THING;
 			}
 #endif
+#endif // _BSTATION
+			cp_up_pkt_fwd++;							// Forwarded
 
 #if _LOCALSERVER==1
 			// Or special case, we do not use a local server to receive
@@ -710,4 +1045,4 @@ int receivePacket()
 		
 	return(0);											// failure no message read
 	
-}//receivePacket
+}//forwardPacket
@@ -150,9 +150,9 @@ void SerialStat(uint8_t intr)
 				Serial.print(F(" -- "));
 		}
 		Serial.print(F(", eT="));
-		Serial.print( micros() - eventTime );
+		Serial.print( (uint32_t)(micros64() - eventTime) );
 		Serial.print(F(", dT="));
-		Serial.print( micros() - doneTime );
+		Serial.print( (uint32_t)(micros64() - doneTime) );
 		Serial.println();
 	}
 #endif
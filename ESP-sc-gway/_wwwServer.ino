@@ -107,51 +107,6 @@ boolean YesNo()
 }
 
 
-// ----------------------------------------------------------------------------
-// WWWFILE
-// This function will open a pop-up in the browser and then 
-//	display the contents of a file in that window
-// Output is sent to server.sendContent()
-// Parameters:
-//		fn; String with filename
-// Returns:
-//		<none>
-// ----------------------------------------------------------------------------
-void wwwFile(String fn) {
-
-	if (!SPIFFS.exists(fn)) {
-#if DUSB>=1
-		Serial.print(F("wwwFile:: ERROR: file not found="));
-		Serial.println(fn);
-#endif
-		return;
-	}
-#if DUSB>=2
-	else {
-		Serial.print(F("wwwFile:: File existist= "));
-		Serial.println(fn);
-	}
-#endif
-
-#if DUSB>=1
-		File f = SPIFFS.open(fn, "r");					// Open the file for reading
-		
-		int j;
-		for (j=0; j<LOGFILEREC; j++) {
-			
-			String s=f.readStringUntil('\n');
-			if (s.length() == 0) {
-				Serial.print(F("wwwFile:: String length 0"));
-				break;
-			}
-			server.sendContent(s.substring(12));		// Skip the first 12 Gateway specific binary characters
-			server.sendContent("\n");
-			yield();
-		}
-#endif
-	
-}
-
 // ----------------------------------------------------------------------------
 // Button function Docu, display the documentation pages.
 // This is a button on the top of the GUI screen.
@@ -184,22 +139,33 @@ void buttonDocu()
 
 // ----------------------------------------------------------------------------
 // Button function Log displays  logfiles.
-// This is a button on the top of the GUI screen
+// This is a button on the top of the GUI screen.
+// The records are streamed as text to the browser. Optional arguments
+// select the records of one node and/or the last number of hours:
+//	http://<server>/LOG?node=26011234&hours=1
+// hours is limited to 1 .. LOGHOURS.
 // ----------------------------------------------------------------------------
 void buttonLog() 
 {
+#if STAT_LOG==1
+	uint32_t addr = 0;
+	uint32_t from = 0;
 	
-	String response = "";
-	String fn = "";
-	int i = 0;
-	
-	while (i< LOGFILEMAX ) {
-		fn = "/log-" + String(gwayConfig.logFileNo - i);
-		wwwFile(fn);									// Display the file contents in the browser
-		i++;
+	if (server.arg("node").length() > 0) {
+		addr = strtoul(server.arg("node").c_str(), NULL, 16);
+	}
+	if (server.arg("hours").length() > 0) {
+		long hours = server.arg("hours").toInt();
+		if (hours < 1) hours = 1;
+		if (hours > LOGHOURS) hours = LOGHOURS;
+		if (now() > (uint32_t) hours * SECS_IN_HOUR) from = now() - (uint32_t) hours * SECS_IN_HOUR;
 	}
 	
-	server.sendContent(response);
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "text/plain", "");
+	queryLog(addr, from, 0xFFFFFFFF, LOG_WWW);			// Stream the records to the browser
+	server.sendContent("");
+#endif
 }
 
 // ----------------------------------------------------------------------------
@@ -220,6 +186,12 @@ static void wwwButtons()
 	response += "<a href=\"EXPERT\" download><button type=\"button\">" + mode + "</button></a>";
 
 	response += "<a href=\"LOG\" download><button type=\"button\">Log Files</button></a>";
+#if STAT_LOG==1
+	response += "<form action=\"LOG\" style=\"display:inline;\">";
+	response += " Node <input type=\"text\" name=\"node\" size=\"8\">";
+	response += " Hours <input type=\"text\" name=\"hours\" size=\"3\">";
+	response += " <input type=\"submit\" value=\"Query Log\"></form>";
+#endif
 
 	server.sendContent(response);							// Send to the screen
 }
@@ -263,7 +235,7 @@ static void setVariables(const char *cmd, const char *arg) {
 			ifreq=0; 
 			freq=freqs[ifreq]; 
 			rxLoraModem();
-			sf = SF7;
+			sf = scanStart();
 			cadScanner();
 		}
 		writeGwayCfg(CONFIGFILE);									// Save configuration to file
@@ -359,6 +331,7 @@ static void setVariables(const char *cmd, const char *arg) {
 static void openWebPage()
 {
 	++gwayConfig.views;									// increment number of views
+	cntDirty |= CNT_VIEWS;								// Journaled with the stat message
 #if A_REFRESH==1
 	//server.client().stop();							// Experimental, stop webserver in case something is still running!
 #endif
@@ -747,6 +720,120 @@ static void statisticsData()
 		response +="</td></tr>";
 #endif
 
+	// CAD scan order and the preambles detected versus messages received
+	// per SF. Less steps per detect means the order works. Every radio 
+	// has its own order, with more radios the rows are per radio (R<n>).
+	for (uint8_t r=0; (_cad) && (r<_RADIOS); r++) {
+		struct cadStat *c = &radios[r].statCad;
+		String rn = (_RADIOS > 1) ? String(" R") + r : String("");
+		response +="<tr><td class=\"cell\">CAD order" + rn + "</td><td class=\"cell\" colspan=\"2\">";
+		for (int i=0; i<6; i++) { response +="SF"; response +=radios[r].sfOrder[i]; response +=" "; }
+		response +="</td></tr>";
+		response +="<tr><td class=\"cell\">CAD steps/detect" + rn + "</td><td class=\"cell\">";
+		uint32_t dets = 0;
+		for (int i=0; i<6; i++) dets += c->det[i];
+		response += String(dets>0 ? (float) c->steps / dets : 0.0, 2);
+		response +="</td></tr>";
+		for (int i=0; i<6; i++) {
+			response +="<tr><td class=\"cell\">SF"; response +=(i+7); response +=" detect/rcvd" + rn + "</td>";
+			response +="<td class=\"cell\">"; response +=c->det[i];
+			response +="</td><td class=\"cell\">"; response +=c->rcv[i];
+			response +="</td><td class=\"cell\">"; 
+			response += String(c->det[i]>0 ? 100*c->rcv[i]/c->det[i] : 0)+" %"; 
+			response +="</td></tr>";
+		}
+	}
+
+	// Hop planner: time spent, preambles and messages per channel
+	for (uint8_t r=0; (_hop) && (r<_RADIOS); r++) {
+		struct hopStat *h = &radios[r].statHop;
+		String rn = (_RADIOS > 1) ? String(" R") + r : String("");
+		for (int i=0; i<NUM_HOPS; i++) {
+			response +="<tr><td class=\"cell\">Ch "; response +=i; response +=" hops/dwell" + rn + "</td>";
+			response +="<td class=\"cell\">"; response +=h->hops[i];
+			response +="</td><td class=\"cell\">"; response +=(h->dwell[i]/1000); response +=" s";
+			response +="</td><td class=\"cell\">"; response +=h->det[i]; response +=" det, ";
+			response +=h->rcv[i]; response +=" rcvd";
+			response +="</td></tr>";
+		}
+		response +="<tr><td class=\"cell\">Hop skips" + rn + "</td><td colspan=\"2\" class=\"cell\">"; response +=h->skips;
+		response +="</td></tr>";
+	}
+
+	// Downlink: time on air and time not receiving, this and previous hour
+	response +="<tr><td class=\"cell\">TX air (ms/h)</td><td class=\"cell\">"; response +=statTx.airHour;
+	response +="</td><td class=\"cell\">"; response +=statTx.airLast; response +=" last hour";
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">RX deaf (ms/h)</td><td class=\"cell\">"; response +=statTx.deafHour;
+	response +="</td><td class=\"cell\">"; response +=statTx.deafLast; response +=" last hour";
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">TX preempt / timeout</td><td class=\"cell\">"; response +=statTx.preempt;
+	response +="</td><td class=\"cell\">"; response +=statTx.tout; response +=" timeout";
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">TX sent / rcvd</td><td class=\"cell\">"; response +=cp_nb_tx_ok;
+	response +="</td><td class=\"cell\">"; response +=cp_dw_dgram_rcv; response +=" PULL_RESP";
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">UDP read / handled</td><td class=\"cell\">"; response +=statUdp.read;
+	response +="</td><td class=\"cell\">"; response +=statUdp.handled;
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">UDP dropped / oversize</td><td class=\"cell\">"; response +=statUdp.dropped;
+	response +="</td><td class=\"cell\">"; response +=statUdp.oversize;
+	response +="</td></tr>";
+	for (int i=0; i<ACK_DESTS; i++) {
+		if (statAck[i].ip == IPAddress(0, 0, 0, 0)) continue;
+		response +="<tr><td class=\"cell\">PUSH_ACK rtt / avg (ms) "; printIP(statAck[i].ip, '.', response);
+		response +="</td><td class=\"cell\">"; response +=String((float)statAck[i].rtt/1000, 1);
+		response +="</td><td class=\"cell\">"; response +=String((float)statAck[i].rttAvg/1000, 1);
+		response +="</td></tr>";
+	}
+#if _THINGBIN==1
+	// Binary frames to our own backend, and bytes per frame compared to JSON
+	response +="<tr><td class=\"cell\">BIN frames / datagrams</td><td class=\"cell\">"; response +=statBin.frames;
+	response +="</td><td class=\"cell\">"; response +=statBin.dgrams;
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">Bytes/frame BIN / JSON</td><td class=\"cell\">";
+	response +=(statBin.frames > 0 ? statBin.bytes / statBin.frames : 0);
+	response +="</td><td class=\"cell\">"; response +=(statBin.frames > 0 ? statBin.json / statBin.frames : 0);
+	response +="</td></tr>";
+#endif
+#if _BSTATION==1
+	response +="<tr><td class=\"cell\">LNS state / session</td><td class=\"cell\">"; response +=bs.state;
+	response +="</td><td class=\"cell\">"; response +=bs.session;
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">LNS connects / fails</td><td class=\"cell\">"; response +=statBs.connects;
+	response +="</td><td class=\"cell\">"; response +=statBs.fails;
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">LNS updf / lost</td><td class=\"cell\">"; response +=statBs.updf;
+	response +="</td><td class=\"cell\">"; response +=statBs.lost;
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">LNS dnmsg / dntxed</td><td class=\"cell\">"; response +=statBs.dnmsg;
+	response +="</td><td class=\"cell\">"; response +=statBs.dntxed;
+	response +="</td></tr>";
+	response +="<tr><td class=\"cell\">LNS bytes out / in</td><td class=\"cell\">"; response +=statBs.bytesOut;
+	response +="</td><td class=\"cell\">"; response +=statBs.bytesIn;
+	response +="</td></tr>";
+#endif
+	// TX_ACK errors and warnings sent to the server
+	for (int i=TX_TOO_LATE; i<=TX_DUTY; i++) {
+		if (statTx.err[i] == 0) continue;
+		response +="<tr><td class=\"cell\">TX_ACK "; response +=txErrStr[i];
+		response +="</td><td class=\"cell\" colspan=\"2\">"; response +=statTx.err[i];
+		response +="</td></tr>";
+	}
+#if (_DUTY_CYCLE==1) && (DC_BANDS > 0)
+	// Duty cycle per sub-band: air time left (ms), sent and rejected
+	for (int i=0; i<DC_BANDS; i++) {
+		response +="<tr><td class=\"cell\">DC "; response +=String((float)dcBands[i].lo/1000, 1);
+		response +="-"; response +=String((float)dcBands[i].hi/1000, 1);
+		response +=" "; response +=String((float)dcBands[i].permille/10, 1); response +="%</td>";
+		response +="<td class=\"cell\">"; 
+		response +=(statDc[i].last == 0 ? (uint32_t) _DC_WINDOW * dcBands[i].permille : statDc[i].tokens/1000);
+		response +=" ms left</td><td class=\"cell\">"; response +=statDc[i].sent; response +=" sent, ";
+		response +=statDc[i].rejected; response +=" rejected";
+		response +="</td></tr>";
+	}
+#endif
+
 	response +="</table>";
 	server.sendContent(response);
 }
@@ -912,9 +999,12 @@ void setupWWW()
 	server.on("/FORMAT", []() {
 		Serial.print(F("FORMAT ..."));
 		
+		flushLog();										// Empty logBuf before initLog() uses it
 		SPIFFS.format();								// Normally disabled. Enable only when SPIFFS corrupt
 		initConfig(&gwayConfig);
+		initLog();										// Log segments are gone, start again
 		writeConfig( CONFIGFILE, &gwayConfig);
+		writeCounters( COUNTFILE, &gwayConfig);
 #if DUSB>=1
 		Serial.println(F("DONE"));
 #endif
@@ -930,6 +1020,8 @@ void setupWWW()
 		cp_nb_rx_rcv = 0;						// Reset package statistics
 		cp_nb_rx_ok = 0;
 		cp_up_pkt_fwd = 0;
+		cp_dw_dgram_rcv = 0;
+		cp_nb_tx_ok = 0;
 #if STATISTICS >= 1
 		for (int i=0; i<MAX_STAT; i++) { statr[i].sf = 0; }
 #if STATISTICS >= 2
@@ -941,7 +1033,8 @@ void setupWWW()
 		statc.sf12= 0;
 		
 		statc.resets= 0;
-		writeGwayCfg(CONFIGFILE);
+		gwayConfig.resets++;
+		logCounters(CNT_RESETS);
 #if STATISTICS >= 3
 		statc.sf7_0 = 0; statc.sf7_1 = 0; statc.sf7_2 = 0;
 		statc.sf8_0 = 0; statc.sf8_1 = 0; statc.sf8_2 = 0;
@@ -969,7 +1062,7 @@ void setupWWW()
 #endif
 		gwayConfig.reents = 0;					// Re-entrance
 
-		writeGwayCfg(CONFIGFILE);
+		writeCounters(COUNTFILE, &gwayConfig);	// New counter record and journal
 		server.sendHeader("Location", String("/"), true);
 		server.send ( 302, "text/plain", "");
 	});
@@ -1186,12 +1279,10 @@ void setupWWW()
 	});
 	
 	server.on("/LOG", []() {
-		server.sendHeader("Location", String("/"), true);
 #if DUSB>=1
 		Serial.println(F("LOG button"));
 #endif
-		buttonLog();
-		server.send ( 302, "text/plain", "");
+		buttonLog();									// Sends its own reply
 	});
 	
 	// Display Expert mode or Simple mode
@@ -1202,7 +1293,7 @@ void setupWWW()
 	});
 
 	
-	// Update the sketch. Not yet implemented
+	// Update the sketch. The image is downloaded in the background
 	server.on("/UPDATE=1", []() {
 #if A_OTA==1
 		updateOtaa();
@@ -1210,6 +1301,19 @@ void setupWWW()
 		server.sendHeader("Location", String("/"), true);
 		server.send ( 302, "text/plain", "");
 	});
+	
+	// Update the sketch from another server or with a known SHA-256:
+	//	http://<server>/UPDATE?host=<host>&port=80&path=/fw.bin&sha=<sha256>
+	server.on("/UPDATE", []() {
+#if A_OTA==1
+		String host = (server.arg("host").length() > 0 ? server.arg("host") : String(_OTA_HOST));
+		String path = (server.arg("path").length() > 0 ? server.arg("path") : String(_OTA_PATH));
+		uint16_t port = (server.arg("port").length() > 0 ? server.arg("port").toInt() : _OTA_PORT);
+		otaStart(host.c_str(), port, path.c_str(), server.arg("sha").c_str());
+#endif
+		server.sendHeader("Location", String("/"), true);
+		server.send ( 302, "text/plain", "");
+	});
 
 	// -----------
 	// This section from version 4.0.7 defines what PART of the
@@ -1249,6 +1353,19 @@ static void wifiData()
 
 	response +="<tr><td class=\"cell\">WiFi SSID</td><td class=\"cell\">"; 
 	response +=WiFi.SSID(); response+="</tr>";
+	response +="<tr><td class=\"cell\">WiFi outages / down (s)</td><td class=\"cell\">"; 
+	response +=wlan.outages; response +=" / "; response +=wlan.downSecs; response+="</tr>";
+	response +="<tr><td class=\"cell\">WiFi reconnect last / max (ms)</td><td class=\"cell\">"; 
+	response +=wlan.msLast; response +=" / "; response +=wlan.msMax; response+="</tr>";
+	// Every AP: average RSSI, joins failed, PUSH_DATA acknowledged
+	for (uint8_t j=1; j<WPASIZE; j++) {
+		if (wpa[j].login[0] == 0) continue;
+		response +="<tr><td class=\"cell\">AP "; response +=wpa[j].login;
+		response +="</td><td class=\"cell\">"; 
+		response +=String() + wlanAps[j].rssi + " dBm, " + wlanAps[j].fails + "/" + wlanAps[j].joins + " joins failed, ";
+		response +=String() + wlanAps[j].acked + "/" + wlanAps[j].sent + " acked";
+		response+="</tr>";
+	}
 	
 	response +="<tr><td class=\"cell\">IP Address</td><td class=\"cell\">"; 
 	printIP((IPAddress)WiFi.localIP(),'.',response); 
@@ -1314,10 +1431,63 @@ static void systemData()
 		response +="<tr><td class=\"cell\">ESP Chip ID</td><td class=\"cell\">"; response+=ESP.getChipId(); response+="</tr>";
 #endif
 		response +="<tr><td class=\"cell\">OLED</td><td class=\"cell\">"; response+=OLED; response+="</tr>";
+#if REPEATER==1
+		response +="<tr><td class=\"cell\">Repeater</td><td class=\"cell\">"; response+=statRep.rcvd; 
+		response +=" rcvd, "; response+=statRep.sent; response+=" sent, "; response+=statRep.dups; 
+		response +=" dups, "; response+=statRep.denied; response+=" denied, "; response+=statRep.skipped; 
+		response +=" skipped, "; response+=statRep.dropped; response+=" dropped, "; response+=statRep.duty; 
+		response +=" duty, "; response+=statRep.err; response+=" err</td></tr>";
+		// Upper limit of messages per hour for every SF we may receive
+		response +="<tr><td class=\"cell\">Repeater max/hour</td><td class=\"cell\">";
+		for (uint8_t s=SF7; s<=SF12; s++) {
+			if ((_ISF != 0) && (s != _ISF)) continue;
+			response +=String() + "SF" + s + ">SF" + (_OSF != 0 ? _OSF : s) + " " + repRate(s) + " ";
+		}
+		response +="</td></tr>";
+#endif
+#if OLED>=1
+		if (statOled.draws > 0) {
+			response +="<tr><td class=\"cell\">OLED updates</td><td class=\"cell\">"; response+=statOled.draws; 
+			response +=" for "; response+=statOled.pkts; response+=" msgs, "; response+=statOled.bytes / statOled.draws; 
+			response +=" bytes, "; response+=statOled.us / statOled.draws; response+=" us avg, "; 
+			response +=statOled.usMax; response+=" us max</td></tr>";
+		}
+#endif
 		
 #if STATISTICS>=1
 		response +="<tr><td class=\"cell\">WiFi Setups</td><td class=\"cell\">"; response+=gwayConfig.wifis; response+="</tr>";
 		response +="<tr><td class=\"cell\">WWW Views</td><td class=\"cell\">"; response+=gwayConfig.views; response+="</tr>";
+		response +="<tr><td class=\"cell\">Counter writes</td><td class=\"cell\">"; response+=statCnt.appends; 
+		response +=" appends, "; response+=statCnt.compacts; response+=" compactions</td></tr>";
+#endif
+		response +="<tr><td class=\"cell\">Boot (ms)</td><td class=\"cell\">"; response+=bootArmed; 
+		response +=" radio, "; response+=bootFirstRx; response+=" first rx, "; response+=bootReady; response+=" ready</td></tr>";
+		response +="<tr><td class=\"cell\">Up queue</td><td class=\"cell\">"; response+=statUp.queued; 
+		response +=" queued, "; response+=statUp.sent; response+=" sent, "; response+=statUp.dropped; response+=" dropped</td></tr>";
+#if _UPSTORE==1
+		response +="<tr><td class=\"cell\">Up store</td><td class=\"cell\">"; response+=ups.count; 
+		response +=" waiting, "; response+=statUp.stored; response+=" stored, "; response+=statUp.replayed; 
+		response +=" replayed, "; response+=statUp.expired; response+=" expired, "; response+=statUp.lost; response+=" lost</td></tr>";
+#endif
+#if A_OTA==1
+		if (statOta.starts > 0) {
+			const char *otaStates[] = { "idle", "resolve", "connect", "header", "download", "retry", "done", "failed" };
+			response +="<tr><td class=\"cell\">Firmware update</td><td class=\"cell\">"; response+=otaStates[ota.state]; 
+			response +=", "; response+=ota.off; response+="/"; response+=ota.size; response+=" bytes, "; 
+			response+=statOta.resumes; response+=" resumes, "; response+=statOta.fails; response+=" fails</td></tr>";
+		}
+#endif
+#if STAT_LOG==1
+		response +="<tr><td class=\"cell\">Log records</td><td class=\"cell\">"; response+=statLog.recs; response+="</tr>";
+		response +="<tr><td class=\"cell\">Log segment</td><td class=\"cell\">"; response+=gwayConfig.logFileNo; 
+		response +=" ("; response+=gwayConfig.logFileRec; response+=" rec)</td></tr>";
+		response +="<tr><td class=\"cell\">Log flash writes</td><td class=\"cell\">"; response+=statLog.writes; 
+		response +=" ("; response+=statLog.opens; response+=" opens, "; response+=statLog.bytes; response+=" bytes)</td></tr>";
+		response +="<tr><td class=\"cell\">Log writes/1000 pkts</td><td class=\"cell\">"; 
+		response +=(statLog.recs > 0 ? (1000 * statLog.writes) / statLog.recs : 0); response+="</td></tr>";
+		response +="<tr><td class=\"cell\">Log records lost</td><td class=\"cell\">"; response+=statLog.lost; response+="</tr>";
+		response +="<tr><td class=\"cell\">Log query segments</td><td class=\"cell\">"; response+=statLog.segRead; 
+		response +=" read, "; response+=statLog.segSkip; response+=" skipped</td></tr>";
 #endif
 
 		response +="</table>";
@@ -1370,6 +1540,75 @@ static void interruptData()
 		if (mask <16) response += "0";
 		response +=String(mask,HEX); response+="</td></tr>";
 		
+		// Events and SPI use of every radio, the name of the radio is only
+		// given when there is more than one
+		const char * stateName[] = { "INIT", "SCAN", "CAD", "RX", "TX", "TXDONE" };
+		for (uint8_t r=0; r<_RADIOS; r++) {
+			String rn = (_RADIOS > 1) ? String(" radio ") + r : String();
+			
+			response +="<tr><td class=\"cell\">Radio events"; response += rn; response +="</td>";
+			response +="<td class=\"cell\">"; 
+			response += String() + statEvt[r].events;
+			response +="</td><td colspan=\"2\" class=\"cell\">lost "; 
+			response += String() + evtLost[r];
+			response +="</td></tr>";
+			
+			response +="<tr><td class=\"cell\">Event latency (uSec)"; response += rn; response +="</td>";
+			response +="<td class=\"cell\">"; 
+			response += String() + (uint32_t) (statEvt[r].events ? statEvt[r].latSum / statEvt[r].events : 0);
+			response +="</td><td colspan=\"2\" class=\"cell\">max "; 
+			response += String() + statEvt[r].latMax;
+			response +="</td></tr>";
+			
+			response +="<tr><td class=\"cell\">Flag reads / loops"; response += rn; response +="</td>";
+			response +="<td class=\"cell\">"; 
+			response += String() + statEvt[r].reads;
+			response +="</td><td colspan=\"2\" class=\"cell\">"; 
+			response += String() + statEvt[r].loops;
+			response +="</td></tr>";
+
+			response +="<tr><td class=\"cell\">SPI reads / writes"; response += rn; response +="</td>";
+			response +="<td class=\"cell\">"; 
+			response += String() + statSpi[r].reads;
+			response +="</td><td colspan=\"2\" class=\"cell\">"; 
+			response += String() + statSpi[r].writes;
+			response +="</td></tr>";
+			
+			response +="<tr><td class=\"cell\">SPI cached / skipped"; response += rn; response +="</td>";
+			response +="<td class=\"cell\">"; 
+			response += String() + statSpi[r].cached;
+			response +="</td><td colspan=\"2\" class=\"cell\">"; 
+			response += String() + statSpi[r].skipped;
+			response +="</td></tr>";
+			
+			// Average SPI accesses and time used per interrupt, by state
+			for (int i=0; i<=S_TXDONE; i++) {
+				if (statSpi[r].trans[i] == 0) continue;
+				response +="<tr><td class=\"cell\">SPI ops/uSec "; response += stateName[i]; response += rn; response +="</td>";
+				response +="<td class=\"cell\">"; 
+				response += String() + (statSpi[r].ops[i] / statSpi[r].trans[i]);
+				response +="</td><td colspan=\"2\" class=\"cell\">"; 
+				response += String() + (statSpi[r].usec[i] / statSpi[r].trans[i]);
+				response +="</td></tr>";
+			}
+		}
+
+#if _RADIOS > 1
+		// Every radio: state, channel and sf, received and sent messages.
+		// The context of the selected radio is in the globals.
+		for (uint8_t r=0; r<_RADIOS; r++) {
+			response +="<tr><td class=\"cell\">Radio "; response += r;
+			if (r == _TXRADIO) response +=" (TX)";
+			response +="</td><td class=\"cell\">";
+			response += String() + stateName[(r == rad) ? _state : radios[r].state];
+			response +=" ch "; response += (r == rad) ? ifreq : radios[r].ifreq;
+			response +=" SF"; response += (r == rad) ? sf : radios[r].sf;
+			response +="</td><td colspan=\"2\" class=\"cell\">"; 
+			response += String() + radios[r].rcvd + " rcvd, " + radios[r].sent + " sent";
+			response +="</td></tr>";
+		}
+#endif
+		
 		response +="<tr><td class=\"cell\">Re-entrant cntr</td>";
 		response +="<td class=\"cell\">"; 
 		response += String() + gwayConfig.reents;
@@ -1388,6 +1627,33 @@ static void interruptData()
 		stringTime(gwayConfig.ntpErrTime, response);
 		response +="</td>";
 		response +="</tr>";
+
+		response +="<tr><td class=\"cell\">ntp offset (uSec)</td>";
+		response +="<td class=\"cell\">"; 
+		response += String() + statNtp.offset;
+		response +="</td><td colspan=\"2\" class=\"cell\">jitter "; 
+		response += String() + statNtp.jitter;
+		response +="</td></tr>";
+		
+		response +="<tr><td class=\"cell\">ntp round trip (uSec)</td>";
+		response +="<td class=\"cell\">"; 
+		response += String() + statNtp.rtt;
+		response +="</td><td colspan=\"2\" class=\"cell\">drift "; 
+		response += String(statNtp.drift, 2);
+		response +=" ppm, "; 
+		response += String() + statNtp.syncs;
+		response +=" syncs</td></tr>";
+		
+		// Server names: address in use, lookups and the time they take
+		for (uint8_t i=0; i<DNS_ENTRIES; i++) {
+			response +="<tr><td class=\"cell\">DNS "; response += dnsCache[i].name;
+			response +="</td><td class=\"cell\">";
+			printIP(*dnsCache[i].ip, '.', response);
+			response +="</td><td colspan=\"2\" class=\"cell\">"; 
+			response += String() + dnsCache[i].lookups + " lookups, " + dnsCache[i].fails + " fails, ";
+			response += String() + dnsCache[i].failovers + " failovers, " + dnsCache[i].msLast + "/" + dnsCache[i].msMax + " ms";
+			response +="</td></tr>";
+		}
 		
 		response +="<tr><td class=\"cell\">Time Correction (uSec)</td><td class=\"cell\">"; 
 		response += txDelay; 
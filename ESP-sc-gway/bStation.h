@@ -0,0 +1,107 @@
+// bStation.h; 1-channel LoRa Gateway for ESP8266
+// Copyright (c) 2016, 2017, 2018 Maarten Westenberg version for ESP8266
+// Version 5.3.3
+// Date: 2018-08-25
+//
+// 	based on work done by Thomas Telkamp for Raspberry PI 1ch gateway
+//	and many other contributors.
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Author: Maarten Westenberg (mw12554@hotmail.com)
+//
+// This file contains the declarations for the LoRa Basics Station protocol
+// that is used instead of the Semtech UDP protocol when _BSTATION==1.
+//
+// ------------------------------------------------------------------------------------
+
+#if _BSTATION==1
+
+#define BS_BUFSIZE 1536							// Websocket receive buffer, router_config must fit
+#define BS_MSGSIZE 640							// Largest message we send (updf of 128 bytes)
+#define BS_TIMEOUT 5000							// mSec for every step of connecting
+#define BS_CONNECT 1000							// mSec a TCP connect() may block
+#define BS_PDU 127								// Downlink bytes, sendPkt() adds a 0 in payLoad
+#define BS_PING 30000							// mSec between websocket pings
+#define BS_RETRY_MAX 64							// Max seconds between connect attempts
+#define BS_DRS 16								// Data rates in router_config
+#define WS_HDR 8								// Room for the frame header in bsMsg
+
+// Websocket opcodes (RFC 6455)
+#define WS_TEXT 0x1
+#define WS_BINARY 0x2
+#define WS_CLOSE 0x8
+#define WS_PING 0x9
+#define WS_PONG 0xA
+
+// Connection to the LNS. First the router-info websocket is asked for the
+// uri of our muxs, we resolve its host and connect to that, send version
+// and wait for router_config before we forward messages. The address of
+// _LNSSERVER is kept in dnsCache by dnsStep(), so nothing waits for DNS.
+enum bsstate_t { BS_IDLE=0, BS_INFO, BS_RESOLVE, BS_MUXS, BS_CONFIG, BS_UP };
+
+WiFiClient bsClient;
+struct bsConn {
+	uint8_t		state;							// bsstate_t
+	bool		open;							// Websocket upgrade done
+	uint32_t	since;							// millis() state was entered
+	uint32_t	next;							// millis() of next connect attempt
+	uint32_t	lastRx;							// millis() last frame received
+	uint32_t	lastPing;						// millis() last ping sent
+	uint8_t		retry;							// Seconds to wait after a failure
+	uint8_t		session;						// Session in xtime, 1 to 127
+	char		host[48];						// Of the muxs
+	IPAddress	ip;
+	uint16_t	port;
+	char		path[64];
+	uint16_t	inLen;
+	uint8_t		in[BS_BUFSIZE];
+} bs;
+char bsMsg[WS_HDR + BS_MSGSIZE];				// Message under construction
+IPAddress lnsServer;							// Of _LNSSERVER, see dnsCache
+struct dnsEntry bsDns = { bs.host, &bs.ip };	// Lookup of the muxs host
+
+// Data rate table. Set from router_config, the defaults are the plan
+// of _LFREQ. A sf of 0 is a data rate we cannot use (FSK).
+struct bsDr {
+	uint8_t		sf;
+	uint16_t	bw;
+} bsDrs[BS_DRS] = {
+#if _LFREQ==915
+	{ 10, 125 }, { 9, 125 }, { 8, 125 }, { 7, 125 }, { 8, 500 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+	{ 12, 500 }, { 11, 500 }, { 10, 500 }, { 9, 500 }, { 8, 500 }, { 7, 500 }, { 0, 0 }, { 0, 0 }
+#else
+	{ 12, 125 }, { 11, 125 }, { 10, 125 }, { 9, 125 }, { 8, 125 }, { 7, 125 }, { 7, 250 }, { 0, 0 },
+	{ 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }
+#endif
+};
+
+// The dnmsg that is in LoraDown. dntxed is sent when it is transmitted.
+enum bsdn_t { BS_DN_NONE=0, BS_DN_QUEUED, BS_DN_TXED };
+struct bsDown {
+	uint8_t		state;							// bsdn_t
+	uint64_t	txTime;							// micros64() of transmission
+	char		diid[24];						// As received, echoed in dntxed
+	char		devEui[24];
+	char		rctx[12];
+} bsDn;
+
+struct bsStat {
+	uint32_t	connects;						// Times router_config received
+	uint32_t	fails;							// Connection failures
+	uint32_t	updf;							// Uplinks sent
+	uint32_t	lost;							// Uplinks while not connected
+	uint32_t	dnmsg;							// Downlinks received
+	uint32_t	dnerr;							// Downlinks not sent
+	uint32_t	dntxed;							// dntxed sent
+	uint32_t	other;							// Messages we ignore
+	uint32_t	bytesOut;						// Websocket payload bytes
+	uint32_t	bytesIn;
+} statBs;
+
+#endif // _BSTATION
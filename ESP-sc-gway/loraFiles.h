@@ -64,7 +64,7 @@ struct espGwayConfig {
 	uint8_t pdebug;				// pattern debug, 
 
 	uint16_t logFileRec;		// Logging File Record number
-	uint16_t logFileNo;			// Logging File Number
+	uint32_t logFileNo;			// Logging File Number (segment sequence number)
 	uint16_t logFileNum;		// Number of log files
 	
 	bool cad;					// is CAD enabled?
@@ -77,16 +77,185 @@ struct espGwayConfig {
 	String pass;				// Password of WiFi network
 } gwayConfig;
 
+// The configuration is stored in SPIFFS as a binary record in two slots,
+// files CONFIGFILE".a" and CONFIGFILE".b". Every write increments the 
+// sequence number and goes to the other slot, so if power fails during
+// a write, the previous slot is still valid. At boot the valid slot 
+// (magic, version, length and CRC) with the highest sequence number is used.
+// The counters that change often are stored in the same way, but 
+// in their own slots COUNTFILE".a" and COUNTFILE".b" so that a counter
+// update does not rewrite the settings.
+#define CFGMAGIC 0x31435747UL					// "GWC1"
+#define CFGVERSION 1
+
+// Text configuration file of older versions (ID=value lines). It is 
+// converted to the slots once, and removed when both slots are written.
+#define CONFIGTXT "/gwayConfig.txt"
+
+struct cfgHdr {
+	uint32_t magic;								// CFGMAGIC
+	uint16_t version;							// CFGVERSION
+	uint16_t len;								// Length of the record including crc
+	uint32_t seq;								// Write sequence number
+};
+
+struct cfgRec {
+	struct cfgHdr hdr;
+	uint8_t ch;									// Settings, see espGwayConfig
+	uint8_t sf;
+	uint8_t debug;
+	uint8_t pdebug;
+	uint8_t cad;
+	uint8_t hop;
+	uint8_t isNode;
+	uint8_t refresh;
+	uint8_t expert;
+	char ssid[33];
+	char pass[65];
+	uint32_t crc;								// CRC32 of all preceding bytes
+} cfgRec;
+
+struct cntRec {
+	struct cfgHdr hdr;
+	uint16_t fcnt;								// Counters, see espGwayConfig
+	uint16_t boots;
+	uint16_t resets;
+	uint16_t views;
+	uint16_t wifis;
+	uint16_t reents;
+	uint16_t ntpErr;
+	uint16_t ntps;
+	uint32_t ntpErrTime;
+	uint32_t crc;								// CRC32 of all preceding bytes
+} cntRec;
+
+// Counter updates are not written to the cntRec slots directly but appended
+// to a journal file COUNTFILE".j". The journal starts with a cntHdr that
+// holds the sequence number of the cntRec it applies to, followed by cntEnt
+// entries that each set one counter to a new value. At boot we read the cntRec
+// and replay the journal. When the journal has CNTMAXENT entries it is compacted:
+// a new cntRec is written and the journal is started again.
+// Appending 8 bytes programs the last data page in place, SPIFFS only writes
+// the index header of the file again. Rewriting the config took a new index
+// header twice and a new data page, so this is about 3 times fewer erases
+// (test/bench_cnt.cpp).
+#define CNTMAXENT 256							// Max entries in journal (2KB)
+
+#define CNT_FCNT	0x0001						// Masks for logCounters()
+#define CNT_BOOTS	0x0002
+#define CNT_RESETS	0x0004
+#define CNT_VIEWS	0x0008
+#define CNT_WIFIS	0x0010
+#define CNT_REENTS	0x0020
+#define CNT_NTPS	0x0040
+#define CNT_NTPERR	0x0080
+#define CNT_NTPETIM	0x0100
+#define CNT_ALL		0x01FF
+#define CNT_NUM		9
+
+struct cntHdr {
+	uint32_t magic;								// CFGMAGIC
+	uint32_t seq;								// cntRec.hdr.seq the journal applies to
+};
+
+struct cntEnt {
+	uint8_t id;									// Counter number 0 .. CNT_NUM-1
+	uint8_t inv;								// ~id, to detect partially written entries
+	uint16_t rsv;
+	uint32_t val;								// New value of the counter
+};
+
+uint16_t cntEntries = CNTMAXENT;				// Entries in the journal, CNTMAXENT forces compaction
+uint16_t cntDirty = 0;							// Counters to journal with the next stat message
+
+struct cntStat {
+	uint32_t appends;							// Journal appends
+	uint32_t compacts;							// Journal compactions (cntRec writes)
+} statCnt;
+
 // Define a log record to be written to the log file
 // Keep logfiles SHORT in name! to save memory
 #if STAT_LOG == 1
 
-// We do keep admin of logfiles by number
-// 
-//uint32_t logFileNo = 1;		// Included in struct espGwayConfig LogFile number
-//uint32_t logFileRec = 0;		// Number of records in a single logfile
-//uint32_t logFileNum = 1;		// Number of log files
-#define LOGFILEMAX 10
-#define LOGFILEREC 100
+// The log is a ring of LOGFILEMAX segment files /log-0 .. /log-<LOGFILEMAX-1>.
+// Each segment starts with a logHdr and contains at most LOGFILEREC fixed 
+// size binary logRec records. When a segment is full we start writing the
+// next segment with "w" which truncates the oldest segment, so we never
+// have to remove files or check whether they exist on the packet path.
+// Records are collected in RAM (logBuf) and written to SPIFFS in batches
+// of one flash page (LOGPAGE bytes) or when the buffer is older than
+// LOGFLUSH seconds.
+//
+// gwayConfig.logFileNo is the sequence number of the segment we write to,
+// the file number is logFileNo % LOGFILEMAX.
+// gwayConfig.logFileRec is the number of records in that segment
+// gwayConfig.logFileNum is the number of segments in use
+#define LOGFILEMAX 10							// Number of segment files in the ring
+#define LOGFILEREC 100							// Number of records per segment
+#define LOGPAGE 256								// SPIFFS page size, we write in batches of a page
+#define LOGFLUSH 60								// Max seconds records stay in RAM before flush
+#define LOGPAYLOAD 0							// Set to 1 to also log the first LOGPAYLEN bytes of payload
+#define LOGPAYLEN 16
+#define LOGMAGIC 0x31474F4CUL					// "LOG1" in the segment header
+
+struct logHdr {
+	uint32_t magic;								// LOGMAGIC
+	uint32_t seq;								// Sequence number of the segment
+	uint32_t tmst;								// Time the segment was started (now())
+	uint16_t recLen;							// sizeof(struct logRec)
+	uint16_t recMax;							// LOGFILEREC
+};
+
+struct logRec {
+	uint32_t tmst;								// Time of reception, now() in seconds
+	uint32_t addr;								// DevAddr of the node
+	uint16_t fcnt;								// Frame counter of the message
+	uint8_t ch;									// Channel index ifreq
+	uint8_t sf;									// Spreading factor
+	int16_t prssi;								// Packet RSSI (corrected)
+	int8_t snr;									// SNR
+	uint8_t len;								// Length of the LoRa message
+#if LOGPAYLOAD == 1
+	uint8_t data[LOGPAYLEN];					// Start of the message
+#endif
+};
+
+#define LOGBUFREC (LOGPAGE / sizeof(struct logRec))
+
+struct logRec logBuf[LOGBUFREC];				// RAM buffer of records not yet written
+uint8_t logBufCnt = 0;							// Number of records in logBuf
+uint32_t logTime = 0;							// now() when the first buffered record was added
+
+// Per segment index, kept in RAM. It is built by initLog() at boot and
+// updated by flushLog(). A query for a time range or a node only opens 
+// the segments that may contain matching records.
+// The DevAddr bloom filter has LOGBLOOM*8 bits and two hash bits per address.
+#define LOGBLOOM 32
+
+struct logIdx {
+	uint32_t first;								// Time of first record in segment
+	uint32_t last;								// Time of last record in segment
+	uint16_t recs;								// Number of records in segment
+	uint8_t bloom[LOGBLOOM];					// DevAddr bloom filter
+} logIdx[LOGFILEMAX];
+
+// Max hours back of a /LOG?hours= query (31 days)
+#define LOGHOURS 744
+
+// Output destinations of queryLog()
+#define LOG_SERIAL 0
+#define LOG_WWW 1
+
+// Counters so we can see how often we really go to flash
+struct logStat {
+	uint32_t recs;								// Records added to the log
+	uint32_t flushes;							// Number of buffer flushes
+	uint32_t opens;								// Number of SPIFFS.open() calls
+	uint32_t writes;							// Number of write() calls to SPIFFS
+	uint32_t bytes;								// Bytes written
+	uint32_t lost;								// Records lost because of write errors
+	uint32_t segRead;							// Segments read by queries
+	uint32_t segSkip;							// Segments skipped by queries using the index
+} statLog;
 
 #endif
@@ -34,6 +34,18 @@
 //
 #define NUM_HOPS 3
 
+// Hop planner. Every channel has an activity score that increases with
+// HOPDET for a detected preamble and HOPRCV for a received message.
+// Channels without activity are skipped, but visited at least every HOPSKIP
+// hops. The time we stay on a channel increases with its activity.
+// The scores are halved every HOPDECAY seconds.
+//
+#define HOPDET 1
+#define HOPRCV 4
+#define HOPACTMAX 64
+#define HOPSKIP 4
+#define HOPDECAY 60
+
 // Do not change these setting for RSSI detection. They are used for CAD
 // Given the correction factor of 157, we can get to -122dB with this rating
 // 
@@ -79,6 +91,7 @@ int freqs [] = {
 	869525000									// Channel 9, 869.5 MHz/125 for RX2 responses SF9(10%)
 	// TTN defines an additional channel at 869.525Mhz using SF9 for class B. Not used
 };
+#define _RX2FREQ 869525000						// RX2 downlink frequency
 #elif _LFREQ==433
 // The following 3 frequencies should be defined/used in an EU433 
 // environment.
@@ -93,6 +106,7 @@ int freqs [] = {
 	434575000, 									// Channel 7, 434.575 MHz primary
 	434775000 									// Channel 8, 434.775 MHz primary
 };
+#define _RX2FREQ 434665000						// RX2 downlink frequency
 #elif _LFREQ==915
 // US902=928
 // AU915-928
@@ -111,6 +125,7 @@ int freqs [] = {
 	// We should specify downlink frequencies here											
 												// SFxxxBW500
 };
+#define _RX2FREQ 923300000						// RX2 downlink frequency (SF12BW500)
 #else
 int freqs [] = {
 	// Print an Error, Not supported
@@ -120,6 +135,44 @@ int freqs [] = {
 uint32_t  freq = freqs[0];
 uint8_t	 ifreq = 0;								// Channel Index
 
+// Duty cycle sub-bands (ETSI EN 300 220) as used by LoRaWAN: range in kHz
+// and the allowed duty cycle in permille. US915 has no duty cycle limit.
+//
+struct dcBand {
+	uint32_t	lo;								// kHz, start of band
+	uint32_t	hi;								// kHz, end of band
+	uint16_t	permille;						// Duty cycle
+};
+#if _LFREQ==868
+const struct dcBand dcBands[] = {
+	{ 863000, 865000, 1 },						// 0.1%
+	{ 865000, 868000, 10 },						// 1%
+	{ 868000, 868600, 10 },						// 1%, channel 0-2
+	{ 868700, 869200, 1 },						// 0.1%
+	{ 869400, 869650, 100 },					// 10%, RX2
+	{ 869700, 870000, 10 }						// 1%
+};
+#define DC_BANDS 6
+#elif _LFREQ==433
+const struct dcBand dcBands[] = {
+	{ 433050, 434790, 100 }						// 10%
+};
+#define DC_BANDS 1
+#else
+#define DC_BANDS 0
+#endif
+
+// FRF register value of a frequency: freq * 2^19 / 32MHz, which is the
+// same as freq * 256 / 15625. FRF() is for constants and is computed by the
+// compiler, frfOf() in _loraModem.ino does it in 32 bits at runtime.
+// frfs[] holds the value for every channel in freqs[] and is filled by
+// initFrf() once, so setFreq() never has to divide for our own channels.
+//
+#define FRF(f) ((uint32_t)(((uint64_t)(f) << 19) / 32000000))
+#define NUM_FREQS (sizeof(freqs)/sizeof(int))
+uint32_t frfs[NUM_FREQS];
+const uint32_t frfRx2 = FRF(_RX2FREQ);
+
 
 
 // Set the structure for spreading factor
@@ -132,6 +185,39 @@ enum state_t { S_INIT=0, S_SCAN, S_CAD, S_RX, S_TX, S_TXDONE};
 volatile state_t _state=S_INIT;
 volatile uint8_t _event=0;
 
+// The interrupt handlers put an event with the dio source and the micros()
+// of the edge in evtRing of their radio. stateMachine() takes them out and
+// only reads the interrupt flags over SPI when there is an event (or every 
+// EVENT_POLL uSec in case an edge was missed on a shared dio pin).
+// evtHead is only written by the interrupt handlers, evtTail only by loop().
+// A radio has a pending event when its evtHead != evtTail, _event is only
+// the soft event the state machine sets for the selected radio itself. 
+// radioPending() tells loop() if any radio has work.
+//
+#define EVTRING 8								// Must be a power of 2
+#define EVENT_POLL 20000						// uSec between flag reads without event
+#define EVT_DIO0 0x01
+#define EVT_DIO1 0x02
+#define EVT_DIO2 0x04
+struct radioEvt {
+	uint32_t	tmst;							// micros() at the edge
+	uint8_t		src;							// EVT_DIO0 .. EVT_DIO2
+};
+volatile struct radioEvt evtRing[_RADIOS][EVTRING];
+volatile uint8_t evtHead[_RADIOS];
+volatile uint8_t evtTail[_RADIOS];
+volatile uint32_t evtLost[_RADIOS];				// Ring full
+uint32_t evtTmst = 0;							// Edge time of the event being handled
+uint64_t pollTime = 0;							// Last time the flags were read
+
+struct evtStat {
+	uint32_t	events;							// Events handled
+	uint32_t	loops;							// stateMachine() calls
+	uint32_t	reads;							// Times the flags were read over SPI
+	uint64_t	latSum;							// uSec from edge to handling, total (32 bits is 72 min)
+	uint32_t	latMax;							// uSec, maximum
+} statEvt[_RADIOS];						// Per radio, like evtRing
+
 // rssi is measured at specific moments and reported on others
 // so we need to store the current value we like to work with
 uint8_t _rssi;	
@@ -141,8 +227,120 @@ bool _hop= (bool) false;// experimental; frequency hopping. Only use when dio2 c
 
 unsigned long nowTime=0;
 unsigned long msgTime=0;
-unsigned long hopTime=0;
-unsigned long detTime=0;
+uint64_t hopTime=0;
+uint64_t detTime=0;
+
+// CAD scan order, see scanStart(). sfOrder in radios[] is sorted on 
+// sfWeight, which is the (decaying) number of messages received per SF.
+// The hop planner scores (hopAct) are in radios[] too, as every radio 
+// hears other nodes.
+#define SFWEIGHTMAX 1000						// Halve all weights above this
+uint8_t sfIdx = 0;								// Index in scan order
+bool sfExplore = false;							// This cycle uses SF7 to SF12
+
+struct hopStat {
+	uint32_t	hops[NUM_HOPS];					// Times we hopped to the channel
+	uint32_t	dwell[NUM_HOPS];				// millis spent on the channel
+	uint32_t	det[NUM_HOPS];					// Preambles detected
+	uint32_t	rcv[NUM_HOPS];					// Messages received
+	uint32_t	skips;							// Idle channels skipped
+};
+
+// Shadow of the radio registers that only change when we write them
+// (regCache). Reads of these registers are served from regShadow and
+// writing the value they already have is skipped. All other registers
+// (OPMODE, IRQ_FLAGS, FIFO pointers, RSSI, LNA with AGC etc.) always go
+// over SPI. Bit n of byte (addr>>3) stands for register addr.
+// Every radio has its own shadow, regShadow[rad].
+//
+const uint8_t regCache[0x80/8] = {
+	0xC0,										// 0x06-0x07 FRF_MSB, FRF_MID
+	0xCF,										// 0x08-0x0B FRF_LSB, PAC, PARAMP, OCP; 0x0E-0x0F FIFO bases
+	0x02,										// 0x11 IRQ_FLAGS_MASK
+	0xE0,										// 0x1D-0x1F MODEM_CONFIG1/2, SYMB_TIMEOUT
+	0x5F,										// 0x20-0x24 PREAMBLE, PAYLOAD_LENGTH, MAX_PAYLOAD, HOP_PERIOD; 0x26 MODEM_CONFIG3
+	0x00,
+	0x8A,										// 0x31 DETECT_OPT, 0x33 INVERTIQ, 0x37 DET_TRESH
+	0x02,										// 0x39 SYNC_WORD
+	0x07,										// 0x40-0x42 DIO_MAPPING_1/2, VERSION
+	0x20,										// 0x4D PADAC_SX1276
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+uint8_t regShadow[_RADIOS][0x80];
+uint8_t regValid[_RADIOS][0x80/8];				// Bit set when regShadow is valid
+
+// SPI statistics. Per state we count the register accesses and the time
+// used by stateMachine() when handling an interrupt, which tells how quickly
+// the radio is armed again after RX and TX. Every radio has its own, 
+// statSpi[rad].
+//
+struct spiStat {
+	uint32_t	reads;							// Register reads over SPI
+	uint32_t	writes;							// Register writes over SPI
+	uint32_t	cached;							// Reads served from regShadow
+	uint32_t	skipped;						// Writes skipped, same value
+	uint32_t	trans[S_TXDONE+1];				// Interrupts handled per state
+	uint32_t	ops[S_TXDONE+1];				// SPI accesses for those
+	uint32_t	usec[S_TXDONE+1];				// uSec for those
+} statSpi[_RADIOS];
+
+// Downlink arbiter. A downlink message waits in LoraDown while the radio
+// keeps receiving, until TX_LEAD uSec before it has to be sent (see
+// txArbiter()). After TXDONE the receiver is started again at once, or when
+// TXDONE does not come within the time-on-air plus TX_MARGIN.
+// The time the radio cannot receive (deaf) is counted per hour of uptime.
+//
+#define TX_LEAD 20000							// uSec to load the radio before tx time
+#define TX_MARGIN 50000							// uSec after time-on-air to wait for TXDONE
+#define TX_EARLY 10000000						// uSec, downlinks further ahead are refused
+#define TX_POWE_MIN 2							// Power range of setPow()
+#define TX_POWE_MAX 15
+
+// Result of handing a downlink to the arbiter, reported in TX_ACK.
+// txErrStr[] are the names of the Semtech protocol (v2), except 
+// DUTY_CYCLE_OVERFLOW which it does not have (it is the ChirpStack name).
+// TX_POWER is a warning only: the message is sent with the nearest power.
+//
+enum txerr_t { TX_NONE=0, TX_TOO_LATE, TX_TOO_EARLY, TX_COLLISION, TX_FREQ, TX_POWER, TX_DUTY };
+const char * txErrStr[] = { "NONE", "TOO_LATE", "TOO_EARLY", "COLLISION_PACKET", "TX_FREQ",
+	"TX_POWER", "DUTY_CYCLE_OVERFLOW" };
+uint8_t txErr = TX_NONE;						// Result of the last downlink
+uint8_t txWarn = TX_NONE;						// Warning for the last downlink
+
+struct txStat {
+	bool		pending;						// LoraDown waits to be sent
+	uint64_t	due;							// micros64() to start loading the radio
+	uint64_t	start;							// micros64() radio stopped receiving
+	uint32_t	air;							// uSec time-on-air of LoraDown
+	uint32_t	hour;							// Uptime hour of airHour and deafHour
+	uint32_t	airHour;						// mSec on air, this hour
+	uint32_t	airLast;						// mSec on air, previous hour
+	uint32_t	deafHour;						// mSec not receiving, this hour
+	uint32_t	deafLast;						// mSec not receiving, previous hour
+	uint32_t	preempt;						// Receptions aborted for a downlink
+	uint32_t	tout;							// No TXDONE in time
+	uint32_t	err[TX_DUTY+1];					// TX_ACK errors and warnings sent
+} statTx;
+
+// Token bucket per duty cycle sub-band. tokens is the time-on-air in uSec
+// we may still use. It fills with permille/1000 of the time passed, up to
+// the limit of _DC_WINDOW seconds.
+//
+#if DC_BANDS > 0
+struct dcStat {
+	uint32_t	tokens;							// uSec air time left
+	uint64_t	last;							// micros64() of last update
+	uint32_t	sent;							// Messages sent in band
+	uint32_t	rejected;						// Messages over duty cycle
+} statDc[DC_BANDS];
+#endif
+
+struct cadStat {
+	uint32_t	cycles;							// Scan cycles started
+	uint32_t	steps;							// SF steps before CDDETD, total
+	uint32_t	det[6];							// CDDETD per SF (SF7 = 0)
+	uint32_t	rcv[6];							// Messages received per SF
+};
 
 #if _PIN_OUT==1
 // ----------------------------------------------------------------------------
@@ -245,6 +443,72 @@ struct pins {
 #error "Pin Definitions _PIN_OUT must be 1(HALLARD) or 2 (COMRESULT)"
 #endif
 
+#if _RADIOS > 4
+#error "No more than 4 radios are supported"
+#elif _RADIOS > 1
+// ----------------------------------------------------------------------------
+// Pins of the radios after the first one (which uses pins above): ss, dio0,
+// dio1, dio2, rst. The values are an example for an ESP32 only, change them
+// to your own wiring. When dio0 and dio1 are wired to one GPIO use the same
+// value. Do not share rst with radio 0 as a reset of one radio resets all.
+// Do not use the strapping pins GPIO0, 2, 5, 12 and 15: a radio pulling
+// them up or down at power on keeps the ESP32 from booting.
+// GPIO34 and 35 are input only, which is fine for a dio.
+const uint8_t radioPins[_RADIOS-1][5] = {
+	{ 17, 34, 34, 34, 13 }						// Radio 1
+#if _RADIOS > 2
+	,{ 23, 35, 35, 35, 25 }						// Radio 2
+#endif
+#if _RADIOS > 3
+	,{ 22, 21, 21, 21, 16 }						// Radio 3, not with OLED_RST on 16
+#endif
+};
+#endif
+
+// Downlink messages go out on this radio
+#define TXRADIO ((_TXRADIO >= 0) ? _TXRADIO : 0)
+
+// ----------------------------------------------------------------------------
+// Radio context. The radio driver and the state machine work on the globals
+// (pins, _state, ifreq, sf, eventTime etc.) of the selected radio rad. With 
+// more than one radio radioSelect() saves these in radios[] and loads the
+// ones of the other radio. The register shadow and the event ring are
+// indexed by radio instead, as they are used while another radio is 
+// selected. The counters, the CAD scan order and the hop planner are 
+// used in radios[rad] directly.
+//
+struct radio {
+	uint8_t		ss;								// Pins
+	uint8_t		dio0;
+	uint8_t		dio1;
+	uint8_t		dio2;
+	uint8_t		rst;
+	state_t		state;
+	uint8_t		event;
+	uint8_t		ifreq;
+	uint32_t	freq;
+	sf_t		sf;
+	uint8_t		sfIdx;
+	bool		sfExplore;
+	uint8_t		rssi;
+	uint64_t	eventTime;
+	uint64_t	doneTime;
+	uint64_t	sendTime;
+	uint64_t	hopTime;
+	uint64_t	detTime;
+	uint64_t	pollTime;
+	uint32_t	rcvd;							// Messages received
+	uint32_t	sent;							// Messages transmitted
+	uint8_t		sfOrder[6];						// CAD scan order, see scanOrder()
+	uint16_t	sfWeight[6];
+	uint8_t		hopAct[NUM_HOPS];				// Activity score per channel
+	uint8_t		hopSkip[NUM_HOPS];				// Times skipped since last visit
+	uint64_t	hopDecay;						// Last time scores were halved
+	struct cadStat	statCad;
+	struct hopStat	statHop;
+} radios[_RADIOS];
+uint8_t rad = 0;								// Selected radio
+
 // STATR contains the statictis that are kept by message. 
 // Ech time a message is received or sent the statistics are updated.
 // In case STATISTICS==1 we define the last MAX_STAT messages as statistics
@@ -333,6 +597,78 @@ struct LoraUp {
 	uint8_t		sf;
 } LoraUp;
 
+// Queue for received messages that cannot be sent upstream yet.
+// During startup the receiver is armed before WiFi, DNS and NTP are
+// available, so messages received in that period are kept in RAM and
+// forwarded once the network is up. The same is done while the WiFi link
+// is down. If the queue is full, the messages are moved to the flash 
+// store (_UPSTORE) or else the oldest message is dropped.
+//
+// A message is removed once every destination that is up has taken it, 
+// done marks the destinations that already have it so they do not get it
+// again when sending to another one failed.
+//
+#define UPQUEUE 8
+#define UP_TTN 0x01									// _TTNSERVER, or the LNS (_BSTATION)
+#define UP_THING 0x02								// _THINGSERVER
+#define UP_DONE 0xFF								// Popped from the flash store, see initStore()
+struct upFrame {
+	uint32_t	tmst;								// micros() at reception
+	uint32_t	time;								// now() at reception
+	uint32_t	freq;								// Frequency it was received on
+	uint8_t		ifreq;								// and its channel
+	uint8_t		rad;								// Radio that received it
+	uint8_t		done;								// UP_TTN, UP_THING: sent there
+	struct LoraUp up;
+} upQueue[UPQUEUE];
+uint8_t upHead = 0;									// Oldest message in queue
+uint8_t upCount = 0;								// Number of messages in queue
+uint32_t upTime = 0;								// now() at reception of a queued message 
+													// that is forwarded, 0 for live messages
+uint8_t upSkip = 0;									// Destinations forwardPacket() leaves out
+uint8_t upSent = 0;									// Destinations forwardPacket() sent to
+#define UPTIME_VALID 1514764800UL					// 2018-01-01, older means now() was not set yet
+
+struct upStat {
+	uint32_t	queued;								// Messages put in queue
+	uint32_t	sent;								// Messages sent from the queue
+	uint32_t	dropped;							// Messages dropped, queue or store full
+	uint32_t	stored;								// Messages written to the flash store
+	uint32_t	replayed;							// Messages sent from the flash store
+	uint32_t	expired;							// Older than _UPSTORE_AGE when replayed
+	uint32_t	lost;								// Flash write or read errors
+} statUp;
+
+#if _UPSTORE==1
+// The flash store is a ring of UPSFILEMAX segment files /up-0 .. /up-<UPSFILEMAX-1>
+// like the log, each with a upsHdr and at most UPSFILEREC upFrame records.
+// Records are read back in order, a segment that has been read completely 
+// is removed. When a new segment must be started and the ring is full, the 
+// oldest segment is overwritten and its unread records are dropped.
+// Segments are identified by their sequence number, the file number is 
+// seq % UPSFILEMAX. The ring survives a restart, see initStore().
+#define UPSFILEMAX 8								// Number of segment files in the ring
+#define UPSFILEREC 64								// Number of records per segment
+#define UPSMAGIC 0x32535055UL						// "UPS2" in the segment header
+
+struct upsHdr {
+	uint32_t	magic;								// UPSMAGIC
+	uint32_t	seq;								// Sequence number of the segment
+	uint16_t	recLen;								// sizeof(struct upFrame)
+	uint16_t	recMax;								// UPSFILEREC
+};
+
+struct upStore {
+	uint32_t	rdSeq;								// Segment of the next record to replay
+	uint16_t	rdRec;								// and its index in that segment
+	uint32_t	wrSeq;								// Segment we append to
+	uint16_t	wrRec;								// Records in that segment
+	uint32_t	count;								// Records not replayed yet
+	uint32_t	next;								// millis() of next replay
+	uint8_t		recs[UPSFILEMAX];					// Records written in every segment file
+} ups;
+#endif
+
 
 
 
@@ -497,15 +833,261 @@ struct LoraUp {
 
 // ----------------------------------------
 // Definitions for UDP message arriving from server
-#define PROTOCOL_VERSION			0x01
+#define PROTOCOL_VERSION			0x02		// v2 has TX_ACK
 #define PKT_PUSH_DATA				0x00
 #define PKT_PUSH_ACK				0x01
 #define PKT_PULL_DATA				0x02
 #define PKT_PULL_RESP				0x03
 #define PKT_PULL_ACK				0x04
 #define PKT_TX_ACK                  0x05
+#define PKT_PUSH_BIN				0x80		// Not Semtech, binary PUSH_DATA
+
+// Binary PUSH_DATA for our own backend (_THINGBIN==1). The datagram has the
+// same 12-byte header as PUSH_DATA, with identifier PKT_PUSH_BIN, followed
+// by one or more frames until the end of the datagram. The backend answers
+// with a PUSH_ACK. All values little endian:
+//	0	tmst		uint32, micros() at reception
+//	4	freq		uint32, Hz
+//	8	sf | rad<<4	uint8, spreading factor and radio
+//	9	rssi		int16, packet RSSI in dBm
+//	11	snr			int8, dB
+//	12	size		uint8, payload length
+//	13	payload		size bytes
+//
+#if _THINGBIN==1
+#ifndef _THINGSERVER
+#error "_THINGBIN needs _THINGSERVER"
+#endif
+#define BIN_HDR 13								// Bytes per frame without payload
+#define BIN_SIZE 512							// Datagram size
+uint8_t binBuf[BIN_SIZE];
+uint16_t binLen = 0;							// 0 is empty
+uint32_t binTime = 0;							// millis() of first frame in binBuf
+
+struct binStat {
+	uint32_t	frames;							// Frames sent binary
+	uint32_t	dgrams;							// Datagrams sent
+	uint32_t	bytes;							// Bytes in these datagrams
+	uint32_t	json;							// Bytes the same frames have in JSON
+} statBin;
+#endif
+
+// The last PUSH_DATA we sent to each server and the round trip time of its
+// PUSH_ACK. A server gets an entry when we first send to it, when all are
+// in use the one of the oldest PUSH_DATA is taken (e.g. after a failover).
+#define ACK_DESTS 3								// Servers we keep the rtt of
+struct ackStat {
+	IPAddress	ip;								// Server, 0.0.0.0 is unused
+	bool		waiting;						// No PUSH_ACK yet
+	uint16_t	token;
+	uint64_t	sent;							// micros64() sent
+	uint32_t	rtt;							// uSec, last
+	uint32_t	rttAvg;							// uSec, average of about 8
+} statAck[ACK_DESTS];
+
+// Cache of the addresses of the servers we use. dnsStep() resolves the
+// names again every _DNS_TTL seconds without waiting for the answer, and
+// keeps the last DNS_ADDRS different addresses of a name. When DNS_ACKLOST
+// PUSH_DATA messages in a row to a server are not acknowledged, the next
+// address is used and the name is resolved again at once. The address that
+// failed is not used for DNS_BAD mSec, unless it answers or there is no
+// other, so the answer to that lookup does not switch back to it. Until a
+// PUSH_ACK arrives, uplinks are stored instead of sent (see upLink()).
+// A PUSH_DATA only counts as unacknowledged when the next one is sent 
+// DNS_ACKWAIT mSec or more after it, so a burst of uplinks (e.g. the queue
+// sent after an outage) does not look like a server that is gone.
+// lwIP keeps answers for the TTL of the record, so asking it again before
+// that costs nothing.
+//
+#define DNS_ADDRS 3								// Addresses kept per name
+#define DNS_ACKLOST 3							// Unacknowledged PUSH_DATA for failover
+#define DNS_ACKWAIT 2000						// mSec a PUSH_ACK may take
+#define DNS_TIMEOUT 5000						// mSec to wait for an answer
+#define DNS_RETRY 5000							// mSec after a failure
+#define DNS_BAD 600000							// mSec an address is avoided after failover
+struct dnsEntry {
+	const char	*name;
+	IPAddress	*ip;							// Address in use, e.g. &ttnServer
+	IPAddress	addr[DNS_ADDRS];				// Newest first
+	uint32_t	bad[DNS_ADDRS];					// millis() addr[i] is avoided until, 0 if not
+	uint8_t		n;								// Addresses in addr
+	uint8_t		cur;							// Index of *ip in addr
+	uint32_t	next;							// millis() to resolve again
+	uint32_t	start;							// millis() of request, 0 if none
+	volatile bool done;							// Answer arrived, in found
+	volatile uint32_t found;					// Address, 0 when not found
+	bool		waiting;						// PUSH_DATA not acknowledged yet
+	uint32_t	pushed;							// millis() of that PUSH_DATA
+	uint8_t		miss;							// Unacknowledged PUSH_DATA in a row
+	bool		lost;							// Failover done, no PUSH_ACK since
+	uint32_t	lookups;
+	uint32_t	fails;
+	uint32_t	failovers;
+	uint32_t	msLast;							// Time of last lookup
+	uint32_t	msMax;
+};
+
+// WiFi link manager. wlanStep() is called by loop() and never waits for a
+// connection. When the link is lost the SDK first tries the same AP for
+// WLAN_AUTO mSec, then we scan and join the best AP of the wpa list. An AP
+// scores by its average RSSI and by how many of our PUSH_DATA messages
+// were acknowledged while we were on it.
+//
+#define WLAN_AUTO 10000							// mSec for the SDK to reconnect
+#define WLAN_JOIN 15000							// mSec to join an AP
+#define WLAN_SCAN 10000							// mSec for a scan
+#define WLAN_WAIT 10000							// mSec after no AP was found
+#define WPASIZE (sizeof(wpa)/sizeof(wpa[0]))
+enum wlan_t { L_DOWN=0, L_SCAN, L_JOIN, L_WAIT, L_UP };
+struct wlanLink {
+	uint8_t		state;							// wlan_t
+	uint8_t		ap;								// Index in wpa of the AP we use
+	uint32_t	since;							// millis() state was entered
+	uint32_t	lost;							// millis() link was lost, 0 at boot
+	uint32_t	outages;						// Times the link was lost
+	uint32_t	downSecs;						// Total time without link
+	uint32_t	msLast;							// Last reconnect time
+	uint32_t	msMax;
+} wlan;
+struct wlanAp {
+	int16_t		rssi;							// Average of scans, 0 when never seen
+	bool		seen;							// In the last scan
+	uint8_t		failRow;						// Joins failed in a row
+	uint32_t	joins;
+	uint32_t	fails;
+	uint32_t	sent;							// PUSH_DATA sent while on this AP
+	uint32_t	acked;							// and acknowledged
+} wlanAps[WPASIZE];
+
+#if ESP32_ARCH==1
+#define DNS_IP4(a) ((a)->u_addr.ip4.addr)
+#else
+#define DNS_IP4(a) ((a)->addr)
+#endif
 
 #define MGT_RESET					0x15		// Not a LoRa Gateway Spec message
 #define MGT_SET_SF					0x16
 #define MGT_SET_FREQ				0x17
 
+// Intake ring for datagrams from the servers. udpIntake() reads all that
+// the socket has into the ring, loop() handles at most UDP_BUDGET of them
+// per call so that a burst cannot keep the state machine waiting.
+// Datagrams that do not fit in the ring wait in the socket, lwIP drops them
+// when its buffers are full, we do not see that. Datagrams that do not fit
+// in a buffer or cannot be read whole are dropped.
+//
+#define UDPRING 4								// Must be a power of 2
+#define UDP_BUDGET 2							// Datagrams handled per loop()
+#define UDP_BUFSIZE 640							// Largest PULL_RESP is about 560 bytes
+struct udpBuf {
+	IPAddress	ip;								// Sender
+	uint16_t	port;
+	uint16_t	size;
+	uint8_t		data[UDP_BUFSIZE];
+} udpRing[UDPRING];
+uint8_t udpHead = 0;							// Next to fill
+uint8_t udpTail = 0;							// Next to handle
+
+struct udpStat {
+	uint32_t	read;							// Datagrams read into the ring
+	uint32_t	handled;						// Datagrams handled
+	uint32_t	dropped;						// Short read
+	uint32_t	oversize;						// Larger than UDP_BUFSIZE
+} statUdp;
+
+#if A_OTA==1
+// Firmware download, see otaStep(). The host is resolved without waiting,
+// the SHA-256 file is read first if the hash was not given, then the image.
+// Every time the connection breaks the download is continued with a Range
+// request, at most OTA_RETRIES times in a row.
+#define OTA_READ 1024							// Bytes handled per loop()
+#define OTA_TIMEOUT 10000						// mSec without data
+#define OTA_CONNECT_MS 1000						// mSec a TCP connect() may block
+#define OTA_RETRIES 8
+#define OTA_BACKOFF 2000						// mSec, times the retries
+enum ota_t { OTA_IDLE=0, OTA_RESOLVE, OTA_CONNECT, OTA_HEAD, OTA_BODY, OTA_WAIT, OTA_DONE, OTA_FAIL };
+enum otaf_t { OTA_F_SHA=0, OTA_F_BIN };
+
+struct sha256Ctx {
+	uint32_t	h[8];
+	uint8_t		buf[64];
+	uint32_t	len;							// Bytes hashed, images are < 4 GB
+};
+
+struct otaConn {
+	uint8_t		state;							// ota_t
+	uint8_t		file;							// otaf_t, file being read
+	uint8_t		retries;						// Failures in a row
+	char		host[48];
+	IPAddress	ip;								// Of host, 0.0.0.0 until resolved
+	uint16_t	port;
+	char		path[64];
+	char		sha[65];						// Expected SHA-256 in hex
+	uint32_t	size;							// Of the image
+	uint32_t	off;							// Bytes of the image received
+	uint32_t	skip;							// Bytes to skip, server ignored the Range
+	uint32_t	since;							// millis() of last data or state change
+	int			status;							// HTTP status of the response
+	uint32_t	length;							// Content-Length of the response
+	uint32_t	range;							// First byte of a 206 response
+	char		line[96];						// Header line being read
+	uint8_t		lineLen;
+	struct sha256Ctx ctx;
+} ota;
+uint8_t otaBuf[OTA_READ];
+struct dnsEntry otaDns = { ota.host, &ota.ip };	// Lookup of the host
+
+struct otaStat {
+	uint32_t	starts;
+	uint32_t	resumes;						// Downloads continued with a Range
+	uint32_t	fails;
+	uint32_t	start;							// millis() the download started
+	uint32_t	msLast;							// Time of the last complete download
+} statOta;
+#endif
+
+#if REPEATER==1
+// Repeater pipeline, see _repeater.ino. Received uplinks wait in repQueue 
+// until they are due and the transmitter is free. Messages with the same
+// CRC as one of the last REP_DEDUP messages within REP_WINDOW are not
+// repeated again (retransmissions of a node, or a message heard twice).
+//
+#define REPQUEUE 4
+#define REP_DEDUP 8
+#define REP_WINDOW 60000						// mSec
+#define REP_LEAD 50000							// uSec from txQueue() to transmission
+#define REP_LATE 5000000						// uSec after due, then dropped
+#define REP_PL 23								// Payload for throughput limits (10 bytes data)
+#if _ICHAN == _OCHAN
+#error "REPEATER: _OCHAN must be another channel than _ICHAN"
+#endif
+
+struct repFrame {
+	uint64_t	due;							// micros64() to repeat
+	uint8_t		sf;								// To send with
+	uint8_t		len;
+	uint8_t		data[128];
+} repQueue[REPQUEUE];
+uint8_t repHead = 0;
+uint8_t repCount = 0;
+
+struct repSeen {
+	uint32_t	crc;
+	uint32_t	ms;								// millis() of reception
+} repSeen[REP_DEDUP];
+uint8_t repSeenIdx = 0;
+
+const uint32_t repNodes[] = _REP_NODES;
+const uint64_t repEuis[] = _REP_EUIS;
+
+struct repStat {
+	uint32_t	rcvd;							// Uplinks on _ICHAN
+	uint32_t	skipped;						// Other SF or not a LoRaWAN uplink
+	uint32_t	denied;							// Not in _REP_NODES or _REP_EUIS
+	uint32_t	dups;
+	uint32_t	dropped;						// Queue full or too late
+	uint32_t	sent;							// Accepted by txQueue()
+	uint32_t	duty;							// Refused for duty cycle
+	uint32_t	err;							// Refused for other reasons
+} statRep;
+#endif
@@ -65,4 +65,30 @@ SSD1306  display(OLED_ADDR, OLED_SDA, OLED_SCL);// i2c ADDR & SDA, SCL on wemos
 SH1106  display(OLED_ADDR, OLED_SDA, OLED_SCL);	// i2c ADDR & SDA, SCL on wemos
 #endif
 
+// The receive path only stores the message data in oledPkt, loop() calls 
+// draw_oLED() which shows it at most every OLED_INTERVAL mSec. The driver
+// compares the new screen with the last one and only sends the changed 
+// columns of every page over I2C. For this screen that is about 310 bytes
+// per update, against 844 for the box around all changes that it sent 
+// before and 1224 for the whole screen (test/test_oled.cpp).
+#define OLED_INTERVAL 500						// mSec between screen updates
+
+struct oledPkt {
+	bool		dirty;							// Not shown yet
+	uint32_t	tmst;							// now() at reception
+	int16_t		rssi;							// Packet RSSI (corrected)
+	int8_t		snr;
+	uint8_t		len;
+	uint8_t		addr[4];						// DevAddr, MSB first
+} oledPkt;
+uint32_t oledTime = 0;							// millis() of last update
+
+struct oledStat {
+	uint32_t	pkts;							// Messages given to msg_oLED()
+	uint32_t	draws;							// Screen updates
+	uint32_t	bytes;							// I2C bytes of the updates
+	uint32_t	us;								// Time spent in the updates
+	uint32_t	usMax;
+} statOled;
+
 #endif//OLED>=1
\ No newline at end of file
@@ -232,6 +232,9 @@ class OLEDDisplay : public Print {
     uint8_t            *buffer_back;
     #endif
 
+    // Bytes sent to the display over I2C by display()
+    uint32_t            i2cBytes = 0;
+
   protected:
 
     OLEDDISPLAY_TEXT_ALIGNMENT   textAlignment = TEXT_ALIGN_LEFT;
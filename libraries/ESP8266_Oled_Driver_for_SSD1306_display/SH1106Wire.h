@@ -60,68 +60,33 @@ class SH1106Wire : public OLEDDisplay {
 
     void display(void) {
       #ifdef OLEDDISPLAY_DOUBLE_BUFFER
-        uint8_t minBoundY = ~0;
-        uint8_t maxBoundY = 0;
-
-        uint8_t minBoundX = ~0;
-        uint8_t maxBoundX = 0;
-
         uint8_t x, y;
 
-        // Calculate the Y bounding box of changes
-        // and copy buffer[pos] to buffer_back[pos];
+        // Send only the changed columns of every page, and copy buffer
+        // to buffer_back. The SH1106 has 132 columns, the display starts
+        // at column 2.
         for (y = 0; y < (DISPLAY_HEIGHT / 8); y++) {
+          uint8_t minBoundX = 0xFF;
+          uint8_t maxBoundX = 0;
+          uint16_t pos = y * DISPLAY_WIDTH;
           for (x = 0; x < DISPLAY_WIDTH; x++) {
-           uint16_t pos = x + y * DISPLAY_WIDTH;
-           if (buffer[pos] != buffer_back[pos]) {
-             minBoundY = _min(minBoundY, y);
-             maxBoundY = _max(maxBoundY, y);
-             minBoundX = _min(minBoundX, x);
-             maxBoundX = _max(maxBoundX, x);
-           }
-           buffer_back[pos] = buffer[pos];
-         }
-         yield();
-        }
-
-        // If the minBoundY wasn't updated
-        // we can savely assume that buffer_back[pos] == buffer[pos]
-        // holdes true for all values of pos
-        if (minBoundY == ~0) return;
-
-        // Calculate the colum offset
-        uint8_t minBoundXp2H = (minBoundX + 2) & 0x0F;
-        uint8_t minBoundXp2L = 0x10 | ((minBoundX + 2) >> 4 );
-
-        byte k = 0;
-        for (y = minBoundY; y <= maxBoundY; y++) {
-          sendCommand(0xB0 + y);
-          sendCommand(minBoundXp2H);
-          sendCommand(minBoundXp2L);
-          for (x = minBoundX; x <= maxBoundX; x++) {
-            if (k == 0) {
-              Wire.beginTransmission(_address);
-              Wire.write(0x40);
-            }
-            Wire.write(buffer[x + y * DISPLAY_WIDTH]);
-            k++;
-            if (k == 16)  {
-              Wire.endTransmission();
-              k = 0;
+            if (buffer[pos + x] != buffer_back[pos + x]) {
+              minBoundX = _min(minBoundX, x);
+              maxBoundX = _max(maxBoundX, x);
+              buffer_back[pos + x] = buffer[pos + x];
             }
           }
-          if (k != 0)  {
-            Wire.endTransmission();
-            k = 0;
-          }
-          yield();
-        }
+          if (minBoundX == 0xFF) continue;
 
-        if (k != 0) {
-          Wire.endTransmission();
+          sendCommand(0xB0 + y);
+          sendCommand((minBoundX + 2) & 0x0F);
+          sendCommand(0x10 | ((minBoundX + 2) >> 4));
+          sendData(&buffer[pos + minBoundX], maxBoundX - minBoundX + 1);
+          yield();
         }
       #else
         uint8_t * p = &buffer[0];
+        i2cBytes += DISPLAY_BUFFER_SIZE + DISPLAY_BUFFER_SIZE / 16;
         for (uint8_t y=0; y<8; y++) {
           sendCommand(0xB0+y);
           sendCommand(0x02);
@@ -144,6 +109,21 @@ class SH1106Wire : public OLEDDisplay {
       Wire.write(0x80);
       Wire.write(command);
       Wire.endTransmission();
+      i2cBytes += 2;
+    }
+
+    // Send n bytes of display data, 16 per I2C transmission
+    void sendData(const uint8_t *p, uint8_t n) {
+      while (n > 0) {
+        uint8_t k = (n < 16 ? n : 16);
+        Wire.beginTransmission(_address);
+        Wire.write(0x40);
+        Wire.write(p, k);
+        Wire.endTransmission();
+        i2cBytes += k + 1;
+        p += k;
+        n -= k;
+      }
     }
 
 
@@ -54,62 +54,36 @@ class SSD1306Wire : public OLEDDisplay {
 
     void display(void) {
       #ifdef OLEDDISPLAY_DOUBLE_BUFFER
-        uint8_t minBoundY = ~0;
-        uint8_t maxBoundY = 0;
-
-        uint8_t minBoundX = ~0;
-        uint8_t maxBoundX = 0;
         uint8_t x, y;
 
-        // Calculate the Y bounding box of changes
-        // and copy buffer[pos] to buffer_back[pos];
+        // Send only the changed columns of every page, and copy buffer
+        // to buffer_back. Changes in two pages far apart (a clock at the
+        // top and a counter at the bottom) do not make the pages in
+        // between dirty.
         for (y = 0; y < (DISPLAY_HEIGHT / 8); y++) {
+          uint8_t minBoundX = 0xFF;
+          uint8_t maxBoundX = 0;
+          uint16_t pos = y * DISPLAY_WIDTH;
           for (x = 0; x < DISPLAY_WIDTH; x++) {
-           uint16_t pos = x + y * DISPLAY_WIDTH;
-           if (buffer[pos] != buffer_back[pos]) {
-             minBoundY = _min(minBoundY, y);
-             maxBoundY = _max(maxBoundY, y);
-             minBoundX = _min(minBoundX, x);
-             maxBoundX = _max(maxBoundX, x);
-           }
-           buffer_back[pos] = buffer[pos];
-         }
-         yield();
-        }
+            if (buffer[pos + x] != buffer_back[pos + x]) {
+              minBoundX = _min(minBoundX, x);
+              maxBoundX = _max(maxBoundX, x);
+              buffer_back[pos + x] = buffer[pos + x];
+            }
+          }
+          if (minBoundX == 0xFF) continue;
 
-        // If the minBoundY wasn't updated
-        // we can savely assume that buffer_back[pos] == buffer[pos]
-        // holdes true for all values of pos
-        if (minBoundY == ~0) return;
+          sendCommand(COLUMNADDR);
+          sendCommand(minBoundX);
+          sendCommand(maxBoundX);
 
-        sendCommand(COLUMNADDR);
-        sendCommand(minBoundX);
-        sendCommand(maxBoundX);
+          sendCommand(PAGEADDR);
+          sendCommand(y);
+          sendCommand(y);
 
-        sendCommand(PAGEADDR);
-        sendCommand(minBoundY);
-        sendCommand(maxBoundY);
-
-        byte k = 0;
-        for (y = minBoundY; y <= maxBoundY; y++) {
-          for (x = minBoundX; x <= maxBoundX; x++) {
-            if (k == 0) {
-              Wire.beginTransmission(_address);
-              Wire.write(0x40);
-            }
-            Wire.write(buffer[x + y * DISPLAY_WIDTH]);
-            k++;
-            if (k == 16)  {
-              Wire.endTransmission();
-              k = 0;
-            }
-          }
+          sendData(&buffer[pos + minBoundX], maxBoundX - minBoundX + 1);
           yield();
         }
-
-        if (k != 0) {
-          Wire.endTransmission();
-        }
       #else
 
         sendCommand(COLUMNADDR);
@@ -120,6 +94,7 @@ class SSD1306Wire : public OLEDDisplay {
         sendCommand(0x0);
         sendCommand(0x7);
 
+        i2cBytes += DISPLAY_BUFFER_SIZE + DISPLAY_BUFFER_SIZE / 16;
         for (uint16_t i=0; i < DISPLAY_BUFFER_SIZE; i++) {
           Wire.beginTransmission(this->_address);
           Wire.write(0x40);
@@ -139,6 +114,21 @@ class SSD1306Wire : public OLEDDisplay {
       Wire.write(0x80);
       Wire.write(command);
       Wire.endTransmission();
+      i2cBytes += 2;
+    }
+
+    // Send n bytes of display data, 16 per I2C transmission
+    void sendData(const uint8_t *p, uint8_t n) {
+      while (n > 0) {
+        uint8_t k = (n < 16 ? n : 16);
+        Wire.beginTransmission(_address);
+        Wire.write(0x40);
+        Wire.write(p, k);
+        Wire.endTransmission();
+        i2cBytes += k + 1;
+        p += k;
+        n -= k;
+      }
     }
 
 
@@ -0,0 +1,78 @@
+// 1-channel LoRa Gateway for ESP8266, host benchmarks
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Uplinks per second of LoRa Basics Station (the bs variant): bsUplink()
+// to the mock LNS of host/wsserver.h over a real TCP connection, until the
+// LNS has every message, for frames of 16, 51 and 128 bytes.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include "wsserver.h"
+#include <string>
+
+#define MSGS 20000
+
+static void lns(const hostWsMsg &m)
+{
+	if (m.path == "/router-info") {
+		hostWsSend("{\"uri\":\"ws://127.0.0.1:" + std::to_string(_LNSPORT) + "/gw\"}", m.conn);
+	}
+	else if (m.text.find("\"version\"") != std::string::npos) {
+		hostWsSend("{\"msgtype\":\"router_config\"}", m.conn);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Send MSGS data frames of len bytes, print messages per second and the
+// bytes on the websocket per message
+// ----------------------------------------------------------------------------
+static void bench(uint8_t len)
+{
+	LoraUp.payLength = len;
+	LoraUp.payLoad[0] = 0x40;
+	LoraUp.payLoad[5] = 0x00;
+	for (int i=1; i<len; i++) if (i != 5) LoraUp.payLoad[i] = i;
+	LoraUp.sf = SF7;
+	hostWsRcvd.clear();
+	uint32_t bytes = statBs.bytesOut;
+	uint32_t updf = statBs.updf;
+	double t = hostClock();
+	for (int i=0; i<MSGS; i++) {
+		LoraUp.payLoad[6] = i;
+		bsUplink(micros());
+		if ((i % 16) == 15) hostWsPoll();
+	}
+	for (int i=0; (i < 10000) && (hostWsRcvd.size() < MSGS); i++) hostWsPoll();
+	t = hostClock() - t;
+	printf("bs: %3u byte frames: %8.0f msg/s, %5.1f us per message, %u bytes per message\n",
+		len, MSGS / t, t * 1e6 / MSGS, (statBs.bytesOut - bytes) / MSGS);
+	CHECK(statBs.updf - updf == MSGS);
+	CHECK(hostWsRcvd.size() == MSGS);
+}
+
+int main()
+{
+	hostInit("benchbs");
+	hostDns[_LNSSERVER] = IPAddress(127, 0, 0, 1);
+	hostWsListen(_LNSPORT);
+	hostWsOnMsg = lns;
+	for (int i=0; (i < 100) && (dnsStep() < (int) DNS_ENTRIES); i++) hostRun(1000);
+	for (int i=0; (i < 5000) && (bs.state != BS_UP); i++) {
+		bsLoop();
+		hostWsPoll();
+		hostRun(1000);
+	}
+	CHECK(bs.state == BS_UP);
+	hostWsOnMsg = NULL;
+
+	bench(16);
+	bench(51);
+	bench(128);
+	return hostDone();
+}
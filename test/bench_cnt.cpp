@@ -0,0 +1,163 @@
+// 1-channel LoRa Gateway for ESP8266, host benchmarks
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Flash wear of the persistent counters over a simulated year: a sensor
+// frame every _SENSOR_INTERVAL (fcnt journaled every 10 frames), an NTP
+// request every _NTP_INTERVAL, 30 page views a day journaled with the stat
+// message, two WiFi connects a day and a boot a week. Each counter update
+// goes through logCounters() (journal and cntRec slots), and through the
+// text config rewrite writeGwayCfg() did for every update before.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+
+#define DAYS 365
+#define STEP 60									// Seconds per simulation step
+#ifndef _SENSOR_INTERVAL
+#define _SENSOR_INTERVAL 300					// As for GATEWAYNODE==1
+#endif
+
+struct wear { uint32_t updates, opens, writes, bytes, pages, jPages, cPages; };
+
+// ----------------------------------------------------------------------------
+// The text config as writeConfig() wrote it for every counter update
+// ----------------------------------------------------------------------------
+static void oldWriteConfig(const char *fn, struct espGwayConfig *c)
+{
+	SPIFFS.exists(fn);
+	File f = SPIFFS.open(fn, "w");
+	f.print("SSID"); f.print('='); f.print((*c).ssid); f.print('\n');
+	f.print("PASS"); f.print('='); f.print((*c).pass); f.print('\n');
+	f.print("CH"); f.print('='); f.print((*c).ch); f.print('\n');
+	f.print("SF");   f.print('='); f.print((*c).sf);   f.print('\n');
+	f.print("FCNT"); f.print('='); f.print((*c).fcnt); f.print('\n');
+	f.print("DEBUG"); f.print('='); f.print((*c).debug); f.print('\n');
+	f.print("PDEBUG"); f.print('='); f.print((*c).pdebug); f.print('\n');
+	f.print("CAD");  f.print('='); f.print((*c).cad); f.print('\n');
+	f.print("HOP");  f.print('='); f.print((*c).hop); f.print('\n');
+	f.print("NODE");  f.print('='); f.print((*c).isNode); f.print('\n');
+	f.print("BOOTS");  f.print('='); f.print((*c).boots); f.print('\n');
+	f.print("RESETS");  f.print('='); f.print((*c).resets); f.print('\n');
+	f.print("WIFIS");  f.print('='); f.print((*c).wifis); f.print('\n');
+	f.print("VIEWS");  f.print('='); f.print((*c).views); f.print('\n');
+	f.print("REFR");  f.print('='); f.print((*c).refresh); f.print('\n');
+	f.print("REENTS");  f.print('='); f.print((*c).reents); f.print('\n');
+	f.print("NTPETIM");  f.print('='); f.print((*c).ntpErrTime); f.print('\n');
+	f.print("NTPERR");  f.print('='); f.print((*c).ntpErr); f.print('\n');
+	f.print("NTPS");  f.print('='); f.print((*c).ntps); f.print('\n');
+	f.print("FILEREC");  f.print('='); f.print((*c).logFileRec); f.print('\n');
+	f.print("FILENO");  f.print('='); f.print((*c).logFileNo); f.print('\n');
+	f.print("FILENUM");  f.print('='); f.print((*c).logFileNum); f.print('\n');
+	f.print("EXPERT");  f.print('='); f.print((*c).expert); f.print('\n');
+	f.close();
+}
+
+// ----------------------------------------------------------------------------
+// Make the counters of mask persistent, with the journal or the old way.
+// Pages of journal appends and of compactions are counted apart.
+// ----------------------------------------------------------------------------
+static void update(bool old, uint16_t mask, struct wear *w)
+{
+	w->updates++;
+	if (old) {
+		oldWriteConfig(CONFIGFILE, &gwayConfig);
+		return;
+	}
+	uint32_t pages = hostFsPages;
+	uint32_t compacts = statCnt.compacts;
+	CHECK(logCounters(mask) == 1);
+	if (statCnt.compacts != compacts) w->cPages += hostFsPages - pages;
+	else w->jPages += hostFsPages - pages;
+}
+
+// ----------------------------------------------------------------------------
+// One year of counter updates
+// ----------------------------------------------------------------------------
+static void year(bool old, struct wear *w)
+{
+	SPIFFS.format();
+	gwayConfig = espGwayConfig();
+	gwayConfig.ssid = "gateway";
+	gwayConfig.pass = "secret";
+	memset(&cntRec, 0, sizeof(cntRec));
+	memset(&statCnt, 0, sizeof(statCnt));
+	if (!old) CHECK(writeCounters(COUNTFILE, &gwayConfig) == 1);
+	memset(w, 0, sizeof(*w));
+	uint32_t opens = hostFsOpens, writes = hostFsWrites, bytes = hostFsBytes, pages = hostFsPages;
+	uint32_t frames = 0;
+	uint16_t dirty = 0;
+
+	for (uint32_t t=STEP; t <= DAYS * 86400UL; t += STEP) {
+		if ((t % _SENSOR_INTERVAL) == 0) {
+			frames++;
+			if ((frames % 10) == 0) {
+				gwayConfig.fcnt = frames;
+				update(old, CNT_FCNT, w);
+			}
+		}
+		if ((t % _NTP_INTERVAL) == 0) {
+			gwayConfig.ntps++;
+			update(old, CNT_NTPS, w);
+		}
+		if ((t % 2880) == 0) {						// 30 views a day
+			gwayConfig.views++;
+			dirty |= CNT_VIEWS;
+		}
+		if (((t % _STAT_INTERVAL) == 0) && (dirty != 0)) {
+			update(old, dirty, w);
+			dirty = 0;
+		}
+		if ((t % 43200) == 21600) {
+			gwayConfig.wifis++;
+			update(old, CNT_WIFIS, w);
+		}
+		if ((t % 604800) == 3600 + STEP) {			// Boot: replay the journal first
+			if (!old) {
+				struct espGwayConfig c = gwayConfig;
+				CHECK(readCounters(COUNTFILE, &c) >= 0);
+				CHECK(c.fcnt == gwayConfig.fcnt);
+				CHECK(c.views == gwayConfig.views);
+			}
+			gwayConfig.boots++;
+			update(old, CNT_BOOTS, w);
+		}
+	}
+	w->opens = hostFsOpens - opens;
+	w->writes = hostFsWrites - writes;
+	w->bytes = hostFsBytes - bytes;
+	w->pages = hostFsPages - pages;
+}
+
+int main()
+{
+	hostInit("benchcnt");
+	struct wear n, o;
+
+	year(false, &n);
+	struct espGwayConfig c = gwayConfig;
+	CHECK(readCounters(COUNTFILE, &c) >= 0);
+	CHECK(c.fcnt == gwayConfig.fcnt);
+	CHECK(c.ntps == gwayConfig.ntps);
+	CHECK(c.views == gwayConfig.views);
+	CHECK(c.wifis == gwayConfig.wifis);
+	CHECK(c.boots == gwayConfig.boots);
+	uint32_t compacts = statCnt.compacts;
+
+	year(true, &o);
+
+	printf("cnt: %u counter updates in %d days\n", n.updates, DAYS);
+	printf("cnt: journal:  %6u opens %7u writes %8u bytes %6u pages %5u block erases"
+		" (appends %u pages, %u compactions %u pages)\n",
+		n.opens, n.writes, n.bytes, n.pages, n.pages / 32, n.jPages, compacts, n.cPages);
+	printf("cnt: old text: %6u opens %7u writes %8u bytes %6u pages %5u block erases\n",
+		o.opens, o.writes, o.bytes, o.pages, o.pages / 32);
+	CHECK(n.updates == o.updates);
+	CHECK(n.pages * 2 < o.pages);
+	return hostDone();
+}
@@ -0,0 +1,205 @@
+// 1-channel LoRa Gateway for ESP8266, host benchmarks
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Query speed of the log over 10000 records (100 segments, see the log10k
+// build variant in the Makefile), with the index (queryLog()) and by 
+// reading every segment, which is what the index saves.
+// Flash writes per 1000 packets: addLog() with its page buffer, for back to
+// back packets and for a packet every 30 seconds (flushed after LOGFLUSH
+// seconds as loop() does), next to the text addLog() of older versions.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+
+#define RECS 10000
+#define NODES 50
+#define RUNS 20
+#define PKTS 1000
+
+// rxpk JSON of a 12 byte message, as older versions logged it
+static const char *rxpk = "{\"rxpk\":[{\"tmst\":3512348611,\"chan\":0,\"rfch\":0,"
+	"\"freq\":868.100000,\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF7BW125\","
+	"\"codr\":\"4/5\",\"lsnr\":5,\"rssi\":-80,\"size\":12,"
+	"\"data\":\"QAEBASYAAQABcmVw\",\"time\":\"2023-11-14T22:13:20Z\"}]}";
+
+struct fsUse { uint32_t opens, writes, bytes, pages; };
+
+// ----------------------------------------------------------------------------
+// Read all records of all segments, without the index. Matching records
+// are formatted like queryLog() does.
+// ----------------------------------------------------------------------------
+static int scanAll(uint32_t addr, uint32_t from, uint32_t to)
+{
+	char fn[16];
+	char line[128];
+	int n, found = 0;
+	for (int i=0; i<LOGFILEMAX; i++) {
+		sprintf(fn, "/log-%d", i);
+		File f = SPIFFS.open(fn, "r");
+		if (!f) continue;
+		f.seek(sizeof(struct logHdr), SeekSet);
+		while ((n = f.read((uint8_t *) logBuf, sizeof(logBuf)) / sizeof(struct logRec)) > 0) {
+			for (int j=0; j<n; j++) {
+				if ((logBuf[j].tmst < from) || (logBuf[j].tmst > to)) continue;
+				if ((addr != 0) && (logBuf[j].addr != addr)) continue;
+				sprintLogRec(&logBuf[j], line, sizeof(line)-1);
+				found++;
+			}
+		}
+		f.close();
+	}
+	return found;
+}
+
+// ----------------------------------------------------------------------------
+// Time RUNS queries, print µs per query, records found and file opens
+// ----------------------------------------------------------------------------
+static void bench(const char *what, uint32_t addr, uint32_t from, uint32_t to)
+{
+	int found = 0, scanned = 0;
+	uint32_t opens = hostFsOpens;
+	uint32_t segRead = statLog.segRead;
+	double t = hostClock();
+	for (int i=0; i<RUNS; i++) found = queryLog(addr, from, to, LOG_SERIAL);
+	double tq = (hostClock() - t) * 1e6 / RUNS;
+	uint32_t qOpens = (hostFsOpens - opens) / RUNS;
+	
+	opens = hostFsOpens;
+	t = hostClock();
+	for (int i=0; i<RUNS; i++) scanned = scanAll(addr, from, to);
+	double ts = (hostClock() - t) * 1e6 / RUNS;
+	
+	printf("%-18s found=%5d  index: %7.0f us %3u opens %3u segments   full scan: %7.0f us %3u opens\n",
+		what, found, tq, qOpens, (statLog.segRead - segRead) / RUNS, ts, (hostFsOpens - opens) / RUNS);
+	CHECK(found == scanned);
+}
+
+// ----------------------------------------------------------------------------
+// The text addLog() of older versions: exists(), open("a"), 12 '*' for the
+// binary header, the JSON and a newline, close(). A file per LOGFILEREC
+// lines, the oldest removed when there are more than LOGFILEMAX.
+// ----------------------------------------------------------------------------
+static void oldAddLog(const unsigned char *line, int cnt)
+{
+	char fn[16];
+	if (gwayConfig.logFileRec > LOGFILEREC) {
+		gwayConfig.logFileRec = 0;
+		gwayConfig.logFileNo++;
+		gwayConfig.logFileNum++;
+	}
+	gwayConfig.logFileRec++;
+	if (gwayConfig.logFileNum > LOGFILEMAX) {
+		sprintf(fn,"/log-%d", gwayConfig.logFileNo - LOGFILEMAX);
+		SPIFFS.remove(fn);
+		gwayConfig.logFileNum--;
+	}
+	sprintf(fn,"/log-%d", gwayConfig.logFileNo);
+	SPIFFS.exists(fn);
+	File f = SPIFFS.open(fn, "a");
+	if (!f) return;
+	int i;
+	for (i=0; i< 12; i++) f.print('*');
+	f.write(&(line[i]), cnt-12);
+	f.print('\n');
+	f.close();
+}
+
+// ----------------------------------------------------------------------------
+// Start with an empty file system and log
+// ----------------------------------------------------------------------------
+static void emptyLog()
+{
+	logBufCnt = 0;
+	SPIFFS.format();
+	memset(logIdx, 0, sizeof(logIdx));
+	gwayConfig.logFileNo = 0;
+	gwayConfig.logFileRec = 0;
+	gwayConfig.logFileNum = 0;
+	initLog();
+}
+
+// ----------------------------------------------------------------------------
+// File system use of PKTS packets, gap seconds apart, with the log (old is
+// false) or with the text addLog() of older versions
+// ----------------------------------------------------------------------------
+static struct fsUse perThousand(bool old, int gap)
+{
+	uint8_t msg[12] = { 0x40, 0x01, 0x01, 0x01, 0x26 };
+	unsigned char line[512];
+	int cnt = 12 + strlen(rxpk);
+	memset(line, 0, 12);
+	memcpy(line + 12, rxpk, strlen(rxpk));
+	
+	emptyLog();
+	struct logStat l = statLog;
+	struct fsUse u = { hostFsOpens, hostFsWrites, hostFsBytes, hostFsPages };
+	for (int i=0; i<PKTS; i++) {
+		msg[6] = i;
+		if (old) oldAddLog(line, cnt);
+		else addLog(msg, sizeof(msg), 7, -80, 5);
+		delay(gap * 1000);
+		if ((logBufCnt > 0) && ((now() - logTime) >= LOGFLUSH)) flushLog();
+	}
+	if (!old) flushLog();
+	u.opens = hostFsOpens - u.opens;
+	u.writes = hostFsWrites - u.writes;
+	u.bytes = hostFsBytes - u.bytes;
+	u.pages = hostFsPages - u.pages;
+	if (!old) {											// The counters of the status page
+		CHECK(statLog.recs - l.recs == PKTS);
+		CHECK(statLog.opens - l.opens == u.opens);
+		CHECK(statLog.writes - l.writes == u.writes);
+		CHECK(statLog.bytes - l.bytes == u.bytes);
+	}
+	return u;
+}
+
+static void printUse(const char *what, struct fsUse u)
+{
+	printf("log: %-24s %5u opens %6u writes %7u bytes %5u pages %4u block erases per %d packets\n",
+		what, u.opens, u.writes, u.bytes, u.pages, u.pages / 32, PKTS);
+}
+
+int main()
+{
+	hostInit("benchlog");
+	setTime(1700000000UL);
+	initLog();
+	
+	uint8_t msg[12] = { 0x40 };
+	double t = hostClock();
+	for (int i=0; i<RECS; i++) {
+		uint32_t addr = 0x26010000 + (i % NODES) * 0x101;
+		msg[1] = addr; msg[2] = addr >> 8; msg[3] = addr >> 16; msg[4] = addr >> 24;
+		addLog(msg, sizeof(msg), 7, -80, 5);
+		delay(30000);
+	}
+	flushLog();
+	printf("log: %d records, %u segments, %.1f us per addLog(), %u flushes\n", RECS, 
+		gwayConfig.logFileNum, (hostClock() - t) * 1e6 / RECS, statLog.flushes);
+	CHECK(gwayConfig.logFileNum == LOGFILEMAX);
+	
+	uint32_t node = 0x26010000 + 7 * 0x101;
+	bench("all", 0, 0, 0xFFFFFFFF);
+	bench("node", node, 0, 0xFFFFFFFF);
+	bench("last hour", 0, now() - 3600, now());
+	bench("node, last hour", node, now() - 3600, now());
+	bench("unknown node", 0x12345678, 0, 0xFFFFFFFF);
+	
+	struct fsUse burst = perThousand(false, 0);
+	struct fsUse slow = perThousand(false, 30);
+	struct fsUse text = perThousand(true, 0);
+	printUse("buffered, back to back", burst);
+	printUse("buffered, every 30 s", slow);
+	printUse("text addLog()", text);
+	CHECK(burst.opens * 10 < text.opens);
+	CHECK(slow.opens < text.opens);
+	CHECK(burst.pages < text.pages);
+	return hostDone();
+}
@@ -0,0 +1,319 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Minimal Arduino core for running the gateway sketch on a Linux host.
+// Time does not run by itself: micros() and millis() return hostUs, which
+// the tests advance with hostRun() or delay(). micros() wraps at 32 bits
+// just like on the ESP8266.
+// ----------------------------------------------------------------------------
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+class __FlashStringHelper;
+#define F(x) (reinterpret_cast<const __FlashStringHelper*>(x))
+#define PSTR(x) (x)
+#define PROGMEM
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+#define HEX 16
+#define DEC 10
+#define OCT 8
+#define BIN 2
+#define OUTPUT 1
+#define INPUT 0
+#define INPUT_PULLUP 2
+#define HIGH 1
+#define LOW 0
+#define RISING 1
+#define CHANGE 2
+#define FALLING 3
+#define MSBFIRST 1
+#define SPI_MODE0 0
+#define D0 16
+#define D1 5
+#define D2 4
+#define D3 0
+#define D4 2
+#define D5 14
+#define D6 12
+#define D7 13
+#define D8 15
+#define A0 17
+
+template <class A, class B> inline auto min(A a, B b) -> decltype(a < b ? a : b) { return a < b ? a : b; }
+template <class A, class B> inline auto max(A a, B b) -> decltype(a > b ? a : b) { return a > b ? a : b; }
+#define _min(a,b) ((a)<(b)?(a):(b))
+#define _max(a,b) ((a)>(b)?(a):(b))
+#define constrain(a,l,h) ((a)<(l)?(l):((a)>(h)?(h):(a)))
+
+// Host time and pins, see host.cpp
+extern uint64_t hostUs;							// Microseconds since "power on"
+extern void (*hostYield)();						// Called by yield() and delay()
+extern uint8_t hostPin[64];						// Level of the output pins
+extern void (*hostTick)();						// Called when time advanced, see radio.h
+extern void (*hostPinWrite)(uint8_t pin, uint8_t val);	// Called by digitalWrite()
+void hostRun(uint64_t us);						// Advance time by us and call hostYield
+void hostIrq(uint8_t pin);						// Call the interrupt handler of pin
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+int digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(uint8_t irq, void (*isr)(), int mode);
+void detachInterrupt(uint8_t irq);
+void noInterrupts();
+void interrupts();
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+char *itoa(int v, char *s, int base);
+char *ltoa(long v, char *s, int base);
+char *utoa(unsigned v, char *s, int base);
+char *ultoa(unsigned long v, char *s, int base);
+char *dtostrf(double v, signed char w, unsigned char p, char *s);
+
+
+// ----------------------------------------------------------------------------
+// String, on top of std::string
+// ----------------------------------------------------------------------------
+class String {
+ public:
+	std::string s;
+	String() {}
+	String(const char *c) : s(c ? c : "") {}
+	String(const std::string &c) : s(c) {}
+	String(const String &o) : s(o.s) {}
+	String(const __FlashStringHelper *c) : s((const char *) c) {}
+	explicit String(char c) : s(1, c) {}
+	explicit String(unsigned char v, unsigned char base=10) { num(v, base); }
+	explicit String(int v, unsigned char base=10) { num(v, base); }
+	explicit String(unsigned int v, unsigned char base=10) { num(v, base); }
+	explicit String(long v, unsigned char base=10) { num(v, base); }
+	explicit String(unsigned long v, unsigned char base=10) { num(v, base); }
+	explicit String(long long v, unsigned char base=10) { num(v, base); }
+	explicit String(unsigned long long v, unsigned char base=10) { num(v, base); }
+	explicit String(float v, unsigned char d=2) { dbl(v, d); }
+	explicit String(double v, unsigned char d=2) { dbl(v, d); }
+
+	String &operator=(const String &o) { s = o.s; return *this; }
+	String &operator=(const char *c) { s = (c ? c : ""); return *this; }
+	String &operator+=(const String &o) { s += o.s; return *this; }
+	String &operator+=(const char *c) { if (c) s += c; return *this; }
+	String &operator+=(const __FlashStringHelper *c) { s += (const char *) c; return *this; }
+	String &operator+=(char c) { s += c; return *this; }
+	String &operator+=(unsigned char v) { return *this += String(v); }
+	String &operator+=(int v) { return *this += String(v); }
+	String &operator+=(unsigned int v) { return *this += String(v); }
+	String &operator+=(long v) { return *this += String(v); }
+	String &operator+=(unsigned long v) { return *this += String(v); }
+	String &operator+=(long long v) { return *this += String(v); }
+	String &operator+=(unsigned long long v) { return *this += String(v); }
+	String &operator+=(float v) { return *this += String(v); }
+	String &operator+=(double v) { return *this += String(v); }
+	bool concat(const String &o) { s += o.s; return true; }
+	bool concat(const char *c) { s += c; return true; }
+	bool concat(char c) { s += c; return true; }
+	bool concat(int v) { *this += v; return true; }
+
+	bool operator==(const String &o) const { return s == o.s; }
+	bool operator==(const char *c) const { return s == c; }
+	bool operator!=(const String &o) const { return s != o.s; }
+	bool operator!=(const char *c) const { return s != c; }
+	bool operator<(const String &o) const { return s < o.s; }
+	char operator[](unsigned i) const { return i < s.size() ? s[i] : 0; }
+	char &operator[](unsigned i) { return s[i]; }
+
+	unsigned length() const { return s.size(); }
+	const char *c_str() const { return s.c_str(); }
+	bool reserve(unsigned n) { s.reserve(n); return true; }
+	char charAt(unsigned i) const { return (*this)[i]; }
+	void setCharAt(unsigned i, char c) { if (i < s.size()) s[i] = c; }
+	int toInt() const { return atol(s.c_str()); }
+	float toFloat() const { return atof(s.c_str()); }
+	String substring(unsigned b) const { return b < s.size() ? String(s.substr(b)) : String(); }
+	String substring(unsigned b, unsigned e) const {
+		if (e > s.size()) e = s.size();
+		return b < e ? String(s.substr(b, e-b)) : String();
+	}
+	int indexOf(char c, unsigned from=0) const { size_t i = s.find(c, from); return i == std::string::npos ? -1 : (int) i; }
+	int indexOf(const String &o, unsigned from=0) const { size_t i = s.find(o.s, from); return i == std::string::npos ? -1 : (int) i; }
+	int lastIndexOf(char c) const { size_t i = s.rfind(c); return i == std::string::npos ? -1 : (int) i; }
+	bool startsWith(const String &o) const { return s.compare(0, o.s.size(), o.s) == 0; }
+	bool endsWith(const String &o) const { return s.size() >= o.s.size() && s.compare(s.size()-o.s.size(), o.s.size(), o.s) == 0; }
+	bool equals(const String &o) const { return s == o.s; }
+	bool equalsIgnoreCase(const String &o) const { return strcasecmp(s.c_str(), o.s.c_str()) == 0; }
+	void toCharArray(char *buf, unsigned n, unsigned idx=0) const { getBytes((unsigned char *) buf, n, idx); }
+	void getBytes(unsigned char *buf, unsigned n, unsigned idx=0) const {
+		if (n == 0) return;
+		unsigned k = (idx < s.size() ? s.size() - idx : 0);
+		if (k > n-1) k = n-1;
+		memcpy(buf, s.data() + idx, k);
+		buf[k] = 0;
+	}
+	void trim() {
+		size_t b = s.find_first_not_of(" \t\r\n");
+		size_t e = s.find_last_not_of(" \t\r\n");
+		s = (b == std::string::npos ? "" : s.substr(b, e-b+1));
+	}
+	void toUpperCase() { for (auto &c : s) c = toupper(c); }
+	void toLowerCase() { for (auto &c : s) c = tolower(c); }
+	void replace(const String &a, const String &b) {
+		if (a.s.empty()) return;
+		for (size_t i = 0; (i = s.find(a.s, i)) != std::string::npos; i += b.s.size()) s.replace(i, a.s.size(), b.s);
+	}
+	void remove(unsigned i, unsigned n=(unsigned)-1) { if (i < s.size()) s.erase(i, n); }
+
+ private:
+	void num(unsigned long long v, unsigned char base) {
+		char b[70]; int i = 69; b[i] = 0;
+		do { b[--i] = "0123456789ABCDEF"[v % base]; v /= base; } while (v);
+		s = &b[i];
+		if (base == 16) for (auto &c : s) c = tolower(c);
+	}
+	void num(long long v, unsigned char base) {
+		if ((v < 0) && (base == 10)) { num((unsigned long long) -v, base); s = "-" + s; }
+		else num((unsigned long long) v, base);
+	}
+	void num(unsigned long v, unsigned char base) { num((unsigned long long) v, base); }
+	void num(long v, unsigned char base) { num((long long) v, base); }
+	void num(unsigned int v, unsigned char base) { num((unsigned long long) v, base); }
+	void num(int v, unsigned char base) { num((long long) v, base); }
+	void num(unsigned char v, unsigned char base) { num((unsigned long long) v, base); }
+	void dbl(double v, unsigned char d) { char b[64]; snprintf(b, sizeof(b), "%.*f", d, v); s = b; }
+};
+
+inline String operator+(const String &a, const String &b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, const char *b) { String r(a); r += b; return r; }
+inline String operator+(const char *a, const String &b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, const __FlashStringHelper *b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, char b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, unsigned char b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, int b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, unsigned int b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, long b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, unsigned long b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, float b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, double b) { String r(a); r += b; return r; }
+
+
+// ----------------------------------------------------------------------------
+// Print and Stream
+// ----------------------------------------------------------------------------
+class Print {
+ public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buf, size_t n) { size_t k = 0; while (n--) k += write(*buf++); return k; }
+	size_t write(const char *c) { return c ? write((const uint8_t *) c, strlen(c)) : 0; }
+	size_t write(const char *c, size_t n) { return write((const uint8_t *) c, n); }
+
+	size_t print(const __FlashStringHelper *c) { return write((const char *) c); }
+	size_t print(const String &c) { return write(c.c_str()); }
+	size_t print(const char c[]) { return write(c); }
+	size_t print(char c) { return write((uint8_t) c); }
+	size_t print(unsigned char v, int b=DEC) { return print(String(v, b)); }
+	size_t print(int v, int b=DEC) { return print(String(v, b)); }
+	size_t print(unsigned int v, int b=DEC) { return print(String(v, b)); }
+	size_t print(long v, int b=DEC) { return print(String(v, b)); }
+	size_t print(unsigned long v, int b=DEC) { return print(String(v, b)); }
+	size_t print(long long v, int b=DEC) { return print(String(v, b)); }
+	size_t print(unsigned long long v, int b=DEC) { return print(String(v, b)); }
+	size_t print(double v, int d=2) { return print(String(v, d)); }
+	template <typename T> size_t println(const T &v) { size_t k = print(v); return k + println(); }
+	template <typename T> size_t println(const T &v, int b) { size_t k = print(v, b); return k + println(); }
+	size_t println() { return write("\r\n"); }
+	size_t printf(const char *fmt, ...) {
+		char b[256]; va_list a; va_start(a, fmt); vsnprintf(b, sizeof(b), fmt, a); va_end(a); return write(b);
+	}
+};
+
+class Stream : public Print {
+ public:
+	unsigned long _timeout = 1000;
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() { return -1; }
+	virtual void flush() {}
+	void setTimeout(unsigned long t) { _timeout = t; }
+	size_t readBytes(char *buf, size_t n) { return readBytes((uint8_t *) buf, n); }
+	size_t readBytes(uint8_t *buf, size_t n) {
+		size_t k = 0; int c;
+		while ((k < n) && ((c = read()) >= 0)) buf[k++] = c;
+		return k;
+	}
+	String readStringUntil(char t) { String r; int c; while (((c = read()) >= 0) && (c != t)) r += (char) c; return r; }
+	String readString() { String r; int c; while ((c = read()) >= 0) r += (char) c; return r; }
+};
+
+// Serial output goes to stdout only when hostVerbose is set
+extern bool hostVerbose;
+
+class HardwareSerial : public Stream {
+ public:
+	HardwareSerial() {}
+	HardwareSerial(int) {}
+	void begin(unsigned long) {}
+	void begin(unsigned long, int, int, int) {}
+	size_t write(uint8_t c) override { if (hostVerbose) putchar(c); return 1; }
+	using Print::write;
+	int available() override { return 0; }
+	int read() override { return -1; }
+	void flush() override { if (hostVerbose) fflush(stdout); }
+	operator bool() { return true; }
+};
+extern HardwareSerial Serial;
+#define SERIAL_8N1 0
+
+
+// ----------------------------------------------------------------------------
+// IPAddress
+// ----------------------------------------------------------------------------
+class IPAddress {
+ public:
+	uint8_t a[4];
+	IPAddress() { memset(a, 0, 4); }
+	IPAddress(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) { a[0]=b0; a[1]=b1; a[2]=b2; a[3]=b3; }
+	IPAddress(uint32_t v) { memcpy(a, &v, 4); }
+	uint8_t operator[](int i) const { return a[i]; }
+	uint8_t &operator[](int i) { return a[i]; }
+	operator uint32_t() const { uint32_t v; memcpy(&v, a, 4); return v; }
+	bool operator==(const IPAddress &o) const { return memcmp(a, o.a, 4) == 0; }
+	bool operator!=(const IPAddress &o) const { return memcmp(a, o.a, 4) != 0; }
+	bool fromString(const char *c) {
+		unsigned x[4];
+		if (sscanf(c, "%u.%u.%u.%u", &x[0], &x[1], &x[2], &x[3]) != 4) return false;
+		for (int i=0; i<4; i++) a[i] = x[i];
+		return true;
+	}
+	String toString() const { char b[16]; snprintf(b, sizeof(b), "%u.%u.%u.%u", a[0], a[1], a[2], a[3]); return String(b); }
+};
@@ -0,0 +1,135 @@
+// Host stand-in for the part of the ArduinoJson 6 API that the gateway uses
+// to decode a PULL_RESP: deserializeJson() into a document and reading
+// values of nested objects.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+#include <map>
+#include <memory>
+#include <vector>
+
+struct JsonNode {
+	enum { NUL, NUM, STR, BOOL, OBJ, ARR } type = NUL;
+	double num = 0;
+	std::string str;
+	std::map<std::string, std::shared_ptr<JsonNode>> obj;
+	std::vector<std::shared_ptr<JsonNode>> arr;
+};
+
+class JsonVariant {
+ public:
+	std::shared_ptr<JsonNode> n;
+	JsonVariant() {}
+	JsonVariant(std::shared_ptr<JsonNode> p) : n(p) {}
+	JsonVariant operator[](const char *k) const {
+		if (!n || (n->type != JsonNode::OBJ)) return JsonVariant();
+		auto i = n->obj.find(k);
+		return i == n->obj.end() ? JsonVariant() : JsonVariant(i->second);
+	}
+	JsonVariant operator[](int i) const {
+		if (!n || (n->type != JsonNode::ARR) || (i < 0) || (i >= (int) n->arr.size())) return JsonVariant();
+		return JsonVariant(n->arr[i]);
+	}
+	bool isNull() const { return !n || (n->type == JsonNode::NUL); }
+	bool containsKey(const char *k) const { return !(*this)[k].isNull(); }
+	double number() const {
+		if (!n) return 0;
+		if (n->type == JsonNode::BOOL) return n->num;
+		return n->type == JsonNode::NUM ? n->num : 0;
+	}
+	operator const char *() const { return (n && (n->type == JsonNode::STR)) ? n->str.c_str() : nullptr; }
+	operator bool() const { return number() != 0; }
+	operator float() const { return number(); }
+	operator double() const { return number(); }
+	operator uint8_t() const { return (uint8_t) number(); }
+	operator int() const { return (int) number(); }
+	operator unsigned int() const { return (unsigned int) number(); }
+	operator long() const { return (long) number(); }
+	operator unsigned long() const { return (unsigned long) number(); }
+	template <typename T> T as() const { return (T) *this; }
+};
+typedef JsonVariant JsonObject;
+
+struct DeserializationError {
+	int code = 0;
+	explicit operator bool() const { return code != 0; }
+	const char *c_str() const { return code ? "InvalidInput" : "Ok"; }
+};
+
+class JsonDocument {
+ public:
+	std::shared_ptr<JsonNode> root;
+	template <typename T> T as() const { return T(root); }
+	JsonVariant operator[](const char *k) const { return JsonVariant(root)[k]; }
+	void clear() { root.reset(); }
+};
+
+template <size_t N> class StaticJsonDocument : public JsonDocument {};
+
+namespace hostjson {
+inline void ws(const char *&p) { while (*p && isspace((uint8_t) *p)) p++; }
+inline std::shared_ptr<JsonNode> parse(const char *&p, int depth) {
+	auto n = std::make_shared<JsonNode>();
+	ws(p);
+	if (depth > 10) return nullptr;
+	if (*p == '{') {
+		n->type = JsonNode::OBJ; p++; ws(p);
+		if (*p == '}') { p++; return n; }
+		while (*p == '"') {
+			auto k = parse(p, depth+1);
+			ws(p);
+			if (!k || (*p != ':')) return nullptr;
+			p++;
+			auto v = parse(p, depth+1);
+			if (!v) return nullptr;
+			n->obj[k->str] = v;
+			ws(p);
+			if (*p == ',') { p++; ws(p); continue; }
+			if (*p == '}') { p++; return n; }
+			return nullptr;
+		}
+		return nullptr;
+	}
+	if (*p == '[') {
+		n->type = JsonNode::ARR; p++; ws(p);
+		if (*p == ']') { p++; return n; }
+		for (;;) {
+			auto v = parse(p, depth+1);
+			if (!v) return nullptr;
+			n->arr.push_back(v);
+			ws(p);
+			if (*p == ',') { p++; continue; }
+			if (*p == ']') { p++; return n; }
+			return nullptr;
+		}
+	}
+	if (*p == '"') {
+		n->type = JsonNode::STR; p++;
+		while (*p && (*p != '"')) {
+			if ((*p == '\\') && p[1]) p++;
+			n->str += *p++;
+		}
+		if (*p != '"') return nullptr;
+		p++;
+		return n;
+	}
+	if (!strncmp(p, "true", 4)) { n->type = JsonNode::BOOL; n->num = 1; p += 4; return n; }
+	if (!strncmp(p, "false", 5)) { n->type = JsonNode::BOOL; p += 5; return n; }
+	if (!strncmp(p, "null", 4)) { p += 4; return n; }
+	char *e;
+	n->num = strtod(p, &e);
+	if (e == p) return nullptr;
+	n->type = JsonNode::NUM;
+	p = e;
+	return n;
+}
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *in) {
+	DeserializationError err;
+	const char *p = in;
+	doc.root = hostjson::parse(p, 0);
+	if (!doc.root) err.code = 1;
+	return err;
+}
+inline DeserializationError deserializeJson(JsonDocument &doc, char *in) { return deserializeJson(doc, (const char *) in); }
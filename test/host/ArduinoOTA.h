@@ -0,0 +1,20 @@
+#pragma once
+#include "Arduino.h"
+#include <functional>
+typedef enum { OTA_AUTH_ERROR, OTA_BEGIN_ERROR, OTA_CONNECT_ERROR, OTA_RECEIVE_ERROR, OTA_END_ERROR } ota_error_t;
+#define U_FLASH 0
+#define U_SPIFFS 100
+class ArduinoOTAClass {
+ public:
+	void setHostname(const char *) {}
+	void begin() {}
+	void handle() {}
+	int getCommand() { return U_FLASH; }
+	void setPort(uint16_t) {}
+	void setPassword(const char *) {}
+	void onStart(std::function<void()>) {}
+	void onEnd(std::function<void()>) {}
+	void onError(std::function<void(ota_error_t)>) {}
+	void onProgress(std::function<void(unsigned int, unsigned int)>) {}
+};
+extern ArduinoOTAClass ArduinoOTA;
@@ -0,0 +1,46 @@
+// Host stand-in for the web server. A test calls a page with hostGet(),
+// which runs the handler of the uri and returns everything it sent.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "ESP8266WiFi.h"
+#include <functional>
+#include <map>
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST };
+
+class ESP8266WebServer {
+ public:
+	typedef std::function<void(void)> THandlerFunction;
+	std::map<std::string, THandlerFunction> handlers;
+	THandlerFunction notFound;
+	std::map<std::string, std::string> args_;
+	std::string reply;
+	int code = 0;
+	ESP8266WebServer(int) {}
+	void begin() {}
+	void handleClient() {}
+	void on(const String &uri, THandlerFunction f) { handlers[uri.s] = f; }
+	void on(const String &uri, HTTPMethod, THandlerFunction f) { handlers[uri.s] = f; }
+	void onNotFound(THandlerFunction f) { notFound = f; }
+	void send(int c, const char *, const String &body) { code = c; reply += body.s; }
+	void send(int c, const char *t) { send(c, t, String()); }
+	void send(int c, const String &t, const String &body) { send(c, t.c_str(), body); }
+	void sendHeader(const String &, const String &, bool first=false) {}
+	void sendContent(const String &body) { reply += body.s; }
+	void sendContent(const char *body) { reply += body; }
+	void setContentLength(size_t) {}
+	String arg(const String &name) { auto i = args_.find(name.s); return i == args_.end() ? String() : String(i->second); }
+	bool hasArg(const String &name) { return args_.count(name.s) > 0; }
+	int args() { return args_.size(); }
+	WiFiClient client() { return WiFiClient(); }
+	
+	// Run the handler of uri with the arguments in a, return the reply
+	std::string hostGet(const std::string &uri, const std::map<std::string, std::string> &a = {}) {
+		args_ = a; reply.clear(); code = 0;
+		auto i = handlers.find(uri);
+		if (i != handlers.end()) i->second();
+		else if (notFound) notFound();
+		return reply;
+	}
+};
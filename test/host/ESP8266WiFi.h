@@ -0,0 +1,83 @@
+// Host stand-in for the ESP8266 WiFi station. The link is up when hostWifiUp
+// is set and WiFi.begin() was called at least HOST_JOIN_US before. The scan
+// finds the networks in hostAps.
+// WiFiClient is a real (non-blocking) TCP socket, so the gateway can talk
+// to a mock server on the host.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+#include "WiFiUdp.h"
+#include <vector>
+
+typedef enum { WL_NO_SHIELD=255, WL_IDLE_STATUS=0, WL_NO_SSID_AVAIL, WL_SCAN_COMPLETED, WL_CONNECTED, WL_CONNECT_FAILED, WL_CONNECTION_LOST, WL_DISCONNECTED } wl_status_t;
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+enum WiFiMode_t { WIFI_OFF=0, WIFI_STA=1, WIFI_AP=2, WIFI_AP_STA=3 };
+
+#define HOST_JOIN_US 2000000
+
+struct hostAp {
+	String ssid;
+	int32_t rssi;
+};
+extern std::vector<hostAp> hostAps;
+extern uint32_t hostJoins;						// Number of WiFi.begin() calls
+int hostResolve(const char *name, IPAddress &ip);	// See hostDns
+
+class WiFiClient : public Stream {
+ public:
+	int fd = -1;
+	int peeked = -1;
+	WiFiClient() {}
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t *buf, size_t n) override;
+	using Print::write;
+	int available() override;
+	int read() override;
+	int read(uint8_t *buf, size_t n);
+	int peek() override;
+	void flush() override {}
+	int connect(IPAddress ip, uint16_t port);
+	int connect(const char *host, uint16_t port);
+	uint8_t connected();
+	void stop();
+	operator bool() { return connected(); }
+	void setNoDelay(bool) {}
+	IPAddress remoteIP() { return IPAddress(); }
+};
+
+class ESP8266WiFiClass {
+ public:
+	uint64_t joinUs = 0;
+	bool joined = false;
+	int scanning = 0;
+	String ssid, pass;
+	bool mode(WiFiMode_t) { return true; }
+	wl_status_t status();
+	wl_status_t begin(const char *s, const char *p=NULL, int32_t ch=0, const uint8_t *bssid=NULL, bool connect=true);
+	wl_status_t begin() { return begin(ssid.c_str(), pass.c_str()); }
+	bool disconnect(bool wifioff=false) { joined = false; joinUs = 0; return true; }
+	bool isConnected() { return status() == WL_CONNECTED; }
+	IPAddress localIP() { return isConnected() ? IPAddress(192,168,1,10) : IPAddress(); }
+	IPAddress gatewayIP() { return IPAddress(192,168,1,1); }
+	IPAddress subnetMask() { return IPAddress(255,255,255,0); }
+	String SSID() { return isConnected() ? ssid : String(); }
+	String SSID(uint8_t i) { return i < hostAps.size() ? hostAps[i].ssid : String(); }
+	String psk() { return pass; }
+	int32_t RSSI() { for (auto &a : hostAps) if (a.ssid == ssid) return a.rssi; return 0; }
+	int32_t RSSI(uint8_t i) { return i < hostAps.size() ? hostAps[i].rssi : 0; }
+	uint8_t *macAddress(uint8_t *m) { for (int i=0; i<6; i++) m[i] = 0x10 + i; return m; }
+	String macAddress() { return String("10:11:12:13:14:15"); }
+	int hostByName(const char *name, IPAddress &ip) { return hostResolve(name, ip); }
+	int hostByName(const char *name, IPAddress &ip, uint32_t) { return hostResolve(name, ip); }
+	const char *getHostname() { return "esp-host"; }
+	bool setHostname(const char *) { return true; }
+	bool hostname(const char *) { return true; }
+	void persistent(bool) {}
+	bool setAutoConnect(bool) { return true; }
+	bool setAutoReconnect(bool) { return true; }
+	int8_t scanNetworks(bool async=false, bool hidden=false);
+	int8_t scanComplete();
+	void scanDelete() { scanning = 0; }
+};
+extern ESP8266WiFiClass WiFi;
@@ -0,0 +1,14 @@
+#pragma once
+#include "ESP8266WiFi.h"
+#include "Updater.h"
+enum HTTPUpdateResult { HTTP_UPDATE_FAILED, HTTP_UPDATE_NO_UPDATES, HTTP_UPDATE_OK };
+typedef HTTPUpdateResult t_httpUpdate_return;
+class ESP8266HTTPUpdate {
+ public:
+	void rebootOnUpdate(bool) {}
+	t_httpUpdate_return update(const String &, uint16_t, const String &, const String &v="") { return HTTP_UPDATE_NO_UPDATES; }
+	t_httpUpdate_return update(const String &, const String &v="") { return HTTP_UPDATE_NO_UPDATES; }
+	int getLastError() { return 0; }
+	String getLastErrorString() { return String(); }
+};
+extern ESP8266HTTPUpdate ESPhttpUpdate;
@@ -0,0 +1,4 @@
+#pragma once
+#include "Arduino.h"
+class MDNSResponder { public: bool begin(const char *) { return true; } void addService(const char *, const char *, uint16_t) {} void update() {} };
+extern MDNSResponder MDNS;
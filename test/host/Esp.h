@@ -0,0 +1,16 @@
+#pragma once
+#include "Arduino.h"
+
+extern uint32_t hostRestarts;
+
+class EspClass {
+ public:
+	void restart() { hostRestarts++; }
+	void reset() { hostRestarts++; }
+	uint32_t getFreeHeap() { return 32768; }
+	uint32_t getChipId() { return 0x00C0FFEE; }
+	uint8_t getCpuFreqMHz() { return 80; }
+	uint32_t getFlashChipSize() { return 4194304; }
+	uint32_t getCycleCount() { return (uint32_t) (hostUs * 80); }
+};
+extern EspClass ESP;
@@ -0,0 +1,66 @@
+// Host stand-in for the ESP8266 SPIFFS file system. Files are stored in
+// the directory hostFsDir (see host.cpp), so a test can look at them or
+// damage them. hostFsWriteLimit makes writes fail after that many bytes,
+// to simulate a power failure in the middle of a write.
+// hostFsWrites and hostFsBytes count the write() calls and the bytes they
+// write. hostFsPages counts the flash pages of 256 bytes SPIFFS takes for
+// them: a page for every data page the file grows into or that is written
+// again, and a page for the index header, which SPIFFS writes again on
+// open(fn, "w") and on close() after a write. Bytes appended to a partly
+// filled last page are programmed in place and take no new page. A page is
+// programmed only once until its block is erased, so hostFsPages / 32 is
+// the number of 8 KB blocks erased for these writes.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+
+enum SeekMode { SeekSet=0, SeekCur=1, SeekEnd=2 };
+
+extern std::string hostFsDir;
+extern long hostFsWriteLimit;					// Bytes that can still be written, -1 is no limit
+extern uint32_t hostFsOpens;
+extern uint32_t hostFsWrites;
+extern uint32_t hostFsBytes;
+extern uint32_t hostFsPages;
+
+class File : public Stream {
+ public:
+	FILE *fp = nullptr;
+	std::string fn;
+	bool append = false;						// Opened with "a" or "a+"
+	bool written = false;						// Index header to write on close()
+	File() {}
+	File(FILE *f, const char *n, bool a) : fp(f), fn(n), append(a) {}
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t *buf, size_t n) override;
+	using Print::write;
+	int available() override;
+	int read() override { uint8_t c; return read(&c, 1) == 1 ? c : -1; }
+	int peek() override;
+	void flush() override { if (fp) fflush(fp); }
+	size_t read(uint8_t *buf, size_t n) { return fp ? fread(buf, 1, n, fp) : 0; }
+	bool seek(uint32_t pos, SeekMode mode=SeekSet);
+	size_t position() const { return fp ? ftell(fp) : 0; }
+	size_t size() const;
+	void close();
+	operator bool() const { return fp != nullptr; }
+	const char *name() const { return fn.c_str(); }
+};
+
+struct FSInfo { size_t totalBytes, usedBytes, blockSize, pageSize, maxOpenFiles, maxPathLength; };
+
+class FS {
+ public:
+	bool begin();
+	void end() {}
+	bool format();
+	bool info(FSInfo &i);
+	File open(const char *fn, const char *mode);
+	File open(const String &fn, const char *mode) { return open(fn.c_str(), mode); }
+	bool exists(const char *fn);
+	bool exists(const String &fn) { return exists(fn.c_str()); }
+	bool remove(const char *fn);
+	bool remove(const String &fn) { return remove(fn.c_str()); }
+	bool rename(const char *a, const char *b);
+};
+extern FS SPIFFS;
@@ -0,0 +1,19 @@
+// The SPI bus is connected to the simulated radios, if any: transfer()
+// calls hostSpi, which looks at hostPin[] to see which radio is selected.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+
+extern uint8_t (*hostSpi)(uint8_t out);
+
+class SPISettings { public: SPISettings() {} SPISettings(uint32_t, uint8_t, uint8_t) {} };
+class SPIClass {
+ public:
+	void begin() {}
+	void beginTransaction(SPISettings) {}
+	void endTransaction() {}
+	uint8_t transfer(uint8_t c);
+	void usingInterrupt(int) {}
+	void setFrequency(uint32_t) {}
+};
+extern SPIClass SPI;
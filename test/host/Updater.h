@@ -0,0 +1,31 @@
+// Host stand-in for the flash updater. The image is written to hostImage;
+// end() succeeds when the announced size was written.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+#include <vector>
+
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+
+class UpdaterClass {
+ public:
+	std::vector<uint8_t> image;
+	size_t expect = 0;
+	bool running = false;
+	uint32_t ends = 0;							// Successful end() calls
+	bool begin(size_t n, int command=0) { image.clear(); expect = n; running = true; return true; }
+	size_t write(uint8_t *buf, size_t n) { if (!running) return 0; image.insert(image.end(), buf, buf+n); return n; }
+	bool end(bool evenIfRemaining=false) {
+		bool ok = running && (image.size() == expect);
+		running = false;
+		if (ok) ends++;
+		return ok;
+	}
+	bool hasError() { return false; }
+	bool isRunning() { return running; }
+	size_t size() { return expect; }
+	size_t progress() { return image.size(); }
+	size_t remaining() { return expect - image.size(); }
+	uint8_t getError() { return 0; }
+};
+extern UpdaterClass Update;
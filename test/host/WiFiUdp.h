@@ -0,0 +1,54 @@
+// Host stand-in for WiFiUDP. Nothing goes on the network: sent datagrams
+// are passed to hostUdpSend (the test's backend), and the test queues 
+// datagrams for the gateway with hostUdpRecv(). While hostWifiUp is false
+// nothing is sent or received. A read gives at most hostUdpReadLimit bytes,
+// as when lwIP has only part of a datagram. endPacket() to hostUdpRefuse
+// fails, as when lwIP has no buffer or route.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+#include <vector>
+#include <deque>
+
+struct hostDgram {
+	uint16_t local;								// Local port of the gateway socket
+	IPAddress ip;								// Remote address and port
+	uint16_t port;
+	std::vector<uint8_t> data;
+};
+
+extern bool hostWifiUp;
+extern long hostUdpReadLimit;					// -1 is no limit
+extern IPAddress hostUdpRefuse;					// 0.0.0.0 is none
+extern void (*hostUdpSend)(const hostDgram &d);
+void hostUdpRecv(uint16_t local, IPAddress ip, uint16_t port, const uint8_t *buf, size_t n);
+
+class WiFiUDP : public Stream {
+ public:
+	uint16_t local = 0;
+	hostDgram tx, rx;
+	size_t rxPos = 0;
+	uint8_t begin(uint16_t port) { local = port; return 1; }
+	void stop() { local = 0; }
+	int beginPacket(IPAddress ip, uint16_t port) { tx.ip = ip; tx.port = port; tx.data.clear(); return 1; }
+	int beginPacket(const char *host, uint16_t port);
+	int endPacket();
+	size_t write(uint8_t c) override { tx.data.push_back(c); return 1; }
+	size_t write(const uint8_t *buf, size_t n) override { tx.data.insert(tx.data.end(), buf, buf+n); return n; }
+	using Print::write;
+	int parsePacket();
+	int available() override { return rx.data.size() - rxPos; }
+	int read() override { return rxPos < rx.data.size() ? rx.data[rxPos++] : -1; }
+	int read(unsigned char *buf, size_t n) {
+		size_t k = std::min(n, rx.data.size() - rxPos);
+		if ((hostUdpReadLimit >= 0) && (k > (size_t) hostUdpReadLimit)) k = hostUdpReadLimit;
+		memcpy(buf, rx.data.data() + rxPos, k);
+		rxPos += k;
+		return k;
+	}
+	int read(char *buf, size_t n) { return read((unsigned char *) buf, n); }
+	int peek() override { return rxPos < rx.data.size() ? rx.data[rxPos] : -1; }
+	void flush() override { rxPos = rx.data.size(); }
+	IPAddress remoteIP() { return rx.ip; }
+	uint16_t remotePort() { return rx.port; }
+};
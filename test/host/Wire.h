@@ -0,0 +1,18 @@
+// Host stand-in for the I2C bus of the OLED. Only counts the bytes, so 
+// that tests can see how much a display update costs.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+
+class TwoWire {
+ public:
+	uint32_t bytes = 0;							// Bytes incl. address byte
+	uint32_t transmissions = 0;
+	void begin(int sda=-1, int scl=-1) {}
+	void setClock(uint32_t) {}
+	void beginTransmission(uint8_t) { bytes++; transmissions++; }
+	size_t write(uint8_t) { bytes++; return 1; }
+	size_t write(const uint8_t *, size_t n) { bytes += n; return n; }
+	uint8_t endTransmission(bool stop=true) { return 0; }
+};
+extern TwoWire Wire;
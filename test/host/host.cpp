@@ -0,0 +1,544 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Implementation of the host stand-ins for the Arduino core and the
+// ESP8266 libraries used by the gateway.
+// ----------------------------------------------------------------------------
+#include "Arduino.h"
+#include "Esp.h"
+#include "SPI.h"
+#include "FS.h"
+#include "Wire.h"
+#include "ESP8266WiFi.h"
+#include "ESP8266mDNS.h"
+#include "ESP8266httpUpdate.h"
+#include "ArduinoOTA.h"
+#include "host.h"
+extern "C" {
+#include "lwip/dns.h"
+}
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <deque>
+
+// ----------------------------------------------------------------------------
+// Time, pins and interrupts
+// ----------------------------------------------------------------------------
+uint64_t hostUs = 0;
+void (*hostYield)() = nullptr;
+uint8_t hostPin[64];
+static void (*hostIsr[64])();
+static bool inYield = false;
+bool hostVerbose = false;
+uint32_t hostRestarts = 0;
+
+unsigned long millis() { return (uint32_t) (hostUs / 1000); }
+unsigned long micros() { return (uint32_t) hostUs; }
+
+void yield()
+{
+	if (inYield || !hostYield) return;
+	inYield = true;
+	hostYield();
+	inYield = false;
+}
+
+void (*hostTick)() = nullptr;
+void (*hostPinWrite)(uint8_t pin, uint8_t val) = nullptr;
+
+void hostRun(uint64_t us) { hostUs += us; if (hostTick) hostTick(); yield(); }
+void delay(unsigned long ms) { hostRun((uint64_t) ms * 1000); }
+void delayMicroseconds(unsigned int us) { hostUs += us; if (hostTick) hostTick(); }
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	if (pin >= 64) return;
+	hostPin[pin] = val;
+	if (hostPinWrite) hostPinWrite(pin, val);
+}
+int digitalRead(uint8_t pin) { return pin < 64 ? hostPin[pin] : 0; }
+int analogRead(uint8_t) { return 512; }
+int digitalPinToInterrupt(uint8_t pin) { return pin; }
+void attachInterrupt(uint8_t irq, void (*isr)(), int) { if (irq < 64) hostIsr[irq] = isr; }
+void detachInterrupt(uint8_t irq) { if (irq < 64) hostIsr[irq] = nullptr; }
+void noInterrupts() {}
+void interrupts() {}
+void hostIrq(uint8_t pin) { if ((pin < 64) && hostIsr[pin]) hostIsr[pin](); }
+
+long random(long m) { return m > 0 ? ::random() % m : 0; }
+long random(long a, long b) { return b > a ? a + ::random() % (b - a) : a; }
+void randomSeed(unsigned long s) { srandom(s); }
+
+static char *conv(unsigned long long v, bool neg, char *s, int base)
+{
+	char b[70]; int i = 69; b[i] = 0;
+	do { b[--i] = "0123456789abcdefghijklmnopqrstuvwxyz"[v % base]; v /= base; } while (v);
+	if (neg) b[--i] = '-';
+	strcpy(s, &b[i]);
+	return s;
+}
+char *itoa(int v, char *s, int base) { return conv(v < 0 && base == 10 ? -(long long) v : (unsigned) v, v < 0 && base == 10, s, base); }
+char *ltoa(long v, char *s, int base) { return conv(v < 0 && base == 10 ? -(long long) v : (unsigned long) v, v < 0 && base == 10, s, base); }
+char *utoa(unsigned v, char *s, int base) { return conv(v, false, s, base); }
+char *ultoa(unsigned long v, char *s, int base) { return conv(v, false, s, base); }
+char *dtostrf(double v, signed char w, unsigned char p, char *s) { sprintf(s, "%*.*f", w, p, v); return s; }
+
+HardwareSerial Serial;
+EspClass ESP;
+MDNSResponder MDNS;
+ArduinoOTAClass ArduinoOTA;
+ESP8266HTTPUpdate ESPhttpUpdate;
+UpdaterClass Update;
+TwoWire Wire;
+
+// ----------------------------------------------------------------------------
+// SPI, connected to the simulated radios
+// ----------------------------------------------------------------------------
+uint8_t (*hostSpi)(uint8_t out) = nullptr;
+SPIClass SPI;
+
+uint8_t SPIClass::transfer(uint8_t c) { return hostSpi ? hostSpi(c) : 0; }
+
+
+// ----------------------------------------------------------------------------
+// SPIFFS, one host file per SPIFFS file in hostFsDir
+// ----------------------------------------------------------------------------
+std::string hostFsDir = "build/fs";
+long hostFsWriteLimit = -1;
+uint32_t hostFsOpens = 0;
+uint32_t hostFsWrites = 0;
+uint32_t hostFsBytes = 0;
+uint32_t hostFsPages = 0;
+FS SPIFFS;
+
+static std::string hostPath(const char *fn)
+{
+	std::string p = hostFsDir + "/";
+	for (const char *c = (*fn == '/' ? fn+1 : fn); *c; c++) p += (*c == '/' ? '%' : *c);
+	return p;
+}
+
+size_t File::write(const uint8_t *buf, size_t n)
+{
+	if (!fp) return 0;
+	if ((hostFsWriteLimit >= 0) && ((long) n > hostFsWriteLimit)) n = hostFsWriteLimit;
+	size_t s = size();
+	size_t pos = append ? s : ftell(fp);
+	size_t k = fwrite(buf, 1, n, fp);
+	if (hostFsWriteLimit >= 0) hostFsWriteLimit -= k;
+	fflush(fp);
+	hostFsWrites++;
+	hostFsBytes += k;
+	if (k > 0) {
+		size_t end = pos + k;
+		if (pos < s) hostFsPages += ((end < s ? end : s) + 255) / 256 - pos / 256;	// Written again
+		if (end > s) hostFsPages += (end + 255) / 256 - (s + 255) / 256;			// New pages
+		written = true;
+	}
+	return k;
+}
+
+void File::close()
+{
+	if (!fp) return;
+	fclose(fp);
+	fp = nullptr;
+	if (written) hostFsPages++;
+	written = false;
+}
+
+int File::available() { return fp ? (int) (size() - position()) : 0; }
+
+int File::peek()
+{
+	if (!fp) return -1;
+	int c = fgetc(fp);
+	if (c >= 0) ungetc(c, fp);
+	return c;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+	if (!fp) return false;
+	if ((mode == SeekSet) && (pos > size())) return false;
+	return fseek(fp, pos, mode == SeekSet ? SEEK_SET : (mode == SeekCur ? SEEK_CUR : SEEK_END)) == 0;
+}
+
+size_t File::size() const
+{
+	struct stat st;
+	if (!fp) return 0;
+	fflush(fp);
+	return fstat(fileno(fp), &st) == 0 ? st.st_size : 0;
+}
+
+bool FS::begin() { mkdir("build", 0755); mkdir(hostFsDir.c_str(), 0755); return true; }
+
+bool FS::format()
+{
+	DIR *d = opendir(hostFsDir.c_str());
+	if (!d) return begin();
+	struct dirent *e;
+	while ((e = readdir(d)) != nullptr) {
+		if (e->d_name[0] == '.') continue;
+		unlink((hostFsDir + "/" + e->d_name).c_str());
+	}
+	closedir(d);
+	return true;
+}
+
+bool FS::info(FSInfo &i)
+{
+	memset(&i, 0, sizeof(i));
+	i.totalBytes = 3 * 1024 * 1024;
+	i.blockSize = 8192;
+	i.pageSize = 256;
+	return true;
+}
+
+File FS::open(const char *fn, const char *mode)
+{
+	const char *m = "rb";
+	if (!strcmp(mode, "w")) m = "wb";
+	else if (!strcmp(mode, "a")) m = "ab";
+	else if (!strcmp(mode, "r+")) m = "r+b";
+	else if (!strcmp(mode, "w+")) m = "w+b";
+	else if (!strcmp(mode, "a+")) m = "a+b";
+	hostFsOpens++;
+	FILE *f = fopen(hostPath(fn).c_str(), m);
+	if (!f) return File();
+	if (m[0] == 'w') hostFsPages++;				// New index header
+	return File(f, fn, m[0] == 'a');
+}
+
+bool FS::exists(const char *fn) { struct stat st; return stat(hostPath(fn).c_str(), &st) == 0; }
+bool FS::remove(const char *fn) { return unlink(hostPath(fn).c_str()) == 0; }
+bool FS::rename(const char *a, const char *b) { return ::rename(hostPath(a).c_str(), hostPath(b).c_str()) == 0; }
+
+
+// ----------------------------------------------------------------------------
+// Resolver
+// ----------------------------------------------------------------------------
+std::map<std::string, IPAddress> hostDns;
+std::set<std::string> hostDnsPending;
+
+struct hostDnsWait {
+	std::string name;
+	dns_found_callback cb;
+	void *arg;
+};
+static std::vector<hostDnsWait> dnsWaits;
+
+int hostResolve(const char *name, IPAddress &ip)
+{
+	if (ip.fromString(name)) return 1;
+	auto i = hostDns.find(name);
+	if ((i == hostDns.end()) || hostDnsPending.count(name)) return 0;
+	ip = i->second;
+	return 1;
+}
+
+err_t dns_gethostbyname(const char *name, ip_addr_t *ip, dns_found_callback cb, void *arg)
+{
+	IPAddress a;
+	if (!hostWifiUp) return ERR_ARG;
+	if (hostDnsPending.count(name)) {
+		dnsWaits.push_back({ name, cb, arg });
+		return ERR_INPROGRESS;
+	}
+	if (!hostResolve(name, a)) return ERR_ARG;
+	ip->addr = (uint32_t) a;
+	return ERR_OK;
+}
+
+void hostDnsAnswer(const char *name)
+{
+	hostDnsPending.erase(name);
+	std::vector<hostDnsWait> w;
+	w.swap(dnsWaits);
+	for (auto &d : w) {
+		if (d.name != name) { dnsWaits.push_back(d); continue; }
+		IPAddress a;
+		ip_addr_t ip;
+		if (hostResolve(name, a)) {
+			ip.addr = (uint32_t) a;
+			d.cb(name, &ip, d.arg);
+		}
+		else d.cb(name, nullptr, d.arg);
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// WiFi station
+// ----------------------------------------------------------------------------
+bool hostWifiUp = true;
+std::vector<hostAp> hostAps;
+uint32_t hostJoins = 0;
+ESP8266WiFiClass WiFi;
+
+wl_status_t ESP8266WiFiClass::status()
+{
+	if (!hostWifiUp) {
+		joined = false;
+		return joinUs ? WL_NO_SSID_AVAIL : WL_DISCONNECTED;
+	}
+	if (joined) return WL_CONNECTED;
+	if (joinUs && (hostUs >= joinUs)) {
+		bool found = hostAps.empty();
+		for (auto &a : hostAps) if (a.ssid == ssid) found = true;
+		if (found) {
+			joined = true;
+			return WL_CONNECTED;
+		}
+		return WL_NO_SSID_AVAIL;
+	}
+	return WL_DISCONNECTED;
+}
+
+wl_status_t ESP8266WiFiClass::begin(const char *s, const char *p, int32_t, const uint8_t *, bool)
+{
+	ssid = s;
+	pass = (p ? p : "");
+	joined = false;
+	joinUs = hostUs + HOST_JOIN_US;
+	hostJoins++;
+	return WL_DISCONNECTED;
+}
+
+int8_t ESP8266WiFiClass::scanNetworks(bool async, bool)
+{
+	scanning = 1;
+	return async ? WIFI_SCAN_RUNNING : scanComplete();
+}
+
+int8_t ESP8266WiFiClass::scanComplete()
+{
+	if (!scanning) return WIFI_SCAN_FAILED;
+	return hostWifiUp ? hostAps.size() : 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// UDP
+// ----------------------------------------------------------------------------
+void (*hostUdpSend)(const hostDgram &d) = nullptr;
+long hostUdpReadLimit = -1;
+IPAddress hostUdpRefuse;
+static std::deque<hostDgram> udpQueue;
+
+void hostUdpRecv(uint16_t local, IPAddress ip, uint16_t port, const uint8_t *buf, size_t n)
+{
+	hostDgram d;
+	d.local = local;
+	d.ip = ip;
+	d.port = port;
+	d.data.assign(buf, buf+n);
+	udpQueue.push_back(d);
+}
+
+int WiFiUDP::beginPacket(const char *host, uint16_t port)
+{
+	IPAddress ip;
+	if (!hostResolve(host, ip)) return 0;
+	return beginPacket(ip, port);
+}
+
+int WiFiUDP::endPacket()
+{
+	if (!hostWifiUp || !WiFi.isConnected()) return 0;
+	if ((hostUdpRefuse != IPAddress(0, 0, 0, 0)) && (tx.ip == hostUdpRefuse)) return 0;
+	tx.local = local;
+	if (hostUdpSend) hostUdpSend(tx);
+	tx.data.clear();
+	return 1;
+}
+
+int WiFiUDP::parsePacket()
+{
+	rx.data.clear();
+	rxPos = 0;
+	if (!hostWifiUp) return 0;
+	for (auto i = udpQueue.begin(); i != udpQueue.end(); i++) {
+		if (i->local != local) continue;
+		rx = *i;
+		udpQueue.erase(i);
+		return rx.data.size();
+	}
+	return 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// TCP client, a non-blocking socket. connect() waits at most the timeout
+// of setTimeout(), 1 second by default, like the ESP8266 core.
+// ----------------------------------------------------------------------------
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+	struct sockaddr_in sa;
+	stop();
+	if (!hostWifiUp) return 0;
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return 0;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = (uint32_t) ip;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (::connect(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		struct pollfd p = { fd, POLLOUT, 0 };
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if ((errno != EINPROGRESS) || (poll(&p, 1, (int) _timeout) != 1) ||
+			(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) || err)
+		{
+			stop();
+			return 0;
+		}
+	}
+	peeked = -1;
+	return 1;
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+	IPAddress ip;
+	if (!hostResolve(host, ip)) return 0;
+	return connect(ip, port);
+}
+
+uint8_t WiFiClient::connected()
+{
+	if (fd < 0) return 0;
+	if (peeked >= 0) return 1;
+	uint8_t c;
+	int n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) return 0;
+	return 1;
+}
+
+void WiFiClient::stop()
+{
+	if (fd >= 0) close(fd);
+	fd = -1;
+	peeked = -1;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t n)
+{
+	size_t k = 0;
+	if (fd < 0 || !hostWifiUp) return 0;
+	while (k < n) {
+		int r = send(fd, buf+k, n-k, MSG_NOSIGNAL);
+		if (r > 0) { k += r; continue; }
+		if ((r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+			struct pollfd p = { fd, POLLOUT, 0 };
+			if (poll(&p, 1, 1000) == 1) continue;
+		}
+		break;
+	}
+	return k;
+}
+
+int WiFiClient::available()
+{
+	int n = 0;
+	if (fd < 0) return 0;
+	uint8_t b[2048];
+	n = recv(fd, b, sizeof(b), MSG_PEEK | MSG_DONTWAIT);
+	return (n > 0 ? n : 0) + (peeked >= 0 ? 1 : 0);
+}
+
+int WiFiClient::read(uint8_t *buf, size_t n)
+{
+	size_t k = 0;
+	if ((fd < 0) || (n == 0)) return -1;
+	if (peeked >= 0) {
+		buf[k++] = peeked;
+		peeked = -1;
+	}
+	int r = recv(fd, buf+k, n-k, MSG_DONTWAIT);
+	if (r > 0) k += r;
+	return k > 0 ? (int) k : -1;
+}
+
+int WiFiClient::read()
+{
+	uint8_t c;
+	return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::peek()
+{
+	if (peeked < 0) peeked = read();
+	return peeked;
+}
+
+
+// ----------------------------------------------------------------------------
+// Test helpers
+// ----------------------------------------------------------------------------
+int hostChecks = 0;
+int hostFails = 0;
+static const char *testName = "test";
+
+void hostCheck(bool ok, const char *what, const char *file, int line)
+{
+	hostChecks++;
+	if (ok) return;
+	hostFails++;
+	printf("%s:%d: FAILED: %s\n", file, line, what);
+}
+
+void hostInit(const char *name)
+{
+	testName = name;
+	hostFsDir = std::string("build/fs-") + name;
+	SPIFFS.begin();
+	SPIFFS.format();
+	hostFsWriteLimit = -1;
+	hostUdpReadLimit = -1;
+	hostUdpRefuse = IPAddress(0, 0, 0, 0);
+	hostWifiUp = true;
+	hostVerbose = (getenv("HOST_VERBOSE") != nullptr);
+}
+
+int hostDone()
+{
+	printf("%s: %d checks, %d failed\n", testName, hostChecks, hostFails);
+	return hostFails ? 1 : 0;
+}
+
+double hostClock()
+{
+	struct timeval tv;
+	gettimeofday(&tv, nullptr);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void hostLoop(uint32_t ms, uint32_t step)
+{
+	for (uint32_t i=0; i<ms; i+=step) {
+		loop();
+		hostRun(step * 1000ULL);
+	}
+}
@@ -0,0 +1,57 @@
+// Host test helpers: checks, the resolver table and the test set-up.
+// Include after the sketch.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+#include "FS.h"
+#include "ESP8266WiFi.h"
+#include <map>
+#include <set>
+
+extern int hostChecks;
+extern int hostFails;
+void hostCheck(bool ok, const char *what, const char *file, int line);
+#define CHECK(c) hostCheck((c), #c, __FILE__, __LINE__)
+
+// Start a test: empty file system in build/fs-<name>, time 0, WiFi up.
+void hostInit(const char *name);
+// Print the result, returns the exit code for main()
+int hostDone();
+
+// Names known to the resolver. Names in hostDnsPending are answered by 
+// hostDnsAnswer() only.
+extern std::map<std::string, IPAddress> hostDns;
+extern std::set<std::string> hostDnsPending;
+void hostDnsAnswer(const char *name);
+
+// Wall clock time in seconds, for benchmarks
+double hostClock();
+
+// The sketch, which every test includes
+void setup();
+void loop();
+
+// Run loop() for ms milliseconds, in steps of step ms
+void hostLoop(uint32_t ms, uint32_t step = 1);
+
+#ifdef _RADIOS
+#include "radio.h"
+#include "server.h"
+
+// Boot the sketch: the servers with names, a simulated radio on the pins
+// of every radio, setup() and loop() in steps of step ms until bootStage is
+// B_DONE, for at most 20000 steps. Needs the sketch, so it is in the header.
+inline void hostBoot(std::initializer_list<const char *> names, uint32_t step = 1)
+{
+	hostServers(names);
+	hostRadioAdd(pins.ss, pins.dio0, pins.dio1, pins.dio2);
+#if _RADIOS > 1
+	for (int r=1; r<_RADIOS; r++) {
+		hostRadioAdd(radioPins[r-1][0], radioPins[r-1][1], radioPins[r-1][2], radioPins[r-1][3]);
+	}
+#endif
+	setup();
+	for (int i=0; (i < 20000) && (bootStage != B_DONE); i++) hostLoop(step, step);
+	CHECK(bootStage == B_DONE);
+}
+#endif
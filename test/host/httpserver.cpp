@@ -0,0 +1,136 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Web server stand-in for the firmware server, see httpserver.h
+// ----------------------------------------------------------------------------
+#include "httpserver.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+struct httpConn {
+	int			fd;
+	bool		answered;
+	std::string	in;
+	std::string	out;
+};
+
+static int lfd = -1;
+static std::vector<httpConn> conns;
+hostHttpOpts hostHttp;
+std::map<std::string, std::string> hostHttpFiles;
+std::vector<std::string> hostHttpReqs;
+
+uint16_t hostHttpListen(uint16_t port)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(port);
+	bind(lfd, (struct sockaddr *) &sa, sizeof(sa));
+	listen(lfd, 4);
+	fcntl(lfd, F_SETFL, O_NONBLOCK);
+	getsockname(lfd, (struct sockaddr *) &sa, &len);
+	return ntohs(sa.sin_port);
+}
+
+// ----------------------------------------------------------------------------
+// The response to the request in c.in, with its header complete
+// ----------------------------------------------------------------------------
+static void httpAnswer(httpConn &c)
+{
+	size_t s = c.in.find(' ');
+	std::string path = c.in.substr(s + 1, c.in.find(' ', s + 1) - s - 1);
+	long first = -1;
+	size_t r = c.in.find("\r\nRange: bytes=");
+	if (r != std::string::npos) first = atol(c.in.c_str() + r + 15);
+	hostHttpReqs.push_back(path + " " + std::to_string(first < 0 ? 0 : first));
+	c.answered = true;
+
+	auto f = hostHttpFiles.find(path);
+	if (f == hostHttpFiles.end()) {
+		c.out = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		return;
+	}
+	const std::string &d = f->second;
+	std::string body;
+	if ((first < 0) || hostHttp.noRange) {
+		c.out = "HTTP/1.1 200 OK\r\n";
+		body = d;
+	}
+	else {
+		if (hostHttp.badRange >= 0) {
+			first = hostHttp.badRange;
+			hostHttp.badRange = -1;
+		}
+		if ((size_t) first > d.size()) first = d.size();
+		c.out = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " + std::to_string(first) +
+			"-" + std::to_string(d.size() - 1) + "/" + std::to_string(d.size()) + "\r\n";
+		body = d.substr(first);
+	}
+	c.out += "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+	if ((hostHttp.cut >= 0) && ((size_t) hostHttp.cut < body.size())) {
+		body.resize(hostHttp.cut);
+		hostHttp.cut = -1;
+	}
+	c.out += body;
+}
+
+void hostHttpPoll()
+{
+	int fd;
+	while ((lfd >= 0) && ((fd = accept(lfd, NULL, NULL)) >= 0)) {
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		conns.push_back({ fd, false, "", "" });
+	}
+	for (auto &c : conns) {
+		if (c.fd < 0) continue;
+		char b[1024];
+		int r;
+		while ((r = recv(c.fd, b, sizeof(b), MSG_DONTWAIT)) > 0) c.in.append(b, r);
+		if (!c.answered) {
+			if (c.in.find("\r\n\r\n") == std::string::npos) {
+				if (r == 0) { close(c.fd); c.fd = -1; }
+				continue;
+			}
+			httpAnswer(c);
+		}
+		size_t n = std::min(c.out.size(), hostHttp.rate);
+		if (n > 0) {
+			int w = send(c.fd, c.out.data(), n, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (w > 0) c.out.erase(0, w);
+		}
+		if (c.out.empty()) {
+			close(c.fd);
+			c.fd = -1;
+		}
+	}
+}
+
+void hostHttpClose(bool stop)
+{
+	for (auto &c : conns) {
+		if (c.fd >= 0) close(c.fd);
+		c.fd = -1;
+	}
+	if (stop && (lfd >= 0)) {
+		close(lfd);
+		lfd = -1;
+	}
+}
@@ -0,0 +1,38 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// A web server on 127.0.0.1 that serves the files in hostHttpFiles, the
+// stand-in for the firmware server. It understands "Range: bytes=<n>-" and
+// answers with one connection per request. Like wsserver.h it is not a
+// thread: hostHttpPoll() accepts, reads the requests and writes at most
+// hostHttp.rate bytes of every response per call. hostHttp can make it
+// misbehave once: break the connection, ignore the Range or answer with
+// another one.
+// ----------------------------------------------------------------------------
+#pragma once
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+struct hostHttpOpts {
+	size_t		rate = 4096;					// Bytes written per poll and connection
+	long		cut = -1;						// Close after this many body bytes, once
+	bool		noRange = false;				// Answer a Range request with 200
+	long		badRange = -1;					// Answer a Range request from here, once
+};
+extern hostHttpOpts hostHttp;
+extern std::map<std::string, std::string> hostHttpFiles;
+extern std::vector<std::string> hostHttpReqs;	// "<path> <first byte>" of each request
+
+// Listen on port, or on a free one if 0, returns the port
+uint16_t hostHttpListen(uint16_t port = 0);
+void hostHttpPoll();
+// Close all connections, and stop listening when stop is set
+void hostHttpClose(bool stop = false);
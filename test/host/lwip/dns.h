@@ -0,0 +1,10 @@
+// Host stand-in for the lwIP resolver. Names are looked up in hostDns
+// (see host.h): a name that is not there fails, a name that is marked
+// pending returns ERR_INPROGRESS and the test calls hostDnsAnswer() later.
+// ----------------------------------------------------------------------------
+#pragma once
+#include <stdint.h>
+#include "lwip/err.h"
+typedef struct ip_addr { uint32_t addr; } ip_addr_t;
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ip, void *arg);
+err_t dns_gethostbyname(const char *name, ip_addr_t *ip, dns_found_callback cb, void *arg);
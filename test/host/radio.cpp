@@ -0,0 +1,388 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Simulated SX1276 radios, see radio.h. Register numbers and bits are those
+// of the SX1276 datasheet (rev 6), LoRa mode.
+// ----------------------------------------------------------------------------
+#include "radio.h"
+#include "SPI.h"
+
+#define NRADIO 4
+#define PREAMBLE 8								// Preamble symbols sent by a node
+#define LOCK 6									// Symbols of preamble a receiver needs
+
+#define R_FIFO 0x00
+#define R_OPMODE 0x01
+#define R_FRF 0x06
+#define R_FIFO_PTR 0x0D
+#define R_FIFO_TX 0x0E
+#define R_FIFO_RX 0x0F
+#define R_FIFO_CUR 0x10
+#define R_IRQ_MASK 0x11
+#define R_IRQ 0x12
+#define R_NB_BYTES 0x13
+#define R_PKT_SNR 0x19
+#define R_PKT_RSSI 0x1A
+#define R_RSSI 0x1B
+#define R_HOP_CH 0x1C
+#define R_MC1 0x1D
+#define R_MC2 0x1E
+#define R_SYMB_TO 0x1F
+#define R_PL 0x22
+#define R_INVERTIQ 0x33
+#define R_DIOMAP 0x40
+#define R_VERSION 0x42
+
+#define F_RXTOUT 0x80
+#define F_RXDONE 0x40
+#define F_HEADER 0x10
+#define F_TXDONE 0x08
+#define F_CDDONE 0x04
+#define F_FHSS 0x02
+#define F_CDDETD 0x01
+
+#define M_STDBY 1
+#define M_TX 3
+#define M_RXCONT 5
+#define M_RXSINGLE 6
+#define M_CAD 7
+
+struct simRadio {
+	uint8_t		ss;
+	uint8_t		dio[3];
+	uint8_t		reg[0x80];
+	uint8_t		fifo[256];
+	uint8_t		flags;
+	uint8_t		mode;
+	uint64_t	modeStart;						// hostUs the mode was entered
+	uint64_t	until;							// End of CAD, RX single timeout or TX
+	uint64_t	heard;							// End of the last message it received
+	int			spiPos;							// Byte in the SPI transaction
+	uint8_t		spiAddr;
+	bool		spiWrite;
+};
+
+static simRadio sim[NRADIO];
+static int nsim = 0;
+static uint8_t pinLevel[64];
+static std::vector<hostFrame> air;				// Messages of the nodes
+std::vector<hostFrame> hostAirLog;
+hostRadioStat hostRadioStats[NRADIO];
+
+
+// ----------------------------------------------------------------------------
+// Symbol time and time on air in uSec for the current registers
+// ----------------------------------------------------------------------------
+static uint32_t bwOf(const simRadio &r)
+{
+	switch (r.reg[R_MC1] >> 4) {
+		case 8: return 250000;
+		case 9: return 500000;
+		default: return 125000;
+	}
+}
+
+static uint32_t tsym(uint8_t sf, uint32_t bw)
+{
+	return (uint32_t) (((uint64_t) 1000000 << sf) / bw);
+}
+
+static uint32_t airTimeBw(uint8_t sf, uint32_t bw, int len)
+{
+	int de = ((sf >= 11) && (bw == 125000)) ? 1 : 0;
+	int num = 8 * len - 4 * sf + 28 + 16;
+	int den = 4 * (sf - 2 * de);
+	int nsym = 8;
+	if (num > 0) nsym += ((num + den - 1) / den) * 5;
+	return (uint32_t) ((PREAMBLE + 4.25) * tsym(sf, bw)) + nsym * tsym(sf, bw);
+}
+
+uint32_t hostAirTime(uint8_t sf, int len)
+{
+	return airTimeBw(sf, 125000, len);
+}
+
+static uint32_t frfOfSim(const simRadio &r)
+{
+	return ((uint32_t) r.reg[R_FRF] << 16) | ((uint32_t) r.reg[R_FRF+1] << 8) | r.reg[R_FRF+2];
+}
+
+static uint8_t sfOfSim(const simRadio &r)
+{
+	return r.reg[R_MC2] >> 4;
+}
+
+uint32_t hostRadioFreq(int r)
+{
+	return (uint32_t) ((((uint64_t) frfOfSim(sim[r]) * 32000000) + (1 << 18)) >> 19);
+}
+
+uint8_t hostRadioSf(int r)
+{
+	return sfOfSim(sim[r]);
+}
+
+
+// ----------------------------------------------------------------------------
+// Interrupt flags and dio pins. A flag is only set when it is not masked.
+// The level of a pin is the OR of the dios wired to it, a rising pin calls
+// the interrupt handler.
+// ----------------------------------------------------------------------------
+static bool dioLevel(const simRadio &r, int d)
+{
+	uint8_t map = r.reg[R_DIOMAP];
+	switch (d) {
+		case 0: {
+			static const uint8_t f[4] = { F_RXDONE, F_TXDONE, F_CDDONE, 0 };
+			return r.flags & f[(map >> 6) & 3];
+		}
+		case 1: {
+			static const uint8_t f[4] = { F_RXTOUT, F_FHSS, F_CDDETD, 0 };
+			return r.flags & f[(map >> 4) & 3];
+		}
+		default:
+			return (((map >> 2) & 3) != 3) && (r.flags & F_FHSS);
+	}
+}
+
+static void updateDio(simRadio &r)
+{
+	for (int d=0; d<3; d++) {
+		uint8_t pin = r.dio[d];
+		if (pin >= 64) continue;
+		bool level = false;
+		for (int e=0; e<3; e++) {
+			if ((r.dio[e] == pin) && dioLevel(r, e)) level = true;
+		}
+		if (level && !pinLevel[pin]) {
+			pinLevel[pin] = 1;
+			hostPin[pin] = 1;
+			hostIrq(pin);
+		}
+		else if (!level && pinLevel[pin]) {
+			pinLevel[pin] = 0;
+			hostPin[pin] = 0;
+		}
+	}
+}
+
+static void setFlags(simRadio &r, uint8_t f)
+{
+	r.flags |= f & ~r.reg[R_IRQ_MASK];
+	updateDio(r);
+}
+
+static void setMode(simRadio &r, uint8_t m)
+{
+	r.reg[R_OPMODE] = (r.reg[R_OPMODE] & ~0x07) | m;
+	r.mode = m;
+	r.modeStart = hostUs;
+	uint32_t ts = tsym(sfOfSim(r), bwOf(r));
+	switch (m) {
+		case M_TX: {
+			hostFrame f;
+			int idx = &r - sim;
+			f.start = hostUs;
+			f.frf = frfOfSim(r);
+			f.sf = sfOfSim(r);
+			f.iq = r.reg[R_INVERTIQ];
+			f.mc2 = r.reg[R_MC2];
+			f.radio = idx;
+			for (int i=0; i<r.reg[R_PL]; i++) f.data.push_back(r.fifo[(r.reg[R_FIFO_TX] + i) & 0xFF]);
+			f.end = f.start + airTimeBw(f.sf, bwOf(r), f.data.size());
+			r.until = f.end;
+			hostAirLog.push_back(f);
+			break;
+		}
+		case M_RXSINGLE:
+			r.until = hostUs + (uint64_t) ts * (r.reg[R_SYMB_TO] | ((r.reg[R_MC2] & 0x03) << 8));
+			break;
+		case M_CAD:
+			r.until = hostUs + 2 * ts;
+			hostRadioStats[&r - sim].cads++;
+			break;
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// Put a received message in the FIFO
+// ----------------------------------------------------------------------------
+static void deliver(simRadio &r, const hostFrame &f)
+{
+	uint8_t base = r.reg[R_FIFO_RX];
+	for (size_t i=0; i<f.data.size(); i++) r.fifo[(base + i) & 0xFF] = f.data[i];
+	r.reg[R_FIFO_CUR] = base;
+	r.reg[R_NB_BYTES] = f.data.size();
+	r.reg[R_PKT_SNR] = 32;						// 8 dB
+	r.reg[R_PKT_RSSI] = 60;
+	r.reg[R_HOP_CH] = 0x40;						// CRC on
+	r.heard = f.end;
+	hostRadioStats[&r - sim].rcvd++;
+	setFlags(r, F_HEADER | F_RXDONE);
+}
+
+// A node message the radio can hear: same channel and SF, and the radio
+// listened in time to lock on the preamble
+static const hostFrame *audible(const simRadio &r, uint64_t from, uint64_t to)
+{
+	uint32_t ts = tsym(sfOfSim(r), bwOf(r));
+	for (auto &f : air) {
+		if ((f.frf != frfOfSim(r)) || (f.sf != sfOfSim(r)) || (f.end <= r.heard)) continue;
+		if ((f.start <= to) && (f.start + (uint64_t) (PREAMBLE - LOCK) * ts >= from)) return &f;
+	}
+	return nullptr;
+}
+
+
+// ----------------------------------------------------------------------------
+// Time advanced: finish CAD, RX and TX that are done
+// ----------------------------------------------------------------------------
+static void simTick()
+{
+	for (int i=0; i<nsim; i++) {
+		simRadio &r = sim[i];
+		const hostFrame *f;
+		switch (r.mode) {
+			case M_TX:
+				if (hostUs < r.until) break;
+				setMode(r, M_STDBY);
+				hostRadioStats[i].sent++;
+				setFlags(r, F_TXDONE);
+				break;
+			case M_RXCONT:
+				f = audible(r, r.modeStart, hostUs);
+				if (f && (f->end <= hostUs)) deliver(r, *f);
+				break;
+			case M_RXSINGLE:
+				f = audible(r, r.modeStart, r.until);
+				if (f) {
+					if (f->end > hostUs) break;
+					setMode(r, M_STDBY);
+					deliver(r, *f);
+				}
+				else if (hostUs >= r.until) {
+					setMode(r, M_STDBY);
+					setFlags(r, F_RXTOUT);
+				}
+				break;
+			case M_CAD:
+				if (hostUs < r.until) break;
+				f = audible(r, r.modeStart, r.until);
+				setMode(r, M_STDBY);
+				setFlags(r, F_CDDONE | (f ? F_CDDETD : 0));
+				break;
+		}
+	}
+	while (!air.empty() && (air.front().end + 10000000 < hostUs)) air.erase(air.begin());
+}
+
+
+// ----------------------------------------------------------------------------
+// SPI: the first byte is the address (bit 7 set for a write), the next ones
+// the data. Addresses increment except for the FIFO.
+// ----------------------------------------------------------------------------
+static uint8_t readReg(simRadio &r, uint8_t a)
+{
+	switch (a) {
+		case R_FIFO: return r.fifo[r.reg[R_FIFO_PTR]++];
+		case R_IRQ: return r.flags;
+		case R_RSSI: return 40;
+		default: return r.reg[a];
+	}
+}
+
+static void writeReg(simRadio &r, uint8_t a, uint8_t v)
+{
+	switch (a) {
+		case R_FIFO:
+			r.fifo[r.reg[R_FIFO_PTR]++] = v;
+			return;
+		case R_OPMODE:
+			r.reg[R_OPMODE] = v;
+			if ((v & 0x07) != r.mode) setMode(r, v & 0x07);
+			return;
+		case R_IRQ:
+			r.flags &= ~v;
+			updateDio(r);
+			return;
+		case R_FIFO_CUR: case R_NB_BYTES: case R_VERSION:
+			return;
+		default:
+			r.reg[a] = v;
+			if ((a == R_IRQ_MASK) || (a == R_DIOMAP)) updateDio(r);
+			return;
+	}
+}
+
+static uint8_t simSpi(uint8_t out)
+{
+	for (int i=0; i<nsim; i++) {
+		simRadio &r = sim[i];
+		if (hostPin[r.ss] != LOW) continue;
+		if (r.spiPos++ == 0) {
+			r.spiAddr = out & 0x7F;
+			r.spiWrite = (out & 0x80) != 0;
+			hostRadioStats[i].spi++;
+			return 0;
+		}
+		uint8_t v = 0;
+		if (r.spiWrite) writeReg(r, r.spiAddr, out);
+		else v = readReg(r, r.spiAddr);
+		if (r.spiAddr != R_FIFO) r.spiAddr = (r.spiAddr + 1) & 0x7F;
+		return v;
+	}
+	return 0;
+}
+
+static void simPin(uint8_t pin, uint8_t val)
+{
+	for (int i=0; i<nsim; i++) {
+		if ((sim[i].ss == pin) && (val == LOW)) sim[i].spiPos = 0;
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+// Test interface
+// ----------------------------------------------------------------------------
+int hostRadioAdd(uint8_t ss, uint8_t dio0, uint8_t dio1, uint8_t dio2)
+{
+	simRadio &r = sim[nsim];
+	memset(&r, 0, sizeof(r));
+	r.ss = ss;
+	r.dio[0] = dio0; r.dio[1] = dio1; r.dio[2] = dio2;
+	r.reg[R_OPMODE] = 0x09;
+	r.mode = 1;
+	r.reg[R_FRF] = 0x6C; r.reg[R_FRF+1] = 0x80;
+	r.reg[R_FIFO_TX] = 0x80;
+	r.reg[R_MC1] = 0x72; r.reg[R_MC2] = 0x70; r.reg[R_SYMB_TO] = 0x64;
+	r.reg[R_PL] = 0x01;
+	r.reg[R_INVERTIQ] = 0x27;
+	r.reg[R_VERSION] = 0x12;
+	hostPin[ss] = HIGH;
+	hostSpi = simSpi;
+	hostPinWrite = simPin;
+	hostTick = simTick;
+	return nsim++;
+}
+
+void hostAir(uint32_t freq, uint8_t sf, const uint8_t *data, int len)
+{
+	hostFrame f;
+	f.start = hostUs;
+	f.end = hostUs + hostAirTime(sf, len);
+	f.frf = (uint32_t) (((uint64_t) freq << 19) / 32000000);
+	f.sf = sf;
+	f.iq = 0x27;
+	f.mc2 = (sf << 4) | 0x04;					// CRC on
+	f.radio = -1;
+	f.data.assign(data, data + len);
+	air.push_back(f);
+}
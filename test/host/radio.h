@@ -0,0 +1,55 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Simulated SX1276 radios on the SPI bus, LoRa mode only. The sketch talks
+// to them as to the real chip: registers, the FIFO, the operating modes and
+// the interrupt flags on the dio pins. A rising dio calls the interrupt
+// handler attached to its pin.
+// Messages of nodes are put on the air with hostAir(). A radio receives one
+// when it listens on its frequency and SF: in RX continuous mode from the
+// start of the preamble, in RX single mode when it started during the
+// preamble, and CAD detects it when the CAD overlaps the preamble.
+// Messages the radios send are added to hostAirLog.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+#include <vector>
+
+struct hostFrame {
+	uint64_t	start;							// hostUs at the start of the preamble
+	uint64_t	end;							// hostUs at the end of the message
+	uint32_t	frf;							// FRF register value of the frequency
+	uint8_t		sf;
+	uint8_t		iq;								// INVERTIQ register when sent by a radio
+	uint8_t		mc2;							// MODEM_CONFIG2 register when sent by a radio
+	int			radio;							// Radio that sent it, -1 for a node
+	std::vector<uint8_t> data;
+};
+
+struct hostRadioStat {
+	uint32_t	rcvd;							// RXDONE given
+	uint32_t	missed;							// Messages on its channel and SF not received
+	uint32_t	cads;							// CAD runs
+	uint32_t	sent;							// TXDONE given
+	uint32_t	spi;							// SPI transactions
+};
+
+// Connect a radio with select pin ss and the given dio pins, returns its
+// number. Pins may be shared, the level of the pin is the OR of the dios.
+int hostRadioAdd(uint8_t ss, uint8_t dio0, uint8_t dio1, uint8_t dio2);
+// A node starts sending data now, on frequency freq (Hz) with sf at 125 kHz
+void hostAir(uint32_t freq, uint8_t sf, const uint8_t *data, int len);
+// Time on air in uSec at 125 kHz, CR 4/5, explicit header, CRC on
+uint32_t hostAirTime(uint8_t sf, int len);
+// Current frequency (Hz) and SF set in the registers of radio r
+uint32_t hostRadioFreq(int r);
+uint8_t hostRadioSf(int r);
+
+extern std::vector<hostFrame> hostAirLog;		// Messages sent by the radios
+extern hostRadioStat hostRadioStats[4];
@@ -0,0 +1,136 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Stand-ins for the NTP and LoRa network servers, see server.h
+// ----------------------------------------------------------------------------
+#include "server.h"
+#include "host.h"
+
+hostLnsStat hostLns;
+uint64_t hostEpoch = 1700000000ULL * 1000000ULL;
+
+// ----------------------------------------------------------------------------
+// Write the NTP timestamp (seconds and fraction since 1900) of UTC uSec us
+// ----------------------------------------------------------------------------
+static void ntpStamp(uint8_t *b, uint64_t us)
+{
+	uint32_t secs = (uint32_t) (us / 1000000 + 2208988800ULL);
+	uint32_t frac = (uint32_t) (((us % 1000000) << 32) / 1000000);
+	for (int i=0; i<4; i++) {
+		b[i] = secs >> (24 - 8*i);
+		b[4+i] = frac >> (24 - 8*i);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Answer a request with a server mode reply, stratum 2. The originate time
+// is the transmit time of the request.
+// ----------------------------------------------------------------------------
+static void ntpServer(const hostDgram &d)
+{
+	if (d.data.size() < 48) return;
+	uint8_t b[48] = { 0 };
+	b[0] = 0x24;									// LI 0, version 4, mode 4
+	b[1] = 2;
+	memcpy(b + 24, d.data.data() + 40, 8);
+	ntpStamp(b + 32, hostEpoch + hostUs);
+	ntpStamp(b + 40, hostEpoch + hostUs);
+	hostLns.ntp++;
+	hostUdpRecv(d.local, d.ip, d.port, b, sizeof(b));
+}
+
+// ----------------------------------------------------------------------------
+// The LoRa network server: acknowledge what the gateway sends
+// ----------------------------------------------------------------------------
+static void lnsServer(const hostDgram &d)
+{
+	if (!hostLns.up) { hostLns.lost++; return; }
+	if (d.data.size() < 4) return;
+	hostLns.last = d;
+	uint8_t ack[4] = { d.data[0], d.data[1], d.data[2], 0 };
+	switch (d.data[3]) {
+	case 0x00:										// PUSH_DATA
+		hostLns.push++;
+		if (d.data.size() > 12) {
+			hostLns.rxpk.push_back(std::string(d.data.begin() + 12, d.data.end()));
+			hostLns.rxpkIp.push_back(d.ip);
+		}
+		ack[3] = 0x01;
+		break;
+	case 0x80:										// PUSH_BIN
+		hostLns.push++;
+		hostLns.bin.push_back(d);
+		ack[3] = 0x01;
+		break;
+	case 0x02:										// PULL_DATA
+		hostLns.pull++;
+		hostLns.pullFrom = d;
+		ack[3] = 0x04;
+		break;
+	case 0x05:										// TX_ACK
+		hostLns.txack++;
+		return;
+	default:
+		return;
+	}
+	for (auto &m : hostLns.mute) {
+		if (m == d.ip) return;
+	}
+	hostUdpRecv(d.local, d.ip, d.port, ack, sizeof(ack));
+}
+
+static void serverSend(const hostDgram &d)
+{
+	if (d.port == 123) ntpServer(d);
+	else lnsServer(d);
+}
+
+IPAddress hostServerIp(int n)
+{
+	return IPAddress(10, 0, 0, 1 + n);
+}
+
+void hostServers(std::initializer_list<const char *> names)
+{
+	int n = 0;
+	for (const char *name : names) {
+		hostDns[name] = hostServerIp(n++);
+	}
+	hostLns = hostLnsStat();
+	hostUdpSend = serverSend;
+}
+
+void hostPullResp(const char *json, uint16_t token)
+{
+	const hostDgram &p = hostLns.pullFrom;
+	std::vector<uint8_t> b = { 0x02, (uint8_t) token, (uint8_t) (token >> 8), 0x03 };
+	b.insert(b.end(), json, json + strlen(json));
+	hostUdpRecv(p.local, p.ip, p.port, b.data(), b.size());
+}
+
+bool hostBinDecode(const hostDgram &d, std::vector<hostBinFrame> &f)
+{
+	const std::vector<uint8_t> &b = d.data;
+	if ((b.size() < 12) || (b[3] != 0x80)) return false;
+	size_t i = 12;
+	while (i < b.size()) {
+		if ((i + 13 > b.size()) || (i + 13 + b[i+12] > b.size())) return false;
+		hostBinFrame r;
+		r.tmst = b[i] | (b[i+1] << 8) | (b[i+2] << 16) | ((uint32_t) b[i+3] << 24);
+		r.freq = b[i+4] | (b[i+5] << 8) | (b[i+6] << 16) | ((uint32_t) b[i+7] << 24);
+		r.sf = b[i+8] & 0x0F;
+		r.rad = b[i+8] >> 4;
+		r.rssi = (int16_t) (b[i+9] | (b[i+10] << 8));
+		r.snr = (int8_t) b[i+11];
+		r.data.assign(b.begin() + i + 13, b.begin() + i + 13 + b[i+12]);
+		f.push_back(r);
+		i += 13 + b[i+12];
+	}
+	return true;
+}
@@ -0,0 +1,65 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Stand-ins for the servers of the gateway. hostServers() gives the server
+// names an address in hostDns and installs a handler in hostUdpSend that
+// answers NTP requests (port 123) and plays the LoRa network server on any
+// other port: PUSH_DATA and PUSH_BIN get a PUSH_ACK, PULL_DATA a PULL_ACK.
+// The answers are queued for the gateway right away, there is no delay.
+// A server in hostLns.mute is a plain UDP handler: it takes the datagrams
+// and does not answer.
+// hostBinDecode() is what a backend does with a PUSH_BIN datagram.
+// ----------------------------------------------------------------------------
+#pragma once
+#include "Arduino.h"
+#include "WiFiUdp.h"
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+struct hostLnsStat {
+	bool		up = true;						// When false, datagrams are lost
+	uint32_t	push = 0;						// PUSH_DATA and PUSH_BIN received
+	uint32_t	pull = 0;						// PULL_DATA received
+	uint32_t	txack = 0;						// TX_ACK received
+	uint32_t	ntp = 0;						// NTP requests answered
+	uint32_t	lost = 0;						// Datagrams sent while down
+	hostDgram	last;							// Last datagram received
+	hostDgram	pullFrom;						// Last PULL_DATA, for hostPullResp()
+	std::vector<std::string> rxpk;				// PUSH_DATA JSON, after the header
+	std::vector<IPAddress> rxpkIp;				// Server that got each rxpk
+	std::vector<IPAddress> mute;				// Servers that take datagrams but never answer
+	std::vector<hostDgram> bin;					// PUSH_BIN datagrams
+};
+extern hostLnsStat hostLns;
+
+// UTC in uSec at hostUs 0, the time the NTP server gives
+extern uint64_t hostEpoch;
+
+// Names get the addresses 10.0.0.1, 10.0.0.2 ... in the order given
+void hostServers(std::initializer_list<const char *> names);
+// The address hostServers() gave to name n (0 based)
+IPAddress hostServerIp(int n);
+// Send a PULL_RESP with the txpk JSON to the gateway, as answer to the last
+// PULL_DATA
+void hostPullResp(const char *json, uint16_t token = 0x1234);
+
+// A frame of a PUSH_BIN datagram, see loraModem.h for the format
+struct hostBinFrame {
+	uint32_t	tmst;
+	uint32_t	freq;							// Hz
+	uint8_t		sf;
+	uint8_t		rad;
+	int16_t		rssi;
+	int8_t		snr;
+	std::vector<uint8_t> data;
+};
+// Decode the frames of PUSH_BIN datagram d and add them to f. Returns false
+// if it is not a PUSH_BIN or a frame does not fit in the datagram.
+bool hostBinDecode(const hostDgram &d, std::vector<hostBinFrame> &f);
@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+typedef struct { int x; } os_timer_t;
+struct station_config { uint8_t ssid[32]; uint8_t password[64]; uint8_t bssid_set; uint8_t bssid[6]; };
+inline bool wifi_station_set_hostname(char *) { return true; }
+inline char *wifi_station_get_hostname(void) { static char h[] = "esp-host"; return h; }
+inline bool wifi_station_get_config(struct station_config *c) { memset(c, 0, sizeof(*c)); return true; }
+inline void os_timer_setfn(os_timer_t *, void (*)(void *), void *) {}
+inline void os_timer_arm(os_timer_t *, uint32_t, bool) {}
+inline void os_timer_disarm(os_timer_t *) {}
+inline void system_restart(void) {}
+inline bool system_update_cpu_freq(uint8_t) { return true; }
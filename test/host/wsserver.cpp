@@ -0,0 +1,176 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Websocket server stand-in for the LNS, see wsserver.h
+// ----------------------------------------------------------------------------
+#include "wsserver.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+struct wsConn {
+	int			fd;
+	bool		open;							// Upgrade done
+	std::string	path;
+	std::string	in;
+};
+
+static int lfd = -1;
+static std::vector<wsConn> conns;
+std::vector<hostWsMsg> hostWsRcvd;
+void (*hostWsOnMsg)(const hostWsMsg &m) = nullptr;
+uint32_t hostWsPings = 0;
+uint32_t hostWsConns = 0;
+
+uint16_t hostWsListen(uint16_t port)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(port);
+	bind(lfd, (struct sockaddr *) &sa, sizeof(sa));
+	listen(lfd, 4);
+	fcntl(lfd, F_SETFL, O_NONBLOCK);
+	getsockname(lfd, (struct sockaddr *) &sa, &len);
+	return ntohs(sa.sin_port);
+}
+
+// ----------------------------------------------------------------------------
+// Write all of b, the socket is blocking for writes
+// ----------------------------------------------------------------------------
+static void wsWrite(int fd, const std::string &b)
+{
+	size_t k = 0;
+	while (k < b.size()) {
+		int r = send(fd, b.data() + k, b.size() - k, MSG_NOSIGNAL);
+		if (r <= 0) return;
+		k += r;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Handle the complete frames in c.in. Client frames are masked.
+// Returns false when the connection must be closed.
+// ----------------------------------------------------------------------------
+static bool wsFrames(wsConn &c, int idx)
+{
+	while (c.in.size() >= 2) {
+		const uint8_t *p = (const uint8_t *) c.in.data();
+		uint8_t op = p[0] & 0x0F;
+		uint64_t len = p[1] & 0x7F;
+		size_t h = 2;
+		if (len == 126) {
+			if (c.in.size() < 4) return true;
+			len = (p[2] << 8) | p[3];
+			h = 4;
+		}
+		else if (len == 127) {
+			return false;
+		}
+		if (p[1] & 0x80) h += 4;
+		if (c.in.size() < h + len) return true;
+		std::string d(c.in, h, len);
+		if (p[1] & 0x80) {
+			for (size_t i=0; i<len; i++) d[i] ^= p[h - 4 + (i & 3)];
+		}
+		c.in.erase(0, h + len);
+		if (op == 0x1) {
+			hostWsMsg m = { idx, c.path, d };
+			hostWsRcvd.push_back(m);
+			if (hostWsOnMsg) hostWsOnMsg(m);
+		}
+		else if (op == 0x9) {
+			hostWsPings++;
+			std::string f = { (char) 0x8A, (char) d.size() };
+			wsWrite(c.fd, f + d);
+		}
+		else if (op == 0x8) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void hostWsPoll()
+{
+	int fd;
+	while ((lfd >= 0) && ((fd = accept(lfd, NULL, NULL)) >= 0)) {
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		conns.push_back({ fd, false, "", "" });
+		hostWsConns++;
+	}
+	for (size_t i=0; i<conns.size(); i++) {
+		wsConn &c = conns[i];
+		if (c.fd < 0) continue;
+		char b[4096];
+		int r;
+		bool closed = false;
+		while ((r = recv(c.fd, b, sizeof(b), MSG_DONTWAIT)) > 0) c.in.append(b, r);
+		if ((r == 0) || ((r < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) closed = true;
+		if (!c.open) {
+			size_t e = c.in.find("\r\n\r\n");
+			if (e != std::string::npos) {
+				size_t s = c.in.find(' ');
+				c.path = c.in.substr(s + 1, c.in.find(' ', s + 1) - s - 1);
+				c.in.erase(0, e + 4);
+				c.open = true;
+				wsWrite(c.fd, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+					"Connection: Upgrade\r\nSec-WebSocket-Accept: x\r\n\r\n");
+			}
+		}
+		if (c.open && !wsFrames(c, i)) closed = true;
+		if (closed) {
+			close(c.fd);
+			c.fd = -1;
+		}
+	}
+}
+
+void hostWsSend(const std::string &text, int conn)
+{
+	if (conn < 0) {
+		for (conn = conns.size() - 1; (conn >= 0) && (conns[conn].fd < 0); conn--) ;
+		if (conn < 0) return;
+	}
+	std::string f;
+	f += (char) 0x81;
+	if (text.size() < 126) {
+		f += (char) text.size();
+	}
+	else {
+		f += (char) 126;
+		f += (char) (text.size() >> 8);
+		f += (char) (text.size() & 0xFF);
+	}
+	wsWrite(conns[conn].fd, f + text);
+}
+
+void hostWsClose(bool stop)
+{
+	for (auto &c : conns) {
+		if (c.fd >= 0) close(c.fd);
+		c.fd = -1;
+	}
+	if (stop && (lfd >= 0)) {
+		close(lfd);
+		lfd = -1;
+	}
+}
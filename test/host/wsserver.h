@@ -0,0 +1,39 @@
+// 1-channel LoRa Gateway for ESP8266, host test environment
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// A websocket server on 127.0.0.1, the stand-in for a LoRa Basics Station
+// LNS. It is not a thread: hostWsPoll() accepts connections, answers the
+// upgrade request and reads the frames of the clients. The test calls it
+// while it runs loop(), and answers the messages in hostWsOnMsg.
+// ----------------------------------------------------------------------------
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct hostWsMsg {
+	int			conn;							// Connection number, from 0
+	std::string	path;							// Of the websocket
+	std::string	text;
+};
+
+// Listen on port, or on a free one if 0, returns the port
+uint16_t hostWsListen(uint16_t port = 0);
+// Accept, upgrade and read. Every text message is added to hostWsRcvd and
+// passed to hostWsOnMsg.
+void hostWsPoll();
+// Send a text message on connection conn, -1 is the newest one
+void hostWsSend(const std::string &text, int conn = -1);
+// Close all connections, and stop listening when stop is set
+void hostWsClose(bool stop = false);
+
+extern std::vector<hostWsMsg> hostWsRcvd;
+extern void (*hostWsOnMsg)(const hostWsMsg &m);
+extern uint32_t hostWsPings;					// Ping frames received
+extern uint32_t hostWsConns;					// Connections accepted
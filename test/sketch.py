@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+# 1-channel LoRa Gateway for ESP8266, host test environment
+#
+# Make one C++ file of the sketch, the way the Arduino IDE does: the main
+# .ino file first, then the other .ino files in alphabetical order, with
+# prototypes of all functions before the first variable definition.
+# The headers of the sketch are copied next to it, with the settings given
+# on the command line changed, so tests can be built for other settings. A
+# setting that is commented out (//#define NAME ...) is switched on. A
+# value in braces, a list, is replaced as a whole:
+#
+#	sketch.py <outdir> [NAME=VALUE ...]
+#
+import glob, os, re, sys
+
+src = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'ESP-sc-gway')
+src = os.path.normpath(src)
+out = sys.argv[1]
+defs = dict(a.split('=', 1) for a in sys.argv[2:])
+os.makedirs(out, exist_ok=True)
+
+for h in glob.glob(os.path.join(src, '*.h')):
+	text = open(h).read()
+	for name, value in defs.items():
+		text = re.sub(r'^(?://\s*)?(#define\s+%s)\s+(?:\{[^}]*\}|\S+)' % re.escape(name), r'\g<1> %s' % value, text, flags=re.M)
+	dst = os.path.join(out, os.path.basename(h))
+	if not os.path.exists(dst) or open(dst).read() != text:
+		open(dst, 'w').write(text)
+
+files = [os.path.join(src, 'ESP-sc-gway.ino')] + sorted(glob.glob(os.path.join(src, '_*.ino')))
+code = ''
+for f in files:
+	code += '#line 1 "%s"\n' % f + open(f).read() + '\n'
+
+# Prototypes of all functions defined at the start of a line
+pat = re.compile(r'^((?:static\s+|inline\s+|ICACHE_RAM_ATTR\s+)*(?:unsigned\s+|const\s+|struct\s+)?'
+	r'[A-Za-z_][A-Za-z0-9_:<>]*\s*[\*&]?\s+[\*&]?)([A-Za-z_][A-Za-z0-9_]*)\s*\(([^;{]*)\)\s*(\{|$)', re.M)
+skip = ('return', 'else', 'if', 'while', 'for', 'switch', 'case', 'new', 'delete', 'using')
+protos = []
+for m in pat.finditer(code):
+	typ, name, args = m.group(1), m.group(2), m.group(3)
+	if typ.split()[0] in skip or name in skip + ('sizeof',):
+		continue
+	if m.group(4) == '' and not code[m.end():m.end()+200].lstrip().startswith('{'):
+		continue
+	typ = typ.replace('ICACHE_RAM_ATTR', '').strip()
+	protos.append('%s %s(%s);' % (typ, name, ' '.join(args.split())))
+
+marker = 'uint8_t debug=1;'
+i = code.index(marker)
+line = code[:i].count('\n')
+code = (code[:i] + '\n'.join(protos) + '\n#line %d "%s"\n' % (line, files[0]) + code[i:])
+code = '#include "Arduino.h"\n' + code
+
+dst = os.path.join(out, 'sketch.cpp')
+if not os.path.exists(dst) or open(dst).read() != code:
+	open(dst, 'w').write(code)
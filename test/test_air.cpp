@@ -0,0 +1,78 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Time on air (_loraModem.ino): airTime() against values of the Semtech
+// formula, and rateAirTime() with the bandwidth and coding rate of the
+// modem config registers setRate() writes, for the sx1276 and the sx1272.
+// airTime() is exact for every SF, bandwidth, coding rate and length.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include <math.h>
+
+// ----------------------------------------------------------------------------
+// Time on air in uSec with the formula of the datasheet, in floating point.
+// Low data rate optimize is on when a symbol takes more than 16 ms.
+// ----------------------------------------------------------------------------
+static double semtech(int sf, int bw, int cr, int pl, bool crc)
+{
+	double tsym = pow(2, sf) / (bw * 1000.0);
+	int de = (tsym > 0.016) ? 1 : 0;
+	double n = ceil((8.0 * pl - 4 * sf + 28 + (crc ? 16 : 0)) / (4.0 * (sf - 2 * de)));
+	double npay = 8 + fmax(n * (cr + 4), 0);
+	return ((8 + 4.25) * tsym + npay * tsym) * 1e6;
+}
+
+int main()
+{
+	hostInit("air");
+
+	// SF7, 125 kHz, 4/5, 20 bytes, CRC: 12.25 + 43 symbols of 1024 uSec
+	CHECK(airTime(SF7, 125, 1, 20, true) == 56576);
+	// SF12, 125 kHz, 4/5, 20 bytes, CRC, low data rate optimize:
+	// 12.25 + 28 symbols of 32768 uSec
+	CHECK(airTime(SF12, 125, 1, 20, true) == 1318912);
+	CHECK(airTime(SF7, 250, 1, 20, true) == 56576 / 2);
+	// SF12 at 250 kHz: a symbol is 16384 uSec, low data rate optimize too
+	CHECK(airTime(SF12, 250, 1, 20, true) == 1318912 / 2);
+
+	// sx1276: 125 kHz, 4/8 for SF8 and 4/5 otherwise, CRC as asked
+	sx1272 = false;
+	for (uint8_t s=SF7; s<=SF12; s++) {
+		uint8_t cr = (s == SF8 ? 4 : 1);
+		CHECK(rateAirTime(s, 0x04, 20) == airTime(s, 125, cr, 20, true));
+		CHECK(rateAirTime(s, 0x00, 20) == airTime(s, 125, cr, 20, false));
+	}
+
+	// sx1272: modem config 0x0A and 0x0B are 125 kHz, 4/5, CRC on
+	sx1272 = true;
+	for (uint8_t s=SF7; s<=SF12; s++) {
+		CHECK(rateAirTime(s, 0x04, 20) == airTime(s, 125, 1, 20, true));
+		CHECK(rateAirTime(s, 0x00, 20) == airTime(s, 125, 1, 20, true));
+		CHECK(rateAirTime(s, 0x04, 20) != airTime(s, 250, 1, 20, true));
+	}
+
+	// All settings against the formula in floating point
+	int wrong = 0;
+	for (int sf=SF7; sf<=SF12; sf++) {
+		for (int bw=125; bw<=500; bw*=2) {
+			for (int cr=1; cr<=4; cr++) {
+				for (int pl=0; pl<=255; pl++) {
+					for (int crc=0; crc<=1; crc++) {
+						long t = llround(semtech(sf, bw, cr, pl, crc));
+						if ((long) airTime(sf, bw, cr, pl, crc) != t) wrong++;
+					}
+				}
+			}
+		}
+	}
+	CHECK(wrong == 0);
+
+	return hostDone();
+}
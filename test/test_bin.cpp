@@ -0,0 +1,136 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Binary PUSH_DATA (_THINGBIN==1 and 3 radios, the bin variant): the frames binFrame()
+// (_txRx.ino) puts in PUSH_BIN datagrams are decoded by hostBinDecode() as
+// the backend does, with the same values, and take fewer bytes than the
+// JSON of buildPacket(). The PUSH_ACK round trip time is kept per server.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include "radio.h"
+#include "server.h"
+
+// ----------------------------------------------------------------------------
+// Put a data up frame of len bytes in LoraUp
+// ----------------------------------------------------------------------------
+static void frame(uint8_t len, uint8_t s, int prssi, long snr, uint8_t seed)
+{
+	for (int i=0; i<len; i++) LoraUp.payLoad[i] = seed + i;
+	LoraUp.payLoad[0] = 0x40;
+	LoraUp.payLength = len;
+	LoraUp.sf = s;
+	LoraUp.prssi = prssi;
+	LoraUp.rssicorr = 157;
+	LoraUp.snr = snr;
+}
+
+// ----------------------------------------------------------------------------
+// Handle the answers of the servers
+// ----------------------------------------------------------------------------
+static void drain()
+{
+	udpIntake();
+	while (udpTail != udpHead) {
+		struct udpBuf *u = &udpRing[udpTail & (UDPRING-1)];
+		udpTail++;
+		readUdp(u);
+	}
+}
+
+int main()
+{
+	hostInit("bin");
+	hostBoot({ NTP_TIMESERVER, _TTNSERVER, _THINGSERVER });
+	CHECK(thingServer == hostServerIp(2));
+	drain();
+	hostLns.rxpk.clear();
+	hostLns.bin.clear();
+
+	// Frames of all sizes, SF and signal, forwarded as JSON to TTN and as
+	// PUSH_BIN to our own server. Decoded they are what was received.
+	struct { uint8_t len, sf; int prssi; long snr; uint8_t rad; uint32_t freq; } in[] = {
+		{ 12, SF7, 100, 9, 0, 868100000 },
+		{ 23, SF12, 30, -17, 0, 868300000 },
+		{ 51, SF9, 157, 0, 1, 868500000 },
+		{ 120, SF10, 60, -5, 2, 867100000 },
+		{ 1, SF8, 140, 12, 0, 868100000 },
+	};
+	const int N = sizeof(in) / sizeof(in[0]);
+	uint32_t tmst[N];
+	uint32_t push = hostLns.push;
+	for (int i=0; i<N; i++) {
+		frame(in[i].len, in[i].sf, in[i].prssi, in[i].snr, i * 16);
+		rad = in[i].rad;
+		freq = in[i].freq;
+		tmst[i] = micros();
+		CHECK(forwardPacket(tmst[i]) > 0);
+		hostRun(1000);
+	}
+	rad = 0;
+	CHECK(binLen > 0);
+	CHECK(binFlush());
+	CHECK(hostLns.rxpk.size() == N);				// JSON to TTN
+	CHECK(hostLns.bin.size() >= 1);
+	CHECK(hostLns.push - push == N + hostLns.bin.size());
+
+	std::vector<hostBinFrame> f;
+	for (auto &d : hostLns.bin) {
+		CHECK(d.ip == thingServer);
+		CHECK(d.port == _THINGPORT);
+		CHECK(hostBinDecode(d, f));
+	}
+	CHECK(f.size() == N);
+	for (int i=0; (i < N) && (i < (int) f.size()); i++) {
+		CHECK(f[i].tmst == tmst[i]);
+		CHECK(f[i].freq == in[i].freq);
+		CHECK(f[i].sf == in[i].sf);
+		CHECK(f[i].rad == in[i].rad);
+		CHECK(f[i].rssi == in[i].prssi - 157);
+		CHECK(f[i].snr == in[i].snr);
+		CHECK(f[i].data.size() == in[i].len);
+		bool same = (f[i].data.size() == in[i].len);
+		for (int j=1; same && (j<in[i].len); j++) same = (f[i].data[j] == (uint8_t) (i * 16 + j));
+		CHECK(same);
+	}
+
+	// A frame that runs past the end of the datagram is an error
+	if (hostLns.bin.size() > 0) {
+		hostDgram d = hostLns.bin.back();
+		d.data.pop_back();
+		CHECK(!hostBinDecode(d, f));
+	}
+
+	// Bytes per frame, binary against the JSON of buildPacket()
+	CHECK(statBin.frames == N);
+	uint32_t bin = statBin.bytes / statBin.frames;
+	uint32_t json = statBin.json / statBin.frames;
+	printf("bin: %u bytes per frame, JSON %u\n", bin, json);
+	CHECK(bin * 2 < json);
+
+	// PUSH_ACK round trip time per server: the PUSH_DATA to TTN and the
+	// PUSH_BIN to our server each have their own token and time
+	struct ackStat *ttn = ackFind(ttnServer, false);
+	struct ackStat *thing = ackFind(thingServer, false);
+	CHECK((ttn != NULL) && (thing != NULL) && (ttn != thing));
+	drain();
+	frame(20, SF7, 100, 5, 0);
+	uint32_t t = micros();
+	CHECK(forwardPacket(t) > 0);					// TTN now, bin after _BIN_HOLD
+	hostRun(5000);
+	CHECK(binFlush());
+	CHECK(ttn->waiting && thing->waiting);
+	CHECK(ttn->token != thing->token);
+	CHECK(ttn->sent < thing->sent);
+	drain();
+	CHECK(!ttn->waiting && !thing->waiting);
+	CHECK(ttn->rtt > thing->rtt);
+
+	return hostDone();
+}
@@ -0,0 +1,180 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// LoRa Basics Station (_bStation.ino, the bs variant) against the mock LNS
+// of host/wsserver.h: router-info, the muxs, router_config, an uplink as
+// updf, the size limit of a dnmsg pdu, a dnmsg with a data rate of 250 kHz
+// that goes out in RX2 or not at all. The address of the LNS comes from
+// dnsCache and a muxs that does not resolve or answer does not block.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include "wsserver.h"
+#include <string>
+
+// ----------------------------------------------------------------------------
+// The LNS: router-info gives the muxs on the same port, the muxs answers
+// version with router_config
+// ----------------------------------------------------------------------------
+static void lns(const hostWsMsg &m)
+{
+	if (m.path == "/router-info") {
+		hostWsSend("{\"router\":\"x\",\"muxs\":\"x\",\"uri\":\"ws://muxs.test:" +
+			std::to_string(_LNSPORT) + "/gw/1\"}", m.conn);
+	}
+	else if (m.text.find("\"version\"") != std::string::npos) {
+		hostWsSend("{\"msgtype\":\"router_config\",\"DRs\":[[12,125,0],[11,125,0],[10,125,0],"
+			"[9,125,0],[8,125,0],[7,125,0],[7,250,0],[0,0,0]]}", m.conn);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Run bsLoop() and the LNS for ms milliseconds, or until the state is s
+// ----------------------------------------------------------------------------
+static void run(uint32_t ms, int s = -1)
+{
+	for (uint32_t i=0; (i < ms) && (bs.state != s); i++) {
+		bsLoop();
+		hostWsPoll();
+		hostRun(1000);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// A dnmsg for the last uplink with a pdu of len bytes, data rates rx1 and
+// rx2
+// ----------------------------------------------------------------------------
+static std::string dnmsg(int len, int rx1 = 5, int rx2 = 0)
+{
+	char xt[24];
+	std::string pdu(2 * len, 'A');
+	return "{\"msgtype\":\"dnmsg\",\"DevEui\":\"00-00-00-00-00-00-00-01\",\"dC\":0,\"diid\":7,"
+		"\"pdu\":\"" + pdu + "\",\"RxDelay\":1,\"RX1DR\":" + std::to_string(rx1) +
+		",\"RX1Freq\":868100000,\"RX2DR\":" + std::to_string(rx2) +
+		",\"RX2Freq\":869525000,\"priority\":0,\"xtime\":" +
+		bsU64(xt, bsXtime(micros64())) + ",\"rctx\":0}";
+}
+
+int main()
+{
+	hostInit("bs");
+	hostDns[_LNSSERVER] = IPAddress(127, 0, 0, 1);
+	hostDns["muxs.test"] = IPAddress(127, 0, 0, 1);
+	CHECK(hostWsListen(_LNSPORT) == _LNSPORT);
+	hostWsOnMsg = lns;
+
+	// No address of the LNS yet: fail without a lookup or connect
+	uint32_t fails = statBs.fails;
+	run(1);
+	CHECK(statBs.fails == fails + 1);
+	CHECK(bs.state == BS_IDLE);
+	CHECK(hostWsConns == 0);
+
+	// The address of the LNS is kept in dnsCache
+	for (int i=0; (i < 100) && (dnsStep() < (int) DNS_ENTRIES); i++) hostRun(1000);
+	CHECK(lnsServer == IPAddress(127, 0, 0, 1));
+
+	// router-info, the muxs, version and router_config
+	run(5000, BS_UP);
+	CHECK(bs.state == BS_UP);
+	CHECK(statBs.connects == 1);
+	CHECK(hostWsConns == 2);
+	CHECK(strcmp(bs.host, "muxs.test") == 0);
+	CHECK(strcmp(bs.path, "/gw/1") == 0);
+	CHECK(bs.ip == IPAddress(127, 0, 0, 1));
+	CHECK(hostWsRcvd.size() == 2);
+	CHECK(hostWsRcvd[0].path == "/router-info");
+	CHECK(hostWsRcvd[1].path == "/gw/1");
+	CHECK(hostWsRcvd[1].text.find("\"msgtype\":\"version\"") != std::string::npos);
+
+	// An uplink is an updf with the fields of the frame
+	uint8_t up[] = { 0x40, 0x04, 0x03, 0x02, 0x01, 0x00, 0x2A, 0x00, 0x01, 'h', 'i', 1, 2, 3, 4 };
+	memcpy(LoraUp.payLoad, up, sizeof(up));
+	LoraUp.payLength = sizeof(up);
+	LoraUp.sf = SF9;
+	LoraUp.prssi = -60;
+	LoraUp.rssicorr = 0;
+	LoraUp.snr = 7;
+	CHECK(bsUplink(micros()) > 0);
+	CHECK(statBs.updf == 1);
+	run(10);
+	CHECK(hostWsRcvd.size() == 3);
+	std::string &u = hostWsRcvd.back().text;
+	CHECK(u.find("\"msgtype\":\"updf\"") != std::string::npos);
+	CHECK(u.find("\"DevAddr\":16909060") != std::string::npos);
+	CHECK(u.find("\"FCnt\":42") != std::string::npos);
+	CHECK(u.find("\"FRMPayload\":\"6869\"") != std::string::npos);
+	CHECK(u.find("\"DR\":3") != std::string::npos);
+
+	// A pdu of 128 bytes does not fit in payLoad with its 0, 127 does
+	uint32_t dnmsgs = statBs.dnmsg;
+	uint32_t dnerr = statBs.dnerr;
+	hostWsSend(dnmsg(128));
+	run(10);
+	CHECK(statBs.dnmsg == dnmsgs + 1);
+	CHECK(statBs.dnerr == dnerr + 1);
+	CHECK(bs.state == BS_UP);
+	LoraDown.payLength = 0;
+	hostWsSend(dnmsg(BS_PDU));
+	run(10);
+	CHECK(statBs.dnmsg == dnmsgs + 2);
+	CHECK(LoraDown.payLength == BS_PDU);
+	CHECK(bs.state == BS_UP);
+	statTx.pending = false;
+	bsDn.state = BS_DN_NONE;
+
+	// DR6 is SF7 at 250 kHz, which we cannot send: RX2 is used instead,
+	// and when RX2 has it too the dnmsg is not sent
+	hostWsSend(dnmsg(10, 6, 0));
+	run(10);
+	CHECK(statBs.dnmsg == dnmsgs + 3);
+	CHECK(statBs.dnerr == dnerr + 1);
+	CHECK(bsDn.state == BS_DN_QUEUED);
+	CHECK(LoraDown.sfTx == SF12);
+	CHECK(LoraDown.fff == 869525000);
+	statTx.pending = false;
+	bsDn.state = BS_DN_NONE;
+	hostWsSend(dnmsg(10, 6, 6));
+	run(10);
+	CHECK(statBs.dnmsg == dnmsgs + 4);
+	CHECK(statBs.dnerr == dnerr + 2);
+	CHECK(bsDn.state == BS_DN_NONE);
+	CHECK(!statTx.pending);
+
+	// A muxs that does not resolve: the lookup is waited for in
+	// BS_RESOLVE, without blocking bsLoop(), and fails after BS_TIMEOUT
+	hostWsClose();
+	run(10, BS_IDLE);
+	CHECK(bs.state == BS_IDLE);
+	hostDnsPending.insert("muxs.test");
+	uint32_t dnsFails = bsDns.fails;
+	fails = statBs.fails;
+	run(70000, BS_RESOLVE);
+	CHECK(bs.state == BS_RESOLVE);
+	double t = hostClock();
+	run(BS_TIMEOUT + 100, BS_IDLE);
+	CHECK(hostClock() - t < 1.0);
+	CHECK(bs.state == BS_IDLE);
+	CHECK(bsDns.fails == dnsFails + 1);
+	CHECK(statBs.fails == fails + 1);
+	hostDnsPending.erase("muxs.test");
+	hostDnsAnswer("muxs.test");
+
+	// An LNS that is not there fails at once and is tried again later
+	hostWsClose(true);
+	fails = statBs.fails;
+	t = hostClock();
+	run(70000, BS_UP);
+	CHECK(hostClock() - t < 5.0);
+	CHECK(bs.state != BS_UP);
+	CHECK(statBs.fails > fails);
+	CHECK(bsClient._timeout == BS_CONNECT);
+
+	return hostDone();
+}
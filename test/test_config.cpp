@@ -0,0 +1,190 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Configuration slots (_loraFiles.ino): conversion of the old text file,
+// and recovery from a torn write, a bad CRC and a stale slot. Counter
+// journal: replay, and a partial entry at the end.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Read or write a whole SPIFFS file
+// ----------------------------------------------------------------------------
+static std::vector<uint8_t> getFile(const char *fn)
+{
+	std::vector<uint8_t> b;
+	File f = SPIFFS.open(fn, "r");
+	if (!f) return b;
+	b.resize(f.size());
+	f.read(b.data(), b.size());
+	f.close();
+	return b;
+}
+
+static void putFile(const char *fn, const std::vector<uint8_t> &b)
+{
+	File f = SPIFFS.open(fn, "w");
+	f.write(b.data(), b.size());
+	f.close();
+}
+
+static std::string slot(char c) { return std::string(CONFIGFILE) + "." + c; }
+
+// ----------------------------------------------------------------------------
+// Write a config with channel ch and the given SSID
+// ----------------------------------------------------------------------------
+static int writeCh(uint8_t ch, const char *ssid)
+{
+	gwayConfig.ch = ch;
+	gwayConfig.ssid = ssid;
+	return writeConfig(CONFIGFILE, &gwayConfig);
+}
+
+// ----------------------------------------------------------------------------
+// Read the config as at boot, into a cleared gwayConfig
+// ----------------------------------------------------------------------------
+static int boot()
+{
+	gwayConfig = espGwayConfig();
+	memset(&cfgRec, 0, sizeof(cfgRec));
+	memset(&cntRec, 0, sizeof(cntRec));
+	return readConfig(CONFIGFILE, &gwayConfig);
+}
+
+int main()
+{
+	hostInit("config");
+
+	// Nothing there: defaults
+	CHECK(boot() == -1);
+	CHECK(gwayConfig.sf == _SPREADING);
+
+	// The text file of older versions is converted once, then removed
+	File f = SPIFFS.open(CONFIGTXT, "w");
+	f.print("SSID=oldnet\nPASS=secret\nCH=2\nSF=10\nFCNT=77\nDEBUG=2\nPDEBUG=4\nCAD=1\nHOP=0\n"
+		"NODE=0\nBOOTS=12\nRESETS=3\nWIFIS=5\nVIEWS=9\nREFR=1\nREENTS=0\nNTPETIM=1234\n"
+		"NTPERR=1\nNTPS=40\nFILEREC=17\nFILENO=6\nFILENUM=4\nEXPERT=1\nUNKNOWN=1\n");
+	f.close();
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.ssid == "oldnet");
+	CHECK(gwayConfig.pass == "secret");
+	CHECK(gwayConfig.ch == 2);
+	CHECK(gwayConfig.sf == 10);
+	CHECK(gwayConfig.debug == 2);
+	CHECK(gwayConfig.expert);
+	CHECK(gwayConfig.boots == 12);
+	CHECK(gwayConfig.ntps == 40);
+	CHECK(gwayConfig.ntpErrTime == 1234);
+	CHECK(gwayConfig.logFileNo == 6);
+	CHECK(!SPIFFS.exists(CONFIGTXT));
+	CHECK(boot() == 1);									// Now from the slots
+	CHECK(gwayConfig.ssid == "oldnet");
+	CHECK(gwayConfig.ch == 2);
+	CHECK(gwayConfig.boots == 12);
+	CHECK(gwayConfig.views == 9);
+
+	// Every write goes to the other slot
+	CHECK(writeCh(3, "net3") == 1);
+	CHECK(writeCh(4, "net4") == 1);
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.ch == 4);
+	CHECK(gwayConfig.ssid == "net4");
+
+	// Torn write: power fails halfway the record, the previous slot is used
+	hostFsWriteLimit = sizeof(struct cfgRec) / 2;
+	CHECK(writeCh(5, "net5") == -1);
+	hostFsWriteLimit = -1;
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.ch == 4);
+	CHECK(gwayConfig.ssid == "net4");
+	CHECK(writeCh(6, "net6") == 1);						// And we continue after it
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.ch == 6);
+
+	// Bad CRC (one bit flipped in the newest slot)
+	char c = 'a' + (cfgRec.hdr.seq % 2);
+	std::vector<uint8_t> b = getFile(slot(c).c_str());
+	CHECK(b.size() == sizeof(struct cfgRec));
+	b[offsetof(struct cfgRec, ssid)] ^= 0x01;
+	putFile(slot(c).c_str(), b);
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.ch == 4);
+	CHECK(gwayConfig.ssid == "net4");
+
+	// Stale slot: an old, valid record must not win over a newer one,
+	// whatever slot file it is in
+	CHECK(writeCh(7, "net7") == 1);
+	std::vector<uint8_t> stale = getFile(slot('a' + (cfgRec.hdr.seq % 2)).c_str());
+	CHECK(writeCh(8, "net8") == 1);
+	CHECK(writeCh(9, "net9") == 1);
+	uint32_t seq = cfgRec.hdr.seq;
+	putFile(slot('a' + ((seq + 1) % 2)).c_str(), stale);
+	CHECK(boot() == 1);
+	CHECK(cfgRec.hdr.seq == seq);
+	CHECK(gwayConfig.ch == 9);
+	putFile(slot('a' + (seq % 2)).c_str(), stale);			// Both stale
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.ch == 7);
+
+	// Both slots damaged: defaults, and the next write is valid again
+	putFile(slot('a').c_str(), std::vector<uint8_t>(10, 0xFF));
+	putFile(slot('b').c_str(), std::vector<uint8_t>());
+	CHECK(boot() == -1);
+	CHECK(gwayConfig.sf == _SPREADING);
+	CHECK(writeCh(1, "net1") == 1);
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.ssid == "net1");
+
+	// Counter journal: every logCounters() appends one entry per counter
+	CHECK(writeCounters(COUNTFILE, &gwayConfig) == 1);
+	for (int i=0; i<10; i++) {
+		gwayConfig.boots++;
+		CHECK(logCounters(CNT_BOOTS) == 1);
+	}
+	uint16_t boots = gwayConfig.boots;
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.boots == boots);
+	CHECK(cntEntries == 10);
+
+	// A partial entry at the end of the journal (power failure during the
+	// append): the entries before it count, and the journal is compacted
+	// with the next update instead of appending after the partial entry
+	std::string jn = std::string(COUNTFILE) + ".j";
+	f = SPIFFS.open(jn.c_str(), "a");
+	f.write((const uint8_t *) "\x01\xFE\x00", 3);
+	f.close();
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.boots == boots);
+	CHECK(cntEntries == CNTMAXENT);
+	uint32_t compacts = statCnt.compacts;
+	gwayConfig.boots++;
+	CHECK(logCounters(CNT_BOOTS) == 1);
+	CHECK(statCnt.compacts == compacts + 1);
+	gwayConfig.wifis = 33;
+	CHECK(logCounters(CNT_WIFIS) == 1);
+	CHECK(boot() == 1);
+	CHECK(gwayConfig.boots == boots + 1);
+	CHECK(gwayConfig.wifis == 33);
+	CHECK(cntEntries == 1);
+
+	// A page view is not journaled right away
+	setTime(1700000000);
+	setupWWW();
+	uint32_t appends = statCnt.appends;
+	uint16_t views = gwayConfig.views;
+	server.hostGet("/");
+	server.hostGet("/");
+	CHECK(gwayConfig.views == views + 2);
+	CHECK(statCnt.appends == appends);
+	CHECK(cntDirty & CNT_VIEWS);
+
+	return hostDone();
+}
@@ -0,0 +1,138 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Duty cycle of downlinks (_loraModem.ino): the token bucket of dcCheck()
+// per EU868 sub-band fills up to the time of transmission and holds at most
+// _DC_WINDOW seconds of the duty cycle, a rejected message takes nothing.
+// The 10% RX2 band allows ten times the messages of a 1% band, frequencies
+// between the bands are refused. txQueue() counts TX_DUTY in statTx.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+
+#define S 1000000ULL							// uSec in a second
+
+// ----------------------------------------------------------------------------
+// Index in dcBands[] of frequency f in Hz
+// ----------------------------------------------------------------------------
+static int band(uint32_t f)
+{
+	for (int i=0; i<DC_BANDS; i++) {
+		if ((f / 1000 >= dcBands[i].lo) && (f / 1000 < dcBands[i].hi)) return(i);
+	}
+	return(-1);
+}
+
+// ----------------------------------------------------------------------------
+// Number of messages of air uSec the full bucket of f takes at time t
+// ----------------------------------------------------------------------------
+static int burst(uint32_t f, uint32_t air, uint64_t t)
+{
+	int n = 0;
+	while ((n < 10000) && (dcCheck(f, air, t) == TX_NONE)) n++;
+	return(n);
+}
+
+int main()
+{
+	hostInit("dc");
+
+	// 868.1 MHz is in a 1% band: the bucket holds 36 seconds of air time
+	uint32_t f = 868100000;
+	int i = band(f);
+	CHECK((i >= 0) && (dcBands[i].permille == 10));
+	uint32_t cap = (uint32_t) _DC_WINDOW * 1000 * 10;
+	uint64_t t = 1000 * S;
+
+	// The first message finds a full bucket, the next one an empty one
+	CHECK(dcCheck(f, cap, t) == TX_NONE);
+	CHECK(statDc[i].tokens == 0);
+	CHECK(statDc[i].sent == 1);
+	CHECK(dcCheck(f, 1, t) == TX_DUTY);
+	CHECK(statDc[i].rejected == 1);
+	CHECK(statDc[i].tokens == 0);
+
+	// 10 seconds later it has 1% of that: 100 mSec. It is filled up to the
+	// time of transmission, a message that does not fit takes nothing.
+	t += 10 * S;
+	CHECK(dcCheck(f, 100001, t) == TX_DUTY);
+	CHECK(statDc[i].tokens == 100000);
+	CHECK(statDc[i].last == t);
+	CHECK(dcCheck(f, 100000, t) == TX_NONE);
+	CHECK(statDc[i].tokens == 0);
+	CHECK(statDc[i].sent == 2);
+	CHECK(statDc[i].rejected == 2);
+
+	// A message sent before the last one does not fill the bucket
+	CHECK(dcCheck(f, 1, t - 5 * S) == TX_DUTY);
+	CHECK(statDc[i].last == t);
+	CHECK(statDc[i].tokens == 0);
+
+	// After a long time the bucket holds no more than _DC_WINDOW * 1%
+	t += 10 * _DC_WINDOW * S;
+	CHECK(dcCheck(f, cap + 1, t) == TX_DUTY);
+	CHECK(statDc[i].tokens == cap);
+	CHECK(dcCheck(f, cap, t) == TX_NONE);
+	CHECK(statDc[i].tokens == 0);
+
+	// The channels 0-2 share their band
+	CHECK(dcCheck(868500000, 1, t) == TX_DUTY);
+
+	// SF12 messages of 20 bytes in a full bucket: the RX2 band of 10% takes
+	// ten times those of a 1% band, a 0.1% band a tenth of them
+	uint32_t air = airTime(SF12, 125, 1, 20, false);
+	int rx2 = band(869525000);
+	CHECK((rx2 >= 0) && (dcBands[rx2].permille == 100));
+	CHECK(burst(869525000, air, t) == (int) ((uint32_t) _DC_WINDOW * 1000 * 100 / air));
+	CHECK(burst(866100000, air, t) == (int) (cap / air));
+	CHECK(burst(868900000, air, t) == (int) ((uint32_t) _DC_WINDOW * 1000 / air));
+	CHECK(burst(869525000, air, t) == 0);
+	CHECK(burst(869525000, air, t + 10 * air) == 1);
+
+	// Frequencies outside every band are refused, no bucket is touched
+	uint32_t sent = 0;
+	uint32_t rejected = 0;
+	for (i=0; i<DC_BANDS; i++) {
+		sent += statDc[i].sent;
+		rejected += statDc[i].rejected;
+	}
+	uint32_t out[] = { 862000000, 868650000, 869300000, 869675000, 870000000, 915000000 };
+	for (uint8_t k=0; k<sizeof(out)/sizeof(out[0]); k++) {
+		CHECK(band(out[k]) < 0);
+		CHECK(dcCheck(out[k], 1, t) == TX_FREQ);
+	}
+	for (i=0; i<DC_BANDS; i++) {
+		sent -= statDc[i].sent;
+		rejected -= statDc[i].rejected;
+	}
+	CHECK(sent == 0);
+	CHECK(rejected == 0);
+
+	// txQueue() in the empty RX2 band: TX_DUTY, not pending, counted
+	uint8_t down[20] = { 0x60 };
+	LoraDown.payLoad = down;
+	LoraDown.payLength = sizeof(down);
+	LoraDown.sfTx = SF12;
+	LoraDown.powe = 14;
+	LoraDown.fff = 869525000;
+	LoraDown.crc = 0x00;
+	LoraDown.iiq = 0x40;
+	statDc[rx2].tokens = 0;
+	statDc[rx2].last = micros64() + 2 * S;
+	LoraDown.tmst = micros() + 1000000;
+	uint32_t duty = statTx.err[TX_DUTY];
+	rejected = statDc[rx2].rejected;
+	CHECK(txQueue() == TX_DUTY);
+	CHECK(!statTx.pending);
+	CHECK(statTx.err[TX_DUTY] == duty + 1);
+	CHECK(statDc[rx2].rejected == rejected + 1);
+	CHECK(statDc[rx2].tokens == 0);
+
+	return hostDone();
+}
@@ -0,0 +1,125 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// The server address cache (_WiFi.ino): after a failover the address that
+// did not acknowledge is avoided, also when the lookup that follows gives
+// it again, until it answers, and a burst of PUSH_DATA messages is no
+// reason for a failover. A late answer after a timeout is used but
+// does not count as lookup time.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+
+static IPAddress a(10, 0, 0, 2);
+static IPAddress b(10, 0, 0, 3);
+
+// ----------------------------------------------------------------------------
+// The dnsCache entry of the TTN server
+// ----------------------------------------------------------------------------
+static struct dnsEntry *ttn()
+{
+	for (uint8_t i=0; i<DNS_ENTRIES; i++) {
+		if (dnsCache[i].ip == &ttnServer) return(&dnsCache[i]);
+	}
+	return(NULL);
+}
+
+// ----------------------------------------------------------------------------
+// Resolve the name of e again now
+// ----------------------------------------------------------------------------
+static void resolve(struct dnsEntry *e)
+{
+	e->next = millis();
+	dnsStep();
+	hostRun(1000);
+	dnsStep();
+}
+
+// ----------------------------------------------------------------------------
+// Server ip does not acknowledge DNS_ACKLOST + 1 PUSH_DATA messages, sent
+// DNS_ACKWAIT apart
+// ----------------------------------------------------------------------------
+static void unanswered(IPAddress ip)
+{
+	for (int i=0; i<=DNS_ACKLOST; i++) {
+		dnsPush(ip);
+		hostRun(DNS_ACKWAIT * 1000ULL);
+	}
+}
+
+int main()
+{
+	hostInit("dns");
+	hostDns[NTP_TIMESERVER] = IPAddress(10, 0, 0, 1);
+	struct dnsEntry *e = ttn();
+	CHECK(e != NULL);
+
+	// The server moves from a to b, both are kept
+	hostDns[_TTNSERVER] = a;
+	resolve(e);
+	CHECK(ttnServer == a);
+	hostDns[_TTNSERVER] = b;
+	resolve(e);
+	CHECK(ttnServer == b);
+	CHECK(e->n == 2);
+
+	// A burst of PUSH_DATA without time for the answers is no failover
+	for (int i=0; i<=DNS_ACKLOST * 2; i++) dnsPush(b);
+	CHECK(e->failovers == 0);
+	CHECK(ttnServer == b);
+	dnsAck(b);
+
+	// b does not acknowledge: failover to a. The lookup at the failover
+	// gives b again, which does not replace a.
+	unanswered(b);
+	CHECK(e->failovers == 1);
+	CHECK(ttnServer == a);
+	CHECK(e->next == millis() - DNS_ACKWAIT);
+	dnsStep();
+	CHECK(e->lookups == 3);
+	CHECK(e->addr[0] == b);
+	CHECK(ttnServer == a);
+
+	// Until b is used again after DNS_BAD
+	hostRun((DNS_BAD + 1000) * 1000ULL);
+	resolve(e);
+	CHECK(ttnServer == b);
+
+	// Both fail: a, then b again as there is no other
+	unanswered(b);
+	CHECK(ttnServer == a);
+	unanswered(a);
+	CHECK(ttnServer == b);
+
+	// A PUSH_ACK of a ends its failover: the next lookup uses it
+	dnsAck(a);
+	CHECK(!dnsBad(e, 1));
+	hostDns[_TTNSERVER] = a;
+	resolve(e);
+	CHECK(ttnServer == a);
+
+	// An answer after the timeout is used, without a lookup time
+	uint32_t msLast = e->msLast;
+	uint32_t fails = e->fails;
+	dnsAck(b);
+	hostDnsPending.insert(_TTNSERVER);
+	hostDns[_TTNSERVER] = b;
+	e->next = millis();
+	dnsStep();
+	hostRun((DNS_TIMEOUT + 100) * 1000ULL);
+	dnsStep();
+	CHECK(e->fails == fails + 1);
+	CHECK(ttnServer == a);
+	hostDnsAnswer(_TTNSERVER);
+	dnsStep();
+	CHECK(e->msLast == msLast);
+	CHECK(ttnServer == b);
+
+	return hostDone();
+}
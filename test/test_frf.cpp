@@ -0,0 +1,49 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// FRF register values (_loraModem.ino): frfOf() in 32 bits must give the
+// same value as the double precision formula freq * 2^19 / 32 MHz, for
+// every entry of freqs[] and the RX2 frequency. Built for each _LFREQ.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+
+// ----------------------------------------------------------------------------
+// The FRF value as given in the SX1276 datasheet, in double precision
+// ----------------------------------------------------------------------------
+static uint32_t frfDouble(uint32_t f)
+{
+	return (uint32_t) floor((double) f * 524288.0 / 32000000.0);
+}
+
+int main()
+{
+	static char name[16];
+	sprintf(name, "frf%d", _LFREQ);
+	hostInit(name);
+
+	initFrf();
+	for (uint8_t i=0; i<NUM_FREQS; i++) {
+		CHECK(frfOf(freqs[i]) == frfDouble(freqs[i]));
+		CHECK(frfs[i] == frfDouble(freqs[i]));
+		CHECK(FRF(freqs[i]) == frfDouble(freqs[i]));
+	}
+	CHECK(frfRx2 == frfDouble(_RX2FREQ));
+	CHECK(frfOf(_RX2FREQ) == frfDouble(_RX2FREQ));
+
+	// Downlink frequencies are not in the table: every 100 Hz of the band
+	// the SX127x can tune to (137 .. 1020 MHz)
+	int bad = 0;
+	for (uint32_t f = 137000000; f <= 1020000000; f += 100) {
+		if (frfOf(f) != frfDouble(f)) bad++;
+	}
+	CHECK(bad == 0);
+
+	return hostDone();
+}
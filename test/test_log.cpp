@@ -0,0 +1,176 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Log ring and indexed queries (_loraFiles.ino): records written with
+// addLog() must be found by queryLog() for any node and time range, also
+// after initLog() rebuilt the index from the segments at boot.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include <vector>
+
+#define T0 1700000000UL							// now() of the first record
+#define NODES 20
+
+struct logRef {
+	uint32_t tmst;
+	uint32_t addr;
+	uint32_t seq;								// Segment the record was written to
+};
+static std::vector<logRef> refs;
+
+// ----------------------------------------------------------------------------
+// Add a message of node n to the log, and to the reference list
+// ----------------------------------------------------------------------------
+static void logMsg(int n)
+{
+	uint8_t msg[12] = { 0x40 };
+	uint32_t addr = 0x26010000 + n * 0x101;
+	msg[1] = addr; msg[2] = addr >> 8; msg[3] = addr >> 16; msg[4] = addr >> 24;
+	msg[6] = refs.size(); msg[7] = refs.size() >> 8;
+	addLog(msg, sizeof(msg), 7, -80, 5);
+	refs.push_back({ (uint32_t) now(), addr, (uint32_t) (refs.size() / LOGFILEREC + 1) });
+}
+
+// ----------------------------------------------------------------------------
+// Number of records of the reference list that are still in the ring
+// and match the query
+// ----------------------------------------------------------------------------
+static int expect(uint32_t addr, uint32_t from, uint32_t to)
+{
+	int n = 0;
+	for (auto &r : refs) {
+		if (r.seq + LOGFILEMAX <= gwayConfig.logFileNo) continue;
+		if ((r.tmst < from) || (r.tmst > to)) continue;
+		if ((addr != 0) && (r.addr != addr)) continue;
+		n++;
+	}
+	return n;
+}
+
+// ----------------------------------------------------------------------------
+// Run a set of queries and compare with the reference
+// ----------------------------------------------------------------------------
+static void checkQueries()
+{
+	uint32_t t = now();
+	for (int n=0; n<NODES; n += 7) {
+		uint32_t addr = 0x26010000 + n * 0x101;
+		CHECK(queryLog(addr, 0, 0xFFFFFFFF, LOG_SERIAL) == expect(addr, 0, 0xFFFFFFFF));
+		CHECK(queryLog(addr, t - 3600, 0xFFFFFFFF, LOG_SERIAL) == expect(addr, t - 3600, 0xFFFFFFFF));
+	}
+	CHECK(queryLog(0, 0, 0xFFFFFFFF, LOG_SERIAL) == expect(0, 0, 0xFFFFFFFF));
+	CHECK(queryLog(0, t - 600, t - 300, LOG_SERIAL) == expect(0, t - 600, t - 300));
+	CHECK(queryLog(0x12345678, 0, 0xFFFFFFFF, LOG_SERIAL) == 0);
+}
+
+// ----------------------------------------------------------------------------
+// Simulate a restart: forget everything in RAM and find the segments again
+// ----------------------------------------------------------------------------
+static void reboot()
+{
+	flushLog();
+	memset(logIdx, 0, sizeof(logIdx));
+	gwayConfig.logFileNo = 0;
+	gwayConfig.logFileRec = 0;
+	gwayConfig.logFileNum = 0;
+	initLog();
+}
+
+int main()
+{
+	hostInit("log");
+	setTime(T0);
+	initLog();
+	CHECK(gwayConfig.logFileNum == 0);
+	CHECK(queryLog(0, 0, 0xFFFFFFFF, LOG_SERIAL) == 0);
+
+	// Less than one segment, partly still in logBuf
+	for (int i=0; i<50; i++) { logMsg(i % NODES); delay(10000); }
+	checkQueries();
+
+	// Wrap the ring twice, one message per 10 seconds
+	for (int i=0; i<2 * LOGFILEMAX * LOGFILEREC + 37; i++) { logMsg(i % NODES); delay(10000); }
+	CHECK(gwayConfig.logFileNum == LOGFILEMAX);
+	checkQueries();
+
+	// A query for a short time range only reads the segments of that range
+	uint32_t skip = statLog.segSkip;
+	uint32_t read = statLog.segRead;
+	queryLog(0, now() - 600, now(), LOG_SERIAL);
+	CHECK(statLog.segRead - read <= 2);
+	CHECK(statLog.segSkip - skip >= LOGFILEMAX - 2);
+
+	// Same results after a restart
+	uint32_t seq = gwayConfig.logFileNo;
+	reboot();
+	CHECK(gwayConfig.logFileNo == seq);
+	CHECK(gwayConfig.logFileNum == LOGFILEMAX);
+	checkQueries();
+
+	// A partial record at the end of the current segment (power failure
+	// during a write) closes that segment, the next record starts a new one
+	char fn[16];
+	sprintf(fn, "/log-%d", (int) (gwayConfig.logFileNo % LOGFILEMAX));
+	File f = SPIFFS.open(fn, "a");
+	f.write((const uint8_t *) "torn", 4);
+	f.close();
+	reboot();
+	CHECK(gwayConfig.logFileNo == seq);
+	CHECK(gwayConfig.logFileRec == LOGFILEREC);
+	logMsg(3);
+	refs.back().seq = seq + 1;
+	flushLog();
+	CHECK(gwayConfig.logFileNo == seq + 1);
+	CHECK(queryLog(refs.back().addr, now(), now(), LOG_SERIAL) == 1);
+
+	// Full flash: the records that were not written are not counted, a
+	// partial record closes the segment, and the next segment is only
+	// used once its header is written
+	uint32_t lost = statLog.lost;
+	CHECK(gwayConfig.logFileRec == 1);
+	logMsg(4); logMsg(5); logMsg(6);
+	refs[refs.size() - 3].seq = seq + 1;
+	refs.pop_back(); refs.pop_back();
+	hostFsWriteLimit = sizeof(struct logRec) + 5;
+	CHECK(flushLog() == 1);
+	CHECK(statLog.lost - lost == 2);
+	CHECK(gwayConfig.logFileNo == seq + 1);
+	CHECK(gwayConfig.logFileRec == LOGFILEREC);
+	hostFsWriteLimit = 0;
+	logMsg(7);
+	refs.pop_back();
+	CHECK(flushLog() == 0);
+	CHECK(statLog.lost - lost == 3);
+	CHECK(gwayConfig.logFileNo == seq + 1);
+	hostFsWriteLimit = -1;
+	logMsg(8);
+	refs.back().seq = seq + 2;
+	CHECK(flushLog() == 1);
+	CHECK(gwayConfig.logFileNo == seq + 2);
+	CHECK(gwayConfig.logFileRec == 1);
+	reboot();
+	CHECK(gwayConfig.logFileNo == seq + 2);
+	CHECK(gwayConfig.logFileRec == 1);
+	checkQueries();
+
+	// The web page: hours is limited to 1 .. LOGHOURS
+	setupWWW();
+	uint32_t addr = 0x26010000 + 3 * 0x101;
+	char node[12];
+	sprintf(node, "%08X", addr);
+	auto lines = [](const std::string &s) { return (int) std::count(s.begin(), s.end(), '\n'); };
+	CHECK(lines(server.hostGet("/LOG", {{ "node", node }})) == expect(addr, 0, 0xFFFFFFFF));
+	CHECK(lines(server.hostGet("/LOG", {{ "node", node }, { "hours", "1" }})) == expect(addr, now() - 3600, 0xFFFFFFFF));
+	CHECK(lines(server.hostGet("/LOG", {{ "node", node }, { "hours", "-5" }})) == expect(addr, now() - 3600, 0xFFFFFFFF));
+	CHECK(lines(server.hostGet("/LOG", {{ "node", node }, { "hours", "99999999" }})) == expect(addr, 0, 0xFFFFFFFF));
+	CHECK(lines(server.hostGet("/LOG", {{ "node", node }, { "hours", "99999999" }})) > 0);
+
+	return hostDone();
+}
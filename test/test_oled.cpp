@@ -0,0 +1,139 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// OLED updates (_oLED.ino, SH1106Wire.h): the I2C bytes of a screen update
+// counted by the Wire stand-in, for the driver that sends the changed
+// columns per page and for the bounding box around all changes that the
+// driver sent before, on the same screens. A burst of messages costs two
+// updates, not one per message.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include <vector>
+
+#define N 20									// Messages 1 second apart
+#define BURST 10								// Messages in 50 mSec
+
+// ----------------------------------------------------------------------------
+// display() of SH1106Wire.h before it sent the changed columns per page:
+// one box around all changes, from screen back to screen buf
+// ----------------------------------------------------------------------------
+static void boxCommand(uint8_t command)
+{
+	Wire.beginTransmission(OLED_ADDR);
+	Wire.write(0x80);
+	Wire.write(command);
+	Wire.endTransmission();
+}
+
+static void boxDisplay(uint8_t *back, const uint8_t *buf)
+{
+	uint8_t minBoundY = ~0;
+	uint8_t maxBoundY = 0;
+	uint8_t minBoundX = ~0;
+	uint8_t maxBoundX = 0;
+	uint8_t x, y;
+
+	for (y = 0; y < (DISPLAY_HEIGHT / 8); y++) {
+		for (x = 0; x < DISPLAY_WIDTH; x++) {
+			uint16_t pos = x + y * DISPLAY_WIDTH;
+			if (buf[pos] != back[pos]) {
+				minBoundY = _min(minBoundY, y);
+				maxBoundY = _max(maxBoundY, y);
+				minBoundX = _min(minBoundX, x);
+				maxBoundX = _max(maxBoundX, x);
+			}
+			back[pos] = buf[pos];
+		}
+	}
+	if (minBoundY == (uint8_t) ~0) return;
+
+	uint8_t k = 0;
+	for (y = minBoundY; y <= maxBoundY; y++) {
+		boxCommand(0xB0 + y);
+		boxCommand((minBoundX + 2) & 0x0F);
+		boxCommand(0x10 | ((minBoundX + 2) >> 4));
+		for (x = minBoundX; x <= maxBoundX; x++) {
+			if (k == 0) {
+				Wire.beginTransmission(OLED_ADDR);
+				Wire.write(0x40);
+			}
+			Wire.write(buf[x + y * DISPLAY_WIDTH]);
+			if (++k == 16) {
+				Wire.endTransmission();
+				k = 0;
+			}
+		}
+		if (k != 0) {
+			Wire.endTransmission();
+			k = 0;
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// A message from DevAddr 26 01 10 <n> of len bytes
+// ----------------------------------------------------------------------------
+static void msg(uint8_t n, uint8_t len, int rssi, long snr)
+{
+	uint8_t m[64] = { 0x40, n, 0x10, 0x01, 0x26 };
+	msg_oLED(m, len, rssi, snr);
+}
+
+int main()
+{
+	hostInit("oled");
+	init_oLED();
+	acti_oLED();
+	std::vector<uint8_t> back(display.buffer_back, display.buffer_back + DISPLAY_BUFFER_SIZE);
+
+	// Every message shown: the bytes of both drivers for the same screens
+	uint32_t cols = 0;
+	uint32_t box = 0;
+	for (int i=0; i<N; i++) {
+		hostRun(1000000);
+		msg(i, 12 + (i % 3) * 10, -40 - i * 3, 9 - i);
+		uint32_t draws = statOled.draws;
+		uint32_t w = Wire.bytes;
+		draw_oLED();
+		CHECK(statOled.draws == draws + 1);
+		cols += Wire.bytes - w;
+		w = Wire.bytes;
+		boxDisplay(back.data(), display.buffer);
+		box += Wire.bytes - w;
+	}
+	CHECK(memcmp(back.data(), display.buffer_back, DISPLAY_BUFFER_SIZE) == 0);
+
+	// Without OLEDDISPLAY_DOUBLE_BUFFER every update is the whole screen:
+	// per page 3 commands and 8 transmissions of 16 bytes
+	uint32_t full = 8 * (3 * 3 + 8 * (2 + 16));
+	printf("oled: %u I2C bytes per update, %u with the bounding box, %u full screen\n",
+		cols / N, box / N, full);
+	CHECK(cols < box);
+	CHECK(box / N < full);
+	CHECK(statOled.bytes < cols);						// Without the address bytes
+
+	// A burst: the first message is shown at once, the others in one
+	// update after OLED_INTERVAL
+	hostRun(1000000);
+	uint32_t draws = statOled.draws;
+	for (int i=0; i<BURST; i++) {
+		msg(100 + i, 20, -60, 5);
+		draw_oLED();
+		hostRun(5000);
+	}
+	CHECK(statOled.draws == draws + 1);
+	hostRun(OLED_INTERVAL * 1000);
+	draw_oLED();
+	CHECK(statOled.draws == draws + 2);
+	draw_oLED();
+	CHECK(statOled.draws == draws + 2);
+
+	return hostDone();
+}
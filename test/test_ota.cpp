@@ -0,0 +1,161 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Firmware download (_otaServer.ino): the SHA-256 against the FIPS 180-4
+// examples, then downloads from the web server of httpserver.h. The host
+// is resolved without blocking, a broken download continues with a Range
+// request, a 206 that does not start where the download stopped is asked
+// again, an ignored Range is skipped and an image with the wrong hash is
+// never activated.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include "httpserver.h"
+#include <string>
+
+#define HOST "ota.test"
+#define SIZE 100000								// Bytes of the image
+
+static uint16_t port;
+static std::string image;
+
+// ----------------------------------------------------------------------------
+// SHA-256 in hex of n bytes of p, given to sha256Update() in parts of step
+// ----------------------------------------------------------------------------
+static std::string sha(const void *p, uint32_t n, uint32_t step)
+{
+	struct sha256Ctx c;
+	char hex[65];
+	sha256Init(&c);
+	for (uint32_t i=0; i<n; i+=step) {
+		sha256Update(&c, (const uint8_t *) p + i, (n - i < step ? n - i : step));
+	}
+	sha256Hex(&c, hex);
+	return std::string(hex);
+}
+
+// ----------------------------------------------------------------------------
+// Run otaStep() and the web server, 1 mSec apart, until the download is
+// done or failed or ms have passed
+// ----------------------------------------------------------------------------
+static void run(uint32_t ms)
+{
+	for (uint32_t i=0; (i < ms) && (ota.state != OTA_DONE) && (ota.state != OTA_FAIL); i++) {
+		otaStep();
+		hostHttpPoll();
+		hostRun(1000);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Download the image, true when it is done and in the Updater
+// ----------------------------------------------------------------------------
+static bool download(const char *host, const char *hash)
+{
+	hostHttpReqs.clear();
+	ota.state = OTA_IDLE;
+	if (otaStart(host, port, "/fw.bin", hash) != 0) return(false);
+	run(200000);
+	return ((ota.state == OTA_DONE) &&
+		(std::string(Update.image.begin(), Update.image.end()) == image));
+}
+
+int main()
+{
+	hostInit("ota");
+
+	// FIPS 180-4 examples, also in parts that do not fill a block
+	std::string m448 = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	CHECK(sha("abc", 3, 64) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	CHECK(sha("", 0, 64) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	CHECK(sha(m448.data(), m448.size(), 64) == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+	CHECK(sha(m448.data(), m448.size(), 5) == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+	std::string a(1000000, 'a');
+	CHECK(sha(a.data(), a.size(), 1000) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+	CHECK(sha(a.data(), a.size(), 777) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+	// The image and its hash file on the web server
+	for (int i=0; i<SIZE; i++) image.push_back((char) ((i * 7919) >> 5));
+	std::string hash = sha(image.data(), image.size(), 4096);
+	hostHttpFiles["/fw.bin"] = image;
+	hostHttpFiles["/fw.bin.sha256"] = hash + "  fw.bin\n";
+	port = hostHttpListen();
+	hostDns[HOST] = IPAddress(127, 0, 0, 1);
+	wlanState(L_UP);
+
+	// The hash file, then the image. The restart comes after OTA_DONE.
+	CHECK(download(HOST, ""));
+	CHECK(hostHttpReqs.size() == 2);
+	CHECK(Update.ends == 1);
+	CHECK(strcmp(ota.sha, hash.c_str()) == 0);
+	CHECK(hostRestarts == 0);
+	for (int i=0; i<3000; i++) {
+		otaStep();
+		hostRun(1000);
+	}
+	CHECK(hostRestarts > 0);
+
+	// The connection breaks: continued with a Range request and a 206
+	uint32_t resumes = statOta.resumes;
+	hostHttp.cut = 30000;
+	CHECK(download(HOST, hash.c_str()));
+	CHECK(hostHttpReqs.size() == 2);
+	CHECK((hostHttpReqs.size() == 2) && (hostHttpReqs[1] == "/fw.bin 30000"));
+	CHECK(statOta.resumes == resumes + 1);
+	CHECK(Update.ends == 2);
+
+	// A 206 from another byte is not used, the Range is asked again
+	hostHttp.cut = 30000;
+	hostHttp.badRange = 0;
+	CHECK(download(HOST, hash.c_str()));
+	CHECK(hostHttpReqs.size() == 3);
+	CHECK((hostHttpReqs.size() == 3) && (hostHttpReqs[2] == "/fw.bin 30000"));
+	CHECK(Update.ends == 3);
+
+	// The server ignores the Range: the part already written is skipped
+	hostHttp.cut = 30000;
+	hostHttp.noRange = true;
+	CHECK(download(HOST, hash.c_str()));
+	CHECK(hostHttpReqs.size() == 2);
+	CHECK(Update.ends == 4);
+	hostHttp.noRange = false;
+
+	// An image with another hash is not activated
+	uint32_t fails = statOta.fails;
+	CHECK(!download(HOST, std::string(64, '0').c_str()));
+	CHECK(ota.state == OTA_FAIL);
+	CHECK(statOta.fails == fails + 1);
+	CHECK(Update.ends == 4);
+
+	// otaStep() does not wait for a slow DNS answer
+	hostDnsPending.insert(HOST);
+	ota.state = OTA_IDLE;
+	CHECK(otaStart(HOST, port, "/fw.bin", hash.c_str()) == 0);
+	double t = hostClock();
+	for (int i=0; i<100; i++) {
+		otaStep();
+		hostRun(1000);
+	}
+	CHECK(hostClock() - t < 0.1);
+	CHECK(ota.state == OTA_RESOLVE);
+	hostDnsAnswer(HOST);
+	run(200000);
+	CHECK(ota.state == OTA_DONE);
+	CHECK(Update.ends == 5);
+
+	// A name that is not found fails after OTA_RETRIES lookups
+	uint32_t lookups = otaDns.lookups;
+	CHECK(!download("nohost.test", hash.c_str()));
+	CHECK(ota.state == OTA_FAIL);
+	CHECK(otaDns.lookups - lookups == OTA_RETRIES + 1);
+	CHECK(hostHttpReqs.size() == 0);
+
+	hostHttpClose(true);
+	return hostDone();
+}
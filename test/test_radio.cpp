@@ -0,0 +1,203 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// More than one radio (_RADIOS=3), with simulated radios: every radio
+// listens on its own channel, nodes sending at the same time on the three
+// channels are all forwarded. An interrupt of one radio while another is
+// selected is seen by loop(), and the CAD, event and SPI statistics are
+// kept per radio.
+// PULL_DATA does not restart radio 0 while it has a downlink to send.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include "radio.h"
+#include "server.h"
+
+// ----------------------------------------------------------------------------
+// Restart the receivers, as loop() does after a quiet period: scanning with
+// CAD, or listening continuously on the SF of the gateway
+// ----------------------------------------------------------------------------
+static void restart(bool cad)
+{
+	_cad = cad;
+	for (uint8_t r=0; r<_RADIOS; r++) {
+		radioSelect(r);
+		if (_cad) {
+			_state = S_SCAN;
+			sf = scanStart();
+			cadScanner();
+		}
+		else {
+			_state = S_RX;
+			sf = (sf_t) _SPREADING;
+			rxLoraModem();
+		}
+		writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t) 0x00);
+		writeRegister(REG_IRQ_FLAGS, (uint8_t) 0xFF);
+	}
+	radioSelect(0);
+}
+
+// ----------------------------------------------------------------------------
+// An unconfirmed data up message of node addr with counter fcnt
+// ----------------------------------------------------------------------------
+static std::vector<uint8_t> dataUp(uint32_t addr, uint16_t fcnt)
+{
+	std::vector<uint8_t> m = { 0x40, (uint8_t) addr, (uint8_t) (addr >> 8),
+		(uint8_t) (addr >> 16), (uint8_t) (addr >> 24), 0x00, (uint8_t) fcnt,
+		(uint8_t) (fcnt >> 8), 0x01, 'h', 'e', 'l', 'l', 'o', 1, 2, 3, 4 };
+	return m;
+}
+
+// ----------------------------------------------------------------------------
+// The channel radioSetup() gave radio r
+// ----------------------------------------------------------------------------
+static uint32_t chFreq(int r)
+{
+	return freqs[(ifreq + r) % NUM_HOPS];
+}
+
+// ----------------------------------------------------------------------------
+// Count the forwarded messages on freq (Hz). The JSON has the frequency of
+// the FRF register, in MHz.
+// ----------------------------------------------------------------------------
+static int forwarded(uint32_t f)
+{
+	int n = 0;
+	for (auto &j : hostLns.rxpk) {
+		size_t i = j.find("\"freq\":");
+		if (i == std::string::npos) continue;
+		if (fabs(atof(j.c_str() + i + 7) - f / 1e6) < 0.0001) n++;
+	}
+	return n;
+}
+
+int main()
+{
+	hostInit("radio");
+
+	// No radio pin is a strapping pin of the ESP32
+	for (int r=0; r<_RADIOS-1; r++) {
+		for (int i=0; i<5; i++) {
+			uint8_t p = radioPins[r][i];
+			CHECK((p != 0) && (p != 2) && (p != 5) && (p != 12) && (p != 15));
+		}
+	}
+
+	hostBoot({ NTP_TIMESERVER, _TTNSERVER });
+	CHECK(hostLns.ntp > 0);
+
+	// Every radio on its own channel
+	for (int r=0; r<_RADIOS; r++) {
+		CHECK(labs((long) hostRadioFreq(r) - (long) chFreq(r)) < 62);	// FRF step
+	}
+
+	// Three nodes send at the same time, one on each channel, with the SF
+	// of the gateway. The radios listen continuously, so none is missed.
+	restart(false);
+	uint32_t rcvd[_RADIOS];
+	struct spiStat spi[_RADIOS];
+	for (int r=0; r<_RADIOS; r++) {
+		rcvd[r] = radios[r].rcvd;
+		spi[r] = statSpi[r];
+	}
+	uint32_t push = hostLns.push;
+	const int N = 10;
+	for (int i=0; i<N; i++) {
+		for (int r=0; r<_RADIOS; r++) {
+			std::vector<uint8_t> m = dataUp(0x26011000 + r, i);
+			hostAir(chFreq(r), _SPREADING, m.data(), m.size());
+		}
+		hostLoop(2000);
+	}
+	for (int r=0; r<_RADIOS; r++) {
+		CHECK(radios[r].rcvd - rcvd[r] == N);
+		CHECK(forwarded(chFreq(r)) == N);
+		CHECK(statSpi[r].trans[S_RX] - spi[r].trans[S_RX] >= N);
+		CHECK(statSpi[r].reads > spi[r].reads);
+	}
+	CHECK(hostLns.push - push >= N);
+
+	// An interrupt of radio 1 while radio 0 is selected does not change the
+	// event of radio 0, but loop() sees it and handles it
+	CHECK(rad == 0);
+	uint8_t event = _event;
+	_event = 0;
+	radios[1].event = 0;
+	radios[2].event = 0;
+	CHECK(!radioPending());
+	pushEvent(1, EVT_DIO0);
+	CHECK(_event == 0);
+	CHECK(radioPending());
+	_event = event;
+	loop();
+	CHECK(evtHead[1] == evtTail[1]);
+
+	// A full ring loses events of that radio only
+	uint32_t events = statEvt[1].events;
+	for (int i=0; i<EVTRING+2; i++) pushEvent(1, EVT_DIO0);
+	CHECK(evtLost[1] == 2);
+	CHECK((evtLost[0] == 0) && (evtLost[2] == 0));
+	loop();
+	CHECK(evtHead[1] == evtTail[1]);
+	CHECK(statEvt[1].events - events == EVTRING);
+
+	// CAD statistics per radio: messages at SF7 on the channel of radio 2
+	// only are detected by radio 2 only. The nodes start their preamble
+	// while radio 2 scans SF7.
+	restart(true);
+	struct cadStat cad[_RADIOS];
+	for (int r=0; r<_RADIOS; r++) {
+		cad[r] = radios[r].statCad;
+		rcvd[r] = radios[r].rcvd;
+	}
+	for (int i=0; i<3; i++) {
+		for (int t=0; (t < 1000) && (hostRadioSf(2) != SF7); t++) hostLoop(1);
+		std::vector<uint8_t> m = dataUp(0x26011009, i);
+		hostAir(chFreq(2), SF7, m.data(), m.size());
+		hostLoop(500);
+	}
+	CHECK(radios[2].rcvd - rcvd[2] == 3);
+	CHECK(radios[2].statCad.det[0] - cad[2].det[0] == 3);
+	CHECK(radios[2].statCad.rcv[0] - cad[2].rcv[0] == 3);
+	for (int r=0; r<2; r++) {
+		CHECK(radios[r].statCad.cycles > cad[r].cycles);
+		CHECK(radios[r].statCad.det[0] == cad[r].det[0]);
+		CHECK(radios[r].statCad.rcv[0] == cad[r].rcv[0]);
+		CHECK(radios[r].rcvd == rcvd[r]);
+	}
+
+	// PULL_DATA restarts radio 0, but not while a downlink waits for it or
+	// is being sent: the message is sent in full
+	uint8_t down[20] = { 0x60, 0x01, 0x10, 0x01, 0x26 };
+	LoraDown.payLoad = down;
+	LoraDown.payLength = sizeof(down);
+	LoraDown.sfTx = SF9;
+	LoraDown.powe = 14;
+	LoraDown.fff = chFreq(0);
+	LoraDown.crc = 0x00;
+	LoraDown.iiq = 0x40;
+	LoraDown.tmst = micros() + 100000;
+	CHECK(txQueue() == TX_NONE);
+	uint32_t sent = hostRadioStats[0].sent;
+	int pulls = 0;
+	for (int i=0; (i < 500) && (hostRadioStats[0].sent == sent); i++) {
+		bool tx = (statTx.pending) || (_state == S_TX) || (_state == S_TXDONE);
+		pulltime = (uint32_t) (micros64() / 1000000) - _PULL_INTERVAL;
+		hostLoop(1);
+		if ((tx) && (pulltime != (uint32_t) (micros64() / 1000000) - _PULL_INTERVAL)) pulls++;
+	}
+	CHECK(pulls > 0);
+	CHECK(hostRadioStats[0].sent == sent + 1);
+	CHECK(!statTx.pending);
+	hostLoop(100);
+	CHECK((_state != S_TX) && (_state != S_TXDONE));
+
+	return hostDone();
+}
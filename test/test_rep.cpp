@@ -0,0 +1,105 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// The allow lists of the repeater (_repeater.ino), built with _REP_NODES
+// and _REP_EUIS (the rep variant) and with _REP_NODES only (repnodes). Data
+// messages are repeated for the listed DevAddr only. Join requests, which
+// have no DevAddr yet, are repeated for the listed DevEUI, or all of them
+// when there is no DevEUI list. A repeated message goes out on _OCHAN as an
+// uplink: payload CRC on in MODEM_CONFIG2, IQ not inverted.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include "radio.h"
+#include "server.h"
+
+#define NODE 0x26011234
+#define EUI 0x0004A30B001C0530ULL
+
+// ----------------------------------------------------------------------------
+// Put a data up message of DevAddr addr in LoraUp
+// ----------------------------------------------------------------------------
+static void data(uint32_t addr, uint8_t fcnt)
+{
+	uint8_t m[] = { 0x40, (uint8_t) addr, (uint8_t) (addr >> 8), (uint8_t) (addr >> 16),
+		(uint8_t) (addr >> 24), 0x00, fcnt, 0x00, 0x01, 'r', 'e', 'p', 1, 2, 3, 4 };
+	memcpy(LoraUp.payLoad, m, sizeof(m));
+	LoraUp.payLength = sizeof(m);
+	LoraUp.sf = SF9;
+}
+
+// ----------------------------------------------------------------------------
+// Put a join request of DevEUI eui in LoraUp: MHDR, AppEUI, DevEUI and
+// DevNonce LSB first, MIC
+// ----------------------------------------------------------------------------
+static void join(uint64_t eui, uint16_t nonce)
+{
+	uint8_t m[23] = { 0x00 };
+	for (int i=0; i<8; i++) m[1+i] = 0x70 + i;
+	for (int i=0; i<8; i++) m[9+i] = (uint8_t) (eui >> (8*i));
+	m[17] = (uint8_t) nonce;
+	m[18] = (uint8_t) (nonce >> 8);
+	memcpy(LoraUp.payLoad, m, sizeof(m));
+	LoraUp.payLength = sizeof(m);
+	LoraUp.sf = SF9;
+}
+
+int main()
+{
+	hostInit("rep");
+	hostBoot({ NTP_TIMESERVER, _TTNSERVER });
+	bool euis = (repEuis[0] != 0);
+	CHECK(repNodes[0] == NODE);
+	ifreq = _ICHAN;
+
+	// Data messages: the listed node only
+	data(NODE, 1);
+	CHECK(repeatUp() == 1);
+	data(0x26015678, 1);
+	CHECK(repeatUp() == 0);
+	CHECK(statRep.denied == 1);
+
+	// Join requests: the listed device, or any without a DevEUI list
+	join(EUI, 1);
+	CHECK(repAllowed(LoraUp.payLoad, LoraUp.payLength));
+	CHECK(repeatUp() == 1);
+	join(EUI + 1, 2);
+	CHECK(repAllowed(LoraUp.payLoad, LoraUp.payLength) == !euis);
+	CHECK(repeatUp() == (euis ? 0 : 1));
+	CHECK(statRep.denied == (euis ? 2 : 1));
+
+	// A join request too short for a DevEUI is not repeated
+	join(EUI, 3);
+	CHECK(!repAllowed(LoraUp.payLoad, 16));
+
+	CHECK(repCount == (euis ? 2 : 3));
+
+	// They are due at the same time, so the radio sends the first one only
+	for (int i=0; (i < 20000) && (repCount > 0); i++) hostLoop(1);
+	CHECK(repCount == 0);
+	CHECK(statRep.sent >= 1);
+
+	// A repeated message goes out as an uplink with payload CRC
+	hostLoop(1000);
+	size_t sent = hostAirLog.size();
+	data(NODE, 2);
+	CHECK(repeatUp() == 1);
+	hostLoop(2000);
+	CHECK(hostAirLog.size() == sent + 1);
+	if (hostAirLog.size() > sent) {
+		hostFrame &f = hostAirLog[sent];
+		CHECK(f.mc2 == ((SF9 << 4) | 0x04));
+		CHECK(rateAirTime(SF9, f.mc2 & 0x04, 16) == airTime(SF9, 125, 1, 16, true));
+		CHECK(f.iq == 0x27);
+		CHECK(f.frf == frfOf(freqs[_OCHAN]));
+	}
+
+	printf("rep: DevEUI list %s\n", euis ? "set" : "empty");
+	return hostDone();
+}
@@ -0,0 +1,84 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// 64-bit radio timers (ESP-sc-gway.ino): micros64(), tmst64() and
+// microsLeft() across the wrap of the 32-bit micros(), and loraWait() for
+// a tmst on the other side of the wrap.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+
+#define WRAP 0x100000000ULL						// micros() wraps here
+
+// ----------------------------------------------------------------------------
+// The tmst a server would send for a moment dt uSec from now
+// ----------------------------------------------------------------------------
+static uint32_t tmstIn(int64_t dt)
+{
+	return (uint32_t) (hostUs + dt);
+}
+
+int main()
+{
+	hostInit("timer");
+
+	// Three wraps, in steps well below the wrap time: micros64() must
+	// follow the host clock, and the lower 32 bits are micros()
+	for (int i=0; i<3 * 4295; i++) {
+		hostRun(1000000);
+		if (micros64() != hostUs) { CHECK(micros64() == hostUs); break; }
+	}
+	CHECK((uint32_t) micros64() == micros());
+	CHECK(micros64() >= 3 * WRAP);
+
+	// 2 seconds before the next wrap: a deadline 3 seconds ahead has a
+	// tmst that already wrapped, it must not be taken as in the past
+	hostRun((WRAP - hostUs % WRAP) - 2000000);
+	uint32_t tmst = tmstIn(3000000);
+	CHECK(tmst < micros());
+	CHECK(tmst64(tmst) == hostUs + 3000000);
+	CHECK(microsLeft(tmst64(tmst)) == 3000000);
+
+	// A deadline that passed just before the wrap, seen just after it
+	uint64_t dl = tmst64(tmstIn(-1000000));
+	hostRun(2500000);
+	CHECK(micros() < 1000000);
+	CHECK(microsLeft(dl) == -3500000);
+	CHECK(tmst64((uint32_t) dl) == dl);
+
+	// Count down through the wrap: the time left decreases by the same
+	// step every time, there is no jump at the wrap
+	hostRun((WRAP - hostUs % WRAP) - 2000000);
+	dl = tmst64(tmstIn(2000000));
+	int bad = 0;
+	for (int64_t left = 2000000; left >= -2000000; left -= 100000) {
+		if (microsLeft(dl) != left) bad++;
+		hostRun(100000);
+	}
+	CHECK(bad == 0);
+
+	// tmst64() picks the nearest value: up to half a wrap back or ahead
+	CHECK(tmst64(tmstIn(2000000000)) == hostUs + 2000000000);
+	CHECK(tmst64(tmstIn(-2000000000)) == hostUs - 2000000000);
+
+	// loraWait() just before the wrap, for a transmission just after it,
+	// returns at the moment asked for
+	LoraDown.sfTx = 9;
+	hostRun((WRAP - hostUs % WRAP) - 500000);
+	uint64_t tx = hostUs + 1000000;
+	loraWait((uint32_t) tx - txDelay - txAdjust(LoraDown.sfTx));
+	CHECK(hostUs == tx);
+
+	// And does not wait at all for a moment that has passed
+	uint64_t t0 = hostUs;
+	loraWait(tmstIn(-1000000) - txDelay - txAdjust(LoraDown.sfTx));
+	CHECK(hostUs == t0);
+
+	return hostDone();
+}
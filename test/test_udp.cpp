@@ -0,0 +1,117 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// UDP intake and the handlers of readUdp() (ESP-sc-gway.ino): a datagram
+// that cannot be read whole is dropped and counted, a burst larger than the
+// ring waits in the socket, PUSH_ACK gives the round trip time of its
+// server, PULL_RESP is only taken from our servers.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include <vector>
+
+static IPAddress lns(10, 0, 0, 2);
+
+// ----------------------------------------------------------------------------
+// The server sends a datagram with token and ident, and size bytes in all
+// ----------------------------------------------------------------------------
+static void serverSend(IPAddress ip, uint16_t token, uint8_t ident, int size)
+{
+	std::vector<uint8_t> b(size, 'x');
+	b[0] = PROTOCOL_VERSION;
+	if (size > 1) b[1] = (uint8_t) token;
+	if (size > 2) b[2] = (uint8_t) (token >> 8);
+	if (size > 3) b[3] = ident;
+	hostUdpRecv(_LOCUDPPORT, ip, _TTNPORT, b.data(), b.size());
+}
+
+// ----------------------------------------------------------------------------
+// Read the socket and handle the one datagram it should have
+// ----------------------------------------------------------------------------
+static int handle()
+{
+	if (udpIntake() != 1) return(-2);
+	struct udpBuf *u = &udpRing[udpTail & (UDPRING-1)];
+	udpTail++;
+	return(readUdp(u));
+}
+
+int main()
+{
+	hostInit("udp");
+	CHECK(UDPconnect());
+	ttnServer = lns;
+
+	// PUSH_ACK of the PUSH_DATA we wait for: round trip time. The same
+	// token from another server is not our answer.
+	struct ackStat *a = ackFind(lns, true);
+	CHECK(a != NULL);
+	a->waiting = true;
+	a->token = 0x1234;
+	a->sent = micros64();
+	hostRun(20000);
+	uint32_t acks = cp_up_ack_rcv;
+	serverSend(IPAddress(10, 0, 0, 3), 0x1234, PKT_PUSH_ACK, 4);
+	CHECK(handle() == 4);
+	CHECK(a->waiting);
+	CHECK(ackFind(IPAddress(10, 0, 0, 3), false) == NULL);
+	serverSend(lns, 0x1234, PKT_PUSH_ACK, 4);
+	CHECK(handle() == 4);
+	CHECK(cp_up_ack_rcv == acks + 2);
+	CHECK(!a->waiting);
+	CHECK(a->rtt == 20000);
+
+	// PULL_ACK
+	serverSend(lns, 0x0001, PKT_PULL_ACK, 4);
+	CHECK(handle() == 4);
+
+	// Too short for a header
+	serverSend(lns, 0x0001, PKT_PULL_ACK, 3);
+	CHECK(handle() == 0);
+
+	// A short read drops the datagram, the next one is read whole
+	uint32_t dropped = statUdp.dropped;
+	uint32_t read = statUdp.read;
+	hostUdpReadLimit = 10;
+	serverSend(lns, 0x0002, PKT_PULL_ACK, 20);
+	CHECK(udpIntake() == 0);
+	CHECK(statUdp.dropped == dropped + 1);
+	CHECK(statUdp.read == read);
+	CHECK(udpHead == udpTail);
+	hostUdpReadLimit = -1;
+	serverSend(lns, 0x0003, PKT_PULL_ACK, 20);
+	CHECK(handle() == 20);
+	CHECK(statUdp.read == read + 1);
+
+	// A burst larger than the ring waits in the socket, nothing is dropped
+	dropped = statUdp.dropped;
+	read = statUdp.read;
+	for (int i=0; i<UDPRING+3; i++) serverSend(lns, 0x0010 + i, PKT_PULL_ACK, 4);
+	CHECK(udpIntake() == UDPRING);
+	CHECK(udpIntake() == 0);
+	udpTail = udpHead;
+	CHECK(udpIntake() == 3);
+	udpTail = udpHead;
+	CHECK(udpIntake() == 0);
+	CHECK(statUdp.read == read + UDPRING + 3);
+	CHECK(statUdp.dropped == dropped);
+
+	// PULL_RESP of another host is not sent
+	uint32_t resp = cp_dw_dgram_rcv;
+	serverSend(IPAddress(192, 168, 1, 9), 0x0004, PKT_PULL_RESP, 40);
+	CHECK(handle() == 0);
+	CHECK(cp_dw_dgram_rcv == resp);
+
+	// NTP on the gateway socket is a stray message
+	uint8_t ntp[48] = { 0x24 };
+	hostUdpRecv(_LOCUDPPORT, lns, 123, ntp, sizeof(ntp));
+	CHECK(handle() == 0);
+
+	return hostDone();
+}
@@ -0,0 +1,244 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Store-and-forward of uplinks (_txRx.ino, _loraFiles.ino) through a 30
+// minute outage of the backend while WiFi stays up. After DNS_ACKLOST
+// unacknowledged PUSH_DATA messages the uplinks are stored, the stat
+// messages find out when the backend is back and then every stored uplink
+// is sent once, in order. A message that cannot be sent stays in the store.
+// Then WiFi is gone for 30 minutes: the uplinks are stored within the
+// limits of the store and sent once, in order, when it is back. A restart
+// in the middle of a replay does not send the replayed uplinks again.
+// An uplink is logged and counted once, at reception, with its time and
+// channel, and not again when it is sent from the queue or the store.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include "radio.h"
+#include "server.h"
+#include <string>
+#include <dirent.h>
+
+#define OUTAGE (30 * 60)							// Seconds
+#define EVERY 10								// Seconds between uplinks
+
+// ----------------------------------------------------------------------------
+// An uplink with counter fcnt is received, as the state machine hands it
+// to receivePacket()
+// ----------------------------------------------------------------------------
+static void uplink(uint16_t fcnt)
+{
+	uint8_t m[] = { 0x40, 0x01, 0x10, 0x01, 0x26, 0x00, (uint8_t) fcnt,
+		(uint8_t) (fcnt >> 8), 0x01, 'u', 'p', 1, 2, 3, 4 };
+	memcpy(LoraUp.payLoad, m, sizeof(m));
+	LoraUp.payLength = sizeof(m);
+	LoraUp.sf = SF7;
+	LoraUp.prssi = 100;
+	LoraUp.rssicorr = 157;
+	LoraUp.snr = 8;
+	receivePacket();
+}
+
+// ----------------------------------------------------------------------------
+// The counter of the uplink in rxpk JSON j, -1 if it is none of ours
+// ----------------------------------------------------------------------------
+static int fcnt(const std::string &j)
+{
+	size_t i = j.find("\"data\":\"");
+	if (i == std::string::npos) return -1;
+	char b64[64] = { 0 };
+	char m[48];
+	j.copy(b64, j.find('"', i + 8) - i - 8, i + 8);
+	int n = base64_decode(m, b64, strlen(b64));
+	if ((n < 8) || ((uint8_t) m[1] != 0x01) || ((uint8_t) m[4] != 0x26)) return -1;
+	return (uint8_t) m[6] | ((uint8_t) m[7] << 8);
+}
+
+// ----------------------------------------------------------------------------
+// The counters of our uplinks in the rxpk received since i, in order
+// ----------------------------------------------------------------------------
+static std::vector<int> received(size_t i)
+{
+	std::vector<int> got;
+	for (; i<hostLns.rxpk.size(); i++) {
+		int c = fcnt(hostLns.rxpk[i]);
+		if (c >= 0) got.push_back(c);
+	}
+	return got;
+}
+
+// ----------------------------------------------------------------------------
+// Are the segment files of the store within UPSFILEMAX files of
+// UPSFILEREC records? Not counted in hostFsOpens.
+// ----------------------------------------------------------------------------
+static bool storeFits()
+{
+	uint32_t opens = hostFsOpens;
+	int n = 0;
+	bool fits = true;
+	DIR *d = opendir(hostFsDir.c_str());
+	struct dirent *e;
+	while ((d != NULL) && ((e = readdir(d)) != NULL)) {
+		if (strncmp(e->d_name, "up-", 3) != 0) continue;
+		File f = SPIFFS.open((std::string("/") + e->d_name).c_str(), "r");
+		fits = fits && (f.size() <= sizeof(struct upsHdr) + UPSFILEREC * sizeof(struct upFrame));
+		f.close();
+		n++;
+	}
+	if (d != NULL) closedir(d);
+	hostFsOpens = opens;
+	return(fits && (n <= UPSFILEMAX) && (ups.count <= UPSFILEMAX * UPSFILEREC));
+}
+
+int main()
+{
+	hostInit("upstore");
+	hostBoot({ NTP_TIMESERVER, _TTNSERVER }, 10);
+	CHECK(upLink());
+	uint32_t lostBefore = hostLns.lost;
+
+	// The backend is gone for OUTAGE seconds, WiFi stays up. The first
+	// uplinks are sent and lost until DNS_ACKLOST of them are not answered.
+	hostLns.up = false;
+	hostLns.rxpk.clear();
+	const int N = OUTAGE / EVERY;
+	uint32_t recs = statLog.recs;
+	uint32_t t0 = now();
+	int direct = -1;
+	for (int i=0; i<N; i++) {
+		uplink(i);
+		if ((direct < 0) && !upLink()) direct = i + 1;
+		hostLoop(EVERY * 1000, 10);
+	}
+	CHECK((direct > 0) && (direct <= DNS_ACKLOST + 1));
+	CHECK(!upLink());
+	CHECK(upCount + ups.count == N - direct);
+	CHECK(ups.count > 0);
+	CHECK(statUp.dropped == 0);
+	CHECK(hostLns.lost - lostBefore >= (uint32_t) direct);
+
+	// A message that cannot be sent is not taken from the store
+	CHECK(storeUp() >= 0);							// The RAM queue too
+	CHECK(upCount == 0);
+	uint32_t stored = ups.count;
+	uint32_t replayed = statUp.replayed;
+	hostWifiUp = false;
+	ups.next = millis();
+	CHECK(sendQueue() == 0);
+	CHECK(ups.count == stored);
+	CHECK(statUp.replayed == replayed);
+	CHECK(statUp.lost == 0);
+	hostWifiUp = true;
+
+	// The backend is back: the next stat message is answered, and the
+	// stored uplinks are sent, _UPSTORE_RATE mSec apart
+	hostLns.up = true;
+	for (int i=0; (i < (_STAT_INTERVAL + 10) * 10) && !upLink(); i++) hostLoop(100, 10);
+	CHECK(upLink());
+	for (int i=0; (i < 600) && ((upCount > 0) || (ups.count > 0)); i++) hostLoop(1000, 10);
+	CHECK(upCount == 0);
+	CHECK(ups.count == 0);
+	CHECK(statUp.lost == 0);
+	CHECK(statUp.expired == 0);
+
+	// Every uplink of the outage after the first direct ones, once and in
+	// order
+	std::vector<int> got;
+	for (auto &j : hostLns.rxpk) {
+		int c = fcnt(j);
+		if (c >= 0) got.push_back(c);
+	}
+	CHECK(got.size() == (size_t) (N - direct));
+	bool inOrder = true;
+	for (size_t i=0; i<got.size(); i++) inOrder = inOrder && (got[i] == (int) (direct + i));
+	CHECK(inOrder);
+
+	// Logged at reception, once
+	CHECK(statLog.recs - recs == (uint32_t) N);
+	CHECK(queryLog(0x26011001, t0, t0 + OUTAGE, LOG_SERIAL) == N);
+	CHECK(queryLog(0x26011001, t0 + OUTAGE, now(), LOG_SERIAL) == 0);
+
+	// Live again
+	hostLns.rxpk.clear();
+	uplink(N);
+	CHECK(hostLns.rxpk.size() == 1);
+
+	// WiFi is gone for OUTAGE seconds while the uplinks arrive. All are
+	// stored, the store stays within its files and records, and the flash
+	// is written once per full RAM queue.
+	size_t from = hostLns.rxpk.size();
+	uint32_t dropped = statUp.dropped;
+	uint32_t opens = hostFsOpens - statLog.opens;		// Log flushes not counted
+	bool fits = true;
+	hostWifiUp = false;
+	CHECK(upCount == 0);
+	uint8_t ch = ifreq;
+	ifreq = ch + 1;									// Received on another channel
+	uplink(999);
+	ifreq = ch;
+	CHECK(upQueue[upHead].ifreq == ch + 1);
+	CHECK(statr[0].ch == ch + 1);
+	upCount = 0;
+	for (int i=0; i<N; i++) {
+		uplink(1000 + i);
+		hostLoop(EVERY * 1000, 10);
+		fits = fits && storeFits();
+	}
+	CHECK(!upLink());
+	CHECK(hostLns.rxpk.size() == from);
+	CHECK(upCount + ups.count == N);
+	CHECK(fits);
+	CHECK(statUp.dropped == dropped);
+	CHECK(statUp.lost == 0);
+	opens = hostFsOpens - statLog.opens - opens;
+	printf("upstore: %d uplinks in %d s without WiFi, %u flash opens\n", N, OUTAGE, opens);
+	CHECK(opens <= (uint32_t) (N / UPQUEUE + UPSFILEMAX));
+
+	// WiFi is back: every uplink of the outage once, in order
+	hostWifiUp = true;
+	for (int i=0; (i < 600) && ((upCount > 0) || (ups.count > 0)); i++) hostLoop(1000, 10);
+	CHECK(upCount == 0);
+	CHECK(ups.count == 0);
+	CHECK(statUp.lost == 0);
+	CHECK(statUp.dropped == dropped);
+	got = received(from);
+	CHECK(got.size() == (size_t) N);
+	inOrder = true;
+	for (size_t i=0; i<got.size(); i++) inOrder = inOrder && (got[i] == (int) (1000 + i));
+	CHECK(inOrder);
+	CHECK(storeFits());
+
+	// Restart after a part of the store was replayed: replay continues
+	// after the last uplink that was sent
+	const int M = UPSFILEREC + 20;
+	from = hostLns.rxpk.size();
+	hostWifiUp = false;
+	for (int i=0; i<M; i++) {
+		uplink(2000 + i);
+		hostLoop(EVERY * 1000, 10);
+	}
+	CHECK(storeUp() >= 0);
+	CHECK(ups.count == (uint32_t) M);
+	hostWifiUp = true;
+	replayed = statUp.replayed;
+	for (int i=0; (i < 6000) && (statUp.replayed - replayed < 10); i++) hostLoop(10, 10);
+	CHECK(statUp.replayed - replayed == 10);
+	upCount = 0;
+	initStore();
+	CHECK(ups.count == (uint32_t) (M - 10));
+	for (int i=0; (i < 600) && (ups.count > 0); i++) hostLoop(1000, 10);
+	CHECK(ups.count == 0);
+	got = received(from);
+	CHECK(got.size() == (size_t) M);
+	inOrder = true;
+	for (size_t i=0; i<got.size(); i++) inOrder = inOrder && (got[i] == (int) (2000 + i));
+	CHECK(inOrder);
+	CHECK(storeFits());
+	return hostDone();
+}
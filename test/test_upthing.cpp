@@ -0,0 +1,136 @@
+// 1-channel LoRa Gateway for ESP8266, host tests
+//
+// All rights reserved. This program and the accompanying materials
+// are made available under the terms of the MIT License
+// which accompanies this distribution, and is available at
+// https://opensource.org/licenses/mit-license.php
+//
+// NO WARRANTY OF ANY KIND IS PROVIDED
+//
+// Uplinks to TTN and a _THINGSERVER (the thing variant), per destination
+// (_txRx.ino): a thing server that never answers does not hold up TTN or
+// fill the store, and a queued message that TTN took but the thing server
+// did not is only sent to the thing server again, also from the store.
+// ----------------------------------------------------------------------------
+#include "sketch.cpp"
+#include "host.h"
+#include "radio.h"
+#include "server.h"
+#include <string>
+
+#define EVERY 10								// Seconds between uplinks
+
+// ----------------------------------------------------------------------------
+// An uplink with counter fcnt is received
+// ----------------------------------------------------------------------------
+static void uplink(uint16_t fcnt)
+{
+	uint8_t m[] = { 0x40, 0x01, 0x10, 0x01, 0x26, 0x00, (uint8_t) fcnt,
+		(uint8_t) (fcnt >> 8), 0x01, 'u', 'p', 1, 2, 3, 4 };
+	memcpy(LoraUp.payLoad, m, sizeof(m));
+	LoraUp.payLength = sizeof(m);
+	LoraUp.sf = SF7;
+	LoraUp.prssi = 100;
+	LoraUp.rssicorr = 157;
+	LoraUp.snr = 8;
+	receivePacket();
+}
+
+// ----------------------------------------------------------------------------
+// The counters of our uplinks that server ip received, in order
+// ----------------------------------------------------------------------------
+static std::vector<int> received(IPAddress ip)
+{
+	std::vector<int> got;
+	for (size_t i=0; i<hostLns.rxpk.size(); i++) {
+		const std::string &j = hostLns.rxpk[i];
+		size_t k = j.find("\"data\":\"");
+		if ((hostLns.rxpkIp[i] != ip) || (k == std::string::npos)) continue;
+		char b64[64] = { 0 };
+		char m[48];
+		j.copy(b64, j.find('"', k + 8) - k - 8, k + 8);
+		int n = base64_decode(m, b64, strlen(b64));
+		if ((n < 8) || ((uint8_t) m[4] != 0x26)) continue;
+		got.push_back((uint8_t) m[6] | ((uint8_t) m[7] << 8));
+	}
+	return got;
+}
+
+// ----------------------------------------------------------------------------
+// Are the counters in got first, first+1 .. first+n-1?
+// ----------------------------------------------------------------------------
+static bool sequence(const std::vector<int> &got, int first, int n)
+{
+	if (got.size() != (size_t) n) return(false);
+	for (int i=0; i<n; i++) {
+		if (got[i] != first + i) return(false);
+	}
+	return(true);
+}
+
+int main()
+{
+	hostInit("upthing");
+	hostBoot({ NTP_TIMESERVER, _TTNSERVER, _THINGSERVER }, 10);
+	CHECK(upDests() == (UP_TTN | UP_THING));
+
+	// The thing server takes the uplinks but never answers, as a plain UDP
+	// handler. It is left out after DNS_ACKLOST, TTN gets every uplink live.
+	hostLns.mute.push_back(thingServer);
+	hostLns.rxpk.clear();
+	hostLns.rxpkIp.clear();
+	for (int i=0; i<20; i++) {
+		uplink(i);
+		hostLoop(EVERY * 1000, 10);
+	}
+	CHECK(upDests() == UP_TTN);
+	CHECK(upLink());
+	CHECK(upCount == 0);
+	CHECK(ups.count == 0);
+	CHECK(statUp.queued == 0);
+	CHECK(sequence(received(ttnServer), 0, 20));
+
+	// It answers again: the next uplink makes it a destination again
+	hostLns.mute.clear();
+	uplink(20);
+	hostLoop(1000, 10);
+	CHECK(upDests() == (UP_TTN | UP_THING));
+
+	// WiFi is down for a while: 12 uplinks are queued, 8 of them go to the
+	// store. When it is back the thing server refuses: TTN gets the oldest
+	// message once, the thing server does not, and the message stays.
+	hostLns.rxpk.clear();
+	hostLns.rxpkIp.clear();
+	hostWifiUp = false;
+	for (int i=0; i<12; i++) {
+		uplink(100 + i);
+		hostLoop(1000, 10);
+	}
+	CHECK(ups.count == 8);
+	CHECK(upCount == 4);
+	hostUdpRefuse = thingServer;
+	hostWifiUp = true;
+	for (int i=0; (i < 60) && !upLink(); i++) hostLoop(1000, 10);
+	CHECK(upLink());
+	hostLoop(30000, 10);
+	CHECK(sequence(received(ttnServer), 100, 1));
+	CHECK(received(thingServer).empty());
+	CHECK(ups.count == 8);
+	struct upFrame q;
+	CHECK(readStore(&q) == 1);
+	CHECK(q.done == UP_TTN);							// In the record in flash
+	CHECK(q.up.payLoad[6] == 100);
+
+	// The thing server takes them again: it gets all, TTN gets the rest,
+	// each once and in order
+	hostUdpRefuse = IPAddress(0, 0, 0, 0);
+	for (int i=0; (i < 60) && ((upCount > 0) || (ups.count > 0)); i++) hostLoop(1000, 10);
+	CHECK(upCount == 0);
+	CHECK(ups.count == 0);
+	CHECK(sequence(received(ttnServer), 100, 12));
+	CHECK(sequence(received(thingServer), 100, 12));
+	CHECK(statUp.lost == 0);
+	CHECK(statUp.dropped == 0);
+
+	return hostDone();
+}